@@ -0,0 +1,143 @@
+#ifndef concat_assemble_h__
+#define concat_assemble_h__
+
+#include "manifest.h"
+#include "outfile.h"
+#include "progress.h"
+#include "rawfile.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace concat
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Assemble the tiles of \c manifest into the raw file \c outPath.
+///
+/// The output is built in chunks of whole z planes, as many as fit in half
+/// of \c bufferSize. The tiles in a chunk are read in parallel, each with one
+/// pread of the planes it has in the chunk. A full chunk is written with
+/// one pwrite at the next offset, so the output is written in order. There
+/// are two chunk buffers, the next chunk is read while the last one is
+/// written. Voxels that no tile covers are 0.
+/// \return false if a tile couldn't be read or the output written.
+template<class Ty>
+bool
+assemble(Manifest const &manifest, std::string const &outPath, uint64_t bufferSize)
+{
+  uint64_t const X{ manifest.dims[0] };
+  uint64_t const Y{ manifest.dims[1] };
+  uint64_t const Z{ manifest.dims[2] };
+  uint64_t const planeBytes{ X * Y * sizeof(Ty) };
+
+  // Check every tile before writing anything.
+  for (Tile const &t : manifest.tiles) {
+    preproc::RawFile raw;
+    if (!raw.open(t.path)) {
+      std::cerr << "Could not open tile " << t.path << std::endl;
+      return false;
+    }
+    if (raw.size() < t.dims[0] * t.dims[1] * t.dims[2] * sizeof(Ty)) {
+      std::cerr << "Tile " << t.path << " is smaller than its dimensions." << std::endl;
+      return false;
+    }
+  }
+
+  uint64_t const total{ X * Y * Z };
+  if (manifest.covered < total) {
+    std::cout << total - manifest.covered << " voxels are not in a tile and will be 0."
+              << std::endl;
+  }
+
+  OutFile out;
+  std::string error;
+  if (!out.open(outPath, planeBytes * Z, error)) {
+    std::cerr << error << std::endl;
+    return false;
+  }
+
+  uint64_t const planes{ std::min(Z, std::max<uint64_t>(1, bufferSize / 2 / planeBytes)) };
+  std::vector<Ty> chunks[2]{ std::vector<Ty>(X * Y * planes), std::vector<Ty>(X * Y * planes) };
+  Progress progress{ planeBytes * Z };
+  std::future<void> writing;
+
+  try {
+    for (uint64_t z0{ 0 }, n{ 0 }; z0 < Z; z0 += planes, ++n) {
+      uint64_t const z1{ std::min(Z, z0 + planes) };
+      Ty *chunk{ chunks[n % 2].data() };
+      if (manifest.covered < total) {
+        std::fill(chunk, chunk + X * Y * ( z1 - z0 ), Ty(0));
+      }
+
+      std::vector<Tile const *> inChunk;
+      for (Tile const &t : manifest.tiles) {
+        if (t.offset[2] < z1 && t.offset[2] + t.dims[2] > z0) {
+          inChunk.push_back(&t);
+        }
+      }
+
+      tbb::parallel_for(tbb::blocked_range<size_t>{ 0, inChunk.size(), 1 },
+                        [&](tbb::blocked_range<size_t> const &r) {
+        std::vector<Ty> planesOfTile;
+        for (size_t i{ r.begin() }; i != r.end(); ++i) {
+          Tile const &t = *inChunk[i];
+          uint64_t const tz0{ std::max(z0, t.offset[2]) };
+          uint64_t const tz1{ std::min(z1, t.offset[2] + t.dims[2]) };
+          uint64_t const w{ t.dims[0] };
+          uint64_t const h{ t.dims[1] };
+          uint64_t const bytes{ ( tz1 - tz0 ) * w * h * sizeof(Ty) };
+
+          preproc::RawFile raw;
+          if (!raw.open(t.path)) {
+            throw std::runtime_error("Could not open tile " + t.path);
+          }
+          planesOfTile.resize(( tz1 - tz0 ) * w * h);
+          if (raw.readAt(planesOfTile.data(), bytes,
+                         ( tz0 - t.offset[2] ) * w * h * sizeof(Ty)) != bytes) {
+            throw std::runtime_error("Short read of tile " + t.path);
+          }
+
+          for (uint64_t z{ tz0 }; z < tz1; ++z) {
+            for (uint64_t y{ 0 }; y < h; ++y) {
+              std::memcpy(chunk + ( ( z - z0 ) * Y + t.offset[1] + y ) * X + t.offset[0],
+                          planesOfTile.data() + ( ( z - tz0 ) * h + y ) * w,
+                          w * sizeof(Ty));
+            }
+          }
+        }
+      });
+
+      if (writing.valid()) {
+        writing.get();
+      }
+      uint64_t const bytes{ ( z1 - z0 ) * planeBytes };
+      writing = std::async(std::launch::async, [&out, &progress, chunk, bytes, z0, planeBytes]() {
+        out.writeAt(chunk, bytes, z0 * planeBytes);
+        progress.add(bytes);
+      });
+    }
+    writing.get();
+  } catch (std::exception const &e) {
+    if (writing.valid()) {
+      writing.wait();
+    }
+    std::cerr << '\n' << e.what() << std::endl;
+    return false;
+  }
+
+  progress.done();
+  return true;
+}
+
+} // namespace concat
+
+#endif // ! concat_assemble_h__
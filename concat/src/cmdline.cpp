@@ -53,22 +53,42 @@ try
 
   // target volume X dimension voxels
   TCLAP::ValueArg<int>
-    targetXDimArg("", "tx", "Target X dimension", true, 0, "int");
+    targetXDimArg("", "tx", "Target X dimension", false, 0, "int");
   cmd.add(targetXDimArg);
 
 
   // target volume Y dimension voxels
   TCLAP::ValueArg<int>
-    targetYDimArg("", "ty", "Target Y dimension", true, 0, "int");
+    targetYDimArg("", "ty", "Target Y dimension", false, 0, "int");
   cmd.add(targetYDimArg);
 
 
   // target volume Z dimension voxels
   TCLAP::ValueArg<int>
-    targetZDimArg("", "tz", "Target Z dimension", true, 0, "int");
+    targetZDimArg("", "tz", "Target Z dimension", false, 0, "int");
   cmd.add(targetZDimArg);
 
 
+  // tile manifest for assembly
+  TCLAP::ValueArg<std::string>
+    manifestArg("", "manifest",
+                "Assemble the raw tiles listed in this manifest into -o instead of "
+                "replicating -f. Each line is <raw file> <x> <y> <z> <width> <height> "
+                "<depth>, with an optional line dims <X> <Y> <Z>. The data type is "
+                "-t, or the type in -d.",
+                false, "", "string");
+  cmd.add(manifestArg);
+
+
+  // .dat of the assembled volume
+  TCLAP::ValueArg<std::string>
+    outDatArg("", "out-dat",
+              "Path of the .dat file of an assembled volume (default is the output "
+              "path with a .dat extension).",
+              false, "", "string");
+  cmd.add(outDatArg);
+
+
   cmd.parse(argc, argv);
 
   opts.rawFilePath = fileArg.getValue();
@@ -79,6 +99,28 @@ try
   opts.targetXDim = targetXDimArg.getValue();
   opts.targetYDim = targetYDimArg.getValue();
   opts.targetZDim = targetZDimArg.getValue();
+  opts.manifestPath = manifestArg.getValue();
+  opts.outDatPath = outDatArg.getValue();
+
+  if (opts.manifestPath.empty()) {
+    if (!( targetXDimArg.isSet() && targetYDimArg.isSet() && targetZDimArg.isSet() )) {
+      std::cout << "--tx, --ty and --tz are needed unless --manifest is given." << std::endl;
+      return 0;
+    }
+  } else {
+    if (opts.outputFilePath.empty()) {
+      std::cout << "--manifest needs an output path (-o)." << std::endl;
+      return 0;
+    }
+    if (opts.outDatPath.empty()) {
+      size_t const dot{ opts.outputFilePath.find_last_of('.') };
+      size_t const slash{ opts.outputFilePath.find_last_of('/') };
+      bool const hasExt{ dot != std::string::npos &&
+                             ( slash == std::string::npos || dot > slash ) };
+      opts.outDatPath =
+          ( hasExt ? opts.outputFilePath.substr(0, dot) : opts.outputFilePath ) + ".dat";
+    }
+  }
 
   return static_cast<int>(cmd.getArgList().size());
 
@@ -97,6 +139,7 @@ printThem(CommandLineOptions &opts)
       << "\nDat file: " << opts.datFilePath
       << "\nData Type: " << opts.dataType
       << "\nBuffer Size: " << opts.bufferSize
+      << "\nManifest: " << opts.manifestPath
       << std::endl;
 }
 
@@ -22,6 +22,10 @@ struct CommandLineOptions
   int targetXDim;
   int targetYDim;
   int targetZDim;
+  // manifest of tiles to assemble, empty to replicate rawFilePath.
+  std::string manifestPath;
+  // .dat file to write for an assembled volume.
+  std::string outDatPath;
 };
 
 
@@ -0,0 +1,157 @@
+#ifndef concat_concatenator_h__
+#define concat_concatenator_h__
+
+#include "outfile.h"
+#include "progress.h"
+#include "rawfile.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtx/string_cast.hpp>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace concat
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Tiles a volume into a larger one with outDims / inDims copies
+/// along each axis.
+///
+/// Each input slab is read once and tiled into a whole output slab in
+/// memory. The output slab is then written once for each copy along z,
+/// with one large pwrite per copy at its computed offset, from several
+/// threads. There are two output slabs, so the next one is read and built
+/// while the writes of the last one are in flight.
+template<class Ty>
+class Concatenator
+{
+public:
+  Concatenator(std::string const &inFile,
+    std::string const &outFile,
+    glm::u64vec3 const &inDims,
+    glm::u64vec3 const &outDims)
+    : m_inName{ inFile }
+    , m_outName{ outFile }
+    , m_inDims{ inDims }
+    , m_outDims{ outDims }
+  {
+  }
+
+
+  /// \return false if the files couldn't be read or written.
+  bool
+  concat()
+  {
+    preproc::RawFile in;
+    if (!in.open(m_inName)) {
+      std::cerr << "Could not open input file: " << m_inName << std::endl;
+      return false;
+    }
+    uint64_t const inSlabVoxels{ m_inDims.x * m_inDims.y };
+    uint64_t const inSlabBytes{ inSlabVoxels * sizeof(Ty) };
+    if (in.size() < inSlabBytes * m_inDims.z) {
+      std::cerr << "Input file " << m_inName << " is smaller than the volume." << std::endl;
+      return false;
+    }
+
+    glm::u64vec3 const concats{ m_outDims / m_inDims };
+    glm::u64vec3 const dims{ concats * m_inDims };
+    std::cout << "Number of concats: " << glm::to_string(concats) << std::endl;
+    std::cout << "Final dimensions: " << glm::to_string(dims) << std::endl;
+    if (dims.x * dims.y * dims.z == 0) {
+      std::cerr << "The target dimensions are smaller than the input volume." << std::endl;
+      return false;
+    }
+
+    uint64_t const outSlabBytes{ dims.x * dims.y * sizeof(Ty) };
+    OutFile out;
+    std::string error;
+    if (!out.open(m_outName, outSlabBytes * dims.z, error)) {
+      std::cerr << error << std::endl;
+      return false;
+    }
+
+    std::vector<Ty> inSlab(inSlabVoxels);
+    std::vector<Ty> outSlabs[2]{ std::vector<Ty>(dims.x * dims.y),
+                                 std::vector<Ty>(dims.x * dims.y) };
+    Progress progress{ outSlabBytes * dims.z };
+    std::future<void> writing;
+
+    try {
+      for (uint64_t z{ 0 }; z < m_inDims.z; ++z) {
+        if (in.readAt(inSlab.data(), inSlabBytes, z * inSlabBytes) != inSlabBytes) {
+          throw std::runtime_error("Short read of slab " + std::to_string(z) + " of " +
+                                   m_inName);
+        }
+
+        // The writes of this buffer's last slab were waited for by the
+        // previous iteration.
+        Ty *slab{ outSlabs[z % 2].data() };
+        tile(inSlab.data(), slab, dims);
+
+        if (writing.valid()) {
+          writing.get();
+        }
+        writing = std::async(std::launch::async,
+                             [this, &out, &progress, slab, z, concats, outSlabBytes]() {
+          tbb::parallel_for(tbb::blocked_range<uint64_t>{ 0, concats.z, 1 },
+                            [&](tbb::blocked_range<uint64_t> const &r) {
+            for (uint64_t cz{ r.begin() }; cz != r.end(); ++cz) {
+              out.writeAt(slab, outSlabBytes, ( cz * m_inDims.z + z ) * outSlabBytes);
+              progress.add(outSlabBytes);
+            }
+          });
+        });
+      }
+      writing.get();
+    } catch (std::exception const &e) {
+      if (writing.valid()) {
+        writing.wait();
+      }
+      std::cerr << '\n' << e.what() << std::endl;
+      return false;
+    }
+
+    progress.done();
+    return true;
+  }
+
+private:
+
+  /// \brief Fill the output slab \c slab (\c dims.x by \c dims.y) with
+  /// copies of the input slab \c in.
+  void
+  tile(Ty const *in, Ty *slab, glm::u64vec3 const &dims) const
+  {
+    uint64_t const w{ m_inDims.x };
+    uint64_t const h{ m_inDims.y };
+    tbb::parallel_for(tbb::blocked_range<uint64_t>{ 0, dims.y },
+                      [&](tbb::blocked_range<uint64_t> const &rows) {
+      for (uint64_t y{ rows.begin() }; y != rows.end(); ++y) {
+        Ty const *src{ in + ( y % h ) * w };
+        Ty *dest{ slab + y * dims.x };
+        for (uint64_t x{ 0 }; x < dims.x; x += w) {
+          std::memcpy(dest + x, src, w * sizeof(Ty));
+        }
+      }
+    });
+  }
+
+  std::string const m_inName;
+  std::string const m_outName;
+  glm::u64vec3 const m_inDims;
+  glm::u64vec3 const m_outDims;
+
+}; // class Concatenator
+
+} // namespace concat
+
+#endif // ! concat_concatenator_h__
@@ -2,176 +2,103 @@
 // Created by jim on 8/23/16.
 //
 
+#include "assemble.h"
 #include "cmdline.h"
-
+#include "concatenator.h"
+#include "datwriter.h"
+#include "manifest.h"
 
 #include <bd/log/logger.h>
 #include <bd/io/datfile.h>
-#include <glm/glm.hpp>
-#include <glm/gtx/string_cast.hpp>
 
 #include <iostream>
-#include <array>
 #include <string>
-#include <fstream>
 
 
 namespace concat
 {
   template<class Ty>
-  class RowReader
+  bool
+    doConcat(CommandLineOptions const &clo, bd::DatFileData const &dat)
   {
-  public:
-    RowReader(std::unique_ptr<std::istream> in, glm::u64vec3 const &dims)
-      : m_in{ std::move(in) }
-      , m_dims{ dims }
-      , m_rowBytes{ dims.x * sizeof(Ty) }
-      , m_totalRows{ dims.y * dims.z }
-      , m_currentRow{ 0 }
-      , m_cpos{ 0 }
-    {
-      std::cout << "RowReader has " << m_totalRows << " to read.";
-      std::cout << "Each row is " << m_rowBytes << " bytes.";
-    }
-
-    ~RowReader()
-    {
-    }
-
-    size_t
-    nextRow(Ty *buf)
-    {
-      if (m_currentRow == m_dims.y) {
-        //std::cout << "\nNo rows left." << std::endl;
-        return 0;
-      }
-
-      if (m_in->read(reinterpret_cast<char*>(buf), m_rowBytes)) {
-        m_currentRow++;
-        return m_in->gcount();
-      }
-      return 0;
-    }
+    Concatenator<Ty> cc{
+      clo.rawFilePath,
+      clo.outputFilePath,
+      {dat.rX, dat.rY, dat.rZ},
+      {clo.targetXDim, clo.targetYDim, clo.targetZDim}
+    };
 
-    void
-    seekToSlab(size_t slab) {
-      m_in->seekg(slab * m_dims.x * m_dims.y * sizeof(Ty), m_in->beg);
-      m_currentRow = 0;
+    if (!cc.concat()) {
+      return false;
     }
-
-  private:
-
-    std::unique_ptr<std::istream> m_in;
-    glm::u64vec3 const m_dims;
-    size_t const m_rowBytes;
-    size_t const m_totalRows;
-    size_t m_currentRow;
-    std::streamoff m_cpos;
-  };
+    std::cout << "Done concatenating!" << std::endl;
+    return true;
+  }
 
 
   template<class Ty>
-  class Concatenator
+  bool
+    doAssemble(CommandLineOptions const &clo, Manifest const &manifest, bd::DataType type)
   {
-  public:
-    Concatenator(std::string const &inFile,
-      std::string const &outFile,
-      glm::u64vec3 const &inDims,
-      glm::u64vec3 const &outDims)
-      : m_inName{ inFile }
-      , m_outName{ outFile }
-      , m_inDims{ inDims }
-      , m_outDims{ outDims }
-      , m_inBuffer{ nullptr }
-    {
+    if (!assemble<Ty>(manifest, clo.outputFilePath, clo.bufferSize)) {
+      return false;
     }
-
-
-    ~Concatenator()
-    {
-      if (m_inBuffer != nullptr) {
-        delete m_inBuffer;
-      }
-      /*  if (m_outBuffer != nullptr) {
-          delete m_outBuffer;
-        }*/
+    if (!preproc::writeDat(clo.outDatPath, clo.outputFilePath, manifest.dims, type)) {
+      std::cerr << "Could not write " << clo.outDatPath << std::endl;
+      return false;
     }
+    std::cout << "Done assembling! Wrote " << clo.outDatPath << std::endl;
+    return true;
+  }
 
-    void
-    concat()
-    {
-      m_inBuffer = new Ty[m_inDims.x];
-
-      std::unique_ptr<std::ifstream> inFile{
-        new std::ifstream{ m_inName, std::ios::binary } };
-
-      if (!inFile->is_open()) {
-        std::cerr << "Could not open input file: " << m_inName << std::endl;
-        return;
-      }
-      RowReader<Ty> rr(std::move(inFile), m_inDims);
-
-      std::ofstream outFile{ m_outName, std::ios::binary };
-      if (!outFile.is_open()) {
-        std::cerr << "Could not open output file: " << m_outName << std::endl;
-        return;
-      }
 
-      glm::u64vec3 concats{ m_outDims / m_inDims };
-      std::cout << "Number of concats: " << glm::to_string(concats) << std::endl;
-      std::cout << "Final dimensions: " << glm::to_string(concats * m_inDims) << std::endl;
-      size_t totalRead{ 0 };
-      size_t read{ 0 };
-
-      for (size_t cz = 0; cz < concats.z; ++cz) {
-        // seek to start of file
-        //rr.seekToSlab(0);
-        for (size_t slab = 0; slab < m_inDims.z; ++slab) {
-          for (size_t cy = 0; cy < concats.y; ++cy) {
-            // seek to start of slab cy
-            // write out slab cy, reading row by row.
-            rr.seekToSlab(slab);
-            while ((read = rr.nextRow(m_inBuffer)) > 0) {
-              totalRead += read;
-              // write this row x number of times
-              for (size_t cx = 0; cx < concats.x; ++cx) {
-                outFile.write(reinterpret_cast<char*>(m_inBuffer), read);
-                std::cout << '\r' << "Bytes read: " << totalRead << ", bytes written: " << outFile.tellp() << " bytes.";
-              }
-            } // while
-          } // for cy
-        }
+  /// \brief Assemble the tiles of --manifest, with the data type from -t or
+  /// else the .dat given by -d.
+  bool
+    assembleTiles(CommandLineOptions const &clo)
+  {
+    bd::DataType type;
+    if (!clo.dataType.empty()) {
+      type = bd::to_dataType(clo.dataType);
+    } else if (!clo.datFilePath.empty()) {
+      bd::DatFileData dat;
+      if (!bd::parseDat(clo.datFilePath, dat)) {
+        std::cerr << "Could not open .dat file " << clo.datFilePath << std::endl;
+        return false;
       }
+      type = dat.dataType;
+    } else {
+      std::cerr << "--manifest needs the data type of the tiles, give -t or -d." << std::endl;
+      return false;
     }
 
-  private:
-
-    std::string const m_inName;
-    std::string const m_outName;
-    glm::u64vec3 const m_inDims;
-    glm::u64vec3 const m_outDims;
-
-    Ty *m_inBuffer;
-
-  }; // class Concatenator
-
-
-
-
-  template<class Ty>
-  void
-    doConcat(CommandLineOptions const &clo, bd::DatFileData const &dat)
-  {
-    Concatenator<Ty> cc{
-      clo.rawFilePath,
-      clo.outputFilePath,
-      {dat.rX, dat.rY, dat.rZ},
-      {clo.targetXDim, clo.targetYDim, clo.targetZDim}
-    };
-
-    cc.concat();
-    std::cout << "Done concatenating!" << std::endl;
-
+    Manifest manifest;
+    std::string error;
+    if (!loadManifest(clo.manifestPath, manifest, error)) {
+      std::cerr << error << std::endl;
+      return false;
+    }
+    std::cout << "Assembling " << manifest.tiles.size() << " tiles into "
+              << manifest.dims[0] << "x" << manifest.dims[1] << "x" << manifest.dims[2]
+              << std::endl;
+
+    switch (type) {
+    case bd::DataType::Character:
+      return doAssemble<int8_t>(clo, manifest, type);
+    case bd::DataType::UnsignedCharacter:
+      return doAssemble<uint8_t>(clo, manifest, type);
+    case bd::DataType::Short:
+      return doAssemble<int16_t>(clo, manifest, type);
+    case bd::DataType::UnsignedShort:
+      return doAssemble<uint16_t>(clo, manifest, type);
+    case bd::DataType::Float:
+      return doAssemble<float>(clo, manifest, type);
+    case bd::DataType::Double:
+      return doAssemble<double>(clo, manifest, type);
+    default:
+      std::cerr << "Unsupported data type: " << bd::to_string(type) << std::endl;
+      return false;
+    }
   }
 
 
@@ -189,6 +116,10 @@ main(int argc, const char *argv[])
     return 1;
   }
 
+  if (!clo.manifestPath.empty()) {
+    return concat::assembleTiles(clo) ? 0 : 1;
+  }
+
   bd::DatFileData datFile;
   if (!bd::parseDat(clo.datFilePath, datFile)) {
     std::cerr << "Could not open .dat file " << clo.datFilePath << std::endl;
@@ -196,35 +127,36 @@ main(int argc, const char *argv[])
   }
   std::cout << datFile.to_string() << std::endl;
 
+  bool ok{ false };
   switch (datFile.dataType) {
   case bd::DataType::Character:
     std::cout << "int8_t" << std::endl;
-    concat::doConcat<int8_t>(clo, datFile);
+    ok = concat::doConcat<int8_t>(clo, datFile);
     break;
   case bd::DataType::UnsignedCharacter:
     std::cout << "uint8_t" << std::endl;
-    concat::doConcat<uint8_t>(clo, datFile);
+    ok = concat::doConcat<uint8_t>(clo, datFile);
     break;
   case bd::DataType::Short:
     std::cout << "int16_t" << std::endl;
-    concat::doConcat<int16_t>(clo, datFile);
+    ok = concat::doConcat<int16_t>(clo, datFile);
     break;
   case bd::DataType::UnsignedShort:
     std::cout << "uint16_t" << std::endl;
-    concat::doConcat<uint16_t>(clo, datFile);
+    ok = concat::doConcat<uint16_t>(clo, datFile);
     break;
   case bd::DataType::Float:
     std::cout << "float" << std::endl;
-    concat::doConcat<float>(clo, datFile);
+    ok = concat::doConcat<float>(clo, datFile);
     break;
   case bd::DataType::Double:
     std::cout << "double" << std::endl;
-    concat::doConcat<double>(clo, datFile);
+    ok = concat::doConcat<double>(clo, datFile);
     break;
   default:
     std::cerr << "Unsupported data type: " << bd::to_string(datFile.dataType) << std::endl;
     return 1;
   }
 
-  return 0;
+  return ok ? 0 : 1;
 }
@@ -0,0 +1,119 @@
+#include "manifest.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace concat
+{
+
+namespace
+{
+
+bool
+overlap(Tile const &a, Tile const &b)
+{
+  for (int d{ 0 }; d < 3; ++d) {
+    if (a.offset[d] + a.dims[d] <= b.offset[d] || b.offset[d] + b.dims[d] <= a.offset[d]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+
+bool
+loadManifest(std::string const &path, Manifest &manifest, std::string &error)
+{
+  std::ifstream is{ path };
+  if (!is.is_open()) {
+    error = "Could not open manifest " + path;
+    return false;
+  }
+
+  size_t const slash{ path.find_last_of('/') };
+  std::string const dir{ slash == std::string::npos ? std::string() : path.substr(0, slash + 1) };
+
+  manifest = Manifest{};
+  bool haveDims{ false };
+  std::string line;
+  for (int lineNo{ 1 }; std::getline(is, line); ++lineNo) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream ls{ line };
+    std::string first;
+    if (!( ls >> first )) {
+      continue;
+    }
+
+    std::string const where{ path + ":" + std::to_string(lineNo) + ": " };
+    if (first == "dims") {
+      if (!( ls >> manifest.dims[0] >> manifest.dims[1] >> manifest.dims[2] )) {
+        error = where + "dims needs three values.";
+        return false;
+      }
+      haveDims = true;
+      continue;
+    }
+
+    Tile t;
+    t.path = first[0] == '/' ? first : dir + first;
+    if (!( ls >> t.offset[0] >> t.offset[1] >> t.offset[2] >> t.dims[0] >> t.dims[1] >> t.dims[2] )) {
+      error = where + "expected <raw file> <x> <y> <z> <width> <height> <depth>.";
+      return false;
+    }
+    if (t.dims[0] == 0 || t.dims[1] == 0 || t.dims[2] == 0) {
+      error = where + "tile " + t.path + " is empty.";
+      return false;
+    }
+    manifest.tiles.push_back(t);
+  }
+
+  if (manifest.tiles.empty()) {
+    error = "Manifest " + path + " has no tiles.";
+    return false;
+  }
+
+  uint64_t extent[3]{ 0, 0, 0 };
+  for (Tile const &t : manifest.tiles) {
+    for (int d{ 0 }; d < 3; ++d) {
+      extent[d] = std::max(extent[d], t.offset[d] + t.dims[d]);
+    }
+  }
+  if (!haveDims) {
+    std::copy(extent, extent + 3, manifest.dims);
+  }
+  for (int d{ 0 }; d < 3; ++d) {
+    if (extent[d] > manifest.dims[d]) {
+      error = "Manifest " + path + " has tiles outside of its dims.";
+      return false;
+    }
+  }
+
+  // Tiles sorted by z start only have to be checked against the ones that
+  // start before they end.
+  std::vector<Tile const *> byZ;
+  for (Tile const &t : manifest.tiles) {
+    byZ.push_back(&t);
+  }
+  std::sort(byZ.begin(), byZ.end(),
+            [](Tile const *a, Tile const *b) { return a->offset[2] < b->offset[2]; });
+  for (size_t i{ 0 }; i < byZ.size(); ++i) {
+    for (size_t j{ i + 1 };
+         j < byZ.size() && byZ[j]->offset[2] < byZ[i]->offset[2] + byZ[i]->dims[2]; ++j) {
+      if (overlap(*byZ[i], *byZ[j])) {
+        error = "Tiles " + byZ[i]->path + " and " + byZ[j]->path + " overlap.";
+        return false;
+      }
+    }
+  }
+
+  manifest.covered = 0;
+  for (Tile const &t : manifest.tiles) {
+    manifest.covered += t.dims[0] * t.dims[1] * t.dims[2];
+  }
+  return true;
+}
+
+} // namespace concat
@@ -0,0 +1,51 @@
+#ifndef concat_manifest_h__
+#define concat_manifest_h__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace concat
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A raw file that is one brick of an assembled volume.
+struct Tile
+{
+  std::string path;
+  uint64_t offset[3]; ///< Position of the tile's first voxel in the output.
+  uint64_t dims[3];
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The tiles of an assembled volume and its dimensions.
+///
+/// A manifest is a text file with a line for each tile:
+///
+///     <raw file> <x> <y> <z> <width> <height> <depth>
+///
+/// where x y z is the voxel position of the tile in the output. Relative
+/// paths are relative to the manifest. An optional line
+///
+///     dims <X> <Y> <Z>
+///
+/// gives the output dimensions, otherwise they are the extent of the tiles.
+/// Text after a # is a comment.
+struct Manifest
+{
+  uint64_t dims[3];
+  std::vector<Tile> tiles;
+  uint64_t covered; ///< Voxels of the output that are in a tile.
+};
+
+
+/// \brief Load and check the manifest at \c path.
+/// \return false if it can't be read, is malformed, or has tiles that are
+///         outside of the output or overlap, \c error has the reason.
+bool
+loadManifest(std::string const &path, Manifest &manifest, std::string &error);
+
+} // namespace concat
+
+#endif // ! concat_manifest_h__
@@ -0,0 +1,115 @@
+#ifndef concat_outfile_h__
+#define concat_outfile_h__
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace concat
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A write-only file that is written at explicit offsets with
+/// pwrite(), the writing counterpart of preproc::RawFile.
+///
+/// There is no file position, so any number of threads can write different
+/// parts of the file at the same time.
+class OutFile
+{
+public:
+
+  OutFile()
+      : m_fd{ -1 }
+  {
+  }
+
+
+  ~OutFile()
+  {
+    close();
+  }
+
+
+  OutFile(OutFile const &) = delete;
+  OutFile &operator=(OutFile const &) = delete;
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Create (or truncate) the file at \c path and size it to \c size
+  /// bytes.
+  /// \return false if the file couldn't be created or sized, \c error has
+  ///         the reason.
+  bool
+  open(std::string const &path, uint64_t size, std::string &error)
+  {
+    close();
+
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) {
+      error = "Could not open output file " + path + ": " + std::strerror(errno);
+      return false;
+    }
+
+    if (::ftruncate(m_fd, static_cast<off_t>(size)) != 0) {
+      error = "Could not size output file " + path + ": " + std::strerror(errno);
+      close();
+      return false;
+    }
+
+    m_path = path;
+    return true;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  void
+  close()
+  {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Write \c bytes bytes from \c src starting at byte \c offset.
+  ///
+  /// Short writes from pwrite() are retried until everything is written.
+  /// \throws std::runtime_error if the write fails.
+  void
+  writeAt(void const *src, uint64_t bytes, uint64_t offset) const
+  {
+    char const *p{ static_cast<char const *>(src) };
+    uint64_t total{ 0 };
+
+    while (total < bytes) {
+      ssize_t amount{ ::pwrite(m_fd, p + total, bytes - total, offset + total) };
+
+      if (amount < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Write failed in " + m_path + ": " + std::strerror(errno));
+      }
+
+      total += static_cast<uint64_t>(amount);
+    }
+  }
+
+
+private:
+  int m_fd;
+  std::string m_path;
+
+}; // class OutFile
+
+} // namespace concat
+
+#endif // ! concat_outfile_h__
@@ -0,0 +1,64 @@
+#ifndef concat_progress_h__
+#define concat_progress_h__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+
+namespace concat
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Throttled progress of the bytes written, safe to update from
+/// any thread.
+class Progress
+{
+public:
+  explicit Progress(uint64_t total)
+    : m_total{ total }
+    , m_written{ 0 }
+    , m_last{ std::chrono::steady_clock::now() }
+  {
+  }
+
+  void
+  add(uint64_t bytes)
+  {
+    uint64_t const written{ m_written += bytes };
+    std::unique_lock<std::mutex> lock{ m_mutex, std::try_to_lock };
+    if (!lock.owns_lock()) {
+      return;
+    }
+    auto const now = std::chrono::steady_clock::now();
+    if (now - m_last >= std::chrono::seconds(1)) {
+      m_last = now;
+      print(written);
+    }
+  }
+
+  void
+  done()
+  {
+    print(m_written);
+    std::cout << std::endl;
+  }
+
+private:
+  void
+  print(uint64_t written) const
+  {
+    std::cout << '\r' << "Bytes written: " << written << " of " << m_total << " ("
+              << ( m_total > 0 ? 100 * written / m_total : 100 ) << "%)." << std::flush;
+  }
+
+  uint64_t const m_total;
+  std::atomic<uint64_t> m_written;
+  std::mutex m_mutex;
+  std::chrono::steady_clock::time_point m_last;
+}; // class Progress
+
+} // namespace concat
+
+#endif // ! concat_progress_h__
@@ -16,7 +16,7 @@ try
     return 0;
   }
 
-  TCLAP::CmdLine cmd("Rawhist histogram generator.", ' ');
+  TCLAP::CmdLine cmd("Gradient magnitude volume generator.", ' ');
 
   // volume data file
   TCLAP::ValueArg<std::string>
@@ -30,7 +30,7 @@ try
 
   // output file path
   TCLAP::ValueArg<std::string> outputFilePath
-      ("o", "output-path", "Path to save hist file to.", false, "", "string");
+      ("o", "output-path", "Path to save the gradient volume or 2D histogram to.", false, "", "string");
   cmd.add(outputFilePath);
 
   //// volume data type
@@ -45,10 +45,47 @@ try
   // buffer size
   const std::string sixty_four_megs = "128M";
   TCLAP::ValueArg<std::string>
-      bufferSizeArg("b", "buffer-size", "Buffer size bytes", false, sixty_four_megs,
+      bufferSizeArg("b", "buffer-size", "Bytes of output to buffer, split between the "
+                    "batch being computed and the one being written.", false, sixty_four_megs,
                     "uint");
   cmd.add(bufferSizeArg);
 
+  TCLAP::ValueArg<int>
+      numThreadsArg("n", "num-threads", "Threads to compute slabs with, 0 for all cores.",
+                    false, 0, "int");
+  cmd.add(numThreadsArg);
+
+  // 2D histogram
+  TCLAP::SwitchArg
+      hist2dArg("", "hist2d", "Write a 2D histogram of value and gradient magnitude to the "
+                "output path instead of the gradient volume.", false);
+  cmd.add(hist2dArg);
+
+  TCLAP::ValueArg<uint32_t>
+      valueBinsArg("", "value-bins", "Value bins of the 2D histogram.", false, 256, "uint");
+  cmd.add(valueBinsArg);
+
+  TCLAP::ValueArg<uint32_t>
+      gradBinsArg("", "grad-bins", "Gradient magnitude bins of the 2D histogram.", false, 256,
+                  "uint");
+  cmd.add(gradBinsArg);
+
+  TCLAP::ValueArg<double>
+      valueMinArg("", "value-min", "Value of the first 2D histogram bin. Default: the volume "
+                  "min, like preproc --tfunc2d.", false, 0.0, "float");
+  cmd.add(valueMinArg);
+
+  TCLAP::ValueArg<double>
+      valueMaxArg("", "value-max", "Value at the end of the last 2D histogram bin. Default: "
+                  "the volume max, like preproc --tfunc2d.", false, 0.0, "float");
+  cmd.add(valueMaxArg);
+
+  TCLAP::ValueArg<double>
+      gradMaxArg("", "grad-max", "Gradient magnitude at the end of the last 2D histogram bin. "
+                 "Default: the largest possible, (value max - value min) * sqrt(3) / 2.",
+                 false, 0.0, "float");
+  cmd.add(gradMaxArg);
+
   cmd.parse(argc, argv);
 
   opts.rawFilePath = fileArg.getValue();
@@ -56,6 +93,22 @@ try
   opts.outputFilePath = outputFilePath.getValue();
 //  opts.dataType = dataTypeArg.getValue();
   opts.bufferSize = convertToBytes(bufferSizeArg.getValue());
+  opts.numThreads = numThreadsArg.getValue();
+  opts.hist2d = hist2dArg.getValue();
+  opts.valueBins = valueBinsArg.getValue();
+  opts.gradBins = gradBinsArg.getValue();
+  if (opts.valueBins == 0 || opts.gradBins == 0) {
+    std::cout << "The 2D histogram needs at least one bin in each dimension." << std::endl;
+    return 0;
+  }
+  opts.useValueRange = valueMinArg.isSet() || valueMaxArg.isSet();
+  if (opts.useValueRange && !( valueMinArg.isSet() && valueMaxArg.isSet() )) {
+    std::cout << "--value-min and --value-max must be given together." << std::endl;
+    return 0;
+  }
+  opts.valueMin = valueMinArg.getValue();
+  opts.valueMax = valueMaxArg.getValue();
+  opts.gradMax = gradMaxArg.getValue();
 
   return static_cast<int>(cmd.getArgList().size());
 
@@ -73,6 +126,9 @@ printThem(CommandLineOptions &opts)
       << "File path: " << opts.rawFilePath
       << "\nDat file: " << opts.datFilePath
       << "\nBuffer Size: " << opts.bufferSize
+      << "\nThreads: " << opts.numThreads
+      << "\n2D histogram: " << std::boolalpha << opts.hist2d
+      << " (" << opts.valueBins << " x " << opts.gradBins << " bins)"
       << std::endl;
 }
 
@@ -91,7 +147,8 @@ convertToBytes(std::string s)
     multiplier = 1024*1024*1024;
   }
 
-  std::string numPart(s.begin(), s.end()-1);
+  // a plain number of bytes has no suffix to strip.
+  std::string numPart(s.begin(), multiplier == 1 ? s.end() : s.end()-1);
   auto num = stoull(numPart);
 
   return num*multiplier;
@@ -1,6 +1,7 @@
 #ifndef rawhist_cmdline_h__
 #define rawhist_cmdline_h__
 
+#include <cstdint>
 #include <string>
 
 namespace gmag
@@ -13,8 +14,23 @@ struct CommandLineOptions
   std::string datFilePath;
   // histogram file output path
   std::string outputFilePath;
-  // buffer size
+  // bytes of output to collect before writing
   uint64_t bufferSize;
+  // number of threads, 0 for all cores
+  int numThreads;
+  // true to write a value x gradient magnitude histogram instead of the
+  // gradient volume.
+  bool hist2d;
+  uint32_t valueBins;
+  uint32_t gradBins;
+  // true if valueMin/valueMax were given, otherwise the volume min/max
+  // is used.
+  bool useValueRange;
+  double valueMin;
+  double valueMax;
+  // gradient magnitude of the last gradient bin, 0 for the largest
+  // possible for the value range.
+  double gradMax;
 };
 
 
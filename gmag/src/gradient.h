@@ -0,0 +1,206 @@
+#ifndef gmag_gradient_h__
+#define gmag_gradient_h__
+
+#include "hist2d.h"
+#include "slabring.h"
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gmag
+{
+
+/// \brief Slabs on each side of a slab that its gradients need.
+int64_t const STENCIL_RADIUS{ 1 };
+
+
+/// \brief Squared gradient magnitude from the two neighbors along each axis.
+inline float
+magnitude(double x1, double x2, double y1, double y2, double z1, double z2)
+{
+  double const dx{ ( x1 - x2 ) * 0.5 };
+  double const dy{ ( y1 - y2 ) * 0.5 };
+  double const dz{ ( z1 - z2 ) * 0.5 };
+  return static_cast<float>(dx * dx + dy * dy + dz * dz);
+}
+
+
+/// \brief Squared gradient magnitude of one row of voxels.
+///
+/// \c y1, \c y2, \c z1 and \c z2 are the neighboring rows, already clamped
+/// to the volume, so only the two end voxels need their x neighbors
+/// clamped. The interior loop has no branches and vectorizes.
+template<class Ty>
+void
+gradientRow(Ty const *__restrict row,
+            Ty const *__restrict y1, Ty const *__restrict y2,
+            Ty const *__restrict z1, Ty const *__restrict z2,
+            uint64_t xmax, float *__restrict out)
+{
+  for (uint64_t ix{ 1 }; ix + 1 < xmax; ++ix) {
+    out[ix] = magnitude(row[ix - 1], row[ix + 1], y1[ix], y2[ix], z1[ix], z2[ix]);
+  }
+
+  uint64_t const last{ xmax - 1 };
+  out[0] = magnitude(row[0], row[xmax > 1 ? 1 : 0], y1[0], y2[0], z1[0], z2[0]);
+  if (xmax > 1) {
+    out[last] = magnitude(row[last - 1], row[last], y1[last], y2[last], z1[last], z2[last]);
+  }
+}
+
+
+/// \brief Call fn(iy, row, y1, y2, z1, z2) for each row of slab \c iz, with
+/// the neighboring rows clamped to the volume. Rows are visited in parallel.
+template<class Ty, class Fn>
+void
+forEachRow(SlabRing<Ty> const &ring, int64_t iz, uint64_t const dims[3], Fn fn)
+{
+  uint64_t const xmax{ dims[0] };
+  uint64_t const ymax{ dims[1] };
+  Ty const *below{ ring.slab(iz - 1) };
+  Ty const *here{ ring.slab(iz) };
+  Ty const *above{ ring.slab(iz + 1) };
+
+  tbb::parallel_for(
+      tbb::blocked_range<uint64_t>{ 0, ymax },
+      [=, &fn](tbb::blocked_range<uint64_t> const &r) {
+        for (uint64_t iy{ r.begin() }; iy != r.end(); ++iy) {
+          uint64_t const y1{ iy == 0 ? 0 : iy - 1 };
+          uint64_t const y2{ iy == ymax - 1 ? iy : iy + 1 };
+          fn(iy, here + iy * xmax,
+             here + y1 * xmax, here + y2 * xmax,
+             below + iy * xmax, above + iy * xmax);
+        }
+      });
+}
+
+
+/// \brief Squared gradient magnitude of slab \c iz, by central differences
+/// with neighbors clamped to the volume.
+template<class Ty>
+void
+gradientSlab(SlabRing<Ty> const &ring, int64_t iz, uint64_t const dims[3], float *out)
+{
+  uint64_t const xmax{ dims[0] };
+  forEachRow(ring, iz, dims,
+             [=](uint64_t iy, Ty const *row, Ty const *y1, Ty const *y2,
+                 Ty const *z1, Ty const *z2) {
+               gradientRow(row, y1, y2, z1, z2, xmax, out + iy * xmax);
+             });
+}
+
+
+/// \brief Min and max value of the raw volume, read a slab at a time.
+template<class Ty>
+void
+volumeMinMax(uint64_t const dims[3], std::string const &rawPath, double &min, double &max)
+{
+  SlabRing<Ty> ring{ rawPath, dims, 0 };
+  uint64_t const slabVoxels{ ring.slabVoxels() };
+  min = std::numeric_limits<double>::max();
+  max = std::numeric_limits<double>::lowest();
+  for (int64_t iz{ 0 }; iz < int64_t(dims[2]); ++iz) {
+    ring.advance(iz);
+    Ty const *slab{ ring.slab(iz) };
+    auto const mm = tbb::parallel_reduce(
+        tbb::blocked_range<uint64_t>{ 0, slabVoxels },
+        std::make_pair(min, max),
+        [slab](tbb::blocked_range<uint64_t> const &r, std::pair<double, double> m) {
+          for (uint64_t i{ r.begin() }; i != r.end(); ++i) {
+            m.first = std::min(m.first, double(slab[i]));
+            m.second = std::max(m.second, double(slab[i]));
+          }
+          return m;
+        },
+        [](std::pair<double, double> a, std::pair<double, double> b) {
+          return std::make_pair(std::min(a.first, b.first), std::max(a.second, b.second));
+        });
+    min = mm.first;
+    max = mm.second;
+  }
+}
+
+
+/// \brief Value range and gradient max of a 2D histogram of the raw volume.
+///
+/// Without \c useValueRange the range is the volume min/max, and a
+/// \c gradMax of 0 is (max - min) * sqrt(3) / 2, the same defaults preproc
+/// --tfunc2d normalizes with, so the histogram's bins line up with the
+/// table's.
+template<class Ty>
+void
+histogramRange(uint64_t const dims[3], std::string const &rawPath, bool useValueRange,
+               double &valueMin, double &valueMax, double &gradMax)
+{
+  if (!useValueRange) {
+    volumeMinMax<Ty>(dims, rawPath, valueMin, valueMax);
+  }
+  if (gradMax <= 0.0) {
+    gradMax = ( valueMax - valueMin ) * std::sqrt(3.0) * 0.5;
+  }
+}
+
+
+/// \brief Stream the raw volume once and count each voxel's value and
+/// gradient magnitude into the bins of \c binner.
+///
+/// Each thread bins the rows it computes into its own counts, which are
+/// added together after the last slab, so the bins are never shared
+/// between threads and memory use is a few slabs plus one histogram per
+/// thread. slabDone(n) is called when the first n slabs are counted.
+/// \throws std::runtime_error if the raw file can't be read.
+template<class Ty, class Fn>
+std::vector<uint64_t>
+histogram2dCounts(uint64_t const dims[3], std::string const &rawPath,
+                  Hist2DBinner const &binner, Fn slabDone)
+{
+  uint64_t const xmax{ dims[0] };
+
+  struct Local
+  {
+    std::vector<uint64_t> counts;
+    std::vector<float> gmag; ///< One row of squared gradient magnitudes.
+  };
+  tbb::enumerable_thread_specific<Local> locals{ [&binner, xmax]() {
+    return Local{ std::vector<uint64_t>(binner.size(), 0), std::vector<float>(xmax) };
+  } };
+
+  SlabRing<Ty> ring{ rawPath, dims, STENCIL_RADIUS };
+  for (int64_t iz{ 0 }; iz < int64_t(dims[2]); ++iz) {
+    ring.advance(iz);
+    forEachRow(ring, iz, dims,
+               [&](uint64_t, Ty const *row, Ty const *y1, Ty const *y2,
+                   Ty const *z1, Ty const *z2) {
+                 Local &local = locals.local();
+                 float *g{ local.gmag.data() };
+                 gradientRow(row, y1, y2, z1, z2, xmax, g);
+                 uint64_t *counts{ local.counts.data() };
+                 for (uint64_t ix{ 0 }; ix < xmax; ++ix) {
+                   ++counts[binner.bin(row[ix], std::sqrt(g[ix]))];
+                 }
+               });
+    slabDone(iz + 1);
+  }
+
+  std::vector<uint64_t> counts(binner.size(), 0);
+  locals.combine_each([&counts](Local const &local) {
+    for (size_t i{ 0 }; i < counts.size(); ++i) {
+      counts[i] += local.counts[i];
+    }
+  });
+  return counts;
+}
+
+} // namespace gmag
+
+#endif // ! gmag_gradient_h__
@@ -0,0 +1,88 @@
+#ifndef gmag_hist2d_h__
+#define gmag_hist2d_h__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gmag
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Header of a gmag --hist2d file.
+///
+/// Followed by gradBins rows of valueBins uint64_t counts, the first row is
+/// gradient magnitude 0. Bin (v, g) covers values
+/// [valueMin + v * (valueMax - valueMin) / valueBins, ...) and gradient
+/// magnitudes [g * gradMax / gradBins, ...), values and magnitudes outside
+/// of the ranges are counted in the first or last bin. That is the same
+/// normalization preproc --tfunc2d uses, so a table designed on the
+/// histogram can be given gradMax as its gradient max.
+struct Hist2DHeader
+{
+  char magic[8];       ///< "GMHIST2D"
+  uint32_t version;    ///< 1
+  uint32_t valueBins;
+  uint32_t gradBins;
+  uint32_t reserved;
+  double valueMin;
+  double valueMax;
+  double gradMax;
+  uint64_t voxels;     ///< Sum of the counts.
+};
+
+static_assert(sizeof(Hist2DHeader) == 56, "Hist2DHeader is a file format");
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Maps a voxel value and gradient magnitude to a bin of a Hist2D.
+class Hist2DBinner
+{
+public:
+
+  Hist2DBinner(uint32_t valueBins, uint32_t gradBins,
+               double valueMin, double valueMax, double gradMax)
+      : m_valueBins{ valueBins }
+      , m_gradBins{ gradBins }
+      , m_valueMin{ valueMin }
+      , m_valueScale{ valueMax > valueMin ? valueBins / ( valueMax - valueMin ) : 0.0 }
+      , m_gradScale{ gradMax > 0.0 ? gradBins / gradMax : 0.0 }
+  {
+  }
+
+
+  size_t
+  size() const
+  {
+    return size_t(m_valueBins) * m_gradBins;
+  }
+
+
+  /// \brief Index of the bin for \c value and gradient magnitude \c grad.
+  size_t
+  bin(double value, double grad) const
+  {
+    return clamp(grad * m_gradScale, m_gradBins) * m_valueBins +
+        clamp(( value - m_valueMin ) * m_valueScale, m_valueBins);
+  }
+
+
+private:
+
+  static size_t
+  clamp(double x, uint32_t bins)
+  {
+    return x <= 0.0 ? 0 : x >= bins ? bins - 1 : static_cast<size_t>(x);
+  }
+
+
+  uint32_t m_valueBins;
+  uint32_t m_gradBins;
+  double m_valueMin;
+  double m_valueScale;
+  double m_gradScale;
+
+}; // class Hist2DBinner
+
+} // namespace gmag
+
+#endif // ! gmag_hist2d_h__
@@ -3,142 +3,209 @@
 //
 
 #include "cmdline.h"
+#include "gradient.h"
+#include "hist2d.h"
+#include "slabring.h"
 
 #include <bd/io/datfile.h>
 #include <bd/io/datatypes.h>
 
+#include <tbb/task_scheduler_init.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iomanip>
 #include <iostream>
-#include <fstream>
+#include <stdexcept>
 #include <string>
-#include <cstdint>
+#include <vector>
 
 
-template<class Ty>
-double
-value(Ty const *raw, size_t ix, size_t iy, size_t iz,
-      size_t const x, size_t const y, size_t const z)
+namespace
 {
-  if (ix < 0) ix = 0;
-  else if (ix > x - 1) ix = x - 1;
-
 
-  if (iy < 0) iy = 0;
-  else if (iy > y - 1) iy = y - 1;
-
-
-  if (iz < 0) iz = 0;
-  else if (iz > z - 1) iz = z - 1;
-
-
-  size_t idx{ ix + x * (iy + iz * y) };
-  return raw[idx];
+void
+writeAll(int fd, void const *p, size_t bytes)
+{
+  char const *c{ static_cast<char const *>(p) };
+  while (bytes > 0) {
+    ssize_t amount{ ::write(fd, c, bytes) };
+    if (amount < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+    }
+    c += amount;
+    bytes -= static_cast<size_t>(amount);
+  }
 }
 
+
+/// \brief Stream the squared gradient magnitude of the raw volume to the
+/// output file.
+///
+/// Input slabs come from a SlabRing that reads ahead of the slab being
+/// computed. Output slabs are collected into batches of about
+/// \c bufferSize bytes, and each batch is written by an async task while
+/// the next one is computed.
+/// \throws std::runtime_error if a file can't be opened, read or written.
 template<class Ty>
-size_t
-start(Ty const * raw, /*std::istream &in,*/ std::ostream &out, size_t const dims[3])
+void
+go(uint64_t const dims[3], std::string const &rawPath, std::string const &outPath,
+   uint64_t bufferSize)
 {
-  size_t const zmax = dims[2];
-  size_t const ymax = dims[1];
-  size_t const xmax = dims[0];
-
-  std::cout << "xmax: " << dims[0] << " ymax: " << dims[1] << " zmax: " << dims[2] << std::endl;
-
-  size_t fill = 0;
-  size_t totalBytes = 0;
-
-  size_t const buffer_bytes = 8192;
-  size_t const max{ buffer_bytes / sizeof(float) };
-  float *outvals{ new float[ max ] };
-
-  for (size_t iz{ 0 }; iz < zmax; ++iz)
-    for (size_t iy{ 0 }; iy < ymax; ++iy)
-      for (size_t ix{ 0 }; ix < xmax; ++ix) {
-        double x1, x2, y1, y2, z1, z2;
-
-        x1 = value(raw, ix-1, iy, iz, xmax, ymax, zmax);
-        x2 = value(raw, ix+1, iy, iz, xmax, ymax, zmax);
-
-        y1 = value(raw, ix, iy-1, iz, xmax, ymax, zmax);
-        y2 = value(raw, ix, iy+1, iz, xmax, ymax, zmax);
+  gmag::SlabRing<Ty> ring{ rawPath, dims, gmag::STENCIL_RADIUS };
 
-        z1 = value(raw, ix, iy, iz-1, xmax, ymax, zmax);
-        z2 = value(raw, ix, iy, iz+1, xmax, ymax, zmax);
+  int fd{ ::open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+  if (fd < 0) {
+    throw std::runtime_error("Could not open output file " + outPath + ": " +
+                             std::strerror(errno));
+  }
 
-        double dx = (x1 - x2) * 0.5;
-        double dy = (y1 - y2) * 0.5;
-        double dz = (z1 - z2) * 0.5;
+  uint64_t const slabVoxels{ ring.slabVoxels() };
+  uint64_t const slabBytes{ slabVoxels * sizeof(float) };
+  uint64_t const slabsPerBatch{ std::max<uint64_t>(1, bufferSize / 2 / slabBytes) };
+  uint64_t const totalBytes{ slabBytes * dims[2] };
+  std::vector<float> batches[2]{ std::vector<float>(slabsPerBatch * slabVoxels),
+                                 std::vector<float>(slabsPerBatch * slabVoxels) };
+  std::future<void> pending;
+  int cur{ 0 };
+  uint64_t filled{ 0 };
+  uint64_t pendingBytes{ 0 };
+  uint64_t written{ 0 };
+
+  auto const start = std::chrono::steady_clock::now();
+  auto lastReport = start;
+  auto report = [&](int64_t slab) {
+    auto const now = std::chrono::steady_clock::now();
+    double const secs{ std::chrono::duration<double>(now - start).count() };
+    std::cout << "\rSlab " << slab << "/" << dims[2] << ", "
+              << std::fixed << std::setprecision(1)
+              << written / ( 1024.0 * 1024.0 ) << " of " << totalBytes / ( 1024.0 * 1024.0 )
+              << " MiB written, " << written / ( 1024.0 * 1024.0 ) / std::max(secs, 1e-9)
+              << " MiB/s" << std::flush;
+    lastReport = now;
+  };
 
-        float mag = static_cast<float>(dx*dx + dy*dy + dz*dz);
-        out.write(reinterpret_cast<const char*>(&mag), sizeof(float));
-        fill++;
-        if (fill > max) {
-          totalBytes += sizeof(float);
-          std::cout << "\r " << totalBytes << " bytes written.";
-          fill = 0;
-        }
+  try {
+    for (int64_t iz{ 0 }; iz < int64_t(dims[2]); ++iz) {
+      ring.advance(iz);
+      gmag::gradientSlab(ring, iz, dims, batches[cur].data() + filled * slabVoxels);
+      ++filled;
+
+      if (filled < slabsPerBatch && iz + 1 < int64_t(dims[2])) {
+        continue;
+      }
+
+      if (pending.valid()) {
+        pending.get();
+        written += pendingBytes;
+      }
+      float const *p{ batches[cur].data() };
+      uint64_t const bytes{ filled * slabBytes };
+      pending = std::async(std::launch::async, [fd, p, bytes]() { writeAll(fd, p, bytes); });
+      pendingBytes = bytes;
+      cur = 1 - cur;
+      filled = 0;
+
+      if (std::chrono::steady_clock::now() - lastReport > std::chrono::milliseconds(500)) {
+        report(iz + 1);
+      }
+    }
+    if (pending.valid()) {
+      pending.get();
+      written += pendingBytes;
+    }
+  } catch (...) {
+    if (pending.valid()) {
+      pending.wait();
+    }
+    ::close(fd);
+    throw;
+  }
 
-//        if (fill < max) {
-//          outvals[fill] = mag;
-//          fill += 1;
-//        } else {
-//          char const *p = reinterpret_cast<char const *>(outvals);
-//          out.write(p, fill*sizeof(float));
-//          totalBytes += fill*sizeof(float);
-//          std::cout << "\r " << totalBytes << " bytes written.";
-//          fill = 0;
-//        }
-      } // for
-
-//  if (fill > 0) {
-//    char const *p = reinterpret_cast<char const *>(outvals);
-//    out.write(p, fill*sizeof(float));
-//    totalBytes += fill*sizeof(float);
-//    std::cout << "\r " << totalBytes << " bytes written.";
-//  }
-  out.flush();
+  if (::close(fd) != 0) {
+    throw std::runtime_error("Could not close " + outPath + ": " + std::strerror(errno));
+  }
+  report(dims[2]);
   std::cout << std::endl;
-  delete [] outvals;
-  return totalBytes;
 }
 
+/// \brief Write a 2D histogram of voxel value and gradient magnitude of the
+/// raw volume, see Hist2DHeader.
+/// \throws std::runtime_error if a file can't be opened, read or written.
 template<class Ty>
 void
-go(size_t const dims[3], std::string const &rawPath, std::string const &outPath)
+histogram2d(uint64_t const dims[3], std::string const &rawPath, std::string const &outPath,
+            gmag::CommandLineOptions const &clo)
 {
-  char *rawData{ nullptr };
-
-  try {
-    size_t const bytes{ dims[0] * dims[1] * dims[2] * sizeof(Ty) };
-    rawData = new char[ bytes ];
-    std::cout << "Allocated " << bytes << " bytes." << std::endl;
-  } catch (std::runtime_error &e) {
-    std::cerr << "Could not allocate memory: " << e.what() << std::endl;
-    rawData = nullptr;
+  double valueMin{ clo.valueMin };
+  double valueMax{ clo.valueMax };
+  double gradMax{ clo.gradMax };
+  if (!clo.useValueRange) {
+    std::cout << "No --value-min/--value-max, reading the volume for its min/max first."
+              << std::endl;
   }
-
-  if (! rawData) return;
-
-  std::ifstream rawfile(rawPath, std::ios::binary);
-  if (! rawfile.is_open()) {
-    std::cerr << "Could not open raw file: " << rawPath << std::endl;
-    return;
+  gmag::histogramRange<Ty>(dims, rawPath, clo.useValueRange, valueMin, valueMax, gradMax);
+
+  gmag::Hist2DBinner const binner{ clo.valueBins, clo.gradBins, valueMin, valueMax, gradMax };
+
+  auto const start = std::chrono::steady_clock::now();
+  auto lastReport = start;
+  std::vector<uint64_t> const counts{ gmag::histogram2dCounts<Ty>(
+      dims, rawPath, binner, [&](int64_t slabs) {
+        auto const now = std::chrono::steady_clock::now();
+        if (now - lastReport > std::chrono::milliseconds(500)) {
+          double const secs{ std::chrono::duration<double>(now - start).count() };
+          std::cout << "\rSlab " << slabs << "/" << dims[2] << ", " << std::fixed
+                    << std::setprecision(1)
+                    << slabs * dims[0] * dims[1] * sizeof(Ty) / ( 1024.0 * 1024.0 ) / secs
+                    << " MiB/s" << std::flush;
+          lastReport = now;
+        }
+      }) };
+
+  gmag::Hist2DHeader header;
+  std::memcpy(header.magic, "GMHIST2D", sizeof(header.magic));
+  header.version = 1;
+  header.valueBins = clo.valueBins;
+  header.gradBins = clo.gradBins;
+  header.reserved = 0;
+  header.valueMin = valueMin;
+  header.valueMax = valueMax;
+  header.gradMax = gradMax;
+  header.voxels = dims[0] * dims[1] * dims[2];
+
+  int fd{ ::open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+  if (fd < 0) {
+    throw std::runtime_error("Could not open output file " + outPath + ": " +
+                             std::strerror(errno));
   }
-  rawfile.read(rawData, dims[0] * dims[1] * dims[2] * sizeof(Ty));
-  rawfile.close();
-
-  std::ofstream outfile(outPath, std::ios::binary);
-  if (! outfile.is_open()) {
-    std::cerr << "Could not open output file: " << outPath << std::endl;
-    return;
+  try {
+    writeAll(fd, &header, sizeof(header));
+    writeAll(fd, counts.data(), counts.size() * sizeof(uint64_t));
+  } catch (...) {
+    ::close(fd);
+    throw;
   }
+  if (::close(fd) != 0) {
+    throw std::runtime_error("Could not close " + outPath + ": " + std::strerror(errno));
+  }
+  std::cout << "\rWrote " << clo.valueBins << "x" << clo.gradBins << " histogram, gradient "
+            "max " << gradMax << std::endl;
+}
 
-  start<Ty>(reinterpret_cast<Ty const *>(rawData), outfile, dims);
+} // namespace
 
-  outfile.flush();
-  outfile.close();
-  delete [] rawData;
-}
 
 int
 main(int argc, char const *argv[])
@@ -153,25 +220,38 @@ main(int argc, char const *argv[])
   std::string outPath = clo.outputFilePath;
   bd::DatFileData dat;
   bd::parseDat(clo.datFilePath, dat);
-  size_t dims[3] { dat.rX, dat.rY, dat.rZ };
+  uint64_t dims[3] { dat.rX, dat.rY, dat.rZ };
 
   std::cout << "Datatype: " << bd::to_string(dat.dataType)
             << "\n dims: " << dat.rX << ", " << dat.rY << ", " << dat.rZ
             << std::endl;
 
 
-  switch(dat.dataType) {
-    case bd::DataType::UnsignedCharacter:
+  int numThreads{ clo.numThreads };
+  if (numThreads == 0) {
+    numThreads = tbb::task_scheduler_init::default_num_threads();
+  }
+  tbb::task_scheduler_init init(numThreads);
 
-      go<uint8_t>(dims, path, outPath);
-      break;
-    case bd::DataType::UnsignedShort:
-      go<uint16_t>(dims, path, outPath);
-      break;
-    case bd::DataType::Float:
-    default:
-      go<float>(dims, path, outPath);
-      break;
+  try {
+    switch(dat.dataType) {
+      case bd::DataType::UnsignedCharacter:
+        clo.hist2d ? histogram2d<uint8_t>(dims, path, outPath, clo)
+                   : go<uint8_t>(dims, path, outPath, clo.bufferSize);
+        break;
+      case bd::DataType::UnsignedShort:
+        clo.hist2d ? histogram2d<uint16_t>(dims, path, outPath, clo)
+                   : go<uint16_t>(dims, path, outPath, clo.bufferSize);
+        break;
+      case bd::DataType::Float:
+      default:
+        clo.hist2d ? histogram2d<float>(dims, path, outPath, clo)
+                   : go<float>(dims, path, outPath, clo.bufferSize);
+        break;
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
   }
 
   return 0;
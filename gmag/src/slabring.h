@@ -0,0 +1,152 @@
+#ifndef gmag_slabring_h__
+#define gmag_slabring_h__
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace gmag
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A window of 2r+1 consecutive z-slabs of a raw volume, read from
+/// disk one slab ahead of where it is needed.
+///
+/// The ring has 2r+2 slab buffers: the 2r+1 slabs around the current z,
+/// and the next slab, which is read by an async task while the current
+/// one is processed. Slabs past the ends of the volume are clamped to the
+/// first and last slab, so memory use is O(slab) for any volume depth.
+template<class Ty>
+class SlabRing
+{
+public:
+
+  /// \throws std::runtime_error if the raw file can't be opened.
+  SlabRing(std::string const &path, uint64_t const dims[3], int64_t radius)
+      : m_dims{ dims[0], dims[1], dims[2] }
+      , m_slabVoxels{ dims[0] * dims[1] }
+      , m_radius{ radius }
+      , m_ringSize{ 2 * radius + 2 }
+      , m_slabs(m_ringSize, std::vector<Ty>(m_slabVoxels))
+      , m_slabZ(m_ringSize, -1)
+      , m_fd{ ::open(path.c_str(), O_RDONLY) }
+  {
+    if (m_fd < 0) {
+      throw std::runtime_error("Could not open raw file " + path + ": " + std::strerror(errno));
+    }
+  }
+
+
+  ~SlabRing()
+  {
+    if (m_ahead.valid()) {
+      m_ahead.wait();
+    }
+    ::close(m_fd);
+  }
+
+
+  SlabRing(SlabRing const &) = delete;
+  SlabRing &operator=(SlabRing const &) = delete;
+
+
+  /// \brief Make slabs [z - r, z + r] available and start reading z + r + 1.
+  /// \c z must not decrease between calls.
+  /// \throws std::runtime_error if a read fails.
+  void
+  advance(int64_t z)
+  {
+    if (m_ahead.valid()) {
+      m_ahead.get();
+    }
+    for (int64_t s{ z - m_radius }; s <= z + m_radius; ++s) {
+      int64_t const c{ clamp(s) };
+      if (m_slabZ[slot(c)] != c) {
+        read(c);
+      }
+    }
+
+    int64_t const next{ z + m_radius + 1 };
+    if (next < int64_t(m_dims[2]) && m_slabZ[slot(next)] != next) {
+      m_ahead = std::async(std::launch::async, [this, next]() { read(next); });
+    }
+  }
+
+
+  /// \brief Slab \c z, clamped to the volume. Only valid for slabs within
+  /// the radius of the last advance().
+  Ty const *
+  slab(int64_t z) const
+  {
+    return m_slabs[slot(clamp(z))].data();
+  }
+
+
+  uint64_t
+  slabVoxels() const
+  {
+    return m_slabVoxels;
+  }
+
+
+private:
+
+  int64_t
+  clamp(int64_t z) const
+  {
+    return z < 0 ? 0 : z >= int64_t(m_dims[2]) ? int64_t(m_dims[2]) - 1 : z;
+  }
+
+
+  size_t
+  slot(int64_t z) const
+  {
+    return static_cast<size_t>(z % m_ringSize);
+  }
+
+
+  void
+  read(int64_t z)
+  {
+    size_t const s{ slot(z) };
+    m_slabZ[s] = -1;
+
+    char *p{ reinterpret_cast<char *>(m_slabs[s].data()) };
+    uint64_t const bytes{ m_slabVoxels * sizeof(Ty) };
+    uint64_t const offset{ uint64_t(z) * bytes };
+    uint64_t done{ 0 };
+    while (done < bytes) {
+      ssize_t amount{ ::pread(m_fd, p + done, bytes - done, offset + done) };
+      if (amount < 0 && errno == EINTR) {
+        continue;
+      }
+      if (amount <= 0) {
+        throw std::runtime_error("Could not read slab " + std::to_string(z) + " of the raw file.");
+      }
+      done += static_cast<uint64_t>(amount);
+    }
+    m_slabZ[s] = z;
+  }
+
+
+  uint64_t m_dims[3];
+  uint64_t m_slabVoxels;
+  int64_t m_radius;
+  int64_t m_ringSize;
+  std::vector<std::vector<Ty>> m_slabs;
+  std::vector<int64_t> m_slabZ; ///< z of the slab in each ring slot, -1 if none.
+  int m_fd;
+  std::future<void> m_ahead;
+
+}; // class SlabRing
+
+} // namespace gmag
+
+#endif // ! gmag_slabring_h__
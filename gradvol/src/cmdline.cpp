@@ -0,0 +1,175 @@
+#include "cmdline.h"
+
+#include <tclap/CmdLine.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace gradvol
+{
+
+int
+parseThem(int argc, const char *argv[], CommandLineOptions &opts)
+try
+{
+  if (argc == 1) {
+    return 0;
+  }
+
+  TCLAP::CmdLine cmd("Generate synthetic raw volumes.", ' ');
+
+  // raw file output path
+  TCLAP::ValueArg<std::string>
+      fileArg("f", "outfile", "Path of the raw file to write.", false, "outfile.raw", "string");
+  cmd.add(fileArg);
+
+  // .dat file output path
+  TCLAP::ValueArg<std::string>
+      datFileArg("d", "dat-file",
+                 "Path of the .dat file to write (default is the raw file path with "
+                     "a .dat extension).",
+                 false, "", "string");
+  cmd.add(datFileArg);
+
+  TCLAP::SwitchArg
+      noDatArg("", "no-dat", "Don't write a .dat file.", cmd, false);
+
+  // volume data type
+  std::vector<std::string> dataTypes{ "char", "uchar", "short", "ushort",
+                                      "int", "uint", "float", "double" };
+  TCLAP::ValuesConstraint<std::string> dataTypeAllowValues(dataTypes);
+  TCLAP::ValueArg<std::string>
+      dataTypeArg("t", "type", "Data type.", false, "ushort", &dataTypeAllowValues);
+  cmd.add(dataTypeArg);
+
+  // field
+  std::vector<std::string> fields{ "ramp", "spheres", "noise", "blobs" };
+  TCLAP::ValuesConstraint<std::string> fieldAllowValues(fields);
+  TCLAP::ValueArg<std::string>
+      fieldArg("", "field",
+               "Field to generate: a ramp along x, solid spheres, white noise, or "
+                   "blobs in a grid of cells that are empty with probability --empty.",
+               false, "ramp", &fieldAllowValues);
+  cmd.add(fieldArg);
+
+  // volume dims
+  TCLAP::ValueArg<std::string>
+      dimsArg("", "dims", "Volume dims, XxYxZ or X,Y,Z.", false, "16x16x16", "string");
+  cmd.add(dimsArg);
+
+  // blobs
+  TCLAP::ValueArg<double>
+      emptyArg("", "empty", "Fraction of empty blobs cells (0 to 1).", false, 0.5, "float");
+  cmd.add(emptyArg);
+
+  TCLAP::ValueArg<uint64_t>
+      cellArg("", "cell", "Side of the blobs cells in voxels.", false, 16, "uint");
+  cmd.add(cellArg);
+
+  TCLAP::ValueArg<uint64_t>
+      seedArg("", "seed", "Seed for the spheres, noise and blobs fields.", false, 1, "uint");
+  cmd.add(seedArg);
+
+  // buffer size
+  TCLAP::ValueArg<std::string>
+      bufferSizeArg("b", "buffer-size",
+                    "Bytes of each of the two slab buffers, one is filled while the "
+                        "other is written.",
+                    false, "256M", "uint");
+  cmd.add(bufferSizeArg);
+
+  TCLAP::ValueArg<int>
+      numThreadsArg("n", "num-threads", "Threads to fill slabs with, 0 for all cores.",
+                    false, 0, "int");
+  cmd.add(numThreadsArg);
+
+  cmd.parse(argc, argv);
+
+  std::vector<std::string> split;
+  boost::split(split, dimsArg.getValue(), boost::is_any_of("x,"), boost::token_compress_on);
+  if (split.size() != 3) {
+    std::cerr << "--dims needs three values." << std::endl;
+    return 0;
+  }
+  for (int i{ 0 }; i < 3; ++i) {
+    opts.dims[i] = std::stoull(split[i]);
+    if (opts.dims[i] == 0) {
+      std::cerr << "--dims must be non-zero." << std::endl;
+      return 0;
+    }
+  }
+
+  opts.outFilePath = fileArg.getValue();
+  opts.datFilePath = datFileArg.getValue();
+  if (noDatArg.getValue()) {
+    opts.datFilePath.clear();
+  } else if (opts.datFilePath.empty()) {
+    size_t const dot{ opts.outFilePath.find_last_of('.') };
+    size_t const slash{ opts.outFilePath.find_last_of('/') };
+    bool const hasExt{ dot != std::string::npos &&
+                           ( slash == std::string::npos || dot > slash ) };
+    opts.datFilePath = ( hasExt ? opts.outFilePath.substr(0, dot) : opts.outFilePath ) + ".dat";
+  }
+  opts.dataType = dataTypeArg.getValue();
+  opts.field = fieldArg.getValue();
+  opts.emptyFraction = emptyArg.getValue();
+  opts.cellSize = std::max<uint64_t>(1, cellArg.getValue());
+  opts.seed = seedArg.getValue();
+  opts.bufferSize = convertToBytes(bufferSizeArg.getValue());
+  opts.numThreads = numThreadsArg.getValue();
+
+  return static_cast<int>(cmd.getArgList().size());
+
+} catch (TCLAP::ArgException &e) {
+  std::cerr << "Error parsing command line args: " << e.error() << " for argument "
+            << e.argId() << std::endl;
+  return 0;
+} catch (std::logic_error &e) {
+  std::cerr << "Malformed number in command line args: " << e.what() << std::endl;
+  return 0;
+}
+
+
+void
+printThem(CommandLineOptions &opts)
+{
+  std::cout
+      << "Raw file: " << opts.outFilePath
+      << "\nDat file: " << ( opts.datFilePath.empty() ? "none" : opts.datFilePath )
+      << "\nData type: " << opts.dataType
+      << "\nField: " << opts.field
+      << "\nDims: " << opts.dims[0] << "x" << opts.dims[1] << "x" << opts.dims[2]
+      << "\nEmpty fraction: " << opts.emptyFraction
+      << "\nCell size: " << opts.cellSize
+      << "\nSeed: " << opts.seed
+      << "\nBuffer size: " << opts.bufferSize
+      << "\nThreads: " << opts.numThreads
+      << std::endl;
+}
+
+
+uint64_t
+convertToBytes(std::string s)
+{
+  size_t multiplier{ 1 };
+  std::string last{ *( s.end() - 1 ) };
+
+  if (last == "K") {
+    multiplier = 1024;
+  } else if (last == "M") {
+    multiplier = 1024 * 1024;
+  } else if (last == "G") {
+    multiplier = 1024 * 1024 * 1024;
+  }
+
+  // a plain number of bytes has no suffix to strip.
+  std::string numPart(s.begin(), multiplier == 1 ? s.end() : s.end() - 1);
+  auto num = stoull(numPart);
+
+  return num * multiplier;
+}
+} // namespace gradvol
@@ -0,0 +1,51 @@
+#ifndef gradvol_cmdline_h__
+#define gradvol_cmdline_h__
+
+#include <cstdint>
+#include <string>
+
+namespace gradvol
+{
+struct CommandLineOptions
+{
+  // raw file output path
+  std::string outFilePath;
+  // .dat file output path, empty to not write one
+  std::string datFilePath;
+  // volume data type
+  std::string dataType;
+  // field to generate (ramp, spheres, noise, blobs)
+  std::string field;
+  // volume dimensions
+  uint64_t dims[3];
+  // fraction of blobs cells that are empty
+  double emptyFraction;
+  // side length of blobs cells in voxels
+  uint64_t cellSize;
+  // seed for the noise, spheres and blobs fields
+  uint64_t seed;
+  // bytes of each of the two slab buffers
+  uint64_t bufferSize;
+  // threads to fill slabs with, 0 for all of them
+  int numThreads;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Parses command line args and populates \c opts.
+///
+/// If non-zero arg was returned, then the parse was successful, but it does
+/// not mean that valid or all of the required args were provided on the
+/// command line.
+///
+/// \returns 0 on parse failure, non-zero if the parse was successful.
+///////////////////////////////////////////////////////////////////////////////
+int parseThem(int argc, const char* argv[], CommandLineOptions& opts);
+
+
+void printThem(CommandLineOptions&);
+
+uint64_t convertToBytes(std::string s);
+} // namespace gradvol
+
+#endif // gradvol_cmdline_h__
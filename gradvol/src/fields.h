@@ -0,0 +1,175 @@
+#ifndef gradvol_fields_h__
+#define gradvol_fields_h__
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace gradvol
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// The fields are functors of a voxel's x, y, z index that return a value in
+// [0, 1]. They are pure functions of the index (and seed), so slabs can be
+// filled by any number of threads in any order and give the same volume.
+///////////////////////////////////////////////////////////////////////////////
+
+/// \brief The splitmix64 finalizer, a cheap well mixed 64-bit hash.
+inline uint64_t
+mix(uint64_t z)
+{
+  z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+  return z ^ ( z >> 31 );
+}
+
+
+/// \brief Uniform in [0, 1) for index \c i and \c seed.
+inline double
+unitHash(uint64_t seed, uint64_t i)
+{
+  return ( mix(seed + mix(i)) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+
+/// \brief 0 at x = 0 up to 1 at the last x.
+class RampField
+{
+public:
+  explicit RampField(uint64_t const dims[3])
+      : m_scale{ dims[0] > 1 ? 1.0 / ( dims[0] - 1 ) : 0.0 }
+  {
+  }
+
+  double
+  operator()(uint64_t x, uint64_t, uint64_t) const
+  {
+    return x * m_scale;
+  }
+
+private:
+  double const m_scale;
+};
+
+
+/// \brief White noise.
+class NoiseField
+{
+public:
+  NoiseField(uint64_t const dims[3], uint64_t seed)
+      : m_dimX{ dims[0] }
+      , m_dimY{ dims[1] }
+      , m_seed{ seed }
+  {
+  }
+
+  double
+  operator()(uint64_t x, uint64_t y, uint64_t z) const
+  {
+    return unitHash(m_seed, ( z * m_dimY + y ) * m_dimX + x);
+  }
+
+private:
+  uint64_t const m_dimX;
+  uint64_t const m_dimY;
+  uint64_t const m_seed;
+};
+
+
+/// \brief A handful of solid spheres at random places, brightest at their
+/// centers and 0 outside of all of them.
+class SpheresField
+{
+public:
+  SpheresField(uint64_t const dims[3], uint64_t seed)
+  {
+    double const minDim{ double(std::min({ dims[0], dims[1], dims[2] })) };
+    for (uint64_t i{ 0 }; i < NUM_SPHERES; ++i) {
+      Sphere s;
+      for (int d{ 0 }; d < 3; ++d) {
+        s.c[d] = unitHash(seed, i * 4 + d) * dims[d];
+      }
+      s.r = ( 0.1 + 0.2 * unitHash(seed, i * 4 + 3) ) * minDim;
+      m_spheres.push_back(s);
+    }
+  }
+
+  double
+  operator()(uint64_t x, uint64_t y, uint64_t z) const
+  {
+    double v{ 0 };
+    for (Sphere const &s : m_spheres) {
+      double const dx{ x - s.c[0] };
+      double const dy{ y - s.c[1] };
+      double const dz{ z - s.c[2] };
+      double const d2{ dx * dx + dy * dy + dz * dz };
+      if (d2 < s.r * s.r) {
+        v = std::max(v, 1.0 - std::sqrt(d2) / s.r);
+      }
+    }
+    return v;
+  }
+
+private:
+  static uint64_t const NUM_SPHERES{ 8 };
+
+  struct Sphere
+  {
+    double c[3];
+    double r;
+  };
+
+  std::vector<Sphere> m_spheres;
+};
+
+
+/// \brief A grid of cubic cells, each empty with probability \c empty or
+/// else holding a blob that fills the cell with values in [0.1, 1].
+///
+/// This gives a volume with a known fraction of empty space at a chosen
+/// granularity, which is what the empty space skipping in preproc sees.
+class BlobsField
+{
+public:
+  BlobsField(uint64_t const dims[3], uint64_t seed, double empty, uint64_t cell)
+      : m_cellsX{ ( dims[0] + cell - 1 ) / cell }
+      , m_cellsY{ ( dims[1] + cell - 1 ) / cell }
+      , m_cell{ cell }
+      , m_half{ cell * 0.5 }
+      , m_invRadius{ 1.0 / ( cell * 0.5 * std::sqrt(3.0) ) }
+      , m_seed{ seed }
+      , m_empty{ empty }
+  {
+  }
+
+  double
+  operator()(uint64_t x, uint64_t y, uint64_t z) const
+  {
+    uint64_t const cx{ x / m_cell };
+    uint64_t const cy{ y / m_cell };
+    uint64_t const cz{ z / m_cell };
+    if (unitHash(m_seed, ( cz * m_cellsY + cy ) * m_cellsX + cx) < m_empty) {
+      return 0.0;
+    }
+
+    double const dx{ x - cx * m_cell - m_half };
+    double const dy{ y - cy * m_cell - m_half };
+    double const dz{ z - cz * m_cell - m_half };
+    double const d{ std::sqrt(dx * dx + dy * dy + dz * dz) * m_invRadius };
+    return 0.1 + 0.9 * std::max(0.0, 1.0 - d);
+  }
+
+private:
+  uint64_t const m_cellsX;
+  uint64_t const m_cellsY;
+  uint64_t const m_cell;
+  double const m_half;
+  double const m_invRadius;
+  uint64_t const m_seed;
+  double const m_empty;
+};
+
+} // namespace gradvol
+
+#endif // ! gradvol_fields_h__
@@ -1,58 +1,228 @@
+#include "cmdline.h"
+#include "fields.h"
+#include "datwriter.h"
 
+#include <bd/io/datatypes.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_scheduler_init.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iomanip>
 #include <iostream>
-#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
-#include <glm/glm.hpp>
+namespace gradvol
+{
+namespace
+{
 
+/// \brief Scale a field value in [0, 1] to the range of Ty. Signed integer
+/// types use [0, max] so that 0 is still empty space.
 template<typename Ty>
+Ty
+toVoxel(double v)
+{
+  if (std::is_floating_point<Ty>::value) {
+    return static_cast<Ty>(v);
+  }
+  v = std::min(1.0, std::max(0.0, v));
+  return static_cast<Ty>(v * std::numeric_limits<Ty>::max());
+}
+
+
 void
-go(glm::vec3 const & dims)
-{
-  double const min_grad_perc{ 0.25 };
-  double const max_grad_perc{ 0.75 };
-  
-  auto const max_val = std::numeric_limits<Ty>::max();
-
-  double const delta_per_col{ (max_grad_perc - min_grad_perc) / (dims.x - 2) };
-
-  std::ofstream fout("outfile.raw");
-  if (! fout.is_open())
-  {
-    std::cerr << "Oh no! Could not open the file!\n";
-    return;
-  }
-
-  for (int s{ 0 }; s < dims.z; ++s) {
-    std::cout << "\n Slab " << s << "\n";
-    for (int r{ 0 }; r < dims.y; ++r) {
-      std::cout << "\n Row " << r << ": ";
-      for (int c{ 0 }; c < dims.x; ++c) {
-
-        Ty val{ Ty(0) };
-        if (c == dims.x - 1) {
-          val = Ty(1) * max_val;
-        }
-        else if (c > 0) {
-          val = Ty(c * delta_per_col * max_val);
-        }
-
-        std::cout << val << " ";
-        fout << val;
+writeAll(int fd, void const *p, size_t bytes)
+{
+  char const *c{ static_cast<char const *>(p) };
+  while (bytes > 0) {
+    ssize_t amount{ ::write(fd, c, bytes) };
+    if (amount < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+    }
+    c += amount;
+    bytes -= static_cast<size_t>(amount);
+  }
+}
+
+
+/// \brief Fill slabs [z0, z1) of the volume into \c buf in parallel, one
+/// row per task iteration.
+template<typename Ty, typename Field>
+void
+fillSlabs(Field const &field, uint64_t const dims[3], uint64_t z0, uint64_t z1, Ty *buf)
+{
+  uint64_t const rowLen{ dims[0] };
+  uint64_t const rows{ ( z1 - z0 ) * dims[1] };
+  tbb::parallel_for(tbb::blocked_range<uint64_t>{ 0, rows },
+                    [&](tbb::blocked_range<uint64_t> const &r) {
+                      for (uint64_t row{ r.begin() }; row != r.end(); ++row) {
+                        uint64_t const y{ row % dims[1] };
+                        uint64_t const z{ z0 + row / dims[1] };
+                        Ty *out{ buf + row * rowLen };
+                        for (uint64_t x{ 0 }; x < rowLen; ++x) {
+                          out[x] = toVoxel<Ty>(field(x, y, z));
+                        }
+                      }
+                    });
+}
+
+
+/// \brief Generate the volume into the raw file.
+///
+/// Two slab buffers are used: the next slabs are filled by the TBB threads
+/// while the previous ones are written by an async task, so the disk is kept
+/// busy with large sequential writes.
+template<typename Ty, typename Field>
+void
+generate(CommandLineOptions const &clo, Field const &field)
+{
+  uint64_t const slabVoxels{ clo.dims[0] * clo.dims[1] };
+  uint64_t const slabsPerBuffer{
+      std::max<uint64_t>(1, clo.bufferSize / ( slabVoxels * sizeof(Ty) )) };
+  uint64_t const totalBytes{ slabVoxels * clo.dims[2] * sizeof(Ty) };
+
+  int fd{ ::open(clo.outFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + clo.outFilePath + ": " + std::strerror(errno));
+  }
+
+  std::vector<Ty> bufs[2]{ std::vector<Ty>(slabsPerBuffer * slabVoxels),
+                           std::vector<Ty>(slabsPerBuffer * slabVoxels) };
+  std::future<void> pending;
+  int cur{ 0 };
+  uint64_t written{ 0 };
+  auto const start = std::chrono::steady_clock::now();
+
+  try {
+    for (uint64_t z0{ 0 }; z0 < clo.dims[2]; z0 += slabsPerBuffer) {
+      uint64_t const z1{ std::min(clo.dims[2], z0 + slabsPerBuffer) };
+      fillSlabs<Ty>(field, clo.dims, z0, z1, bufs[cur].data());
+
+      if (pending.valid()) {
+        pending.get();
       }
+      Ty const *p{ bufs[cur].data() };
+      size_t const bytes{ ( z1 - z0 ) * slabVoxels * sizeof(Ty) };
+      pending = std::async(std::launch::async, [fd, p, bytes]() { writeAll(fd, p, bytes); });
+      cur = 1 - cur;
+
+      written += bytes;
+      double const secs{
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+      std::cout << "\rSlab " << z1 << "/" << clo.dims[2] << ", "
+                << std::fixed << std::setprecision(1)
+                << written / ( 1024.0 * 1024.0 ) << " of " << totalBytes / ( 1024.0 * 1024.0 )
+                << " MiB, " << written / ( 1024.0 * 1024.0 ) / secs << " MiB/s" << std::flush;
+    }
+    if (pending.valid()) {
+      pending.get();
+    }
+  } catch (...) {
+    if (pending.valid()) {
+      pending.wait();
     }
+    ::close(fd);
+    throw;
   }
-  fout.flush();
-  fout.close();
-  
+
+  if (::close(fd) != 0) {
+    throw std::runtime_error("Could not close " + clo.outFilePath + ": " + std::strerror(errno));
+  }
+  std::cout << std::endl;
 }
 
+
+template<typename Ty>
+void
+generate(CommandLineOptions const &clo)
+{
+  if (clo.field == "ramp") {
+    generate<Ty>(clo, RampField{ clo.dims });
+  } else if (clo.field == "noise") {
+    generate<Ty>(clo, NoiseField{ clo.dims, clo.seed });
+  } else if (clo.field == "spheres") {
+    generate<Ty>(clo, SpheresField{ clo.dims, clo.seed });
+  } else {
+    generate<Ty>(clo, BlobsField{ clo.dims, clo.seed, clo.emptyFraction, clo.cellSize });
+  }
+}
+
+} // namespace
+} // namespace gradvol
+
+
 int
-main(int argc, char* argv[])
+main(int argc, char const *argv[])
 {
-  std::cout << "Volume gradient maker.\n";
-  
-  go<short>({ 16, 16, 16 });
+  gradvol::CommandLineOptions clo;
+  if (gradvol::parseThem(argc, argv, clo) == 0) {
+    std::cerr << "No arguments provided.\nPlease use -h for usage info." << std::endl;
+    return 1;
+  }
+  gradvol::printThem(clo);
 
+  int numThreads{ clo.numThreads };
+  if (numThreads == 0) {
+    numThreads = tbb::task_scheduler_init::default_num_threads();
+  }
+  tbb::task_scheduler_init init(numThreads);
+
+  bd::DataType const type{ bd::to_dataType(clo.dataType) };
+  try {
+    switch (type) {
+    case bd::DataType::Character:
+      gradvol::generate<int8_t>(clo);
+      break;
+    case bd::DataType::UnsignedCharacter:
+      gradvol::generate<uint8_t>(clo);
+      break;
+    case bd::DataType::Short:
+      gradvol::generate<int16_t>(clo);
+      break;
+    case bd::DataType::UnsignedShort:
+      gradvol::generate<uint16_t>(clo);
+      break;
+    case bd::DataType::Integer:
+      gradvol::generate<int32_t>(clo);
+      break;
+    case bd::DataType::UnsignedInteger:
+      gradvol::generate<uint32_t>(clo);
+      break;
+    case bd::DataType::Float:
+      gradvol::generate<float>(clo);
+      break;
+    case bd::DataType::Double:
+      gradvol::generate<double>(clo);
+      break;
+    default:
+      std::cerr << "Unsupported data type: " << clo.dataType << std::endl;
+      return 1;
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if (!clo.datFilePath.empty() &&
+      !preproc::writeDat(clo.datFilePath, clo.outFilePath, clo.dims, type)) {
+    std::cerr << "Could not write .dat file " << clo.datFilePath << std::endl;
+    return 1;
+  }
 
   return 0;
 }
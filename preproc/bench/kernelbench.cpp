@@ -0,0 +1,410 @@
+////////////////////////////////////////////////////////////////////////////////
+// kernelbench
+// Times the preproc parallel kernels over synthetic in-memory volumes.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "parallel/parallelfor_voxelrelevance.h"
+#include "parallel/parallelreduce_blockminmax.h"
+#include "parallel/parallelreduce_blockrov.h"
+#include "parallel/parallelreduce_histogram.h"
+#include "parallel/threadhistogram.h"
+#include "parallel/parallelreduce_minmax.h"
+#include "voxelopacityfunction.h"
+
+#include <bd/io/buffer.h>
+#include <bd/log/logger.h>
+#include <bd/volume/transferfunction.h>
+#include <bd/volume/volume.h>
+
+#include <tclap/CmdLine.h>
+
+#include <tbb/tbb.h>
+#include <tbb/task_scheduler_init.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+
+struct Options
+{
+  uint64_t side;
+  int warmup;
+  int reps;
+  std::vector<int> threads;
+  std::vector<int> grids;
+  std::vector<std::string> types;
+  std::string tfuncPath;
+  std::string jsonPath;
+  std::string label;
+};
+
+
+struct Result
+{
+  std::string kernel;
+  std::string type;
+  int grid;     ///< Blocks along each dim, 0 if the kernel doesn't use blocks.
+  int threads;
+  double bestSeconds;
+  double medianSeconds;
+  uint64_t voxels;
+  uint64_t bytes;
+};
+
+
+/// \brief Synthetic voxels: smooth spheres plus noise, so the values cover
+/// the whole range of the type and blocks have different min/max.
+template<class Ty>
+std::vector<Ty>
+makeVolume(uint64_t side)
+{
+  double const hi{ std::is_floating_point<Ty>::value ?
+                   1.0 : static_cast<double>(std::numeric_limits<Ty>::max()) };
+
+  std::vector<Ty> data(side * side * side);
+  tbb::parallel_for(tbb::blocked_range<uint64_t>{ 0, side },
+                    [&](tbb::blocked_range<uint64_t> const &r) {
+                      std::mt19937 gen{ static_cast<unsigned>(r.begin()) };
+                      std::uniform_real_distribution<double> noise{ -0.05, 0.05 };
+                      for (uint64_t z{ r.begin() }; z != r.end(); ++z) {
+                        for (uint64_t y{ 0 }; y < side; ++y) {
+                          for (uint64_t x{ 0 }; x < side; ++x) {
+                            double v{ 0.5 + 0.45 * std::sin(x * 0.05) * std::cos(y * 0.07) *
+                                std::sin(z * 0.03) + noise(gen) };
+                            v = std::min(1.0, std::max(0.0, v));
+                            data[( z * side + y ) * side + x] = static_cast<Ty>(v * hi);
+                          }
+                        }
+                      }
+                    });
+  return data;
+}
+
+
+/// \brief Run \c kernel warmup + reps times, return the best and median times.
+void
+timeKernel(Options const &opts, std::function<void()> const &kernel, Result &res)
+{
+  for (int i{ 0 }; i < opts.warmup; ++i) {
+    kernel();
+  }
+
+  std::vector<double> times;
+  for (int i{ 0 }; i < opts.reps; ++i) {
+    auto const start = std::chrono::steady_clock::now();
+    kernel();
+    times.push_back(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  std::sort(times.begin(), times.end());
+  res.bestSeconds = times.front();
+  res.medianSeconds = times[times.size() / 2];
+}
+
+
+void
+printResult(Result const &r)
+{
+  std::cout << std::left << std::setw(18) << r.kernel
+            << std::setw(8) << r.type
+            << std::right << std::setw(6) << ( r.grid ? std::to_string(r.grid) + "^3" : "-" )
+            << std::setw(5) << r.threads
+            << std::fixed << std::setprecision(3)
+            << std::setw(10) << r.medianSeconds * 1e3 << " ms"
+            << std::setw(9) << r.bytes / r.medianSeconds / 1e9 << " GB/s"
+            << std::setw(9) << r.voxels / r.medianSeconds / 1e9 << " Gvox/s"
+            << std::endl;
+}
+
+
+/// \brief Benchmark the kernels that read voxels of type Ty.
+template<class Ty>
+void
+benchType(Options const &opts,
+          std::string const &typeName,
+          bd::OpacityTransferFunction const *tfunc,
+          std::vector<Result> &results)
+{
+  uint64_t const side{ opts.side };
+  std::vector<Ty> data{ makeVolume<Ty>(side) };
+  bd::Buffer<Ty> buf{ data.data(), data.size() };
+  buf.setNumElements(data.size());
+  buf.setIndexOffset(0);
+
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  Ty const rawMin{ *mm.first };
+  Ty const rawMax{ *mm.second };
+
+  std::vector<double> rmap(data.size());
+  tbb::blocked_range<size_t> range{ 0, buf.getNumElements() };
+
+  for (int threads : opts.threads) {
+    tbb::task_scheduler_init init(threads);
+
+    auto run = [&](std::string const &kernel, int grid, std::function<void()> const &f) {
+      Result r{ kernel, typeName, grid, threads, 0, 0, data.size(), data.size() * sizeof(Ty) };
+      timeKernel(opts, f, r);
+      printResult(r);
+      results.push_back(r);
+    };
+
+    run("minmax", 0, [&]() {
+      preproc::ParallelReduceMinMax<Ty> k{ &buf };
+      tbb::parallel_reduce(range, k);
+    });
+
+    run("histogram", 0, [&]() {
+      preproc::ParallelReduceHistogram<Ty> k{ &buf, rawMin, rawMax };
+      tbb::parallel_reduce(range, k);
+    });
+
+    run("thread-histogram", 0, [&]() {
+      preproc::ThreadHistogram<Ty> k{ double(rawMin), double(rawMax), 1536 };
+      k.add(&buf);
+      k.result();
+    });
+
+    // A ramp, so the relevance kernel can be timed without a transfer function file.
+    auto ramp = [rawMin, rawMax](Ty const &v) -> double {
+      return ( v - double(rawMin) ) / ( double(rawMax) - double(rawMin) );
+    };
+    run("relevance-ramp", 0, [&]() {
+      double *map{ rmap.data() };
+      preproc::ParallelForVoxelRelevance<Ty, decltype(ramp), double *> k{ map, &buf, ramp };
+      tbb::parallel_for(range, k);
+    });
+
+    if (tfunc) {
+      preproc::VoxelOpacityFunction<Ty> relFunc{ *tfunc, double(rawMin), double(rawMax) };
+      run("relevance-tfunc", 0, [&]() {
+        double *map{ rmap.data() };
+        preproc::ParallelForVoxelRelevance<Ty, preproc::VoxelOpacityFunction<Ty>, double *> k{
+            map, &buf, relFunc };
+        tbb::parallel_for(range, k);
+      });
+    }
+
+    for (int grid : opts.grids) {
+      bd::Volume volume{ { side, side, side },
+                         { uint64_t(grid), uint64_t(grid), uint64_t(grid) } };
+      run("block-minmax", grid, [&]() {
+        preproc::ParallelReduceBlockMinMax<Ty> k{ &volume, &buf };
+        tbb::parallel_reduce(range, k);
+      });
+    }
+  }
+}
+
+
+/// \brief Benchmark the block rov kernel, which reads rmap values.
+void
+benchRov(Options const &opts, std::vector<Result> &results)
+{
+  uint64_t const side{ opts.side };
+  std::vector<double> data{ makeVolume<double>(side) };
+  bd::Buffer<double> buf{ data.data(), data.size() };
+  buf.setNumElements(data.size());
+  buf.setIndexOffset(0);
+  tbb::blocked_range<size_t> range{ 0, buf.getNumElements() };
+
+  for (int threads : opts.threads) {
+    tbb::task_scheduler_init init(threads);
+    for (int grid : opts.grids) {
+      bd::Volume volume{ { side, side, side },
+                         { uint64_t(grid), uint64_t(grid), uint64_t(grid) } };
+      Result r{ "block-rov", "double", grid, threads, 0, 0,
+                data.size(), data.size() * sizeof(double) };
+      timeKernel(opts, [&]() {
+                   preproc::ParallelReduceBlockRov k{ &buf, &volume };
+                   tbb::parallel_reduce(range, k);
+                 }, r);
+      printResult(r);
+      results.push_back(r);
+    }
+  }
+}
+
+
+void
+writeJson(Options const &opts, std::vector<Result> const &results)
+{
+  std::ofstream os{ opts.jsonPath };
+  if (!os.is_open()) {
+    bd::Err() << "Could not open " << opts.jsonPath;
+    return;
+  }
+
+  os << std::setprecision(9);
+  os << "{\n"
+     << "  \"label\": \"" << opts.label << "\",\n"
+     << "  \"side\": " << opts.side << ",\n"
+     << "  \"warmup\": " << opts.warmup << ",\n"
+     << "  \"reps\": " << opts.reps << ",\n"
+     << "  \"results\": [\n";
+  for (size_t i{ 0 }; i < results.size(); ++i) {
+    Result const &r = results[i];
+    os << "    {\"kernel\": \"" << r.kernel << "\", \"type\": \"" << r.type
+       << "\", \"grid\": " << r.grid << ", \"threads\": " << r.threads
+       << ", \"best_s\": " << r.bestSeconds << ", \"median_s\": " << r.medianSeconds
+       << ", \"voxels\": " << r.voxels << ", \"bytes\": " << r.bytes
+       << ", \"gb_per_s\": " << r.bytes / r.medianSeconds / 1e9
+       << ", \"voxels_per_s\": " << r.voxels / r.medianSeconds << "}"
+       << ( i + 1 < results.size() ? "," : "" ) << "\n";
+  }
+  os << "  ]\n}\n";
+}
+
+
+std::vector<int>
+parseInts(std::string const &s)
+{
+  std::vector<std::string> split;
+  boost::split(split, s, boost::is_any_of(","), boost::token_compress_on);
+  std::vector<int> ints;
+  for (auto const &v : split) {
+    ints.push_back(std::stoi(v));
+  }
+  return ints;
+}
+
+
+bool
+parseOptions(int argc, char const *argv[], Options &opts)
+try
+{
+  TCLAP::CmdLine cmd("Preproc kernel benchmarks.", ' ');
+
+  TCLAP::ValueArg<uint64_t> sideArg("s", "side", "Side length of the cubic test volume.",
+                                    false, 256, "uint");
+  cmd.add(sideArg);
+  TCLAP::ValueArg<int> warmupArg("", "warmup", "Untimed runs of each kernel.", false, 2, "int");
+  cmd.add(warmupArg);
+  TCLAP::ValueArg<int> repsArg("r", "reps", "Timed runs of each kernel.", false, 10, "int");
+  cmd.add(repsArg);
+
+  std::stringstream defThreads;
+  int const maxThreads{ tbb::task_scheduler_init::default_num_threads() };
+  defThreads << "1";
+  for (int t{ 2 }; t < maxThreads; t *= 2) {
+    defThreads << "," << t;
+  }
+  if (maxThreads > 1) {
+    defThreads << "," << maxThreads;
+  }
+  TCLAP::ValueArg<std::string> threadsArg("n", "threads", "Comma separated thread counts.",
+                                          false, defThreads.str(), "list");
+  cmd.add(threadsArg);
+  TCLAP::ValueArg<std::string> gridsArg("g", "grids",
+                                        "Comma separated blocks per dim for the block kernels.",
+                                        false, "1,8,32,128", "list");
+  cmd.add(gridsArg);
+  TCLAP::ValueArg<std::string> typesArg("t", "types",
+                                        "Comma separated voxel types: uchar, ushort, float.",
+                                        false, "uchar,ushort,float", "list");
+  cmd.add(typesArg);
+  TCLAP::ValueArg<std::string> tfuncArg("u", "tfunc",
+                                        "Transfer function file, also times the relevance "
+                                        "kernel with the real opacity function.",
+                                        false, "", "string");
+  cmd.add(tfuncArg);
+  TCLAP::ValueArg<std::string> jsonArg("j", "json", "Write the results to this json file.",
+                                       false, "", "string");
+  cmd.add(jsonArg);
+  TCLAP::ValueArg<std::string> labelArg("l", "label",
+                                        "Label stored in the json file, e.g. a commit hash.",
+                                        false, "", "string");
+  cmd.add(labelArg);
+
+  cmd.parse(argc, argv);
+
+  opts.side = sideArg.getValue();
+  opts.warmup = warmupArg.getValue();
+  opts.reps = std::max(1, repsArg.getValue());
+  opts.threads = parseInts(threadsArg.getValue());
+  opts.grids = parseInts(gridsArg.getValue());
+  boost::split(opts.types, typesArg.getValue(), boost::is_any_of(","),
+               boost::token_compress_on);
+  opts.tfuncPath = tfuncArg.getValue();
+  opts.jsonPath = jsonArg.getValue();
+  opts.label = labelArg.getValue();
+
+  return true;
+
+} catch (TCLAP::ArgException &e) {
+  std::cerr << "Error parsing command line args: " << e.error() << " for argument "
+            << e.argId() << std::endl;
+  return false;
+} catch (std::logic_error &e) {
+  std::cerr << "Malformed list argument: " << e.what() << std::endl;
+  return false;
+}
+
+} // namespace
+
+
+int
+main(int argc, char const *argv[])
+{
+  Options opts;
+  if (!parseOptions(argc, argv, opts)) {
+    return 1;
+  }
+
+  for (int grid : opts.grids) {
+    if (grid <= 0 || uint64_t(grid) > opts.side) {
+      std::cerr << "Grid " << grid << " doesn't fit a volume of side " << opts.side << std::endl;
+      return 1;
+    }
+  }
+
+  std::unique_ptr<bd::OpacityTransferFunction> tfunc;
+  if (!opts.tfuncPath.empty()) {
+    tfunc.reset(new bd::OpacityTransferFunction{});
+    if (tfunc->load(opts.tfuncPath) < 0) {
+      std::cerr << "Could not read transfer function " << opts.tfuncPath << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << opts.side << "^3 voxels, " << opts.warmup << " warmup and " << opts.reps
+            << " timed runs, median times.\n";
+
+  std::vector<Result> results;
+  for (auto const &type : opts.types) {
+    if (type == "uchar") {
+      benchType<unsigned char>(opts, type, tfunc.get(), results);
+    } else if (type == "ushort") {
+      benchType<unsigned short>(opts, type, tfunc.get(), results);
+    } else if (type == "float") {
+      benchType<float>(opts, type, tfunc.get(), results);
+    } else {
+      std::cerr << "Unknown type " << type << std::endl;
+      return 1;
+    }
+  }
+  benchRov(opts, results);
+
+  if (!opts.jsonPath.empty()) {
+    writeJson(opts, results);
+  }
+
+  bd::logger::shutdown();
+  return 0;
+}
@@ -0,0 +1,340 @@
+#include "preproc_capi.h"
+
+#include "voxelopacityfunction.h"
+
+#include <bd/volume/transferfunction.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/task_arena.h>
+
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+thread_local std::string t_lastError;
+
+
+/// \brief A strided, read only view of the caller's volume.
+template<class Ty>
+struct View
+{
+  char const *base;
+  uint64_t dims[3];
+  int64_t strides[3];
+
+
+  char const *
+  row(uint64_t y, uint64_t z) const
+  {
+    return base + int64_t(y) * strides[1] + int64_t(z) * strides[2];
+  }
+
+
+  Ty
+  at(char const *row, uint64_t x) const
+  {
+    return *reinterpret_cast<Ty const *>(row + int64_t(x) * strides[0]);
+  }
+};
+
+
+/// \brief Running statistics of a block or of the volume.
+struct Acc
+{
+  double min;
+  double max;
+  double total;
+  double rov;
+
+
+  Acc()
+      : min{ std::numeric_limits<double>::max() }
+      , max{ std::numeric_limits<double>::lowest() }
+      , total{ 0 }
+      , rov{ 0 }
+  {
+  }
+
+
+  void
+  join(Acc const &o)
+  {
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+    total += o.total;
+    rov += o.rov;
+  }
+};
+
+
+/// \brief Relevance function used when no transfer function is given.
+template<class Ty>
+struct NoRelevance
+{
+  double
+  operator()(Ty const &) const
+  {
+    return 0.0;
+  }
+};
+
+
+template<class Ty>
+Acc
+volumeMinMax(View<Ty> const &v)
+{
+  uint64_t const rows{ v.dims[1] * v.dims[2] };
+  return tbb::parallel_reduce(
+      tbb::blocked_range<uint64_t>{ 0, rows }, Acc{},
+      [&v](tbb::blocked_range<uint64_t> const &r, Acc acc) -> Acc {
+        for (uint64_t i{ r.begin() }; i != r.end(); ++i) {
+          char const *row{ v.row(i % v.dims[1], i / v.dims[1]) };
+          for (uint64_t x{ 0 }; x < v.dims[0]; ++x) {
+            double const val{ double(v.at(row, x)) };
+            acc.min = std::min(acc.min, val);
+            acc.max = std::max(acc.max, val);
+            acc.total += val;
+          }
+        }
+        return acc;
+      },
+      [](Acc a, Acc const &b) -> Acc {
+        a.join(b);
+        return a;
+      });
+}
+
+
+/// \brief Accumulate the blocks one row of voxels at a time.
+///
+/// A row crosses block_count[0] blocks, so each block's run of voxels is
+/// summed into locals before touching the thread's block array. Each thread
+/// gets one block array for the whole call rather than one per split.
+template<class Ty, class Rel>
+void
+blockStats(View<Ty> const &v, uint64_t const bc[3], Rel const &rel,
+           preproc_block_stats *out)
+{
+  uint64_t const bd[3]{ v.dims[0] / bc[0], v.dims[1] / bc[1], v.dims[2] / bc[2] };
+  uint64_t const nblocks{ bc[0] * bc[1] * bc[2] };
+  // Rows past the last whole block in y or z are skipped.
+  uint64_t const ys{ bd[1] * bc[1] };
+  uint64_t const rows{ ys * bd[2] * bc[2] };
+
+  tbb::enumerable_thread_specific<std::vector<Acc>> local{ std::vector<Acc>(nblocks) };
+  tbb::parallel_for(
+      tbb::blocked_range<uint64_t>{ 0, rows },
+      [&](tbb::blocked_range<uint64_t> const &r) {
+        std::vector<Acc> &blocks = local.local();
+        for (uint64_t i{ r.begin() }; i != r.end(); ++i) {
+          uint64_t const y{ i % ys };
+          uint64_t const z{ i / ys };
+          char const *row{ v.row(y, z) };
+          Acc *acc{ &blocks[( y / bd[1] + bc[1] * ( z / bd[2] ) ) * bc[0]] };
+
+          for (uint64_t bx{ 0 }; bx < bc[0]; ++bx) {
+            Ty mn{ std::numeric_limits<Ty>::max() };
+            Ty mx{ std::numeric_limits<Ty>::lowest() };
+            double total{ 0 };
+            double rov{ 0 };
+            for (uint64_t x{ bx * bd[0] }, end{ x + bd[0] }; x < end; ++x) {
+              Ty const val{ v.at(row, x) };
+              mn = std::min(mn, val);
+              mx = std::max(mx, val);
+              total += val;
+              rov += rel(val);
+            }
+            Acc &a = acc[bx];
+            a.min = std::min(a.min, double(mn));
+            a.max = std::max(a.max, double(mx));
+            a.total += total;
+            a.rov += rov;
+          }
+        }
+      });
+
+  std::vector<Acc> blocks(nblocks);
+  for (std::vector<Acc> const &l : local) {
+    for (uint64_t i{ 0 }; i < nblocks; ++i) {
+      blocks[i].join(l[i]);
+    }
+  }
+
+  double const voxels{ double(bd[0] * bd[1] * bd[2]) };
+  for (uint64_t i{ 0 }; i < nblocks; ++i) {
+    preproc_block_stats &s = out[i];
+    s.min = blocks[i].min;
+    s.max = blocks[i].max;
+    s.total = blocks[i].total;
+    s.avg = blocks[i].total / voxels;
+    s.rov = blocks[i].rov / voxels;
+    s.ijk[0] = i % bc[0];
+    s.ijk[1] = ( i / bc[0] ) % bc[1];
+    s.ijk[2] = i / ( bc[0] * bc[1] );
+  }
+}
+
+
+template<class Ty>
+int
+blockStats(View<Ty> const &v, uint64_t const bc[3], char const *tfPath,
+           double dataMin, double dataMax, preproc_block_stats *out)
+{
+  if (tfPath == nullptr || tfPath[0] == '\0') {
+    blockStats(v, bc, NoRelevance<Ty>{}, out);
+    return PREPROC_OK;
+  }
+
+  bd::OpacityTransferFunction tf;
+  if (tf.load(tfPath) < 0) {
+    t_lastError = std::string("Could not load transfer function: ") + tfPath;
+    return PREPROC_TRANSFER_FUNCTION;
+  }
+  if (dataMin > dataMax) {
+    Acc const range{ volumeMinMax(v) };
+    dataMin = range.min;
+    dataMax = range.max;
+  }
+  blockStats(v, bc, preproc::VoxelOpacityFunction<Ty>{ tf, dataMin, dataMax }, out);
+  return PREPROC_OK;
+}
+
+
+/// \brief Call \c fn with a View of the right voxel type inside an arena of
+/// \c numThreads threads, turning exceptions into status codes.
+template<class Fn>
+int
+dispatch(void const *data, int dtype, uint64_t const dims[3], int64_t const strides[3],
+         int numThreads, Fn fn)
+{
+  if (data == nullptr || dims == nullptr || strides == nullptr || numThreads < 0) {
+    t_lastError = "Null data, dims or strides, or a negative thread count.";
+    return PREPROC_INVALID_ARGUMENT;
+  }
+
+  try {
+    tbb::task_arena arena{ numThreads > 0 ? numThreads : tbb::task_arena::automatic };
+    int rval{ PREPROC_OK };
+    arena.execute([&]() {
+      char const *base{ static_cast<char const *>(data) };
+      switch (dtype) {
+      case PREPROC_INT8:
+        rval = fn(View<int8_t>{ base, { dims[0], dims[1], dims[2] },
+                                { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_UINT8:
+        rval = fn(View<uint8_t>{ base, { dims[0], dims[1], dims[2] },
+                                 { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_INT16:
+        rval = fn(View<int16_t>{ base, { dims[0], dims[1], dims[2] },
+                                 { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_UINT16:
+        rval = fn(View<uint16_t>{ base, { dims[0], dims[1], dims[2] },
+                                  { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_INT32:
+        rval = fn(View<int32_t>{ base, { dims[0], dims[1], dims[2] },
+                                 { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_UINT32:
+        rval = fn(View<uint32_t>{ base, { dims[0], dims[1], dims[2] },
+                                  { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_FLOAT32:
+        rval = fn(View<float>{ base, { dims[0], dims[1], dims[2] },
+                               { strides[0], strides[1], strides[2] } });
+        break;
+      case PREPROC_FLOAT64:
+        rval = fn(View<double>{ base, { dims[0], dims[1], dims[2] },
+                                { strides[0], strides[1], strides[2] } });
+        break;
+      default:
+        t_lastError = "Unknown dtype " + std::to_string(dtype) + ".";
+        rval = PREPROC_INVALID_ARGUMENT;
+        break;
+      }
+    });
+    return rval;
+  } catch (std::bad_alloc &) {
+    t_lastError = "Out of memory.";
+  } catch (std::exception &e) {
+    t_lastError = e.what();
+  } catch (...) {
+    t_lastError = "Unknown error.";
+  }
+  return PREPROC_INTERNAL;
+}
+
+} // namespace
+
+
+extern "C" int
+preproc_volume_minmax(void const *data,
+                      int dtype,
+                      uint64_t const dims[3],
+                      int64_t const strides[3],
+                      int num_threads,
+                      double *min,
+                      double *max,
+                      double *total)
+{
+  if (min == nullptr || max == nullptr || total == nullptr) {
+    t_lastError = "Null min, max or total.";
+    return PREPROC_INVALID_ARGUMENT;
+  }
+
+  return dispatch(data, dtype, dims, strides, num_threads, [&](auto const &v) {
+    Acc const acc{ volumeMinMax(v) };
+    *min = acc.min;
+    *max = acc.max;
+    *total = acc.total;
+    return int(PREPROC_OK);
+  });
+}
+
+
+extern "C" int
+preproc_block_stats_compute(void const *data,
+                            int dtype,
+                            uint64_t const dims[3],
+                            int64_t const strides[3],
+                            uint64_t const block_count[3],
+                            char const *tf_path,
+                            double data_min,
+                            double data_max,
+                            int num_threads,
+                            preproc_block_stats *out)
+{
+  if (block_count == nullptr || out == nullptr || dims == nullptr) {
+    t_lastError = "Null dims, block_count or out.";
+    return PREPROC_INVALID_ARGUMENT;
+  }
+  for (int i{ 0 }; i < 3; ++i) {
+    if (block_count[i] == 0 || block_count[i] > dims[i]) {
+      t_lastError = "Block count must be between 1 and the volume dims.";
+      return PREPROC_INVALID_ARGUMENT;
+    }
+  }
+
+  return dispatch(data, dtype, dims, strides, num_threads, [&](auto const &v) {
+    return blockStats(v, block_count, tf_path, data_min, data_max, out);
+  });
+}
+
+
+extern "C" char const *
+preproc_last_error(void)
+{
+  return t_lastError.c_str();
+}
@@ -0,0 +1,103 @@
+#ifndef preproc_capi_h__
+#define preproc_capi_h__
+
+/*
+ * C interface to the preproc block statistics.
+ *
+ * The volume is read in place through a pointer to voxel (0, 0, 0) and a
+ * byte stride per dimension, so numpy arrays, memmaps and their views can be
+ * passed without a copy. Dimensions and strides are in x, y, z order; for a
+ * C ordered numpy array of shape (z, y, x) reverse both shape and strides.
+ *
+ * Blocks are dims / block_count voxels on a side, as in preproc --generate,
+ * and voxels past the last whole block in a dimension don't belong to any
+ * block.
+ *
+ * Functions return PREPROC_OK or a negative error code, in which case
+ * preproc_last_error() describes the error.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum preproc_dtype
+{
+  PREPROC_INT8 = 0,
+  PREPROC_UINT8 = 1,
+  PREPROC_INT16 = 2,
+  PREPROC_UINT16 = 3,
+  PREPROC_INT32 = 4,
+  PREPROC_UINT32 = 5,
+  PREPROC_FLOAT32 = 6,
+  PREPROC_FLOAT64 = 7
+};
+
+enum preproc_status
+{
+  PREPROC_OK = 0,
+  PREPROC_INVALID_ARGUMENT = -1,
+  PREPROC_TRANSFER_FUNCTION = -2,
+  PREPROC_INTERNAL = -3
+};
+
+/* Statistics of one block, laid out like the numpy structured dtype in
+ * pyproc/src/native.py. */
+typedef struct preproc_block_stats
+{
+  double min;
+  double max;
+  double total;
+  double avg;
+  double rov;
+  uint64_t ijk[3];
+} preproc_block_stats;
+
+
+/* Min, max and total of all voxels in the volume. */
+int
+preproc_volume_minmax(void const *data,
+                      int dtype,
+                      uint64_t const dims[3],
+                      int64_t const strides[3],
+                      int num_threads,
+                      double *min,
+                      double *max,
+                      double *total);
+
+
+/*
+ * Statistics of each block, written to out[i] for block
+ * i = x + block_count[0] * (y + block_count[1] * z).
+ *
+ * rov is only computed when tf_path names an opacity transfer function
+ * file, otherwise it is 0. Voxels are normalized for the transfer function
+ * with [data_min, data_max]; pass data_min > data_max to use the range of
+ * the volume, which costs one more pass over the data.
+ *
+ * num_threads 0 uses all cores.
+ */
+int
+preproc_block_stats_compute(void const *data,
+                            int dtype,
+                            uint64_t const dims[3],
+                            int64_t const strides[3],
+                            uint64_t const block_count[3],
+                            char const *tf_path,
+                            double data_min,
+                            double data_max,
+                            int num_threads,
+                            preproc_block_stats *out);
+
+
+/* Description of the last error on the calling thread. */
+char const *
+preproc_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! preproc_capi_h__ */
@@ -0,0 +1,313 @@
+#include "checkpoint.h"
+
+#include <bd/log/logger.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace preproc
+{
+namespace
+{
+
+char const CHECKPOINT_MAGIC[8]{ 'P', 'P', 'C', 'K', 'P', 'T', '\0', '\0' };
+uint32_t const CHECKPOINT_VERSION{ 1 };
+
+
+/// \brief The fixed size part of a checkpoint file, followed by
+/// numBlocks Checkpoint::Block structs.
+struct CheckpointHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t phase;
+  uint64_t voxelOffset;
+  uint64_t rmapBytes;
+  uint64_t volDims[3];
+  uint64_t blockCount[3];
+  double volMin;
+  double volMax;
+  double volAvg;
+  double volTotal;
+  uint64_t numBlocks;
+};
+
+
+void
+writeAll(int fd, void const *p, size_t bytes, std::string const &path)
+{
+  char const *c{ static_cast<char const *>(p) };
+  while (bytes > 0) {
+    ssize_t amount{ ::write(fd, c, bytes) };
+    if (amount < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Could not write checkpoint " + path + ": " +
+                                   std::strerror(errno));
+    }
+    c += amount;
+    bytes -= static_cast<size_t>(amount);
+  }
+}
+
+
+bool
+readCheckpoint(std::string const &path, Checkpoint &ckpt)
+{
+  std::ifstream is{ path, std::ios::binary };
+  if (!is.is_open()) {
+    return false;
+  }
+
+  CheckpointHeader h;
+  if (!is.read(reinterpret_cast<char *>(&h), sizeof(h))) {
+    return false;
+  }
+  if (std::memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0 ||
+      h.version != CHECKPOINT_VERSION) {
+    bd::Warn() << "Ignoring checkpoint with unknown format: " << path;
+    return false;
+  }
+
+  ckpt.phase = static_cast<Checkpoint::Phase>(h.phase);
+  ckpt.voxelOffset = h.voxelOffset;
+  ckpt.rmapBytes = h.rmapBytes;
+  for (int i{ 0 }; i < 3; ++i) {
+    ckpt.volDims[i] = h.volDims[i];
+    ckpt.blockCount[i] = h.blockCount[i];
+  }
+  ckpt.volMin = h.volMin;
+  ckpt.volMax = h.volMax;
+  ckpt.volAvg = h.volAvg;
+  ckpt.volTotal = h.volTotal;
+
+  ckpt.blocks.resize(h.numBlocks);
+  is.read(reinterpret_cast<char *>(ckpt.blocks.data()),
+          h.numBlocks * sizeof(Checkpoint::Block));
+
+  return static_cast<bool>(is);
+}
+
+
+uint64_t
+fileSize(std::string const &path)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(st.st_size);
+}
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Checkpoint::save(bd::Volume const &volume, std::vector<bd::FileBlock> const &fileBlocks)
+{
+  glm::u64vec3 const vd{ volume.voxelDims() };
+  glm::u64vec3 const bc{ volume.block_count() };
+  for (int i{ 0 }; i < 3; ++i) {
+    volDims[i] = vd[i];
+    blockCount[i] = bc[i];
+  }
+  volMin = volume.min();
+  volMax = volume.max();
+  volAvg = volume.avg();
+  volTotal = volume.total();
+
+  blocks.resize(fileBlocks.size());
+  for (size_t i{ 0 }; i < fileBlocks.size(); ++i) {
+    bd::FileBlock const &b = fileBlocks[i];
+    blocks[i] = Block{ b.min_val, b.max_val, b.total_val, b.rov };
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Checkpoint::restore(bd::Volume &volume, std::vector<bd::FileBlock> &fileBlocks) const
+{
+  volume.min(volMin);
+  volume.max(volMax);
+  volume.avg(volAvg);
+  volume.total(volTotal);
+
+  for (size_t i{ 0 }; i < fileBlocks.size() && i < blocks.size(); ++i) {
+    bd::FileBlock &b = fileBlocks[i];
+    b.min_val = blocks[i].min;
+    b.max_val = blocks[i].max;
+    b.total_val = blocks[i].total;
+    b.rov = blocks[i].rov;
+    b.avg_val = b.total_val / (b.voxel_dims[0] * b.voxel_dims[1] * b.voxel_dims[2]);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool
+Checkpoint::matches(bd::Volume const &volume) const
+{
+  glm::u64vec3 const vd{ volume.voxelDims() };
+  glm::u64vec3 const bc{ volume.block_count() };
+  for (int i{ 0 }; i < 3; ++i) {
+    if (volDims[i] != vd[i] || blockCount[i] != bc[i]) {
+      return false;
+    }
+  }
+  return blocks.size() == volume.total_block_count();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+Checkpointer::Checkpointer(std::string const &base, uint64_t interval)
+    : m_base{ base }
+    , m_interval{ interval }
+    , m_lastEnd{ 0 }
+    , m_nextSlot{ 0 }
+{
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool
+Checkpointer::due(uint64_t end) const
+{
+  if (m_interval == 0) {
+    return false;
+  }
+  return end / m_interval > m_lastEnd / m_interval;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Checkpointer::write(Checkpoint const &ckpt, uint64_t end)
+{
+  CheckpointHeader h;
+  std::memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.version = CHECKPOINT_VERSION;
+  h.phase = static_cast<uint32_t>(ckpt.phase);
+  h.voxelOffset = ckpt.voxelOffset;
+  h.rmapBytes = ckpt.rmapBytes;
+  for (int i{ 0 }; i < 3; ++i) {
+    h.volDims[i] = ckpt.volDims[i];
+    h.blockCount[i] = ckpt.blockCount[i];
+  }
+  h.volMin = ckpt.volMin;
+  h.volMax = ckpt.volMax;
+  h.volAvg = ckpt.volAvg;
+  h.volTotal = ckpt.volTotal;
+  h.numBlocks = ckpt.blocks.size();
+
+  std::string const path{ slotPath(m_nextSlot) };
+  std::string const tmp{ path + ".tmp" };
+
+  int fd{ ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+  if (fd < 0) {
+    throw std::runtime_error("Could not open checkpoint " + tmp + ": " + std::strerror(errno));
+  }
+
+  try {
+    writeAll(fd, &h, sizeof(h), tmp);
+    writeAll(fd, ckpt.blocks.data(), ckpt.blocks.size() * sizeof(Checkpoint::Block), tmp);
+  } catch (std::runtime_error &) {
+    ::close(fd);
+    throw;
+  }
+
+  ::fsync(fd);
+  ::close(fd);
+
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    throw std::runtime_error("Could not rename checkpoint " + tmp + ": " + std::strerror(errno));
+  }
+
+  bd::Dbg() << "Wrote checkpoint " << path << " at voxel " << ckpt.voxelOffset;
+
+  m_lastEnd = end;
+  m_nextSlot = 1 - m_nextSlot;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool
+Checkpointer::load(bd::Volume const &volume, std::string const &rmapPath, Checkpoint &ckpt)
+{
+  Checkpoint slots[2];
+  bool usable[2]{ false, false };
+  uint64_t const rmapSize{ fileSize(rmapPath) };
+
+  for (int s{ 0 }; s < 2; ++s) {
+    if (!readCheckpoint(slotPath(s), slots[s])) {
+      continue;
+    }
+    if (!slots[s].matches(volume)) {
+      bd::Warn() << "Checkpoint " << slotPath(s) << " is for a different volume, ignoring it.";
+      continue;
+    }
+    if (slots[s].rmapBytes > rmapSize) {
+      bd::Warn() << "Rmap file is shorter than checkpoint " << slotPath(s) << " needs, ignoring it.";
+      continue;
+    }
+    usable[s] = true;
+  }
+
+  // The newest checkpoint is the one furthest along, relevance map pass
+  // checkpoints are further along than all of the raw file pass ones.
+  auto newer = [&slots](int a, int b) -> bool {
+    if (slots[a].phase != slots[b].phase) {
+      return slots[a].phase > slots[b].phase;
+    }
+    return slots[a].voxelOffset > slots[b].voxelOffset;
+  };
+
+  int best{ -1 };
+  if (usable[0] && usable[1]) {
+    best = newer(0, 1) ? 0 : 1;
+  } else if (usable[0]) {
+    best = 0;
+  } else if (usable[1]) {
+    best = 1;
+  }
+
+  if (best < 0) {
+    return false;
+  }
+
+  ckpt = slots[best];
+  // Never overwrite the checkpoint we are resuming from.
+  m_nextSlot = 1 - best;
+
+  bd::Dbg() << "Loaded checkpoint " << slotPath(best) << " at voxel " << ckpt.voxelOffset;
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Checkpointer::remove()
+{
+  for (int s{ 0 }; s < 2; ++s) {
+    std::remove(slotPath(s).c_str());
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::string
+Checkpointer::slotPath(int slot) const
+{
+  return m_base + "." + std::to_string(slot);
+}
+
+} // namespace preproc
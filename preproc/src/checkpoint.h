@@ -0,0 +1,145 @@
+#ifndef preproc_checkpoint_h__
+#define preproc_checkpoint_h__
+
+#include <bd/io/fileblock.h>
+#include <bd/volume/volume.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The state of a raw file or relevance map pass at a buffer boundary.
+struct Checkpoint
+{
+  enum class Phase : uint32_t
+  {
+    RawFile = 0, ///< In RFProc, block min/max/total are partial.
+    RelMap = 1   ///< In processRelMap, block rov is a partial sum.
+  };
+
+  /// Block accumulators saved in a checkpoint.
+  struct Block
+  {
+    double min;
+    double max;
+    double total;
+    double rov;
+  };
+
+  Checkpoint()
+      : phase{ Phase::RawFile }
+      , voxelOffset{ 0 }
+      , rmapBytes{ 0 }
+      , volDims{ 0, 0, 0 }
+      , blockCount{ 0, 0, 0 }
+      , volMin{ 0 }
+      , volMax{ 0 }
+      , volAvg{ 0 }
+      , volTotal{ 0 }
+  {
+  }
+
+  Phase phase;
+  uint64_t voxelOffset; ///< Voxels of the pass's input consumed so far.
+  uint64_t rmapBytes;   ///< Bytes of the rmap file this checkpoint depends on.
+  uint64_t volDims[3];
+  uint64_t blockCount[3];
+  double volMin;
+  double volMax;
+  double volAvg;
+  double volTotal;
+  std::vector<Block> blocks;
+
+
+  /// \brief Save the volume statistics and block accumulators.
+  void
+  save(bd::Volume const &volume, std::vector<bd::FileBlock> const &fileBlocks);
+
+
+  /// \brief Restore the volume statistics and block accumulators.
+  void
+  restore(bd::Volume &volume, std::vector<bd::FileBlock> &fileBlocks) const;
+
+
+  /// \brief True if this checkpoint was taken for \c volume.
+  bool
+  matches(bd::Volume const &volume) const;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Writes checkpoints every \c interval bytes of a pass's input.
+///
+/// Checkpoints alternate between two files, <base>.0 and <base>.1, so a
+/// checkpoint is never lost to a crash while the next one is being written.
+/// The older one can still be used if the rmap file did not make it to disk
+/// as far as the newer one needs.
+class Checkpointer
+{
+public:
+
+  /// \param base Path of the checkpoint files without the slot suffix.
+  /// \param interval Bytes of input between checkpoints, 0 to never write.
+  Checkpointer(std::string const &base, uint64_t interval);
+
+
+  /// \brief Start counting the interval from byte \c end of a pass's input.
+  void
+  start(uint64_t end)
+  {
+    m_lastEnd = end;
+  }
+
+
+  /// \brief True if a checkpoint should be written now that the input has
+  /// been consumed up to byte \c end.
+  bool
+  due(uint64_t end) const;
+
+
+  /// \brief Write \c ckpt to the older of the two slots.
+  /// \c ckpt is first written to a temporary file, which is synced and then
+  /// renamed over the slot.
+  /// \throws std::runtime_error if the checkpoint could not be written.
+  void
+  write(Checkpoint const &ckpt, uint64_t end);
+
+
+  /// \brief Load the newest usable checkpoint.
+  ///
+  /// A checkpoint is usable if it was taken for \c volume and the rmap file
+  /// at \c rmapPath is at least as long as the checkpoint needs.
+  /// \return true if a checkpoint was loaded into \c ckpt.
+  bool
+  load(bd::Volume const &volume, std::string const &rmapPath, Checkpoint &ckpt);
+
+
+  /// \brief Delete both checkpoint slots.
+  void
+  remove();
+
+
+  std::string const &
+  base() const
+  {
+    return m_base;
+  }
+
+
+private:
+  std::string
+  slotPath(int slot) const;
+
+  std::string const m_base;
+  uint64_t const m_interval;
+  uint64_t m_lastEnd;
+  int m_nextSlot;
+};
+
+} // namespace preproc
+
+#endif // ! preproc_checkpoint_h__
@@ -2,6 +2,8 @@
 
 #include <tclap/CmdLine.h>
 
+#include <boost/algorithm/string.hpp>
+
 #include <iostream>
 #include <string>
 #include <limits>
@@ -72,6 +74,19 @@ try
   cmd.add(tfuncArg);
 
 
+  // 2D transfer function file
+  TCLAP::ValueArg<std::string> tfunc2dArg("",
+                                          "tfunc2d",
+                                          "Path to a 2D transfer function over value and "
+                                          "gradient magnitude, used instead of --tfunc. "
+                                          "Gradients are computed while the raw file is "
+                                          "read, no gradient file is needed.",
+                                          false,
+                                          "",
+                                          "string");
+  cmd.add(tfunc2dArg);
+
+
   // .dat file
   TCLAP::ValueArg<std::string> datFileArg("d",
                                           "dat-file",
@@ -108,6 +123,18 @@ try
   cmd.add(zdimArg);
 
 
+  // region of interest
+  TCLAP::ValueArg<std::string>
+      roiArg("",
+             "roi",
+             "Only process the box of voxels x0,y0,z0:x1,y1,z1 (upper bounds are "
+             "exclusive). The block grid and index file describe only the ROI.",
+             false,
+             "",
+             "string");
+  cmd.add(roiArg);
+
+
 //  // num blocks
 //  TCLAP::ValueArg<size_t> xBlocksArg("",
 //                                     "nbx",
@@ -159,6 +186,142 @@ try
                   0, "int");
   cmd.add(numThreadsArg);
 
+  // preview sample fraction
+  TCLAP::ValueArg<double>
+    previewArg("",
+               "preview",
+               "Estimate block statistics from a sample of the raw file instead of "
+               "reading all of it. The value is the fraction of rows to sample, "
+               "e.g. 0.01, in (0, 1]. The index file is written with a "
+               "'-preview' suffix, alongside a json file with confidence bounds. "
+               "Can't be combined with --shard, --merge, --resume or "
+               "--checkpoint-interval.\n"
+               "Default: 0 (no preview)",
+               false,
+               0.0, "float");
+  cmd.add(previewArg);
+
+  // checkpoint interval
+  TCLAP::ValueArg<std::string>
+    checkpointIntervalArg("",
+                          "checkpoint-interval",
+                          "Write a checkpoint after every interval of bytes read by "
+                          "the raw file and rmap passes. Format is the same as "
+                          "--buffer-size.\n"
+                          "Default: 0 (no checkpoints)",
+                          false,
+                          "0", "uint");
+  cmd.add(checkpointIntervalArg);
+
+  // resume
+  TCLAP::SwitchArg
+      resumeArg("", "resume", "Resume an interrupted run from its checkpoints.", cmd, false);
+
+  // shard
+  TCLAP::ValueArg<std::string>
+    shardArg("",
+             "shard",
+             "Process only z-slab shard i of N, given as i/N. The shards are "
+             "aligned to block boundaries and each writes a partial index file "
+             "with a '_shard<i>of<N>' suffix, see --merge.",
+             false,
+             "", "string");
+  cmd.add(shardArg);
+
+  // merge
+  TCLAP::MultiArg<std::string>
+    mergeArg("",
+             "merge",
+             "Merge the partial index files of a sharded run into the final index "
+             "file. Give once for each shard's .bin file, along with the same "
+             "--dat-file (or --volx/y/z), -D, --roi, -f, -u and --data-min/"
+             "--data-max the shards used.",
+             false,
+             "string");
+  cmd.add(mergeArg);
+
+  // data range
+  TCLAP::ValueArg<double>
+    dataMinArg("",
+               "data-min",
+               "Use this as the volume minimum when relevance mapping instead of "
+               "computing it (needs --data-max). Sharded runs should give the "
+               "range of the whole volume, otherwise each shard reads all of it.",
+               false,
+               0.0, "float");
+  cmd.add(dataMinArg);
+
+  TCLAP::ValueArg<double>
+    dataMaxArg("",
+               "data-max",
+               "Use this as the volume maximum when relevance mapping, see --data-min.",
+               false,
+               0.0, "float");
+  cmd.add(dataMaxArg);
+
+  TCLAP::ValueArg<double>
+    dataMinPercentileArg("",
+                         "data-min-percentile",
+                         "Use this percentile of the voxel values as the volume minimum "
+                         "when relevance mapping (needs --data-max-percentile). It is "
+                         "found in the min/max pass.",
+                         false,
+                         0.0, "float");
+  cmd.add(dataMinPercentileArg);
+
+  TCLAP::ValueArg<double>
+    dataMaxPercentileArg("",
+                         "data-max-percentile",
+                         "Use this percentile of the voxel values as the volume maximum "
+                         "when relevance mapping, see --data-min-percentile.",
+                         false,
+                         100.0, "float");
+  cmd.add(dataMaxPercentileArg);
+
+  TCLAP::MultiArg<double>
+    percentileArg("",
+                  "percentile",
+                  "Report this percentile (0 - 100) of the voxel values after the "
+                  "min/max pass. Can be given more than once.",
+                  false,
+                  "float");
+  cmd.add(percentileArg);
+
+  // progress interval
+  TCLAP::ValueArg<double>
+    progressIntervalArg("",
+                        "progress-interval",
+                        "Seconds between progress and throughput reports, which "
+                        "are only printed when stdout is a terminal, and never "
+                        "with --serve.\n"
+                        "Default: 1, 0 for no reports",
+                        false,
+                        1.0, "float");
+  cmd.add(progressIntervalArg);
+
+  // trace
+  TCLAP::ValueArg<std::string>
+    traceArg("",
+             "trace",
+             "Record a timeline of the reads, kernels, rmap writes and passes "
+             "and write it to this file in Chrome trace-event format, for "
+             "chrome://tracing or Perfetto. Needs a build with PREPROC_TRACE.",
+             false,
+             "", "string");
+  cmd.add(traceArg);
+
+  // serve
+  TCLAP::ValueArg<std::string>
+    serveArg("",
+             "serve",
+             "Keep the volume (-f with -d or --volx/y/z) mapped and answer index "
+             "requests on this unix domain socket until a shutdown request. "
+             "Send lines of 'index XxYxZ [tfunc path]', each is answered with a "
+             "binary index file. -D grids are computed at startup.",
+             false,
+             "", "string");
+  cmd.add(serveArg);
+
   // print blocks
   TCLAP::SwitchArg
       printBlocksArg("", "print-blocks", "Print blocks into to stdout.", cmd, false);
@@ -170,20 +333,95 @@ try
   cmd.parse(argc, argv);
 
   opts.actionType = readArg.getValue() ? ActionType::Convert : ActionType::Generate;
+  if (!mergeArg.getValue().empty()) {
+    opts.actionType = ActionType::Merge;
+  }
+  if (serveArg.isSet()) {
+    opts.actionType = ActionType::Serve;
+  }
   opts.inFile = fileArg.getValue();
   opts.outFileDirLocation = outFileDirArg.getValue();
   opts.outFilePrefix = outFilePrefixArg.getValue();
   opts.rmapFilePath = rmapFilePathArg.getValue();
   opts.tfuncPath = tfuncArg.getValue();
+  opts.tfunc2dPath = tfunc2dArg.getValue();
   opts.datFilePath = datFileArg.getValue();
   opts.printBlocks = printBlocksArg.getValue();
   opts.skipRmapGeneration = skipRmapArg.getValue();
   opts.vol_dims[0] = xdimArg.getValue();
   opts.vol_dims[1] = ydimArg.getValue();
   opts.vol_dims[2] = zdimArg.getValue();
+  opts.file_dims[0] = opts.vol_dims[0];
+  opts.file_dims[1] = opts.vol_dims[1];
+  opts.file_dims[2] = opts.vol_dims[2];
+  if (!roiArg.getValue().empty() && !parseRoi(roiArg.getValue(), opts.roi)) {
+    std::cerr << "Malformed region of interest: " << roiArg.getValue() << std::endl;
+    return 0;
+  }
   opts.numBlocks = numBlocksMultiArg.getValue();
   opts.bufferSize = convertToBytes(bufferSizeArg.getValue());
   opts.numThreads = numThreadsArg.getValue();
+  opts.previewFraction = previewArg.getValue();
+  opts.checkpointInterval = convertToBytes(checkpointIntervalArg.getValue());
+  opts.resume = resumeArg.getValue();
+  opts.shardIndex = 0;
+  opts.shardCount = 0;
+  if (!shardArg.getValue().empty() &&
+      !parseShard(shardArg.getValue(), opts.shardIndex, opts.shardCount)) {
+    std::cerr << "Malformed shard: " << shardArg.getValue() << std::endl;
+    return 0;
+  }
+  opts.mergeFiles = mergeArg.getValue();
+  if (previewArg.isSet()) {
+    if (!( opts.previewFraction > 0.0 && opts.previewFraction <= 1.0 )) {
+      std::cerr << "The --preview fraction must be in (0, 1]: " << opts.previewFraction
+                << std::endl;
+      return 0;
+    }
+    if (shardArg.isSet() || mergeArg.isSet() || resumeArg.isSet() ||
+        checkpointIntervalArg.isSet()) {
+      std::cerr << "--preview can't be combined with --shard, --merge, --resume or "
+                   "--checkpoint-interval." << std::endl;
+      return 0;
+    }
+  }
+  opts.useDataRange = dataMinArg.isSet() || dataMaxArg.isSet();
+  if (opts.useDataRange && !( dataMinArg.isSet() && dataMaxArg.isSet() )) {
+    std::cerr << "--data-min and --data-max must be given together." << std::endl;
+    return 0;
+  }
+  opts.dataMin = dataMinArg.getValue();
+  opts.dataMax = dataMaxArg.getValue();
+  opts.useDataPercentiles = dataMinPercentileArg.isSet() || dataMaxPercentileArg.isSet();
+  if (opts.useDataPercentiles && !( dataMinPercentileArg.isSet() && dataMaxPercentileArg.isSet() )) {
+    std::cerr << "--data-min-percentile and --data-max-percentile must be given together."
+              << std::endl;
+    return 0;
+  }
+  if (opts.useDataPercentiles && opts.useDataRange) {
+    std::cerr << "Give either --data-min/--data-max or the percentiles, not both." << std::endl;
+    return 0;
+  }
+  opts.dataMinPercentile = dataMinPercentileArg.getValue();
+  opts.dataMaxPercentile = dataMaxPercentileArg.getValue();
+  opts.percentiles = percentileArg.getValue();
+  std::vector<double> all{ opts.percentiles };
+  all.push_back(opts.dataMinPercentile);
+  all.push_back(opts.dataMaxPercentile);
+  for (double p : all) {
+    if (!( p >= 0.0 && p <= 100.0 )) {
+      std::cerr << "Percentiles must be in [0, 100]: " << p << std::endl;
+      return 0;
+    }
+  }
+  if (opts.useDataPercentiles && !( opts.dataMinPercentile < opts.dataMaxPercentile )) {
+    std::cerr << "--data-min-percentile must be less than --data-max-percentile: "
+              << opts.dataMinPercentile << " - " << opts.dataMaxPercentile << std::endl;
+    return 0;
+  }
+  opts.progressInterval = progressIntervalArg.getValue();
+  opts.tracePath = traceArg.getValue();
+  opts.serveSocket = serveArg.getValue();
 
   return static_cast<int>(cmd.getArgList().size());
 
@@ -208,13 +446,34 @@ convertToBytes(std::string s)
     multiplier = 1024 * 1024 * 1024;
   }
 
-  std::string numPart(s.begin(), s.end() - 1);
+  // a plain number of bytes has no suffix to strip.
+  std::string numPart(s.begin(), multiplier == 1 ? s.end() : s.end() - 1);
   auto num = stoull(numPart);
 
   return num * multiplier;
 }
 
 
+bool
+parseShard(std::string const &s, int &index, int &count)
+{
+  std::vector<std::string> split;
+  boost::split(split, s, boost::is_any_of("/"));
+  if (split.size() != 2) {
+    return false;
+  }
+
+  try {
+    index = std::stoi(split[0]);
+    count = std::stoi(split[1]);
+  } catch (std::logic_error &) {
+    return false;
+  }
+
+  return count > 0 && index >= 0 && index < count;
+}
+
+
 void
 printThem(const CommandLineOptions &opts)
 {
@@ -225,8 +484,9 @@ printThem(const CommandLineOptions &opts)
 std::ostream &
 operator<<(std::ostream &os, const CommandLineOptions &opts)
 {
-  os << "Action type: " << ( opts.actionType == ActionType::Convert ?
-                             "Convert" : "Generate" )
+  os << "Action type: " << ( opts.actionType == ActionType::Convert ? "Convert" :
+                             opts.actionType == ActionType::Merge ? "Merge" :
+                             opts.actionType == ActionType::Serve ? "Serve" : "Generate" )
      << "\n" "Input file path: "
      << opts.inFile
      << "\n" "Output file path: "
@@ -237,6 +497,8 @@ operator<<(std::ostream &os, const CommandLineOptions &opts)
      << opts.rmapFilePath
      << "\n" "Transfer function path: "
      << opts.tfuncPath
+     << "\n" "2D transfer function path: "
+     << opts.tfunc2dPath
      << "\n" "Dat file: "
      << opts.datFilePath
      << "\n" "Data Type: "
@@ -245,6 +507,8 @@ operator<<(std::ostream &os, const CommandLineOptions &opts)
      << opts.vol_dims[0] << " X "
      << opts.vol_dims[1] << " X "
      << opts.vol_dims[2]
+     << "\n" "Region of interest: "
+     << ( opts.roi.empty() ? std::string("none") : to_string(opts.roi) )
      << "\n" "Num blocks (x X y X z): "
 //     << opts.num_blks[0] << " X "
 //     << opts.num_blks[1] << " X "
@@ -260,6 +524,23 @@ operator<<(std::ostream &os, const CommandLineOptions &opts)
 //     << "\n" "Volume min/max : "
 //     << opts.volMin << " - "
 //     << opts.volMax
+     << "\n" "Preview fraction: "
+     << opts.previewFraction
+     << "\n" "Checkpoint interval: "
+     << opts.checkpointInterval << " bytes."
+     << "\n" "Resume: " << std::boolalpha
+     << opts.resume
+     << "\n" "Shard: "
+     << ( opts.shardCount == 0 ?
+          std::string("none") :
+          std::to_string(opts.shardIndex) + "/" + std::to_string(opts.shardCount) )
+     << "\n" "Data range: "
+     << ( opts.useDataRange ?
+          std::to_string(opts.dataMin) + " - " + std::to_string(opts.dataMax) :
+          opts.useDataPercentiles ?
+          "percentiles " + std::to_string(opts.dataMinPercentile) + " - " +
+              std::to_string(opts.dataMaxPercentile) :
+          std::string("computed") )
      << "\n" "Print blocks: " << std::boolalpha
      << opts.printBlocks;
 
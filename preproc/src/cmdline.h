@@ -1,6 +1,8 @@
 #ifndef preproc_cmdline_h__
 #define preproc_cmdline_h__
 
+#include "roi.h"
+
 #include <string>
 #include <vector>
 
@@ -10,7 +12,9 @@ namespace preproc
 enum class ActionType
 {
   Convert,  ///< Convert binary to ascii
-  Generate  ///< Generate a new binary or ascii index file
+  Generate, ///< Generate a new binary or ascii index file
+  Merge,    ///< Merge the partial index files of a sharded run
+  Serve     ///< Answer index requests on a unix domain socket
 };
 
 struct CommandLineOptions
@@ -25,6 +29,8 @@ struct CommandLineOptions
   std::string rmapFilePath;
   // transfer function file path
   std::string tfuncPath;
+  // 2D value x gradient magnitude transfer function path, replaces tfuncPath if given.
+  std::string tfunc2dPath;
   // for .dat descriptor file (currently unimplemented)
   std::string datFilePath;
   // volume data type
@@ -37,19 +43,56 @@ struct CommandLineOptions
   bool skipRmapGeneration;
   // number of blocks
 //  uint64_t num_blks[3];
-  // volume dimensions
+  // volume dimensions, the dimensions of the region of interest if one was given.
   uint64_t vol_dims[3];
+  // dimensions of the volume in the raw file.
+  uint64_t file_dims[3];
+  // region of the raw file to process.
+  Roi roi;
   // buffer size
   uint64_t bufferSize;
   // number of threads
   int numThreads;
   std::vector<std::string> numBlocks;
+  // fraction of rows to sample for a preview, 0 for a full pass.
+  double previewFraction;
+  // bytes of input between checkpoints, 0 to not checkpoint.
+  uint64_t checkpointInterval;
+  // true to resume from the checkpoints of an interrupted run.
+  bool resume;
+  // z-slab shard of the volume to process, shardCount is 0 if not sharded.
+  int shardIndex;
+  int shardCount;
+  // partial index files to merge.
+  std::vector<std::string> mergeFiles;
+  // true if dataMin/dataMax replace the volume min/max for relevance mapping.
+  bool useDataRange;
+  double dataMin;
+  double dataMax;
+  // true if the percentiles dataMinPercentile/dataMaxPercentile of the
+  // voxel values replace the volume min/max for relevance mapping.
+  bool useDataPercentiles;
+  double dataMinPercentile;
+  double dataMaxPercentile;
+  // percentiles of the voxel values to report after the min/max pass.
+  std::vector<double> percentiles;
+  // seconds between progress reports, 0 for none.
+  double progressInterval;
+  // file to write a chrome trace of the run to, empty for no trace.
+  std::string tracePath;
+  // unix domain socket to serve index requests on, see serve().
+  std::string serveSocket;
 };
 
 
 size_t convertToBytes(std::string s);
 
 
+/// \brief Parse a shard of the form "i/N" into \c index and \c count.
+/// \return false if \c s is malformed or not 0 <= i < N.
+bool parseShard(std::string const &s, int &index, int &count);
+
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Parses command line args and populates \c opts.
 ///
@@ -0,0 +1,64 @@
+#ifndef preproc_datwriter_h__
+#define preproc_datwriter_h__
+
+#include <bd/io/datatypes.h>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+namespace preproc
+{
+
+/// \brief The .dat Format name for \c type, as bd::parseDat() reads it.
+inline char const *
+datFormat(bd::DataType type)
+{
+  switch (type) {
+  case bd::DataType::Character:
+    return "CHAR";
+  case bd::DataType::UnsignedCharacter:
+    return "UCHAR";
+  case bd::DataType::Short:
+    return "SHORT";
+  case bd::DataType::UnsignedShort:
+    return "USHORT";
+  case bd::DataType::Integer:
+    return "INT";
+  case bd::DataType::UnsignedInteger:
+    return "UINT";
+  case bd::DataType::Float:
+    return "FLOAT";
+  case bd::DataType::Double:
+    return "DOUBLE";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+
+/// \brief Write a .dat file at \c datPath for the raw file \c rawPath, with
+/// dimensions \c dims and voxel type \c type. The .dat names the raw file
+/// without its directory, so the two are expected side by side.
+/// \return false if the file couldn't be written.
+inline bool
+writeDat(std::string const &datPath, std::string const &rawPath,
+         uint64_t const dims[3], bd::DataType type)
+{
+  std::ofstream dat{ datPath };
+  if (!dat.is_open()) {
+    return false;
+  }
+
+  size_t const slash{ rawPath.find_last_of('/') };
+  dat << "ObjectFileName: "
+      << ( slash == std::string::npos ? rawPath : rawPath.substr(slash + 1) )
+      << "\nResolution: " << dims[0] << " " << dims[1] << " " << dims[2]
+      << "\nSliceThickness: 1 1 1"
+      << "\nFormat: " << datFormat(type) << "\n";
+  return static_cast<bool>(dat);
+}
+
+} // namespace preproc
+
+#endif // ! preproc_datwriter_h__
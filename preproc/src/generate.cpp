@@ -0,0 +1,923 @@
+////////////////////////////////////////////////////////////////////////////////
+// Preprocessor
+// Generates index files for simple_blocks viewer.
+// Index file format
+////////////////////////////////////////////////////////////////////////////////
+
+#include "generate.h"
+#include "cmdline.h"
+#include "volumeminmax.h"
+#include "processrawfile.h"
+#include "processrelmap.h"
+#include "processpreview.h"
+#include "metrics.h"
+
+#include <bd/util/util.h>
+#include <bd/io/indexfile.h>
+#include <bd/log/logger.h>
+#include <bd/io/datfile.h>
+
+#include <tbb/tbb.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <fstream>
+
+namespace fs = boost::filesystem;
+
+namespace preproc
+{
+
+////////////////////////////////////////////////////////////////////////////////
+std::string
+makeFileNameString(const CommandLineOptions &clo, std::tuple<int, int, int> nb)
+{
+  std::stringstream outFileName;
+  outFileName << clo.outFileDirLocation << '/' << clo.outFilePrefix
+    << '_' << std::get<0>(nb) << '-'
+    << std::get<1>(nb) << '-'
+    << std::get<2>(nb);
+
+  if (!clo.roi.covers(clo.file_dims)) {
+    outFileName << "_roi_"
+      << clo.roi.lo[0] << '-' << clo.roi.lo[1] << '-' << clo.roi.lo[2] << '_'
+      << clo.roi.hi[0] << '-' << clo.roi.hi[1] << '-' << clo.roi.hi[2];
+  }
+
+  return outFileName.str();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+printBlocksToStdOut(bd::IndexFile const &indexFile)
+{
+  std::cout << "{\n";
+  for (auto &block : indexFile.getFileBlocks()) {
+    std::cout << block << std::endl;
+  }
+  std::cout << "}\n";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+writeIndexFileToDisk(bd::IndexFile const &indexFile,
+                     std::string const &nameWithoutExtension,
+                     CommandLineOptions const &clo)
+{
+  PassTimer timer{ Pass::IndexWrite };
+
+  {
+    std::string outFileName{ nameWithoutExtension + ".json" };
+    indexFile.writeAsciiIndexFile(outFileName);
+  }
+
+  {
+    std::string outFileName{ nameWithoutExtension + ".bin" };
+    indexFile.writeBinaryIndexFile(outFileName);
+  }
+
+}
+
+
+/// \brief Set the total and avg of \c volume from its whole blocks.
+///
+/// Voxels past the last whole block in a dimension are in no block, so the
+/// avg is over the voxels the blocks cover.
+void
+setVolumeTotalFromBlocks(bd::Volume &volume, std::vector<bd::FileBlock> const &blocks)
+{
+  double total{ 0 };
+  for (auto const &b : blocks) {
+    total += b.total_val;
+  }
+  glm::u64vec3 const bd{ volume.block_dims() };
+  glm::u64vec3 const bc{ volume.block_count() };
+  volume.total(total);
+  volume.avg(total / ( bd.x * bc.x * bd.y * bc.y * bd.z * bc.z ));
+}
+
+
+/// \brief Create an IndexFile for the block counts in \c t, with the
+/// volume statistics copied from \c minmax.
+std::unique_ptr<bd::IndexFile>
+makeIndexFile(const CommandLineOptions &clo,
+              std::tuple<int, int, int> const &t,
+              bd::Volume const &minmax,
+              bd::DataType type)
+{
+  fs::path rawPath(clo.inFile);
+  fs::path tfPath(clo.tfunc2dPath.empty() ? clo.tfuncPath : clo.tfunc2dPath);
+
+  std::unique_ptr<bd::IndexFile> indexFile{ new bd::IndexFile() };
+
+  indexFile->setRawFileName(rawPath.filename().string());
+  indexFile->setTFFileName(tfPath.filename().string());
+
+  indexFile->setVolume(bd::Volume{ { clo.vol_dims[0], clo.vol_dims[1], clo.vol_dims[2] },
+    { std::get<0>(t), std::get<1>(t), std::get<2>(t) } });
+
+  indexFile->getVolume().min(minmax.min());
+  indexFile->getVolume().max(minmax.max());
+  indexFile->getVolume().avg(minmax.avg());
+  indexFile->getVolume().total(minmax.total());
+
+  indexFile->init(type);
+
+  return indexFile;
+}
+
+
+/// \brief Generate approximate IndexFiles from a sample of the raw file.
+///
+/// The index files are named like the full ones, plus a "-preview" suffix,
+/// and each gets a "-preview.bounds.json" file, marked "approximate": true,
+/// with the per-block sample counts and 95% confidence bounds of the
+/// estimates.
+/// \throws std::runtime_error if rawfile can't be opened.
+template<class Ty>
+void
+generatePreviewIndexFile(const CommandLineOptions &clo,
+                         std::vector<std::tuple<int, int, int>> tuples,
+                         bd::DataType type)
+{
+  bd::Volume minmax{ {clo.vol_dims[0], clo.vol_dims[1], clo.vol_dims[2]}, {1, 1, 1} };
+  bool haveMinMax{ false };
+
+  for (auto &t : tuples) {
+    std::unique_ptr<bd::IndexFile> indexFile{ makeIndexFile(clo, t, minmax, type) };
+
+    PreviewProc<Ty> preview{ clo, indexFile->getVolume() };
+
+    // The volume min/max is needed to normalize the relevance function, so
+    // estimate it once from the first tuple's strips, unless it was given.
+    if (!haveMinMax) {
+      if (clo.useDataRange) {
+        minmax.min(clo.dataMin);
+        minmax.max(clo.dataMax);
+      } else {
+        bd::Info() << "Estimating volume min/max.";
+        preview.sampleMinMax(minmax);
+      }
+      haveMinMax = true;
+      indexFile->getVolume().min(minmax.min());
+      indexFile->getVolume().max(minmax.max());
+      indexFile->getVolume().avg(minmax.avg());
+      indexFile->getVolume().total(minmax.total());
+    }
+
+    bd::Info() << "Estimating block statistics.";
+    preview.sampleBlocks(indexFile->getVolume(), indexFile->getFileBlocks(),
+                         clo.skipRmapGeneration);
+    if (clo.useDataRange) {
+      setVolumeTotalFromBlocks(indexFile->getVolume(), indexFile->getFileBlocks());
+    }
+
+    std::string const name{ makeFileNameString(clo, t) + "-preview" };
+    writeIndexFileToDisk(*(indexFile.get()), name, clo);
+    preview.writeBoundsFile(name + ".bounds.json", indexFile->getFileBlocks());
+  }
+}
+
+
+/// \brief Report the percentiles asked for in \c clo, and replace the min
+/// and max of \c minmax with the data range percentiles if there are some.
+/// \throws std::runtime_error if the data range percentiles give an empty
+///         range, as they do when both fall in a run of equal values.
+template<class Ty>
+void
+applyPercentiles(const CommandLineOptions &clo,
+                 ThreadHistogram<Ty> const &values,
+                 bd::Volume &minmax)
+{
+  std::vector<double> qs;
+  for (double p : clo.percentiles) {
+    qs.push_back(p / 100.0);
+  }
+  qs.push_back(clo.dataMinPercentile / 100.0);
+  qs.push_back(clo.dataMaxPercentile / 100.0);
+  std::vector<double> const v{ values.quantiles(qs) };
+
+  for (size_t i{ 0 }; i < clo.percentiles.size(); ++i) {
+    bd::Info() << "Percentile " << clo.percentiles[i] << " of the voxel values: " << v[i];
+  }
+
+  if (clo.useDataPercentiles) {
+    double const lo{ v[v.size() - 2] };
+    double const hi{ v[v.size() - 1] };
+    std::ostringstream range;
+    range << "Data range from percentiles " << clo.dataMinPercentile << " - "
+          << clo.dataMaxPercentile << ": " << lo << " - " << hi;
+    if (!( lo < hi )) {
+      throw std::runtime_error(range.str() + ", the min must be less than the max.");
+    }
+    bd::Info() << range.str();
+    minmax.min(lo);
+    minmax.max(hi);
+  }
+}
+
+
+/// \brief Compute the volume min/max of the raw file, or of the ROI if one
+/// was given.
+/// \throws std::runtime_error if the file can't be opened or the data range
+///         percentiles are empty.
+template<class Ty>
+void
+computeVolumeMinMax(const CommandLineOptions &clo, bd::Volume &minmax)
+{
+  PassTimer timer{ Pass::VolumeMinMax };
+  bd::Info() << "Computing volume min/max.";
+
+  // Quantiles are counted in the same pass, while the buffers are in memory.
+  bool const wantQuantiles{ clo.useDataPercentiles || !clo.percentiles.empty() };
+  ThreadHistogram<Ty> values;
+  ThreadHistogram<Ty> *pvalues{ wantQuantiles ? &values : nullptr };
+
+  if (clo.roi.covers(clo.file_dims)) {
+    volumeMinMax<Ty>(clo.inFile, clo.bufferSize, minmax, pvalues);
+  } else {
+    RawFile raw;
+    if (!raw.open(clo.inFile)) {
+      throw std::runtime_error("Could not open file: " + clo.inFile);
+    }
+    RoiReader<Ty> rr;
+    rr.set(&raw, clo.file_dims, clo.roi);
+    volumeMinMax<Ty>(rr, clo.bufferSize, minmax, pvalues);
+  }
+
+  if (wantQuantiles) {
+    applyPercentiles(clo, values, minmax);
+  }
+}
+
+
+/// \brief Suffix of the partial index files of shard \c index of \c count.
+std::string
+shardSuffix(int index, int count)
+{
+  return "_shard" + std::to_string(index) + "of" + std::to_string(count);
+}
+
+
+/// \brief Restrict \c sclo to the z-slab shard clo.shardIndex for the block
+/// counts in \c t.
+///
+/// The shard gets the z blocks [i*nbz/N, (i+1)*nbz/N) of the volume (or of
+/// the ROI) so no block spans two shards, and \c t is changed to the block
+/// counts of the shard. The shard's slab depends on the z block count, so
+/// its rmap file is named for the tuple as well as the shard.
+/// \throws std::runtime_error if there are more shards than z blocks.
+void
+applyShard(CommandLineOptions &sclo, std::tuple<int, int, int> &t)
+{
+  uint64_t const nbz{ static_cast<uint64_t>(std::get<2>(t)) };
+  uint64_t const n{ static_cast<uint64_t>(sclo.shardCount) };
+  uint64_t const i{ static_cast<uint64_t>(sclo.shardIndex) };
+  if (n > nbz) {
+    throw std::runtime_error("Can't split " + std::to_string(nbz) + " z blocks into " +
+                                 std::to_string(n) + " shards.");
+  }
+
+  uint64_t const bdz{ sclo.vol_dims[2] / nbz };
+  if (sclo.vol_dims[2] % nbz != 0) {
+    bd::Warn() << "Volume z dim is not a multiple of the z block count, the last "
+               << sclo.vol_dims[2] % nbz << " slices are not in any shard.";
+  }
+
+  uint64_t const k0{ i * nbz / n };
+  uint64_t const k1{ ( i + 1 ) * nbz / n };
+
+  sclo.roi.hi[2] = sclo.roi.lo[2] + k1 * bdz;
+  sclo.roi.lo[2] = sclo.roi.lo[2] + k0 * bdz;
+  sclo.vol_dims[2] = sclo.roi.dim(2);
+  sclo.rmapFilePath += "_" + std::to_string(std::get<0>(t)) + "x" +
+      std::to_string(std::get<1>(t)) + "x" + std::to_string(nbz) +
+      shardSuffix(sclo.shardIndex, sclo.shardCount);
+  std::get<2>(t) = static_cast<int>(k1 - k0);
+
+  bd::Info() << "Shard " << i << "/" << n << " has z blocks [" << k0 << ", " << k1
+             << "), region " << to_string(sclo.roi) << ".";
+}
+
+
+/// \brief Write a checkpoint at the start of a pass.
+void
+checkpointPassStart(Checkpointer &ckpt,
+                    Checkpoint::Phase phase,
+                    uint64_t rmapBytes,
+                    bd::Volume const &volume,
+                    std::vector<bd::FileBlock> const &blocks)
+{
+  Checkpoint c;
+  c.phase = phase;
+  c.voxelOffset = 0;
+  c.rmapBytes = rmapBytes;
+  c.save(volume, blocks);
+  try {
+    ckpt.write(c, 0);
+  } catch (std::runtime_error &e) {
+    bd::Warn() << e.what();
+  }
+}
+
+
+/// \brief Log the stage metrics of the run and write them to a json file
+/// next to the index files.
+void
+writeStatsFile(CommandLineOptions const &clo,
+               int numThreads,
+               double wallSeconds,
+               std::vector<std::string> const &indexFiles)
+{
+  Metrics::printSummary();
+
+  std::string path{ clo.outFileDirLocation + '/' + clo.outFilePrefix };
+  if (clo.shardCount > 0) {
+    path += shardSuffix(clo.shardIndex, clo.shardCount);
+  }
+  path += ".stats.json";
+
+  std::ofstream os{ path };
+  if (!os.is_open()) {
+    bd::Warn() << "Could not write stats file " << path;
+    return;
+  }
+
+  os << "{\n"
+     << "  \"buffer_size\": " << clo.bufferSize << ",\n"
+     << "  \"threads\": " << numThreads << ",\n"
+     << "  \"wall_seconds\": " << wallSeconds << ",\n"
+     << "  \"index_files\": [";
+  for (size_t i{ 0 }; i < indexFiles.size(); ++i) {
+    os << ( i ? ", " : "" ) << '"' << indexFiles[i] << '"';
+  }
+  os << "],\n"
+     << "  \"passes\": ";
+  Metrics::writePassJson(os);
+  os << ",\n"
+     << "  \"stages\": ";
+  Metrics::writeJson(os);
+  os << "\n}\n";
+
+  bd::Info() << "Wrote stats file " << path;
+}
+
+
+/// \brief The state of one block count tuple while generating index files.
+struct TupleJob
+{
+  std::string name;
+  CommandLineOptions clo; ///< The options restricted to the tuple's shard.
+  std::unique_ptr<bd::IndexFile> indexFile;
+  std::unique_ptr<Checkpointer> ckpt;
+  Checkpoint resumeFrom;
+  bool resuming;
+  bool rawPass;         ///< The raw file pass is not done yet.
+  uint64_t rawStart;    ///< Voxel the raw file pass starts at.
+  uint64_t relMapStart; ///< Voxel the relevance map pass starts at.
+  bool genRMap;         ///< This tuple's raw file pass writes the rmap.
+};
+
+
+/// \brief Generate the IndexFile!
+///
+/// The block count tuples are processed together: each raw file buffer is
+/// read once and handed to all of the tuples, and the same for the
+/// relevance map. The rmap is written by the first tuple's raw file pass.
+///
+/// If clo.shardCount is set, only the shard's z blocks are processed and
+/// partial index files are written, see merge(). The shard of each tuple
+/// is a different part of the file, so each tuple is processed on its own
+/// and writes its own rmap.
+///
+/// If clo.checkpointInterval is set, each block count tuple gets a pair of
+/// checkpoint files next to its index file that are removed once the index
+/// file is written. With clo.resume, tuples whose index file already exists
+/// are skipped, and the others pick up from their newest usable checkpoint.
+/// \throws std::runtime_error if rawfile can't be opened.
+template<class Ty>
+void
+generateIndexFile(const CommandLineOptions &clo,
+                  std::vector<std::tuple<int, int, int>> tuples,
+                  bd::DataType type)
+{
+
+  int numThreads = clo.numThreads;
+  if (numThreads == 0) {
+    numThreads = tbb::task_scheduler_init::default_num_threads();
+  }
+  tbb::task_scheduler_init init(numThreads);
+
+  if (clo.previewFraction > 0) {
+    if (!clo.tfunc2dPath.empty()) {
+      bd::Err() << "--preview only samples rows, so it can't compute the gradients "
+                   "--tfunc2d needs.";
+      return;
+    }
+    if (clo.useDataPercentiles) {
+      bd::Err() << "--preview doesn't read every voxel, so it can't find the "
+                   "--data-min-percentile/--data-max-percentile.";
+      return;
+    }
+    generatePreviewIndexFile<Ty>(clo, tuples, type);
+    return;
+  }
+
+  auto const runStart = std::chrono::steady_clock::now();
+
+  bd::Volume minmax{ {clo.vol_dims[0], clo.vol_dims[1], clo.vol_dims[2]}, {1, 1, 1} };
+  bool haveMinMax{ false };
+  if (clo.useDataRange) {
+    // avg and total are filled in from the blocks after the raw file pass.
+    minmax.min(clo.dataMin);
+    minmax.max(clo.dataMax);
+    haveMinMax = true;
+    if (!clo.percentiles.empty()) {
+      bd::Warn() << "--percentile is found in the min/max pass, which --data-min/--data-max skip.";
+    }
+  } else if (clo.shardCount > 0) {
+    bd::Warn() << "No --data-min/--data-max given, each shard computes the min/max "
+                  "of the whole volume.";
+  }
+
+  bool const sharded{ clo.shardCount > 0 };
+  // True once the rmap of an unsharded run is known to be complete.
+  bool rmapDone{ clo.skipRmapGeneration };
+
+  std::vector<TupleJob> jobs;
+  for (auto t : tuples) {
+    TupleJob job;
+    job.clo = clo;
+    job.name = makeFileNameString(clo, t);
+    if (sharded) {
+      applyShard(job.clo, t);
+      job.name += shardSuffix(clo.shardIndex, clo.shardCount);
+    }
+    job.indexFile = makeIndexFile(job.clo, t, minmax, type);
+    job.ckpt.reset(new Checkpointer{ job.name + ".ckpt", clo.checkpointInterval });
+    job.resuming = false;
+    job.genRMap = false;
+
+    bd::Volume &volume = job.indexFile->getVolume();
+    if (clo.resume) {
+      job.resuming = job.ckpt->load(volume, job.clo.rmapFilePath, job.resumeFrom);
+      if (!job.resuming && fs::exists(job.name + ".bin")) {
+        bd::Info() << "Index file " << job.name << ".bin exists, skipping it.";
+        rmapDone = true;
+        continue;
+      }
+    }
+
+    if (job.resuming) {
+      bd::Info() << "Resuming " << job.name << " from voxel " << job.resumeFrom.voxelOffset
+                 << (job.resumeFrom.phase == Checkpoint::Phase::RawFile ?
+                     " of the raw file." : " of the relevance map.");
+      job.resumeFrom.restore(volume, job.indexFile->getFileBlocks());
+    }
+    bool const inRawPass{ !job.resuming ||
+                              job.resumeFrom.phase == Checkpoint::Phase::RawFile };
+    job.rawPass = inRawPass;
+    job.rawStart = job.resuming && inRawPass ? job.resumeFrom.voxelOffset : 0;
+    job.relMapStart = job.resuming && !inRawPass ? job.resumeFrom.voxelOffset : 0;
+    if (!inRawPass) {
+      rmapDone = true;
+    }
+
+    jobs.push_back(std::move(job));
+  }
+
+  // A checkpoint has the volume min/max, so the min/max pass is only needed
+  // if a tuple is starting from scratch.
+  for (auto &job : jobs) {
+    if (job.resuming && !haveMinMax) {
+      bd::Volume const &v = job.indexFile->getVolume();
+      minmax.min(v.min());
+      minmax.max(v.max());
+      minmax.avg(v.avg());
+      minmax.total(v.total());
+      haveMinMax = true;
+    }
+  }
+
+  for (auto &job : jobs) {
+    if (job.resuming) {
+      continue;
+    }
+    if (!haveMinMax) {
+      computeVolumeMinMax<Ty>(clo, minmax);
+      haveMinMax = true;
+    }
+    bd::Volume &volume = job.indexFile->getVolume();
+    volume.min(minmax.min());
+    volume.max(minmax.max());
+    volume.avg(minmax.avg());
+    volume.total(minmax.total());
+    if (clo.checkpointInterval > 0) {
+      checkpointPassStart(*job.ckpt, Checkpoint::Phase::RawFile, 0,
+                          volume, job.indexFile->getFileBlocks());
+    }
+  }
+
+  // Decide whose raw file pass writes the rmap.
+  if (sharded) {
+    for (auto &job : jobs) {
+      job.genRMap = !clo.skipRmapGeneration && job.rawPass;
+    }
+  } else if (!rmapDone) {
+    auto owner =
+        std::find_if(jobs.begin(), jobs.end(),
+                     [](TupleJob const &j) -> bool {
+                       return j.rawPass && ( !j.resuming || j.resumeFrom.rmapBytes > 0 ||
+                           j.resumeFrom.voxelOffset == 0 );
+                     });
+    if (owner == jobs.end()) {
+      throw std::runtime_error("The rmap file is incomplete and no checkpoint can "
+                                   "resume writing it, run again without --resume.");
+    }
+    owner->genRMap = true;
+  }
+
+  // Tuples can only share a pass if they start at the same voxel of the same
+  // file region.
+  auto groupJobs =
+      [&jobs, sharded](bool raw) -> std::vector<std::vector<TupleJob *>> {
+        std::map<uint64_t, std::vector<TupleJob *>> byStart;
+        std::vector<std::vector<TupleJob *>> groups;
+        for (auto &job : jobs) {
+          if (raw && !job.rawPass) {
+            continue;
+          }
+          if (sharded) {
+            groups.push_back({ &job });
+          } else {
+            byStart[raw ? job.rawStart : job.relMapStart].push_back(&job);
+          }
+        }
+        for (auto &g : byStart) {
+          groups.push_back(g.second);
+        }
+        return groups;
+      };
+
+  for (auto &group : groupJobs(true)) {
+    // The first target's consumer writes the rmap.
+    std::stable_partition(group.begin(), group.end(),
+                          [](TupleJob const *j) -> bool { return j->genRMap; });
+
+    std::vector<RawFileTarget> targets;
+    for (auto *job : group) {
+      targets.push_back(RawFileTarget{ &job->indexFile->getVolume(),
+                                       &job->indexFile->getFileBlocks(),
+                                       job->ckpt.get() });
+    }
+
+    bd::Info() << "Processing raw file.";
+    PassTimer timer{ Pass::RawFile, group[0]->rawStart };
+    RFProc<Ty> proc;
+    proc.setResumeOffset(group[0]->rawStart);
+    int result = proc.processRawFile(group[0]->clo, targets, !group[0]->genRMap);
+
+    if (result != 0) {
+      throw std::runtime_error("Problem processing raw file.");
+    }
+
+    for (auto *job : group) {
+      bd::Volume &volume = job->indexFile->getVolume();
+      std::vector<bd::FileBlock> &blocks = job->indexFile->getFileBlocks();
+
+      if (clo.useDataRange) {
+        setVolumeTotalFromBlocks(volume, blocks);
+      }
+
+      if (clo.checkpointInterval > 0) {
+        checkpointPassStart(*job->ckpt, Checkpoint::Phase::RelMap,
+                            volume.voxelDims().x * volume.voxelDims().y *
+                                volume.voxelDims().z * sizeof(double),
+                            volume, blocks);
+      }
+    }
+  }
+
+  for (auto &group : groupJobs(false)) {
+    std::vector<RelMapTarget> targets;
+    for (auto *job : group) {
+      targets.push_back(RelMapTarget{ &job->indexFile->getVolume(),
+                                      &job->indexFile->getFileBlocks(),
+                                      job->ckpt.get() });
+    }
+
+    bd::Info() << "Processing relevance map.";
+    processRelMap(group[0]->clo, targets, group[0]->relMapStart);
+  }
+
+  std::vector<std::string> indexFiles;
+  for (auto &job : jobs) {
+    writeIndexFileToDisk(*(job.indexFile.get()), job.name, clo);
+    job.ckpt->remove();
+    indexFiles.push_back(job.name + ".bin");
+  }
+
+  writeStatsFile(clo, numThreads,
+                 std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count(),
+                 indexFiles);
+}
+
+
+/// \brief Generate tuples with number of blocks in the X, Y, and Z dimensions.
+/// Each string in the strs parameter is from an occurance of the -D
+/// command line option.
+///
+/// The strings in strs are 3-tuples of the form:
+///     XxYxZ, or X,Y,Z. 
+/// Where X, Y, and Z are the number of blocks in each dimension.
+bool
+makeNumBlocksTuples(std::vector<std::tuple<int, int, int>> &tups,
+                    std::vector<std::string> const &strs)
+{
+  if (strs.size() == 0) {
+    tups.push_back(std::make_tuple(1, 1, 1));
+    return true;
+  }
+
+  for (auto &s : strs) {
+    std::vector<std::string> split;
+    boost::split(split, s, boost::is_any_of("x,"), boost::token_compress_on);
+    if (split.size() < 3) {
+      bd::Err() << "Block dimensions tuple has less than three!";
+      return false;
+    }
+    int x{ std::stoi(split[0]) };
+    int y{ std::stoi(split[1]) };
+    int z{ std::stoi(split[2]) };
+    tups.push_back(std::make_tuple(x, y, z));
+  }
+  return true;
+}
+
+
+/// \brief Restrict the volume dimensions in \c clo to the region of interest.
+///
+/// Afterwards, clo.file_dims holds the dimensions of the raw file, clo.vol_dims
+/// the dimensions of the ROI, and clo.roi is set (to the whole volume if
+/// no ROI was given).
+/// \throws std::runtime_error if the ROI is not inside of the volume.
+void
+applyRoi(CommandLineOptions &clo)
+{
+  for (int d{ 0 }; d < 3; ++d) {
+    clo.file_dims[d] = clo.vol_dims[d];
+  }
+
+  if (clo.roi.empty()) {
+    for (int d{ 0 }; d < 3; ++d) {
+      clo.roi.hi[d] = clo.file_dims[d];
+    }
+    return;
+  }
+
+  for (int d{ 0 }; d < 3; ++d) {
+    if (clo.roi.hi[d] > clo.file_dims[d]) {
+      throw std::runtime_error("Region of interest " + to_string(clo.roi) +
+                                   " is outside of the volume.");
+    }
+    clo.vol_dims[d] = clo.roi.dim(d);
+  }
+
+  bd::Info() << "Processing region of interest " << to_string(clo.roi) << ", "
+             << clo.vol_dims[0] << "x" << clo.vol_dims[1] << "x" << clo.vol_dims[2]
+             << " voxels.";
+}
+
+
+/// \brief If a dat file was provided, populate \c clo with the options from
+/// that dat file.
+void
+loadDatFile(CommandLineOptions &clo)
+{
+  if (!clo.datFilePath.empty()) {
+
+    bd::DatFileData datfile;
+    bd::parseDat(clo.datFilePath, datfile);
+
+    clo.vol_dims[0] = datfile.rX;
+    clo.vol_dims[1] = datfile.rY;
+    clo.vol_dims[2] = datfile.rZ;
+
+    clo.dataType = bd::to_string(datfile.dataType);
+
+    bd::Info() << clo << std::endl; // print cmd line options
+
+  }
+}
+
+
+/// \throws std::runtime_error if rawfile can't be opened.
+void
+generate(CommandLineOptions &clo)
+{
+  loadDatFile(clo);
+  applyRoi(clo);
+
+  std::vector<std::tuple<int, int, int>> tuples;
+  makeNumBlocksTuples(tuples, clo.numBlocks);
+
+  // Decide what data type we have and call generateIndexFile() to kick off the processing.
+  bd::DataType type{ bd::to_dataType(clo.dataType) };
+
+  switch (type) {
+
+  case bd::DataType::UnsignedCharacter:
+    preproc::generateIndexFile<unsigned char>(clo, tuples, type);
+    break;
+
+  case bd::DataType::UnsignedShort:
+    preproc::generateIndexFile<unsigned short>(clo, tuples, type);
+    break;
+
+  case bd::DataType::Float:
+    preproc::generateIndexFile<float>(clo, tuples, type);
+    break;
+
+  default:
+    bd::Err() << "Unsupported/unknown datatype: " << clo.dataType << ".\n Exiting...";
+    break;
+
+  }
+}
+
+
+/// \brief Open a binary index file and print it to stdout or write it to json file.
+void
+convert(CommandLineOptions &clo)
+{
+
+  bool success;
+  std::unique_ptr<bd::IndexFile> index{
+      bd::IndexFile::fromBinaryIndexFile(clo.inFile, success) };
+
+  if (clo.printBlocks) {
+
+    // Print blocks in json format to standard out.
+    index->writeAsciiIndexFile(std::cout);
+
+  }
+  else {
+
+    // Otherwise, just write the blocks to a json text file.
+    // We can't use makeFileNameString() because we want to use the binary file's name.
+
+    auto startName = clo.inFile.rfind('/') + 1;
+    auto endName = startName + (clo.inFile.size() - clo.inFile.rfind('.'));
+
+    std::string name(clo.inFile, startName, endName);
+    name += ".json";
+
+    index->writeAsciiIndexFile(clo.outFileDirLocation + '/' + name);
+
+  }
+}
+
+
+
+/// \brief Merge the partial index files written by the shards of a sharded
+/// run into the index file the unsharded run would have written.
+///
+/// The shard of each partial file is taken from its '_shard<i>of<N>' suffix.
+/// Blocks never span shards, so the partial blocks are copied as they are and
+/// only the volume statistics are recomputed. The volume min/max is the one
+/// the shards used for relevance mapping. If the shards ran the min/max pass,
+/// the volume total and avg are the whole volume's, as the pass found them.
+/// With clo.useDataRange, which must match the shards', they are summed from
+/// the blocks like an unsharded run with --data-min/--data-max does.
+/// \throws std::runtime_error if the partial files don't make up the volume.
+void
+merge(CommandLineOptions &clo)
+{
+  loadDatFile(clo);
+  applyRoi(clo);
+
+  std::vector<std::tuple<int, int, int>> tuples;
+  if (!makeNumBlocksTuples(tuples, clo.numBlocks) || tuples.size() != 1) {
+    throw std::runtime_error("Merge needs exactly one block count (-D).");
+  }
+  std::tuple<int, int, int> const t{ tuples[0] };
+
+  bd::Volume minmax{ {clo.vol_dims[0], clo.vol_dims[1], clo.vol_dims[2]}, {1, 1, 1} };
+  std::unique_ptr<bd::IndexFile> indexFile{
+      makeIndexFile(clo, t, minmax, bd::to_dataType(clo.dataType)) };
+  bd::Volume &volume = indexFile->getVolume();
+  std::vector<bd::FileBlock> &blocks = indexFile->getFileBlocks();
+
+  uint64_t const nbx{ static_cast<uint64_t>(std::get<0>(t)) };
+  uint64_t const nby{ static_cast<uint64_t>(std::get<1>(t)) };
+  uint64_t const nbz{ static_cast<uint64_t>(std::get<2>(t)) };
+
+  std::regex const shardRegex{ "_shard([0-9]+)of([0-9]+)" };
+  std::vector<bool> seen;
+  std::vector<double> totals;
+  int count{ 0 };
+
+  for (auto const &path : clo.mergeFiles) {
+    std::smatch m;
+    std::string const stem{ fs::path(path).stem().string() };
+    if (!std::regex_search(stem, m, shardRegex)) {
+      throw std::runtime_error("No _shard<i>of<N> suffix in " + path);
+    }
+    int const i{ std::stoi(m[1]) };
+    int const n{ std::stoi(m[2]) };
+    if (count == 0) {
+      count = n;
+      seen.resize(n, false);
+    }
+    if (n != count || i >= n || seen[i]) {
+      throw std::runtime_error("Partial index file " + path + " doesn't belong with the others.");
+    }
+    seen[i] = true;
+
+    bool success{ false };
+    std::unique_ptr<bd::IndexFile> part{ bd::IndexFile::fromBinaryIndexFile(path, success) };
+    if (!success) {
+      throw std::runtime_error("Could not read partial index file " + path);
+    }
+
+    uint64_t const k0{ i * nbz / n };
+    uint64_t const k1{ ( i + 1 ) * nbz / n };
+    glm::u64vec3 const pbc{ part->getVolume().block_count() };
+    if (pbc.x != nbx || pbc.y != nby || pbc.z != k1 - k0) {
+      throw std::runtime_error("Partial index file " + path +
+                                   " has a different block count than expected.");
+    }
+
+    bd::Volume const &pv = part->getVolume();
+    if (i == 0) {
+      volume.min(pv.min());
+      volume.max(pv.max());
+      volume.avg(pv.avg());
+      volume.total(pv.total());
+    }
+    if (!clo.useDataRange) {
+      totals.push_back(pv.total());
+    }
+
+    for (auto const &pb : part->getFileBlocks()) {
+      uint64_t const gk{ pb.ijk_index[2] + k0 };
+      bd::FileBlock &b = blocks[pb.ijk_index[0] + nbx * ( pb.ijk_index[1] + nby * gk )];
+      b.min_val = pb.min_val;
+      b.max_val = pb.max_val;
+      b.avg_val = pb.avg_val;
+      b.total_val = pb.total_val;
+      b.rov = pb.rov;
+      b.empty_voxels = pb.empty_voxels;
+      b.is_empty = pb.is_empty;
+    }
+  }
+
+  for (int i{ 0 }; i < count; ++i) {
+    if (!seen[i]) {
+      throw std::runtime_error("Missing partial index file for shard " + std::to_string(i) +
+                                   " of " + std::to_string(count) + ".");
+    }
+  }
+
+  if (clo.useDataRange) {
+    setVolumeTotalFromBlocks(volume, blocks);
+  } else {
+    // Each shard's min/max pass read the whole volume, so they all have the
+    // same total. Shards given --data-min/--data-max only total their own
+    // blocks.
+    auto const mm = std::minmax_element(totals.begin(), totals.end());
+    if (*mm.second - *mm.first > 1e-9 * std::abs(*mm.second)) {
+      throw std::runtime_error("The partial index files have different volume totals, "
+                                   "give --merge the --data-min/--data-max the shards "
+                                   "were run with.");
+    }
+  }
+
+  auto minmaxE =
+      std::minmax_element(blocks.begin(),
+                          blocks.end(),
+                          [](bd::FileBlock const &lhs, bd::FileBlock const &rhs) -> bool {
+                            return lhs.rov < rhs.rov;
+                          });
+  volume.rovMin((*minmaxE.first).rov);
+  volume.rovMax((*minmaxE.second).rov);
+
+  std::string const name{ makeFileNameString(clo, t) };
+  bd::Info() << "Merged " << count << " shards into " << name;
+  writeIndexFileToDisk(*(indexFile.get()), name, clo);
+}
+
+} // namespace preproc
@@ -0,0 +1,55 @@
+#ifndef preproc_generate_h__
+#define preproc_generate_h__
+
+#include "cmdline.h"
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace preproc
+{
+
+/// \brief Path without extension of the index file for the block counts
+/// in \c nb.
+std::string
+makeFileNameString(const CommandLineOptions &clo, std::tuple<int, int, int> nb);
+
+
+/// \brief Parse the -D block count strings into tuples, 1x1x1 if there are none.
+bool
+makeNumBlocksTuples(std::vector<std::tuple<int, int, int>> &tups,
+                    std::vector<std::string> const &strs);
+
+
+/// \brief Restrict the volume dimensions in \c clo to the region of interest.
+/// \throws std::runtime_error if the ROI is not inside of the volume.
+void
+applyRoi(CommandLineOptions &clo);
+
+
+/// \brief If a dat file was provided, populate \c clo with the options from
+/// that dat file.
+void
+loadDatFile(CommandLineOptions &clo);
+
+
+/// \brief Write the index files for the raw file and block counts in \c clo.
+/// \throws std::runtime_error if the raw file can't be processed.
+void
+generate(CommandLineOptions &clo);
+
+
+/// \brief Open a binary index file and print it to stdout or write it to json file.
+void
+convert(CommandLineOptions &clo);
+
+
+/// \brief Merge the partial index files written by the shards of a sharded run.
+/// \throws std::runtime_error if the partial files don't make up the volume.
+void
+merge(CommandLineOptions &clo);
+
+} // namespace preproc
+
+#endif // ! preproc_generate_h__
@@ -0,0 +1,294 @@
+#ifndef preproc_gradientrelevance_h__
+#define preproc_gradientrelevance_h__
+
+#include "rawfile.h"
+#include "roi.h"
+#include "transferfunction2d.h"
+
+#include <bd/io/buffer.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Relevance of each voxel from a 2D transfer function over its value
+/// and gradient magnitude, with the gradient computed while streaming.
+///
+/// The raw buffers are linear runs of the volume, so the neighbors of a
+/// buffer's voxels are in the slab before and the slab after it. Those
+/// rows are kept in a halo window, the buffer's rows plus one slab on each
+/// side, that consecutive buffers move forward. Rows new to the window are
+/// copied from the buffer when it has all of the row, the others are read
+/// from the raw file with pread(), independent of the buffer reader. A ROI
+/// that doesn't span whole rows of the file needs the voxels on either side
+/// of its rows, so then every row is read.
+///
+/// Gradients are central differences like gmag's, with neighbors taken
+/// from the raw file even outside of the ROI, and clamped at the edges of
+/// the file. So a ROI or a shard gets the same relevance as the voxels
+/// would have in a run over the whole file.
+///
+/// Buffers must be given in increasing order of index offset.
+template<class Ty>
+class GradientRelevance
+{
+public:
+
+  /// \param gradMax Gradient magnitude that normalizes to 1, if 0 the
+  /// largest magnitude possible for the data range is used.
+  GradientRelevance(TransferFunction2D const &tf,
+                    double dataMin,
+                    double dataMax,
+                    double gradMax)
+      : m_tf{ tf }
+      , m_dataMin{ dataMin }
+      , m_invDiff{ dataMax > dataMin ? 1.0 / ( dataMax - dataMin ) : 0.0 }
+      , m_invGradMax{ 0.0 }
+      , m_file{ nullptr }
+      , m_fileDims{ 0, 0, 0 }
+      , m_extLo{ 0, 0, 0 }
+      , m_ext{ 0, 0, 0 }
+      , m_off{ 0, 0, 0 }
+      , m_haloFirst{ 0 }
+      , m_haloRows{ 0 }
+  {
+    if (gradMax <= 0.0) {
+      gradMax = ( dataMax - dataMin ) * std::sqrt(3.0) * 0.5;
+    }
+    m_invGradMax = gradMax > 0.0 ? 1.0 / gradMax : 0.0;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Buffers hold \c roi of \c file, a raw volume with dimensions
+  /// \c fileDims. An empty \c roi is the whole file.
+  void
+  set(RawFile const *file, uint64_t const fileDims[3], Roi const &roi)
+  {
+    m_file = file;
+    std::copy(fileDims, fileDims + 3, m_fileDims);
+    m_roi = roi;
+    if (m_roi.empty()) {
+      std::copy(fileDims, fileDims + 3, m_roi.hi);
+    }
+
+    // The ROI grown by one voxel where the file has one, every neighbor of
+    // a ROI voxel is inside of it.
+    for (int d{ 0 }; d < 3; ++d) {
+      uint64_t const lo{ m_roi.lo[d] > 0 ? m_roi.lo[d] - 1 : 0 };
+      uint64_t const hi{ std::min(m_roi.hi[d] + 1, fileDims[d]) };
+      m_extLo[d] = lo;
+      m_ext[d] = hi - lo;
+      m_off[d] = m_roi.lo[d] - lo;
+    }
+
+    m_haloFirst = 0;
+    m_haloRows = 0;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Write the relevance of each voxel in \c rawData to \c rmap.
+  /// \throws std::runtime_error if the halo can't be read.
+  void
+  operator()(bd::Buffer<Ty> const *rawData, double *rmap)
+  {
+    uint64_t const count{ rawData->getNumElements() };
+    if (count == 0) {
+      return;
+    }
+
+    uint64_t const w{ m_roi.dim(0) };
+    uint64_t const h{ m_roi.dim(1) };
+    uint64_t const start{ rawData->getIndexOffset() };
+    uint64_t const end{ start + count };
+    uint64_t const firstRow{ start / w };
+    uint64_t const lastRow{ ( end - 1 ) / w };
+
+    // Window rows: the buffer's rows and one slab of rows on either side.
+    uint64_t const extRows{ m_ext[1] * m_ext[2] };
+    uint64_t const lo{ extRow(firstRow) };
+    uint64_t const hi{ extRow(lastRow) + 1 };
+    moveHalo(lo > m_ext[1] ? lo - m_ext[1] : 0, std::min(hi + m_ext[1], extRows), *rawData);
+
+    Ty const *halo{ m_halo.data() };
+    uint64_t const ex{ m_ext[0] };
+    tbb::parallel_for(
+        tbb::blocked_range<uint64_t>{ firstRow, lastRow + 1 },
+        [&](tbb::blocked_range<uint64_t> const &rows) {
+          for (uint64_t r{ rows.begin() }; r != rows.end(); ++r) {
+            uint64_t const ey{ r % h + m_off[1] };
+            uint64_t const ez{ r / h + m_off[2] };
+            uint64_t const ey1{ ey + 1 < m_ext[1] ? ey + 1 : ey };
+            uint64_t const ey2{ ey > 0 ? ey - 1 : ey };
+            uint64_t const ez1{ ez + 1 < m_ext[2] ? ez + 1 : ez };
+            uint64_t const ez2{ ez > 0 ? ez - 1 : ez };
+
+            Ty const *row{ halo + ( ey + ez * m_ext[1] - m_haloFirst ) * ex };
+            Ty const *y1{ halo + ( ey1 + ez * m_ext[1] - m_haloFirst ) * ex };
+            Ty const *y2{ halo + ( ey2 + ez * m_ext[1] - m_haloFirst ) * ex };
+            Ty const *z1{ halo + ( ey + ez1 * m_ext[1] - m_haloFirst ) * ex };
+            Ty const *z2{ halo + ( ey + ez2 * m_ext[1] - m_haloFirst ) * ex };
+
+            // Only the part of the first and last rows that is in the buffer,
+            // out is the rmap of voxel xs of the row.
+            uint64_t const rowStart{ r * w };
+            uint64_t const xs{ rowStart < start ? start - rowStart : 0 };
+            uint64_t const xe{ std::min(w, end - rowStart) };
+            double *out{ rmap + ( rowStart + xs - start ) };
+
+            for (uint64_t x{ xs }; x < xe; ++x) {
+              uint64_t const i{ x + m_off[0] };
+              uint64_t const i1{ i + 1 < ex ? i + 1 : i };
+              uint64_t const i2{ i > 0 ? i - 1 : i };
+              double const dx{ ( double(row[i1]) - double(row[i2]) ) * 0.5 };
+              double const dy{ ( double(y1[i]) - double(y2[i]) ) * 0.5 };
+              double const dz{ ( double(z1[i]) - double(z2[i]) ) * 0.5 };
+              double const grad{ std::sqrt(dx * dx + dy * dy + dz * dz) };
+              out[x - xs] = m_tf.interpolate(( row[i] - m_dataMin ) * m_invDiff,
+                                            grad * m_invGradMax);
+            }
+          }
+        });
+  }
+
+
+private:
+
+  /// \brief Row of the grown ROI that ROI row \c r is.
+  uint64_t
+  extRow(uint64_t r) const
+  {
+    uint64_t const h{ m_roi.dim(1) };
+    return ( r % h + m_off[1] ) + ( r / h + m_off[2] ) * m_ext[1];
+  }
+
+
+  /// \brief Make the halo window hold rows [lo, hi) of the grown ROI,
+  /// keeping the rows it already has and taking what it can from \c buf.
+  void
+  moveHalo(uint64_t lo, uint64_t hi, bd::Buffer<Ty> const &buf)
+  {
+    uint64_t const ex{ m_ext[0] };
+    uint64_t const oldHi{ m_haloFirst + m_haloRows };
+    uint64_t readFrom{ lo };
+    if (m_haloRows > 0 && lo >= m_haloFirst && lo < oldHi) {
+      uint64_t const keep{ std::min(oldHi, hi) - lo };
+      std::memmove(m_halo.data(), m_halo.data() + ( lo - m_haloFirst ) * ex,
+                   keep * ex * sizeof(Ty));
+      readFrom = lo + keep;
+    }
+    if (m_halo.size() < ( hi - lo ) * ex) {
+      m_halo.resize(( hi - lo ) * ex);
+    }
+    m_haloFirst = lo;
+    m_haloRows = hi - lo;
+
+    readRows(readFrom, hi, buf);
+  }
+
+
+  /// \brief Fill rows [lo, hi) of the grown ROI in the halo window.
+  ///
+  /// Rows that are all in \c buf are copied from it, the others are read
+  /// from the file, rows that are consecutive in the file together.
+  void
+  readRows(uint64_t lo, uint64_t hi, bd::Buffer<Ty> const &buf)
+  {
+    uint64_t const ex{ m_ext[0] };
+    uint64_t const w{ m_roi.dim(0) };
+    uint64_t const h{ m_roi.dim(1) };
+    uint64_t const start{ buf.getIndexOffset() };
+    uint64_t const end{ start + buf.getNumElements() };
+    m_runs.clear();
+    for (uint64_t r{ lo }; r < hi; ++r) {
+      uint64_t const ey{ r % m_ext[1] };
+      uint64_t const ez{ r / m_ext[1] };
+      if (ex == w && ey >= m_off[1] && ey - m_off[1] < h &&
+          ez >= m_off[2] && ez - m_off[2] < m_roi.dim(2)) {
+        uint64_t const first{ ( ( ez - m_off[2] ) * h + ey - m_off[1] ) * w };
+        if (first >= start && first + w <= end) {
+          std::memcpy(m_halo.data() + ( r - m_haloFirst ) * ex,
+                      buf.getPtr() + ( first - start ), w * sizeof(Ty));
+          continue;
+        }
+      }
+
+      uint64_t const y{ m_extLo[1] + r % m_ext[1] };
+      uint64_t const z{ m_extLo[2] + r / m_ext[1] };
+      uint64_t const fileIdx{ ( z * m_fileDims[1] + y ) * m_fileDims[0] + m_extLo[0] };
+      if (!m_runs.empty()) {
+        Run &last = m_runs.back();
+        if (last.fileIdx + last.rows * ex == fileIdx && ex == m_fileDims[0]) {
+          ++last.rows;
+          continue;
+        }
+      }
+      m_runs.push_back({ fileIdx, r, 1 });
+    }
+
+    auto read = [this, ex](Run const &run) {
+      uint64_t const bytes{ run.rows * ex * sizeof(Ty) };
+      Ty *dest{ m_halo.data() + ( run.row - m_haloFirst ) * ex };
+      if (m_file->readAt(dest, bytes, run.fileIdx * sizeof(Ty)) != bytes) {
+        throw std::runtime_error("Short read in the gradient halo.");
+      }
+    };
+
+    // Same threshold as RoiReader, small numbers of runs are cheaper to
+    // issue from this thread.
+    size_t const parallelThreshold{ 64 };
+    if (m_runs.size() < parallelThreshold) {
+      for (Run const &run : m_runs) {
+        read(run);
+      }
+    } else {
+      tbb::parallel_for(tbb::blocked_range<size_t>{ 0, m_runs.size(), 16 },
+                        [&](tbb::blocked_range<size_t> const &range) {
+                          for (size_t i{ range.begin() }; i != range.end(); ++i) {
+                            read(m_runs[i]);
+                          }
+                        });
+    }
+  }
+
+
+  struct Run
+  {
+    uint64_t fileIdx; ///< Index of the first voxel of the run in the file.
+    uint64_t row;     ///< First grown ROI row of the run.
+    uint64_t rows;
+  };
+
+
+  TransferFunction2D const m_tf;
+  double const m_dataMin;
+  double const m_invDiff;
+  double m_invGradMax;
+
+  RawFile const *m_file;
+  uint64_t m_fileDims[3];
+  Roi m_roi;
+  uint64_t m_extLo[3]; ///< First voxel of the grown ROI in the file.
+  uint64_t m_ext[3];   ///< Dimensions of the grown ROI.
+  uint64_t m_off[3];   ///< Position of the ROI in the grown ROI.
+
+  std::vector<Ty> m_halo;
+  uint64_t m_haloFirst; ///< First grown ROI row in m_halo.
+  uint64_t m_haloRows;
+  std::vector<Run> m_runs;
+
+}; // class GradientRelevance
+
+} // namespace preproc
+
+#endif // ! preproc_gradientrelevance_h__
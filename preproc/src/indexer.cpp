@@ -0,0 +1,383 @@
+#include "indexer.h"
+#include "metrics.h"
+#include "processrelmap.h"
+#include "rawfile.h"
+#include "voxelopacityfunction.h"
+#include "parallel/parallelfor_voxelrelevance.h"
+#include "parallel/parallelreduce_blockminmax.h"
+#include "parallel/parallelreduce_blockrov.h"
+#include "parallel/parallelreduce_minmax.h"
+
+#include <bd/io/buffer.h>
+
+#include <tbb/tbb.h>
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <limits>
+#include <stdexcept>
+
+namespace preproc
+{
+
+struct BlockIndexer::Impl
+{
+  uint64_t dims[3];
+  bd::DataType type;
+  std::vector<std::unique_ptr<bd::IndexFile>> grids;
+  std::unique_ptr<bd::OpacityTransferFunction> tf;
+  bool haveRange;
+  double rangeMin;
+  double rangeMax;
+  std::string rawFileName;
+  std::string tfFileName;
+
+  uint64_t pushed;
+  bool finished;
+  double dataMin;
+  double dataMax;
+  double dataTotal;
+  std::vector<double> rel; ///< Voxel relevance of the current push.
+
+
+  uint64_t
+  total() const
+  {
+    return dims[0] * dims[1] * dims[2];
+  }
+
+
+  void
+  checkConfigurable() const
+  {
+    if (pushed > 0 || finished) {
+      throw std::logic_error("BlockIndexer can't be configured after voxels are pushed.");
+    }
+  }
+
+
+  template<class Ty>
+  void
+  push(Ty const *voxels, uint64_t count);
+};
+
+
+namespace
+{
+
+size_t
+sizeOf(bd::DataType type)
+{
+  switch (type) {
+  case bd::DataType::UnsignedCharacter:
+    return sizeof(unsigned char);
+  case bd::DataType::UnsignedShort:
+    return sizeof(unsigned short);
+  case bd::DataType::Float:
+    return sizeof(float);
+  default:
+    return 0;
+  }
+}
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+BlockIndexer::Impl::push(Ty const *voxels, uint64_t count)
+{
+  // The kernels only read through the buffer.
+  bd::Buffer<Ty> buf{ const_cast<Ty *>(voxels), count };
+  buf.setNumElements(count);
+  buf.setIndexOffset(pushed);
+  tbb::blocked_range<size_t> range{ 0, count };
+
+  {
+    StageTimer timer{ Stage::VolumeMinMax, count * sizeof(Ty), count, pushed };
+    ParallelReduceMinMax<Ty> mm{ &buf };
+    tbb::parallel_reduce(range, mm);
+    dataMin = std::min(dataMin, double(mm.min_value));
+    dataMax = std::max(dataMax, double(mm.max_value));
+    dataTotal += mm.tot_value;
+  }
+
+  for (auto &g : grids) {
+    StageTimer timer{ Stage::BlockMinMax, count * sizeof(Ty), count, pushed };
+    std::vector<bd::FileBlock> &blocks = g->getFileBlocks();
+    ParallelReduceBlockMinMax<Ty> minMax{ &g->getVolume(), &buf };
+    tbb::parallel_reduce(range, minMax);
+
+    MinMaxPairDouble const *pairs{ minMax.pairs() };
+    for (size_t i{ 0 }; i < blocks.size(); ++i) {
+      bd::FileBlock &b = blocks[i];
+      b.min_val = std::min(b.min_val, pairs[i].min);
+      b.max_val = std::max(b.max_val, pairs[i].max);
+      b.total_val += pairs[i].total;
+    }
+  }
+
+  if (tf && haveRange) {
+    rel.resize(count);
+    {
+      StageTimer timer{ Stage::Relevance, count * sizeof(Ty), count, pushed };
+      VoxelOpacityFunction<Ty> relFunc{ *tf, rangeMin, rangeMax };
+      double *map{ rel.data() };
+      ParallelForVoxelRelevance<Ty, VoxelOpacityFunction<Ty>, double *> relevance{
+          map, &buf, relFunc };
+      tbb::parallel_for(range, relevance);
+    }
+
+    bd::Buffer<double> relBuf{ rel.data(), count };
+    relBuf.setNumElements(count);
+    relBuf.setIndexOffset(pushed);
+    for (auto &g : grids) {
+      StageTimer timer{ Stage::BlockRov, count * sizeof(double), count, pushed };
+      std::vector<bd::FileBlock> &blocks = g->getFileBlocks();
+      ParallelReduceBlockRov rov{ &relBuf, &g->getVolume() };
+      tbb::parallel_reduce(range, rov);
+      double const *sums{ rov.relevances() };
+      for (size_t i{ 0 }; i < blocks.size(); ++i) {
+        blocks[i].rov += sums[i];
+      }
+    }
+  }
+
+  pushed += count;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+BlockIndexer::BlockIndexer(uint64_t const dims[3], bd::DataType type)
+    : m_impl{ new Impl }
+{
+  if (sizeOf(type) == 0) {
+    throw std::invalid_argument("BlockIndexer supports uchar, ushort and float voxels, not " +
+                                    bd::to_string(type) + ".");
+  }
+
+  std::copy(dims, dims + 3, m_impl->dims);
+  m_impl->type = type;
+  m_impl->haveRange = false;
+  m_impl->rangeMin = 0;
+  m_impl->rangeMax = 0;
+  m_impl->pushed = 0;
+  m_impl->finished = false;
+  m_impl->dataMin = std::numeric_limits<double>::max();
+  m_impl->dataMax = std::numeric_limits<double>::lowest();
+  m_impl->dataTotal = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+BlockIndexer::~BlockIndexer() = default;
+
+
+////////////////////////////////////////////////////////////////////////////////
+size_t
+BlockIndexer::addBlockGrid(uint64_t nbx, uint64_t nby, uint64_t nbz)
+{
+  m_impl->checkConfigurable();
+
+  std::unique_ptr<bd::IndexFile> indexFile{ new bd::IndexFile() };
+  indexFile->setRawFileName(m_impl->rawFileName);
+  indexFile->setTFFileName(m_impl->tfFileName);
+  indexFile->setVolume(bd::Volume{ { m_impl->dims[0], m_impl->dims[1], m_impl->dims[2] },
+                                   { nbx, nby, nbz } });
+  indexFile->init(m_impl->type);
+
+  m_impl->grids.push_back(std::move(indexFile));
+  return m_impl->grids.size() - 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+BlockIndexer::setTransferFunction(bd::OpacityTransferFunction const &tf)
+{
+  m_impl->checkConfigurable();
+  m_impl->tf.reset(new bd::OpacityTransferFunction{ tf });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+BlockIndexer::setDataRange(double min, double max)
+{
+  m_impl->checkConfigurable();
+  m_impl->haveRange = true;
+  m_impl->rangeMin = min;
+  m_impl->rangeMax = max;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+BlockIndexer::setFileNames(std::string const &rawFileName, std::string const &tfFileName)
+{
+  m_impl->rawFileName = rawFileName;
+  m_impl->tfFileName = tfFileName;
+  for (auto &g : m_impl->grids) {
+    g->setRawFileName(rawFileName);
+    g->setTFFileName(tfFileName);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+BlockIndexer::push(void const *voxels, uint64_t count)
+{
+  if (m_impl->finished) {
+    throw std::logic_error("BlockIndexer::push() after finish().");
+  }
+  if (count > m_impl->total() - m_impl->pushed) {
+    throw std::logic_error("BlockIndexer::push() past the end of the volume.");
+  }
+  if (m_impl->tf && !m_impl->haveRange) {
+    // Relevance is computed as voxels arrive, it can't wait for the range
+    // of the data.
+    throw std::logic_error("BlockIndexer::push() with a transfer function needs "
+                               "setDataRange() first, or use readFile().");
+  }
+  if (count == 0) {
+    return;
+  }
+
+  switch (m_impl->type) {
+  case bd::DataType::UnsignedCharacter:
+    m_impl->push(static_cast<unsigned char const *>(voxels), count);
+    break;
+  case bd::DataType::UnsignedShort:
+    m_impl->push(static_cast<unsigned short const *>(voxels), count);
+    break;
+  case bd::DataType::Float:
+    m_impl->push(static_cast<float const *>(voxels), count);
+    break;
+  default:
+    break;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+BlockIndexer::finish()
+{
+  if (m_impl->finished) {
+    return;
+  }
+  if (m_impl->pushed != m_impl->total()) {
+    throw std::logic_error("BlockIndexer::finish() with " +
+                               std::to_string(m_impl->total() - m_impl->pushed) +
+                               " voxels still to push.");
+  }
+  m_impl->finished = true;
+
+  bool const haveRov{ m_impl->tf && m_impl->haveRange };
+  for (auto &g : m_impl->grids) {
+    bd::Volume &volume = g->getVolume();
+    volume.min(m_impl->haveRange ? m_impl->rangeMin : m_impl->dataMin);
+    volume.max(m_impl->haveRange ? m_impl->rangeMax : m_impl->dataMax);
+    volume.total(m_impl->dataTotal);
+    volume.avg(m_impl->dataTotal / m_impl->total());
+
+    std::vector<bd::FileBlock> &blocks = g->getFileBlocks();
+    for (bd::FileBlock &b : blocks) {
+      b.avg_val = b.total_val / ( b.voxel_dims[0] * b.voxel_dims[1] * b.voxel_dims[2] );
+    }
+    if (haveRov) {
+      finishBlockRelevances(volume, blocks);
+    }
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+BlockIndexer::readFile(std::string const &path, uint64_t bufferSize)
+{
+  m_impl->checkConfigurable();
+
+  RawFile raw;
+  if (!raw.open(path)) {
+    throw std::runtime_error("Could not open file: " + path);
+  }
+
+  size_t const voxelSize{ sizeOf(m_impl->type) };
+  uint64_t const total{ m_impl->total() };
+  uint64_t const len{ std::max<uint64_t>(1, bufferSize / 2 / voxelSize) };
+  std::vector<char> mem[2]{ std::vector<char>(len * voxelSize),
+                            std::vector<char>(len * voxelSize) };
+
+  // Read the next buffer while the current one is pushed.
+  auto readNext = [&raw, &mem, voxelSize, total, len](int slot, uint64_t start) -> uint64_t {
+    uint64_t const count{ std::min(len, total - start) };
+    StageTimer timer{ Stage::RawRead, count * voxelSize, count, start };
+    uint64_t const bytes{ raw.readAt(mem[slot].data(), count * voxelSize, start * voxelSize) };
+    if (bytes != count * voxelSize) {
+      throw std::runtime_error("Short read of raw file.");
+    }
+    return count;
+  };
+
+  auto pass = [&](std::function<void(void const *, uint64_t)> const &consume) {
+    std::future<uint64_t> next{ std::async(std::launch::async, readNext, 0, 0) };
+    int slot{ 0 };
+    for (uint64_t start{ 0 }; start < total;) {
+      uint64_t const count{ next.get() };
+      if (start + count < total) {
+        next = std::async(std::launch::async, readNext, 1 - slot, start + count);
+      }
+      consume(mem[slot].data(), count);
+      start += count;
+      slot = 1 - slot;
+    }
+  };
+
+  // Relevance needs the range before the first voxel is pushed.
+  if (m_impl->tf && !m_impl->haveRange) {
+    BlockIndexer minmax{ m_impl->dims, m_impl->type };
+    pass([&minmax](void const *p, uint64_t n) { minmax.push(p, n); });
+    setDataRange(minmax.m_impl->dataMin, minmax.m_impl->dataMax);
+  }
+
+  pass([this](void const *p, uint64_t n) { push(p, n); });
+  finish();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+size_t
+BlockIndexer::numGrids() const
+{
+  return m_impl->grids.size();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bd::IndexFile const &
+BlockIndexer::indexFile(size_t grid) const
+{
+  return *m_impl->grids.at(grid);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<bd::FileBlock> const &
+BlockIndexer::blocks(size_t grid) const
+{
+  return m_impl->grids.at(grid)->getFileBlocks();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t
+BlockIndexer::voxelsPushed() const
+{
+  return m_impl->pushed;
+}
+
+} // namespace preproc
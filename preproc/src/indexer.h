@@ -0,0 +1,122 @@
+#ifndef preproc_indexer_h__
+#define preproc_indexer_h__
+
+#include <bd/io/datatypes.h>
+#include <bd/io/fileblock.h>
+#include <bd/io/indexfile.h>
+#include <bd/volume/transferfunction.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Computes the index file block statistics of a volume in process.
+///
+/// Configure the volume's block grids (and a transfer function for block
+/// relevance), then either push() the voxels in file order as they become
+/// available and finish(), or have readFile() read a raw file. Afterwards
+/// indexFile() has the same statistics preproc --generate writes.
+///
+/// Relevance needs the volume min/max to normalize voxel values. Pushed
+/// voxels arrive only once, so with a transfer function push mode needs the
+/// range from setDataRange(); readFile() does a min/max pass first if it
+/// was not given.
+///
+/// \code
+///   BlockIndexer ix{ { 512, 512, 256 }, bd::DataType::UnsignedShort };
+///   ix.addBlockGrid(16, 16, 8);
+///   ix.setTransferFunction(tf);
+///   ix.setDataRange(0, 4095);
+///   while (...) ix.push(slab, slabVoxels);
+///   ix.finish();
+///   ix.indexFile(0).writeBinaryIndexFile("vol_16-16-8.bin");
+/// \endcode
+class BlockIndexer
+{
+public:
+
+  /// \param dims Voxel dimensions of the volume.
+  /// \param type Type of the voxels that will be pushed or read.
+  /// \throws std::invalid_argument if \c type is not uchar, ushort or float.
+  BlockIndexer(uint64_t const dims[3], bd::DataType type);
+
+
+  ~BlockIndexer();
+
+
+  /// \brief Add a grid of \c nbx x \c nby x \c nbz blocks.
+  /// \return The index of the grid for indexFile().
+  /// \throws std::logic_error once voxels were pushed.
+  size_t
+  addBlockGrid(uint64_t nbx, uint64_t nby, uint64_t nbz);
+
+
+  /// \brief Compute block relevance with \c tf.
+  /// \throws std::logic_error once voxels were pushed.
+  void
+  setTransferFunction(bd::OpacityTransferFunction const &tf);
+
+
+  /// \brief Use [min, max] as the volume range instead of the range of the
+  /// data, for normalizing voxels for the transfer function.
+  /// \throws std::logic_error once voxels were pushed.
+  void
+  setDataRange(double min, double max);
+
+
+  /// \brief Names stored in the index files.
+  void
+  setFileNames(std::string const &rawFileName, std::string const &tfFileName);
+
+
+  /// \brief Add the next \c count voxels of the volume, in x, y, z order.
+  /// \c voxels is only read during the call.
+  /// \throws std::logic_error after finish(), past the end of the volume, or
+  ///         with a transfer function but no setDataRange().
+  void
+  push(void const *voxels, uint64_t count);
+
+
+  /// \brief Compute the averages and rovs once all voxels were pushed.
+  /// \throws std::logic_error if the volume is incomplete.
+  void
+  finish();
+
+
+  /// \brief Push all of the voxels of the raw file at \c path and finish().
+  /// \param bufferSize Bytes to read at a time, two buffers are used.
+  /// \throws std::runtime_error if the file could not be read.
+  void
+  readFile(std::string const &path, uint64_t bufferSize);
+
+
+  size_t
+  numGrids() const;
+
+
+  /// \brief The volume and blocks of grid \c grid.
+  bd::IndexFile const &
+  indexFile(size_t grid) const;
+
+
+  std::vector<bd::FileBlock> const &
+  blocks(size_t grid) const;
+
+
+  uint64_t
+  voxelsPushed() const;
+
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace preproc
+
+#endif // ! preproc_indexer_h__
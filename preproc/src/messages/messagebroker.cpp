@@ -1,8 +0,0 @@
-
-#include "messagebroker.h"
-
-namespace preproc
-{
-  Broker *Broker::m_myself = nullptr;
-}
-
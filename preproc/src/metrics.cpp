@@ -0,0 +1,294 @@
+#include "metrics.h"
+
+#include <bd/log/logger.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+namespace preproc
+{
+
+Metrics::Counters Metrics::s_stages[static_cast<int>(Stage::Count)]{};
+std::atomic<uint64_t> Metrics::s_passes[static_cast<int>(Pass::Count)]{};
+
+
+////////////////////////////////////////////////////////////////////////////////
+char const *
+to_string(Stage s)
+{
+  switch (s) {
+  case Stage::RawRead:
+    return "raw read";
+  case Stage::VolumeMinMax:
+    return "volume min/max";
+  case Stage::BlockMinMax:
+    return "block min/max";
+  case Stage::Relevance:
+    return "relevance";
+  case Stage::RMapWrite:
+    return "rmap write";
+  case Stage::RMapRead:
+    return "rmap read";
+  case Stage::BlockRov:
+    return "block rov";
+  default:
+    return "unknown";
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+char const *
+to_string(Pass p)
+{
+  switch (p) {
+  case Pass::VolumeMinMax:
+    return "volume min/max pass";
+  case Pass::RawFile:
+    return "raw file pass";
+  case Pass::RelMap:
+    return "relevance map pass";
+  case Pass::IndexWrite:
+    return "index write";
+  default:
+    return "unknown";
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+char const *
+waitsOn(Stage s)
+{
+  switch (s) {
+  case Stage::RawRead:
+  case Stage::Relevance:
+  case Stage::RMapRead:
+    return "empty";
+  default:
+    return "full";
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+StageSample
+Metrics::sample(Stage s)
+{
+  Counters const &c = s_stages[static_cast<int>(s)];
+  StageSample sample{ c.bytes.load(std::memory_order_relaxed),
+                      c.buffers.load(std::memory_order_relaxed),
+                      c.voxels.load(std::memory_order_relaxed),
+                      c.nanos.load(std::memory_order_relaxed),
+                      c.maxNanos.load(std::memory_order_relaxed),
+                      c.waits.load(std::memory_order_relaxed),
+                      c.waitNanos.load(std::memory_order_relaxed),
+                      {} };
+  for (size_t i{ 0 }; i < DEPTH_BUCKETS; ++i) {
+    sample.depth[i] = c.depth[i].load(std::memory_order_relaxed);
+  }
+  return sample;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Metrics::printSummary()
+{
+  double const MiB{ 1024.0 * 1024.0 };
+  double const sec{ 1e-9 };
+
+  bd::Info() << "Stage summary (work and wait times are summed over threads):";
+  for (int i{ 0 }; i < static_cast<int>(Stage::Count); ++i) {
+    Stage const st{ static_cast<Stage>(i) };
+    StageSample const s{ sample(st) };
+    if (s.buffers == 0 && s.waits == 0) {
+      continue;
+    }
+
+    // Mean depth of the waited on queue.
+    double depthSum{ 0 };
+    for (size_t d{ 0 }; d < DEPTH_BUCKETS; ++d) {
+      depthSum += double(d) * s.depth[d];
+    }
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3)
+       << std::setw(15) << to_string(st) << ": "
+       << s.bytes / MiB << " MiB in " << s.buffers << " buffers, work "
+       << s.nanos * sec << " s (" << ( s.buffers ? s.nanos * sec / s.buffers : 0 )
+       << " s/buffer, max " << s.maxNanos * sec << " s), blocked on "
+       << waitsOn(st) << " queue " << s.waitNanos * sec << " s, mean depth "
+       << ( s.waits ? depthSum / s.waits : 0 );
+    bd::Info() << ss.str();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Metrics::writeJson(std::ostream &os)
+{
+  os << "{\n";
+  for (int i{ 0 }; i < static_cast<int>(Stage::Count); ++i) {
+    Stage const st{ static_cast<Stage>(i) };
+    StageSample const s{ sample(st) };
+    os << "    \"" << to_string(st) << "\": {\n"
+       << "      \"bytes\": " << s.bytes << ",\n"
+       << "      \"buffers\": " << s.buffers << ",\n"
+       << "      \"voxels\": " << s.voxels << ",\n"
+       << "      \"work_ns\": " << s.nanos << ",\n"
+       << "      \"max_buffer_ns\": " << s.maxNanos << ",\n"
+       << "      \"waits_on\": \"" << waitsOn(st) << "\",\n"
+       << "      \"waits\": " << s.waits << ",\n"
+       << "      \"wait_ns\": " << s.waitNanos << ",\n"
+       << "      \"queue_depth_histogram\": [";
+    for (size_t d{ 0 }; d < DEPTH_BUCKETS; ++d) {
+      os << ( d ? ", " : "" ) << s.depth[d];
+    }
+    os << "]\n    }" << ( i + 1 < static_cast<int>(Stage::Count) ? "," : "" ) << "\n";
+  }
+  os << "  }";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Metrics::writePassJson(std::ostream &os)
+{
+  os << "{\n";
+  for (int i{ 0 }; i < static_cast<int>(Pass::Count); ++i) {
+    Pass const p{ static_cast<Pass>(i) };
+    os << "    \"" << to_string(p) << "\": " << passNanos(p) * 1e-9
+       << ( i + 1 < static_cast<int>(Pass::Count) ? "," : "" ) << "\n";
+  }
+  os << "  }";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Metrics::reset()
+{
+  for (Counters &c : s_stages) {
+    c.bytes.store(0, std::memory_order_relaxed);
+    c.buffers.store(0, std::memory_order_relaxed);
+    c.voxels.store(0, std::memory_order_relaxed);
+    c.nanos.store(0, std::memory_order_relaxed);
+    c.maxNanos.store(0, std::memory_order_relaxed);
+    c.waits.store(0, std::memory_order_relaxed);
+    c.waitNanos.store(0, std::memory_order_relaxed);
+    for (auto &d : c.depth) {
+      d.store(0, std::memory_order_relaxed);
+    }
+  }
+  for (auto &p : s_passes) {
+    p.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+MetricsReporter::MetricsReporter()
+    : m_stop{ false }
+    , m_interval{ 0 }
+    , m_last{}
+{
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+MetricsReporter::~MetricsReporter()
+{
+  stop();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+MetricsReporter::start(double intervalSeconds)
+{
+  // The report line is redrawn with \r, which only works on a terminal. In
+  // a log file or a pipe it would be one ever growing line.
+  if (intervalSeconds <= 0 || m_thread.joinable() || !::isatty(STDOUT_FILENO)) {
+    return;
+  }
+  m_interval = std::chrono::duration<double>(intervalSeconds);
+  m_stop = false;
+  m_thread = std::thread([this]() { run(); });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+MetricsReporter::stop()
+{
+  if (!m_thread.joinable()) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+MetricsReporter::run()
+{
+#ifdef __linux__
+  // Linux sets the nice value of a single thread given its thread id.
+  setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+#endif
+
+  auto last = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    bool const stopping{ m_cv.wait_for(lock, m_interval, [this]() { return m_stop; }) };
+
+    auto const now = std::chrono::steady_clock::now();
+    print(std::chrono::duration<double>(now - last).count());
+    last = now;
+
+    if (stopping) {
+      break;
+    }
+  }
+  std::cout << std::endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+MetricsReporter::print(double seconds)
+{
+  double const MiB{ 1024.0 * 1024.0 };
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1);
+  for (int i{ 0 }; i < static_cast<int>(Stage::Count); ++i) {
+    StageSample const s{ Metrics::sample(static_cast<Stage>(i)) };
+    if (s.buffers == 0) {
+      continue;
+    }
+    double const rate{ seconds > 0 ? ( s.bytes - m_last[i].bytes ) / MiB / seconds : 0 };
+    ss << to_string(static_cast<Stage>(i)) << ": " << s.bytes / MiB << " MiB ("
+       << rate << " MiB/s)  ";
+    m_last[i] = s;
+  }
+
+  std::cout << "\r" << ss.str() << std::flush;
+}
+
+} // namespace preproc
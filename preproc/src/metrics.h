@@ -0,0 +1,317 @@
+#ifndef preproc_metrics_h__
+#define preproc_metrics_h__
+
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+namespace preproc
+{
+
+/// \brief The stages of the pipeline that report metrics.
+enum class Stage : int
+{
+  RawRead,      ///< Reading raw file buffers.
+  VolumeMinMax, ///< Volume min/max reduction.
+  BlockMinMax,  ///< Block min/max/total reduction, once per block count tuple.
+  Relevance,    ///< Voxel relevance (rmap) generation.
+  RMapWrite,    ///< Writing rmap buffers.
+  RMapRead,     ///< Reading rmap buffers.
+  BlockRov,     ///< Block relevance reduction, once per block count tuple.
+  Count
+};
+
+
+char const *
+to_string(Stage s);
+
+
+/// \brief The passes of a run over the whole input, timed end to end.
+enum class Pass : int
+{
+  VolumeMinMax, ///< Volume min/max pass over the raw file.
+  RawFile,      ///< Raw file pass, block statistics and rmap generation.
+  RelMap,       ///< Relevance map pass, block rov.
+  IndexWrite,   ///< Writing the index files.
+  Count
+};
+
+
+char const *
+to_string(Pass p);
+
+
+/// \brief The queue a stage blocks on, "empty" if it waits for buffers to
+/// fill, "full" if it waits for buffers to consume.
+char const *
+waitsOn(Stage s);
+
+
+/// \brief Queue depths 0 to DEPTH_BUCKETS - 2 are counted on their own, the
+/// last bucket counts all deeper queues.
+size_t const DEPTH_BUCKETS{ 17 };
+
+
+/// \brief A copy of the counters of a stage.
+struct StageSample
+{
+  uint64_t bytes;
+  uint64_t buffers;
+  uint64_t voxels;
+  uint64_t nanos;    ///< Time spent working on buffers.
+  uint64_t maxNanos; ///< Longest time spent on one buffer.
+  uint64_t waits;    ///< Number of pops from the queue the stage waits on.
+  uint64_t waitNanos;
+  uint64_t depth[DEPTH_BUCKETS]; ///< Queue depth seen by each pop.
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Process wide, lock-free counters for each Stage.
+///
+/// Recording is a handful of relaxed atomic adds on a cache line of its own
+/// for each stage, so it is cheap enough to do for every buffer. The counters
+/// are only read by the MetricsReporter and at the end of a run.
+class Metrics
+{
+public:
+
+  /// \brief Record that a buffer of \c voxels voxels (\c bytes bytes) went
+  /// through stage \c s in \c nanos nanoseconds.
+  static void
+  add(Stage s, uint64_t bytes, uint64_t voxels, uint64_t nanos)
+  {
+    Counters &c = s_stages[static_cast<int>(s)];
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    c.buffers.fetch_add(1, std::memory_order_relaxed);
+    c.voxels.fetch_add(voxels, std::memory_order_relaxed);
+    c.nanos.fetch_add(nanos, std::memory_order_relaxed);
+
+    uint64_t prev{ c.maxNanos.load(std::memory_order_relaxed) };
+    while (prev < nanos &&
+        !c.maxNanos.compare_exchange_weak(prev, nanos, std::memory_order_relaxed)) {
+    }
+  }
+
+
+  /// \brief Record that stage \c s blocked for \c nanos nanoseconds popping
+  /// from its queue, which held \c depth buffers when the pop started.
+  static void
+  addWait(Stage s, size_t depth, uint64_t nanos)
+  {
+    Counters &c = s_stages[static_cast<int>(s)];
+    c.waits.fetch_add(1, std::memory_order_relaxed);
+    c.waitNanos.fetch_add(nanos, std::memory_order_relaxed);
+    c.depth[depth < DEPTH_BUCKETS ? depth : DEPTH_BUCKETS - 1].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+
+  /// \brief Record that pass \c p ran for \c nanos nanoseconds.
+  static void
+  addPass(Pass p, uint64_t nanos)
+  {
+    s_passes[static_cast<int>(p)].fetch_add(nanos, std::memory_order_relaxed);
+  }
+
+
+  static StageSample
+  sample(Stage s);
+
+
+  /// \brief Total nanoseconds spent in pass \c p.
+  static uint64_t
+  passNanos(Pass p)
+  {
+    return s_passes[static_cast<int>(p)].load(std::memory_order_relaxed);
+  }
+
+
+  /// \brief Log a table of the counters of each stage that did any work.
+  static void
+  printSummary();
+
+
+  /// \brief Write the counters of all of the stages as a json object.
+  static void
+  writeJson(std::ostream &os);
+
+
+  /// \brief Write the seconds spent in each pass as a json object.
+  static void
+  writePassJson(std::ostream &os);
+
+
+  /// \brief Zero all of the counters.
+  static void
+  reset();
+
+
+private:
+  struct alignas(64) Counters
+  {
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> buffers;
+    std::atomic<uint64_t> voxels;
+    std::atomic<uint64_t> nanos;
+    std::atomic<uint64_t> maxNanos;
+    std::atomic<uint64_t> waits;
+    std::atomic<uint64_t> waitNanos;
+    std::atomic<uint64_t> depth[DEPTH_BUCKETS];
+  };
+
+  static Counters s_stages[static_cast<int>(Stage::Count)];
+  static std::atomic<uint64_t> s_passes[static_cast<int>(Pass::Count)];
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Times its scope and records it to a Stage when it is destroyed.
+///
+/// With --trace, the scope is also recorded as a span named for the stage.
+class StageTimer
+{
+public:
+  /// \param offset Voxel index of the buffer, for the trace.
+  StageTimer(Stage s, uint64_t bytes, uint64_t voxels, uint64_t offset = 0)
+      : m_stage{ s }
+      , m_bytes{ bytes }
+      , m_voxels{ voxels }
+      , m_offset{ offset }
+      , m_start{ std::chrono::steady_clock::now() }
+  {
+  }
+
+
+  ~StageTimer()
+  {
+    auto const end = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds const ns{ end - m_start };
+    Metrics::add(m_stage, m_bytes, m_voxels, static_cast<uint64_t>(ns.count()));
+#ifdef PREPROC_TRACE
+    if (Trace::enabled()) {
+      Trace::record(to_string(m_stage), m_start, end, m_offset, m_voxels);
+    }
+#endif
+  }
+
+
+  /// \brief Change the amount recorded, for when it is only known at the end.
+  void
+  setAmount(uint64_t bytes, uint64_t voxels)
+  {
+    m_bytes = bytes;
+    m_voxels = voxels;
+  }
+
+
+private:
+  Stage const m_stage;
+  uint64_t m_bytes;
+  uint64_t m_voxels;
+  uint64_t const m_offset;
+  std::chrono::steady_clock::time_point const m_start;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Times its scope and records it to a Pass when it is destroyed.
+///
+/// With --trace, the scope is also recorded as a span named for the pass.
+class PassTimer
+{
+public:
+  /// \param offset Voxel the pass starts at, for the trace.
+  explicit PassTimer(Pass p, uint64_t offset = 0)
+      : m_pass{ p }
+      , m_offset{ offset }
+      , m_start{ std::chrono::steady_clock::now() }
+  {
+  }
+
+
+  ~PassTimer()
+  {
+    auto const end = std::chrono::steady_clock::now();
+    std::chrono::nanoseconds const ns{ end - m_start };
+    Metrics::addPass(m_pass, static_cast<uint64_t>(ns.count()));
+#ifdef PREPROC_TRACE
+    if (Trace::enabled()) {
+      Trace::record(to_string(m_pass), m_start, end, m_offset, 0);
+    }
+#endif
+  }
+
+
+private:
+  Pass const m_pass;
+  uint64_t const m_offset;
+  std::chrono::steady_clock::time_point const m_start;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pop from \c q on behalf of stage \c s, recording how long the pop
+/// blocked and how deep the queue was.
+template<class Queue>
+auto
+timedPop(Queue &q, Stage s) -> decltype(q.pop())
+{
+  size_t const depth{ q.size() };
+  auto const start = std::chrono::steady_clock::now();
+  auto item = q.pop();
+  std::chrono::nanoseconds const ns{ std::chrono::steady_clock::now() - start };
+  Metrics::addWait(s, depth, static_cast<uint64_t>(ns.count()));
+  return item;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A low priority thread that periodically samples the Metrics and
+/// prints progress and throughput to stdout, if stdout is a terminal.
+class MetricsReporter
+{
+public:
+  MetricsReporter();
+
+
+  ~MetricsReporter();
+
+
+  /// \brief Start reporting every \c intervalSeconds, does nothing if it is 0
+  /// or stdout is not a terminal.
+  void
+  start(double intervalSeconds);
+
+
+  /// \brief Stop the reporter thread after it prints one last time.
+  void
+  stop();
+
+
+private:
+  void
+  run();
+
+
+  void
+  print(double seconds);
+
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_stop;
+  std::chrono::duration<double> m_interval;
+  StageSample m_last[static_cast<int>(Stage::Count)];
+};
+
+} // namespace preproc
+
+#endif // ! preproc_metrics_h__
@@ -0,0 +1,110 @@
+#ifndef preproc_histogrambinning_h__
+#define preproc_histogrambinning_h__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The buckets of a histogram with each bucket's count and the min
+/// and max value counted in it.
+struct HistogramBuckets
+{
+  std::vector<long long> count;
+  std::vector<double> min; ///< max double if the bucket is empty.
+  std::vector<double> max; ///< lowest double if the bucket is empty.
+  long long total;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief How values are mapped to histogram buckets.
+struct HistogramBinning
+{
+  enum class Scale
+  {
+    Exact,  ///< One bucket per value of an 8 or 16 bit unsigned type.
+    Linear, ///< round((v - min) / (max - min) * (buckets - 1))
+    Log     ///< round(log(1 + v - min) / log(1 + max - min) * (buckets - 1))
+  };
+
+
+  /// \brief A bucket for each value of \c Ty.
+  template<class Ty>
+  static HistogramBinning
+  exact()
+  {
+    static_assert(std::is_unsigned<Ty>::value && sizeof(Ty) <= 2,
+                  "Only 8 and 16 bit unsigned types have exact histograms.");
+    return HistogramBinning{ Scale::Exact, size_t(1) << ( 8 * sizeof(Ty) ), 0.0,
+                             double(std::numeric_limits<Ty>::max()) };
+  }
+
+
+  /// \brief Unclamped position of \c v, bucket b is the positions in [b, b + 1).
+  double
+  position(double v) const
+  {
+    double const last{ double(buckets - 1) };
+    switch (scale) {
+    case Scale::Exact:
+      return v;
+    case Scale::Linear:
+      return max > min ? ( v - min ) * ( last / ( max - min ) ) + 0.5 : 0.0;
+    case Scale::Log:
+      return max > min ? std::log1p(std::max(0.0, v - min)) * ( last / std::log1p(max - min) ) + 0.5
+                       : 0.0;
+    }
+    return 0.0;
+  }
+
+
+  /// \brief The value at position \c p, the inverse of position().
+  double
+  value(double p) const
+  {
+    double const last{ double(buckets - 1) };
+    if (scale == Scale::Exact) {
+      return p;
+    }
+    if (!( max > min ) || last <= 0.0) {
+      return min;
+    }
+    return scale == Scale::Linear ?
+           min + ( p - 0.5 ) * ( ( max - min ) / last ) :
+           min + std::expm1(( p - 0.5 ) * ( std::log1p(max - min) / last ));
+  }
+
+
+  /// \brief Bucket of \c v, values outside of [min, max] and NaNs are
+  /// clamped to the first or last bucket.
+  size_t
+  bucket(double v) const
+  {
+    double const last{ double(buckets - 1) };
+    return static_cast<size_t>(std::min(last, std::max(0.0, position(v))));
+  }
+
+
+  std::string
+  name() const
+  {
+    return scale == Scale::Exact ? "exact" : scale == Scale::Linear ? "linear" : "log";
+  }
+
+
+  Scale scale;
+  size_t buckets;
+  double min;
+  double max;
+};
+
+} // namespace preproc
+
+#endif // ! preproc_histogrambinning_h__
@@ -0,0 +1,279 @@
+#ifndef preproc_loghistogram_h__
+#define preproc_loghistogram_h__
+
+#include "histogrambinning.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A fine histogram of float values with log spaced bins, for when
+/// the value range isn't known until all of the values have been seen.
+///
+/// A value's bin is the top 1 + 8 + SUB_BITS bits of its float bit
+/// pattern, so a bin is at most 2^-SUB_BITS of its value wide wherever the
+/// values are. Bins are allocated a power of two (one exponent) at a time
+/// when the first value lands in it, so only the exponents the data uses
+/// take memory. Each bin has its count and the min and max value counted
+/// in it.
+///
+/// Not thread safe, each thread counts into its own LogHistogram and they
+/// are merged.
+class LogHistogram
+{
+public:
+
+  /// Mantissa bits in a bin index, bins are 2^-11 (0.05%) of their value wide.
+  static int const SUB_BITS{ 11 };
+
+
+  LogHistogram()
+      : m_groups(GROUPS)
+  {
+  }
+
+
+  LogHistogram(LogHistogram &&) = default;
+  LogHistogram &operator=(LogHistogram &&) = default;
+
+
+  void
+  add(float v)
+  {
+    uint32_t const key{ orderedKey(v) };
+    Group *g{ m_groups[key >> 23].get() };
+    if (g == nullptr) {
+      g = ( m_groups[key >> 23] = std::unique_ptr<Group>(new Group()) ).get();
+    }
+    uint32_t const s{ ( key >> ( 23 - SUB_BITS ) ) & ( SUBS - 1 ) };
+    g->count[s] += 1;
+    g->min[s] = std::min(g->min[s], v);
+    g->max[s] = std::max(g->max[s], v);
+  }
+
+
+  /// \brief Add the counts of \c o.
+  void
+  merge(LogHistogram const &o)
+  {
+    for (size_t i{ 0 }; i < GROUPS; ++i) {
+      Group const *src{ o.m_groups[i].get() };
+      if (src == nullptr) {
+        continue;
+      }
+      if (!m_groups[i]) {
+        m_groups[i].reset(new Group());
+      }
+      Group *dst{ m_groups[i].get() };
+      for (uint32_t s{ 0 }; s < SUBS; ++s) {
+        dst->count[s] += src->count[s];
+        dst->min[s] = std::min(dst->min[s], src->min[s]);
+        dst->max[s] = std::max(dst->max[s], src->max[s]);
+      }
+    }
+  }
+
+
+  /// \brief Call fn(count, min, max) for each non-empty bin in increasing
+  /// order of value. NaNs are in bins that have min > max.
+  template<class Fn>
+  void
+  forEachBin(Fn fn) const
+  {
+    for (size_t i{ 0 }; i < GROUPS; ++i) {
+      Group const *g{ m_groups[i].get() };
+      if (g == nullptr) {
+        continue;
+      }
+      for (uint32_t s{ 0 }; s < SUBS; ++s) {
+        if (g->count[s] != 0) {
+          fn(g->count[s], double(g->min[s]), double(g->max[s]));
+        }
+      }
+    }
+  }
+
+
+  /// \brief Smallest and largest (non-NaN) value counted, min > max if none.
+  void
+  range(double &min, double &max) const
+  {
+    min = std::numeric_limits<double>::max();
+    max = std::numeric_limits<double>::lowest();
+    forEachBin([&min, &max](long long, double lo, double hi) {
+      if (lo <= hi) {
+        min = std::min(min, lo);
+        max = std::max(max, hi);
+      }
+    });
+  }
+
+
+  /// \brief The values at fractions \c qs (in [0, 1]) of the sorted
+  /// (non-NaN) values, NaN if there are none.
+  ///
+  /// The k-th smallest value for q = k / n is in a known bin, and is
+  /// interpolated between that bin's min and max, so it is off by at most
+  /// the width of the bin: 2^-SUB_BITS of the value.
+  std::vector<double>
+  quantiles(std::vector<double> const &qs) const
+  {
+    long long n{ 0 };
+    forEachBin([&n](long long count, double lo, double hi) {
+      if (lo <= hi) {
+        n += count;
+      }
+    });
+
+    std::vector<double> result(qs.size(), std::numeric_limits<double>::quiet_NaN());
+    if (n == 0) {
+      return result;
+    }
+    for (size_t i{ 0 }; i < qs.size(); ++i) {
+      long long const k{ rank(qs[i], n) };
+      long long before{ 0 };
+      bool found{ false };
+      forEachBin([&](long long count, double lo, double hi) {
+        if (found || !( lo <= hi )) {
+          return;
+        }
+        if (before + count >= k) {
+          double const t{ count > 1 ? double(k - before - 1) / double(count - 1) : 0.0 };
+          result[i] = lo + ( hi - lo ) * t;
+          found = true;
+        }
+        before += count;
+      });
+    }
+    return result;
+  }
+
+
+  /// \brief 1-based rank of the value at fraction \c q of \c n sorted values.
+  static long long
+  rank(double q, long long n)
+  {
+    // q usually comes from a percentage, 99.9 / 100 is a little over 0.999,
+    // which mustn't push an exact rank to the next one.
+    double const x{ std::min(1.0, std::max(0.0, q)) * n };
+    return std::min(n, std::max(1LL, static_cast<long long>(std::ceil(x - x * 1e-12))));
+  }
+
+
+  /// \brief Redistribute the bins into the buckets of \c binning.
+  ///
+  /// A bin that is inside of one bucket goes there with its exact min/max.
+  /// A bin that straddles buckets is split between them in proportion to
+  /// how much of the bin's [min, max] each bucket covers, and those buckets
+  /// get the part of [min, max] that they cover as min/max.
+  /// \param[out] split If not null, the number of values in split bins.
+  HistogramBuckets
+  rebin(HistogramBinning const &binning, long long *split = nullptr) const
+  {
+    size_t const n{ binning.buckets };
+    HistogramBuckets h{ std::vector<long long>(n, 0),
+                        std::vector<double>(n, std::numeric_limits<double>::max()),
+                        std::vector<double>(n, std::numeric_limits<double>::lowest()),
+                        0 };
+    long long splitCount{ 0 };
+
+    auto put = [&h](size_t b, long long count, double lo, double hi) {
+      h.count[b] += count;
+      h.min[b] = std::min(h.min[b], lo);
+      h.max[b] = std::max(h.max[b], hi);
+    };
+
+    forEachBin([&](long long count, double lo, double hi) {
+      h.total += count;
+      if (!( lo <= hi )) {
+        // NaNs go in the first bucket, like HistogramBinning::bucket().
+        h.count[0] += count;
+        return;
+      }
+
+      size_t const b0{ binning.bucket(lo) };
+      size_t const b1{ binning.bucket(hi) };
+      if (b0 == b1) {
+        put(b0, count, lo, hi);
+        return;
+      }
+
+      splitCount += count;
+      double const p0{ clampPosition(binning, binning.position(lo)) };
+      double const p1{ clampPosition(binning, binning.position(hi)) };
+      double const width{ p1 - p0 };
+      long long given{ 0 };
+      for (size_t b{ b0 }; b <= b1; ++b) {
+        // Share of [p0, p1] up to the end of bucket b, rounded so the
+        // shares add up to count.
+        double const end{ b == b1 ? p1 : std::min(p1, double(b + 1)) };
+        long long const upTo{ b == b1 ? count : std::llround(( end - p0 ) / width * count) };
+        if (upTo > given) {
+          double const start{ std::max(p0, double(b)) };
+          put(b, upTo - given,
+              std::max(lo, binning.value(start)), std::min(hi, binning.value(end)));
+          given = upTo;
+        }
+      }
+    });
+
+    if (split != nullptr) {
+      *split = splitCount;
+    }
+    return h;
+  }
+
+
+private:
+
+  static size_t const GROUPS{ 512 };
+  static uint32_t const SUBS{ 1u << SUB_BITS };
+
+
+  struct Group
+  {
+    Group()
+    {
+      std::fill(count, count + SUBS, 0);
+      std::fill(min, min + SUBS, std::numeric_limits<float>::infinity());
+      std::fill(max, max + SUBS, -std::numeric_limits<float>::infinity());
+    }
+
+    long long count[SUBS];
+    float min[SUBS];
+    float max[SUBS];
+  };
+
+
+  /// \brief The float's bits, flipped so that they sort like the values.
+  static uint32_t
+  orderedKey(float v)
+  {
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return ( bits & 0x80000000u ) ? ~bits : ( bits | 0x80000000u );
+  }
+
+
+  static double
+  clampPosition(HistogramBinning const &binning, double p)
+  {
+    return std::min(double(binning.buckets), std::max(0.0, p));
+  }
+
+
+  std::vector<std::unique_ptr<Group>> m_groups; ///< One per sign and exponent.
+
+}; // class LogHistogram
+
+} // namespace preproc
+
+#endif // ! preproc_loghistogram_h__
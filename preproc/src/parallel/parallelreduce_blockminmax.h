@@ -121,9 +121,9 @@ public:
         if (val < b->min) { b->min = val; }
         if (val > b->max) { b->max = val; }
         b->total = b->total + static_cast<double>(val);
-      } else {
-        bd::Warn() << "Block index out of range: " << bI << ", " << bJ << ", " << bK;
       }
+      // Voxels past the last whole block of a dimension that isn't a
+      // multiple of the block count are in no block.
     }
   }
 
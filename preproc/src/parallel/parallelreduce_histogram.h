@@ -8,52 +8,48 @@
 #include <bd/io/buffer.h>
 #include <tbb/tbb.h>
 #include <limits>
+#include <vector>
 namespace preproc
 {
 namespace
 {
 
+/// Default bucket count.
 const long long NUM_BUCKETS{ 1536 };
-const long long MAX_IDX{ NUM_BUCKETS - 1 };
 
 }
 
+/// \brief Histogram of a buffer in \c numBuckets buckets, value v goes in
+/// bucket round((v - rawmin) / (rawmax - rawmin) * (numBuckets - 1)).
+/// \note Use this with TBB's parallel_reduce, for many buffers or exact and
+/// log binning see ThreadHistogram.
 template<class Ty>
 class ParallelReduceHistogram
 {
 public:
-  ParallelReduceHistogram(bd::Buffer<Ty> *b, Ty rawmin, Ty rawmax)
+  ParallelReduceHistogram(bd::Buffer<Ty> *b, Ty rawmin, Ty rawmax,
+                          long long numBuckets = NUM_BUCKETS)
       : m_data{ b->getPtr() }
         , m_rawmin{ rawmin }
         , m_rawmax{ rawmax }
+        , m_maxIdx{ numBuckets - 1 }
         , m_totalCount{ 0 }
+        , m_buckets(numBuckets, 0)
+        , m_histMin(numBuckets, std::numeric_limits<Ty>::max())
+        , m_histMax(numBuckets, std::numeric_limits<Ty>::lowest())
   {
-    m_buckets = new unsigned int[ NUM_BUCKETS ];
-    m_histMin = new Ty[ NUM_BUCKETS ];
-    m_histMax = new Ty[ NUM_BUCKETS ];
-
-    for(int i{ 0 }; i < NUM_BUCKETS; ++i){
-      m_buckets[i] = 0;
-      m_histMin[i] = std::numeric_limits<Ty>::max();
-      m_histMax[i] = std::numeric_limits<Ty>::lowest();
-    }
   }
 
   ParallelReduceHistogram(ParallelReduceHistogram<Ty> &o, tbb::split)
       : m_data{ o.m_data }
         , m_rawmin{ o.m_rawmin }
         , m_rawmax{ o.m_rawmax }
+        , m_maxIdx{ o.m_maxIdx }
         , m_totalCount{ 0 }
+        , m_buckets(o.m_buckets.size(), 0)
+        , m_histMin(o.m_buckets.size(), std::numeric_limits<Ty>::max())
+        , m_histMax(o.m_buckets.size(), std::numeric_limits<Ty>::lowest())
   {
-    m_buckets = new unsigned int[ NUM_BUCKETS ];
-    m_histMin = new Ty[ NUM_BUCKETS ];
-    m_histMax = new Ty[ NUM_BUCKETS ];
-
-    for(int i{ 0 }; i < NUM_BUCKETS; ++i){
-      m_buckets[i] = 0;
-      m_histMin[i] = std::numeric_limits<Ty>::max();
-      m_histMax[i] = std::numeric_limits<Ty>::lowest();
-    }
   }
 
   ~ParallelReduceHistogram() { }
@@ -61,12 +57,13 @@ public:
   void
   operator()(tbb::blocked_range<size_t> const &r)
   {
-    unsigned int * const buckets{ m_buckets };
+    unsigned int * const buckets{ m_buckets.data() };
     Ty const * const data{ m_data };
     double const rawmin{ static_cast<double>(m_rawmin) };
     double const rawmax{ static_cast<double>(m_rawmax) };
-    Ty * const histmin{ m_histMin };
-    Ty * const histmax{ m_histMax };
+    long long const maxIdx{ m_maxIdx };
+    Ty * const histmin{ m_histMin.data() };
+    Ty * const histmax{ m_histMax.data() };
     long long totalCount{ m_totalCount };
 
 
@@ -75,13 +72,13 @@ public:
 
       // Compute the bucket index.
       long long idx{
-          static_cast<long long>((val - rawmin)/(rawmax - rawmin) * MAX_IDX + 0.5) };
+          static_cast<long long>((val - rawmin)/(rawmax - rawmin) * maxIdx + 0.5) };
 
       // Reset idx if it is out of range.
 //      if (idx < 0)
 //        idx = 0;
-      if (idx > MAX_IDX)
-        idx = MAX_IDX;
+      if (idx > maxIdx)
+        idx = maxIdx;
 
       if (val < histmin[idx]) histmin[idx] = val;
       if (val > histmax[idx]) histmax[idx] = val;
@@ -98,7 +95,7 @@ public:
   join(ParallelReduceHistogram<Ty> const &rhs)
   {
     // Accumulate histogram frequences from the joinee.
-    for(size_t i{ 0 }; i < NUM_BUCKETS; ++i) {
+    for(size_t i{ 0 }; i < m_buckets.size(); ++i) {
       m_buckets[i] += rhs.m_buckets[i];
 
       if (rhs.m_histMin[i] < m_histMin[i])
@@ -110,19 +107,21 @@ public:
     m_totalCount += rhs.m_totalCount;
   }
 
-  unsigned int const * getBuckets() const { return m_buckets; }
-  Ty const * getHistMin() const { return m_histMin; }
-  Ty const * getHistMax() const { return m_histMax; }
+  unsigned int const * getBuckets() const { return m_buckets.data(); }
+  Ty const * getHistMin() const { return m_histMin.data(); }
+  Ty const * getHistMax() const { return m_histMax.data(); }
+  long long getNumBuckets() const { return m_maxIdx + 1; }
   long long getTotalCount() const { return m_totalCount; }
 
 private:
   Ty const * const m_data;
   Ty const m_rawmin;
   Ty const m_rawmax;
+  long long const m_maxIdx;
   long long m_totalCount;
-  unsigned int * m_buckets; // [NUM_BUCKETS];
-  Ty * m_histMin;
-  Ty * m_histMax;
+  std::vector<unsigned int> m_buckets;
+  std::vector<Ty> m_histMin;
+  std::vector<Ty> m_histMax;
 };
 
 } // namespace preproc
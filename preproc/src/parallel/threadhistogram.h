@@ -0,0 +1,372 @@
+#ifndef preproc_threadhistogram_h__
+#define preproc_threadhistogram_h__
+
+#include "histogrambinning.h"
+#include "loghistogram.h"
+
+#include <bd/io/buffer.h>
+
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A histogram of any number of buffers, accumulated in bins that are
+/// private to each thread and only merged by result().
+///
+/// Buckets are given by a HistogramBinning, linear binning is the same
+/// bucketing ParallelReduceHistogram does.
+///
+/// Integer types are counted per value, a direct increment with no
+/// bucket math or per-voxel min/max. For exact binning those are the
+/// buckets, otherwise buckets and their min/max come from the value counts
+/// in result(). Floats compute bucket indexes for a run of voxels at a time
+/// in a loop that vectorizes, then count them.
+///
+/// A default constructed ThreadHistogram takes its binning after the pass,
+/// so that the value range doesn't need a pass of its own. Integers need
+/// nothing more, floats are counted in a per-thread LogHistogram and
+/// rebinned by result(binning), with the counts of the fine bins that
+/// straddle two buckets estimated.
+template<class Ty>
+class ThreadHistogram
+{
+  static_assert(!std::is_integral<Ty>::value ||
+                    ( std::is_unsigned<Ty>::value && sizeof(Ty) <= 2 ),
+                "Integers are counted per value, so only 8 and 16 bit unsigned types fit.");
+
+public:
+
+  /// \brief Binning given by result(binning) after the pass.
+  ThreadHistogram()
+      : m_binning{ HistogramBinning::Scale::Linear, 1, 0.0, 0.0 }
+      , m_deferred{ true }
+      , m_locals{ [this]() { return Local(binsPerThread()); } }
+  {
+  }
+
+
+  explicit ThreadHistogram(HistogramBinning const &binning)
+      : m_binning{ binning }
+      , m_deferred{ false }
+      , m_locals{ [this]() { return Local(binsPerThread()); } }
+  {
+  }
+
+
+  /// \brief Linear binning of [rawmin, rawmax] in \c numBuckets buckets.
+  ThreadHistogram(double rawmin, double rawmax, size_t numBuckets)
+      : ThreadHistogram(HistogramBinning{ HistogramBinning::Scale::Linear, numBuckets,
+                                          rawmin, rawmax })
+  {
+  }
+
+
+  HistogramBinning const &
+  binning() const
+  {
+    return m_binning;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Count the voxels of \c buf.
+  void
+  add(bd::Buffer<Ty> const *buf)
+  {
+    Ty const *data{ buf->getPtr() };
+    tbb::parallel_for(tbb::blocked_range<size_t>{ 0, buf->getNumElements(), 4096 },
+                      [this, data](tbb::blocked_range<size_t> const &r) {
+                        count(m_locals.local(), data + r.begin(), r.size(),
+                              std::is_integral<Ty>{});
+                      });
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief The merged histogram of everything added so far, in the
+  /// binning given to the constructor.
+  HistogramBuckets
+  result() const
+  {
+    if (m_deferred) {
+      throw std::logic_error("ThreadHistogram: no binning, use result(binning).");
+    }
+    return result(m_binning);
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief The merged histogram of everything added so far in \c binning.
+  ///
+  /// Floats that were binned at construction ignore \c binning.
+  /// \param[out] split If not null, the number of float voxels whose bucket
+  /// was estimated by rebinning.
+  HistogramBuckets
+  result(HistogramBinning const &binning, long long *split = nullptr) const
+  {
+    if (split != nullptr) {
+      *split = 0;
+    }
+
+    if (!std::is_integral<Ty>::value) {
+      if (m_deferred) {
+        return mergedSketch().rebin(binning, split);
+      }
+      return mergedBuckets();
+    }
+
+    // Fold the value counts into the buckets, values are visited in
+    // increasing order so a bucket's min is the first value seen for it.
+    std::vector<long long> const counts{ mergedCounts() };
+    size_t const buckets{ binning.buckets };
+    HistogramBuckets h{ std::vector<long long>(buckets, 0),
+                        std::vector<double>(buckets, std::numeric_limits<double>::max()),
+                        std::vector<double>(buckets, std::numeric_limits<double>::lowest()),
+                        0 };
+    for (size_t i{ 0 }; i < counts.size(); ++i) {
+      if (counts[i] == 0) {
+        continue;
+      }
+      double const v{ double(i) };
+      size_t const b{ binning.bucket(v) };
+      h.count[b] += counts[i];
+      h.min[b] = std::min(h.min[b], v);
+      h.max[b] = std::max(h.max[b], v);
+      h.total += counts[i];
+    }
+    return h;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Smallest and largest value added so far, \c min > \c max if
+  /// nothing (but NaNs) was.
+  void
+  range(double &min, double &max) const
+  {
+    min = std::numeric_limits<double>::max();
+    max = std::numeric_limits<double>::lowest();
+    if (std::is_integral<Ty>::value) {
+      std::vector<long long> const counts{ mergedCounts() };
+      for (size_t i{ 0 }; i < counts.size(); ++i) {
+        if (counts[i] != 0) {
+          min = std::min(min, double(i));
+          max = double(i);
+        }
+      }
+    } else if (m_deferred) {
+      mergedSketch().range(min, max);
+    } else {
+      HistogramBuckets const h{ mergedBuckets() };
+      for (size_t i{ 0 }; i < h.count.size(); ++i) {
+        min = std::min(min, h.min[i]);
+        max = std::max(max, h.max[i]);
+      }
+    }
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief The values at fractions \c qs (in [0, 1]) of the sorted values
+  /// added so far, NaN if there are none.
+  ///
+  /// Exact for integers. Floats with a deferred binning are within 2^-11 of
+  /// the value (see LogHistogram), otherwise they are interpolated in the
+  /// bucket's min/max.
+  std::vector<double>
+  quantiles(std::vector<double> const &qs) const
+  {
+    if (!std::is_integral<Ty>::value && m_deferred) {
+      return mergedSketch().quantiles(qs);
+    }
+
+    HistogramBuckets const h{
+        std::is_integral<Ty>::value ? result(HistogramBinning::exact<ExactTy>()) : mergedBuckets() };
+    std::vector<double> values(qs.size(), std::numeric_limits<double>::quiet_NaN());
+    if (h.total == 0) {
+      return values;
+    }
+    for (size_t i{ 0 }; i < qs.size(); ++i) {
+      long long const k{ LogHistogram::rank(qs[i], h.total) };
+      long long before{ 0 };
+      for (size_t b{ 0 }; b < h.count.size(); ++b) {
+        long long const count{ h.count[b] };
+        if (before + count >= k) {
+          double const t{ count > 1 ? double(k - before - 1) / double(count - 1) : 0.0 };
+          values[i] = h.min[b] + ( h.max[b] - h.min[b] ) * t;
+          break;
+        }
+        before += count;
+      }
+    }
+    return values;
+  }
+
+
+private:
+
+  /// \brief Ty for integers, a stand in that exact() accepts for floats.
+  using ExactTy = typename std::conditional<std::is_integral<Ty>::value, Ty, uint8_t>::type;
+
+
+  struct Local
+  {
+    explicit Local(size_t bins)
+        : count(bins, 0)
+        , min(std::is_integral<Ty>::value ? 0 : bins, std::numeric_limits<double>::max())
+        , max(std::is_integral<Ty>::value ? 0 : bins, std::numeric_limits<double>::lowest())
+    {
+    }
+
+    std::vector<long long> count;
+    std::vector<double> min; ///< Empty for integer types.
+    std::vector<double> max;
+    LogHistogram sketch;     ///< Floats with a deferred binning.
+  };
+
+
+  std::vector<long long>
+  mergedCounts() const
+  {
+    std::vector<long long> counts(binsPerThread(), 0);
+    for (Local const &l : m_locals) {
+      for (size_t i{ 0 }; i < counts.size(); ++i) {
+        counts[i] += l.count[i];
+      }
+    }
+    return counts;
+  }
+
+
+  HistogramBuckets
+  mergedBuckets() const
+  {
+    size_t const bins{ binsPerThread() };
+    HistogramBuckets h{ mergedCounts(),
+                        std::vector<double>(bins, std::numeric_limits<double>::max()),
+                        std::vector<double>(bins, std::numeric_limits<double>::lowest()),
+                        0 };
+    for (Local const &l : m_locals) {
+      for (size_t i{ 0 }; i < bins; ++i) {
+        h.min[i] = std::min(h.min[i], l.min[i]);
+        h.max[i] = std::max(h.max[i], l.max[i]);
+      }
+    }
+    for (long long c : h.count) {
+      h.total += c;
+    }
+    return h;
+  }
+
+
+  LogHistogram
+  mergedSketch() const
+  {
+    LogHistogram sketch;
+    for (Local const &l : m_locals) {
+      sketch.merge(l.sketch);
+    }
+    return sketch;
+  }
+
+
+  /// \brief Values of the type for integers, otherwise buckets.
+  size_t
+  binsPerThread() const
+  {
+    return std::is_integral<Ty>::value ?
+           size_t(1) << ( 8 * sizeof(Ty) ) :
+           m_deferred ? 0 : m_binning.buckets;
+  }
+
+
+  /// \brief Integer types: one counter per value.
+  void
+  count(Local &l, Ty const *data, size_t n, std::true_type) const
+  {
+    long long *counts{ l.count.data() };
+    for (size_t i{ 0 }; i < n; ++i) {
+      counts[data[i]] += 1;
+    }
+  }
+
+
+  /// \brief Floats: linear or log bucket indexes, or the fine bins of the
+  /// sketch if the binning is deferred.
+  void
+  count(Local &l, Ty const *data, size_t n, std::false_type) const
+  {
+    if (m_deferred) {
+      for (size_t i{ 0 }; i < n; ++i) {
+        l.sketch.add(float(data[i]));
+      }
+      return;
+    }
+
+    double const min{ m_binning.min };
+    double const last{ double(m_binning.buckets - 1) };
+    bool const empty{ !( m_binning.max > min ) };
+    if (m_binning.scale == HistogramBinning::Scale::Log) {
+      double const scale{ empty ? 0.0 : last / std::log1p(m_binning.max - min) };
+      countRuns(l, data, n, [min, scale](double v) {
+        return std::log1p(std::max(0.0, v - min)) * scale + 0.5;
+      });
+    } else {
+      double const scale{ empty ? 0.0 : last / ( m_binning.max - min ) };
+      countRuns(l, data, n, [min, scale](double v) { return ( v - min ) * scale + 0.5; });
+    }
+  }
+
+
+  /// \brief Bucket indexes from \c position for a run of voxels, then the
+  /// counts and min/max for each.
+  template<class Position>
+  void
+  countRuns(Local &l, Ty const *data, size_t n, Position position) const
+  {
+    size_t const run{ 256 };
+    uint32_t idx[run];
+    double const last{ double(m_binning.buckets - 1) };
+
+    long long *counts{ l.count.data() };
+    double *mins{ l.min.data() };
+    double *maxs{ l.max.data() };
+    for (size_t start{ 0 }; start < n; start += run) {
+      size_t const len{ std::min(run, n - start) };
+      Ty const *p{ data + start };
+      for (size_t i{ 0 }; i < len; ++i) {
+        // NaNs go to the first bucket.
+        idx[i] = static_cast<uint32_t>(std::min(last, std::max(0.0, position(p[i]))));
+      }
+      for (size_t i{ 0 }; i < len; ++i) {
+        uint32_t const b{ idx[i] };
+        double const v{ double(p[i]) };
+        counts[b] += 1;
+        mins[b] = std::min(mins[b], v);
+        maxs[b] = std::max(maxs[b], v);
+      }
+    }
+  }
+
+
+  HistogramBinning const m_binning;
+  bool const m_deferred;
+  tbb::enumerable_thread_specific<Local> m_locals;
+
+}; // class ThreadHistogram
+
+} // namespace preproc
+
+#endif // ! preproc_threadhistogram_h__
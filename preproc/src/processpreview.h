@@ -0,0 +1,540 @@
+#ifndef preproc_processpreview_h__
+#define preproc_processpreview_h__
+
+#include "cmdline.h"
+#include "metrics.h"
+#include "rawfile.h"
+#include "voxelopacityfunction.h"
+#include "parallel/parallelreduce_minmax.h"
+
+#include <bd/io/buffer.h>
+#include <bd/io/fileblock.h>
+#include <bd/log/logger.h>
+#include <bd/volume/transferfunction.h>
+#include <bd/volume/volume.h>
+
+#include <tbb/tbb.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace preproc
+{
+
+/// \brief Sampled statistics for a single block, accumulated over the
+/// strips that fell inside of it.
+struct PreviewBlockStats
+{
+  PreviewBlockStats()
+      : samples{ 0 }
+      , sumAvg{ 0 }
+      , sumAvgSq{ 0 }
+      , sumRov{ 0 }
+      , sumRovSq{ 0 }
+  {
+  }
+
+  uint64_t samples; ///< Number of strips sampled in the block.
+  double sumAvg;    ///< Sum of the per-strip averages.
+  double sumAvgSq;  ///< Sum of the squared per-strip averages.
+  double sumRov;    ///< Sum of the per-strip relevance ratios.
+  double sumRovSq;  ///< Sum of the squared per-strip relevance ratios.
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Estimate block statistics from a sparse sample of the raw file.
+///
+/// The volume is sampled in strips: runs of consecutive rows inside a single
+/// slab and a single block row. Every (y, z) block row is stratified along z
+/// and receives at least a few strips, so every block gets an estimate.
+/// Each strip is read with a single pread(). Strips are read in parallel,
+/// and each thread adds the strips it reads to its own per-block
+/// statistics, so a strip costs the same however many blocks there are.
+///
+/// Each strip's average and relevance ratio is one observation for its
+/// block. The reported 95% confidence half-widths come from the variance
+/// between those observations.
+template<class Ty>
+class PreviewProc
+{
+public:
+
+  PreviewProc(CommandLineOptions const &clo, bd::Volume const &volume)
+      : m_clo{ clo }
+      , m_volume{ volume }
+      , m_stripRows{ 1 }
+      , m_bytesRead{ 0 }
+  {
+  }
+
+
+  ~PreviewProc()
+  {
+  }
+
+
+  /// \brief Estimate the volume wide min, max and average from the sampled strips.
+  /// \throws std::runtime_error If the raw file could not be opened or read.
+  void
+  sampleMinMax(bd::Volume &volume);
+
+
+  /// \brief Estimate the per-block min, max, avg and rov from the sampled strips.
+  /// \param volume The volume with min/max already estimated with sampleMinMax().
+  /// \param blocks The blocks to populate.
+  /// \param skipRMap If true, do not estimate the rov.
+  /// \throws std::runtime_error If the raw file could not be opened or read.
+  void
+  sampleBlocks(bd::Volume &volume,
+               std::vector<bd::FileBlock> &blocks,
+               bool skipRMap);
+
+
+  /// \brief Write the estimate and confidence bounds of each block to \c path.
+  void
+  writeBoundsFile(std::string const &path,
+                  std::vector<bd::FileBlock> const &blocks) const;
+
+
+  /// \brief Total bytes read from the raw file so far.
+  uint64_t
+  bytesRead() const
+  {
+    return m_bytesRead;
+  }
+
+
+private:
+
+  struct Strip
+  {
+    uint64_t y; ///< First row of the strip.
+    uint64_t z; ///< Slab of the strip.
+  };
+
+  void
+  open();
+
+  void
+  makeStrips();
+
+  uint64_t
+  readStrip(Strip const &s, Ty *dest) const;
+
+  CommandLineOptions const &m_clo;
+  bd::Volume const &m_volume;
+  RawFile m_rawfile;
+  std::vector<Strip> m_strips;
+  std::vector<PreviewBlockStats> m_stats;
+  uint64_t m_stripRows;
+  uint64_t m_bytesRead;
+
+}; // class PreviewProc
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+PreviewProc<Ty>::open()
+{
+  if (m_rawfile.isOpen()) {
+    return;
+  }
+
+  if (!m_rawfile.open(m_clo.inFile)) {
+    throw std::runtime_error("Could not open file: " + m_clo.inFile);
+  }
+
+  makeStrips();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+PreviewProc<Ty>::makeStrips()
+{
+  // Aim for strips of roughly 1MB so each pread() is large enough to be
+  // efficient, but never let a strip cross a block boundary along y.
+  uint64_t const targetStripBytes{ 1024 * 1024 };
+  uint64_t const minStripsPerBlockRow{ 2 };
+
+  glm::u64vec3 const volDims{ m_volume.voxelDims() };
+  glm::u64vec3 const blkDims{ m_volume.block_dims() };
+  glm::u64vec3 const blkCount{ m_volume.block_count() };
+
+  uint64_t const rowBytes{ volDims.x * sizeof(Ty) };
+  m_stripRows = std::max<uint64_t>(1, std::min<uint64_t>(blkDims.y, targetStripBytes / rowBytes));
+
+  double const fraction{ m_clo.previewFraction };
+  uint64_t const rowsPerBlockRow{ blkDims.y * blkDims.z };
+  uint64_t const stripsPerBlockRow{
+      std::max<uint64_t>(
+          minStripsPerBlockRow,
+          uint64_t(std::ceil(fraction * rowsPerBlockRow / double(m_stripRows)))) };
+
+  // A fixed seed keeps repeated previews of the same file comparable.
+  std::mt19937_64 gen{ 0x70726576 };
+
+  m_strips.clear();
+  m_strips.reserve(stripsPerBlockRow * blkCount.y * blkCount.z);
+
+  for (uint64_t bK{ 0 }; bK < blkCount.z; ++bK) {
+    for (uint64_t bJ{ 0 }; bJ < blkCount.y; ++bJ) {
+      uint64_t const y0{ bJ * blkDims.y };
+      uint64_t const z0{ bK * blkDims.z };
+
+      std::uniform_int_distribution<uint64_t> ydist{ 0, blkDims.y - m_stripRows };
+
+      // Stratify along z: strip s falls somewhere in the s-th stratum of the
+      // block row's slabs.
+      for (uint64_t s{ 0 }; s < stripsPerBlockRow; ++s) {
+        uint64_t const lo{ (s * blkDims.z) / stripsPerBlockRow };
+        uint64_t const hi{ std::max(lo, ((s + 1) * blkDims.z) / stripsPerBlockRow - 1) };
+        std::uniform_int_distribution<uint64_t> zdist{ lo, std::min(hi, blkDims.z - 1) };
+
+        m_strips.push_back(Strip{ y0 + ydist(gen), z0 + zdist(gen) });
+      }
+    }
+  }
+
+  // Read the strips in file order so the preview is mostly forward seeks.
+  std::sort(m_strips.begin(), m_strips.end(),
+            [](Strip const &lhs, Strip const &rhs) -> bool {
+              return lhs.z < rhs.z || (lhs.z == rhs.z && lhs.y < rhs.y);
+            });
+
+  double const sampled{ m_strips.size() * m_stripRows / double(volDims.y * volDims.z) };
+  bd::Info() << "Preview will sample " << m_strips.size() << " strips of "
+             << m_stripRows << " rows (" << 100.0 * sampled << "% of rows).";
+
+  if (sampled > 2.0 * fraction) {
+    bd::Warn() << "Blocks are too small to sample at " << fraction
+               << ", each block row needs at least " << minStripsPerBlockRow << " strips.";
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+uint64_t
+PreviewProc<Ty>::readStrip(Strip const &s, Ty *dest) const
+{
+  // Strips are in ROI coordinates, the file may be larger than the ROI.
+  uint64_t const *fd{ m_clo.file_dims };
+  Roi const &roi = m_clo.roi;
+  uint64_t const rowElements{ roi.dim(0) };
+  uint64_t const z{ roi.lo[2] + s.z };
+  uint64_t const y{ roi.lo[1] + s.y };
+
+  // The strip's rows are contiguous in the file if the ROI spans whole rows.
+  uint64_t const rowsPerRead{ rowElements == fd[0] ? m_stripRows : 1 };
+  uint64_t const bytes{ rowsPerRead * rowElements * sizeof(Ty) };
+
+  StageTimer timer{ Stage::RawRead, m_stripRows * rowElements * sizeof(Ty),
+                    m_stripRows * rowElements };
+  uint64_t total{ 0 };
+  for (uint64_t r{ 0 }; r < m_stripRows; r += rowsPerRead) {
+    uint64_t const offset{ ((z * fd[1] + y + r) * fd[0] + roi.lo[0]) * sizeof(Ty) };
+    uint64_t const amount{ m_rawfile.readAt(dest + r * rowElements, bytes, offset) };
+    if (amount != bytes) {
+      throw std::runtime_error("Short read while sampling " + m_clo.inFile);
+    }
+    total += amount;
+  }
+  return total;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+PreviewProc<Ty>::sampleMinMax(bd::Volume &volume)
+{
+  open();
+
+  uint64_t const stripElements{ m_stripRows * m_volume.voxelDims().x };
+
+  struct MinMaxTotal
+  {
+    double min;
+    double max;
+    double total;
+  };
+
+  tbb::enumerable_thread_specific<std::vector<Ty>> data{ std::vector<Ty>(stripElements) };
+  tbb::combinable<MinMaxTotal> mmt{ [] {
+    return MinMaxTotal{ std::numeric_limits<double>::max(),
+                        std::numeric_limits<double>::lowest(),
+                        0.0 };
+  } };
+  tbb::combinable<uint64_t> bytes{ [] { return uint64_t(0); } };
+
+  // Each strip is read and reduced in its own task so reads from different
+  // threads overlap.
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>{ 0, m_strips.size(), 1 },
+      [&](tbb::blocked_range<size_t> const &r) {
+        std::vector<Ty> &d = data.local();
+        bd::Buffer<Ty> buf{ d.data(), stripElements };
+        buf.setNumElements(stripElements);
+
+        for (size_t i{ r.begin() }; i != r.end(); ++i) {
+          bytes.local() += readStrip(m_strips[i], d.data());
+
+          ParallelReduceMinMax<Ty> mm{ &buf };
+          tbb::parallel_reduce(tbb::blocked_range<size_t>{ 0, stripElements }, mm);
+
+          MinMaxTotal &local = mmt.local();
+          local.min = std::min<double>(local.min, mm.min_value);
+          local.max = std::max<double>(local.max, mm.max_value);
+          local.total += mm.tot_value;
+        }
+      });
+
+  MinMaxTotal const all{ mmt.combine([](MinMaxTotal const &lhs, MinMaxTotal const &rhs) {
+    return MinMaxTotal{ std::min(lhs.min, rhs.min),
+                        std::max(lhs.max, rhs.max),
+                        lhs.total + rhs.total };
+  }) };
+  double const min{ all.min };
+  double const max{ all.max };
+  double const total{ all.total };
+
+  m_bytesRead += bytes.combine(std::plus<uint64_t>());
+
+  glm::u64vec3 const dims{ m_volume.voxelDims() };
+  uint64_t const sampled{ m_strips.size() * stripElements };
+  volume.min(min);
+  volume.max(max);
+  volume.avg(total / double(sampled));
+  volume.total(volume.avg() * double(dims.x * dims.y * dims.z));
+
+  bd::Info() << "Sampled volume min/max/avg: " << min << "/" << max << "/" << volume.avg();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+PreviewProc<Ty>::sampleBlocks(bd::Volume &volume,
+                              std::vector<bd::FileBlock> &blocks,
+                              bool skipRMap)
+{
+  open();
+
+  bd::OpacityTransferFunction tr_func{};
+  if (!skipRMap) {
+    if (tr_func.load(m_clo.tfuncPath) < 0) {
+      throw std::runtime_error("Error reading transfer function.");
+    }
+    if (tr_func.getNumKnots() == 0) {
+      throw std::runtime_error("Transfer function has size 0.");
+    }
+  }
+  preproc::VoxelOpacityFunction<Ty> rel_func{ tr_func, volume.min(), volume.max() };
+
+  glm::u64vec3 const volDims{ m_volume.voxelDims() };
+  glm::u64vec3 const blkDims{ m_volume.block_dims() };
+  glm::u64vec3 const blkCount{ m_volume.block_count() };
+  uint64_t const stripElements{ m_stripRows * volDims.x };
+  // Number of voxels one strip contributes to each block it passes through.
+  double const voxelsPerBlock{ double(m_stripRows * blkDims.x) };
+
+  // One strip's part of a block of its block row.
+  struct StripBlock
+  {
+    double min;
+    double max;
+    double total;
+    double rel;
+  };
+
+  // Each thread adds the strips it reads to its own block statistics, which
+  // are combined after the last strip. A strip only touches the blocks of
+  // its block row, so the work per strip doesn't grow with the block count.
+  struct Local
+  {
+    std::vector<Ty> data;
+    std::vector<StripBlock> strip; ///< One per block of a block row.
+    std::vector<double> min;
+    std::vector<double> max;
+    std::vector<PreviewBlockStats> stats;
+  };
+  tbb::enumerable_thread_specific<Local> locals{ [&]() {
+    return Local{ std::vector<Ty>(stripElements),
+                  std::vector<StripBlock>(blkCount.x),
+                  std::vector<double>(blocks.size(), std::numeric_limits<double>::max()),
+                  std::vector<double>(blocks.size(), std::numeric_limits<double>::lowest()),
+                  std::vector<PreviewBlockStats>(blocks.size()) };
+  } };
+  tbb::combinable<uint64_t> bytes{ [] { return uint64_t(0); } };
+
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>{ 0, m_strips.size(), 1 },
+      [&](tbb::blocked_range<size_t> const &r) {
+        Local &local = locals.local();
+
+        for (size_t i{ r.begin() }; i != r.end(); ++i) {
+          Strip const &s = m_strips[i];
+          bytes.local() += readStrip(s, local.data.data());
+
+          std::fill(local.strip.begin(), local.strip.end(),
+                    StripBlock{ std::numeric_limits<double>::max(),
+                                std::numeric_limits<double>::lowest(), 0.0, 0.0 });
+          for (uint64_t row{ 0 }; row < m_stripRows; ++row) {
+            Ty const *v{ local.data.data() + row * volDims.x };
+            // Voxels past the last whole block are in no block.
+            for (uint64_t bI{ 0 }; bI < blkCount.x; ++bI, v += blkDims.x) {
+              StripBlock &sb = local.strip[bI];
+              for (uint64_t x{ 0 }; x < blkDims.x; ++x) {
+                sb.min = std::min(sb.min, double(v[x]));
+                sb.max = std::max(sb.max, double(v[x]));
+                sb.total += v[x];
+              }
+              if (!skipRMap) {
+                for (uint64_t x{ 0 }; x < blkDims.x; ++x) {
+                  sb.rel += rel_func(v[x]);
+                }
+              }
+            }
+          }
+
+          uint64_t const bJ{ s.y / blkDims.y };
+          uint64_t const bK{ s.z / blkDims.z };
+          for (uint64_t bI{ 0 }; bI < blkCount.x; ++bI) {
+            uint64_t const bIdx{ bI + blkCount.x * (bJ + bK * blkCount.y) };
+            StripBlock const &sb = local.strip[bI];
+            PreviewBlockStats &st = local.stats[bIdx];
+
+            local.min[bIdx] = std::min(local.min[bIdx], sb.min);
+            local.max[bIdx] = std::max(local.max[bIdx], sb.max);
+
+            double const avg{ sb.total / voxelsPerBlock };
+            st.samples += 1;
+            st.sumAvg += avg;
+            st.sumAvgSq += avg * avg;
+
+            double const ratio{ sb.rel / voxelsPerBlock };
+            st.sumRov += ratio;
+            st.sumRovSq += ratio * ratio;
+          }
+        }
+      });
+
+  m_bytesRead += bytes.combine(std::plus<uint64_t>());
+
+  m_stats.assign(blocks.size(), PreviewBlockStats{});
+  for (auto &b : blocks) {
+    b.min_val = std::numeric_limits<double>::max();
+    b.max_val = std::numeric_limits<double>::lowest();
+    b.total_val = 0;
+    b.rov = 0;
+  }
+  locals.combine_each([&](Local const &local) {
+    for (size_t i{ 0 }; i < blocks.size(); ++i) {
+      PreviewBlockStats const &from = local.stats[i];
+      PreviewBlockStats &st = m_stats[i];
+      blocks[i].min_val = std::min(blocks[i].min_val, local.min[i]);
+      blocks[i].max_val = std::max(blocks[i].max_val, local.max[i]);
+      st.samples += from.samples;
+      st.sumAvg += from.sumAvg;
+      st.sumAvgSq += from.sumAvgSq;
+      st.sumRov += from.sumRov;
+      st.sumRovSq += from.sumRovSq;
+    }
+  });
+
+  for (size_t i{ 0 }; i < blocks.size(); ++i) {
+    bd::FileBlock &b = blocks[i];
+    PreviewBlockStats const &st = m_stats[i];
+    if (st.samples == 0) {
+      continue;
+    }
+    b.avg_val = st.sumAvg / st.samples;
+    b.total_val = b.avg_val * (b.voxel_dims[0] * b.voxel_dims[1] * b.voxel_dims[2]);
+    b.rov = st.sumRov / st.samples;
+  }
+
+  if (!skipRMap && !blocks.empty()) {
+    auto minmaxE =
+        std::minmax_element(blocks.begin(),
+                            blocks.end(),
+                            [](bd::FileBlock const &lhs, bd::FileBlock const &rhs) -> bool {
+                              return lhs.rov < rhs.rov;
+                            });
+    volume.rovMin((*minmaxE.first).rov);
+    volume.rovMax((*minmaxE.second).rov);
+  }
+
+  bd::Info() << "Preview read " << m_bytesRead << " of " << m_rawfile.size() << " bytes ("
+             << 100.0 * m_bytesRead / double(m_rawfile.size()) << "%).";
+}
+
+
+namespace
+{
+/// \brief Write the half width of the 95% confidence interval of a mean
+/// of \c n samples, or null if there are too few samples for one.
+inline void
+writeHalfWidth95(std::ostream &os, uint64_t n, double sum, double sumSq)
+{
+  if (n < 2) {
+    os << "null";
+    return;
+  }
+  double const mean{ sum / n };
+  double const var{ std::max(0.0, (sumSq - n * mean * mean) / (n - 1)) };
+  os << 1.96 * std::sqrt(var / n);
+}
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+PreviewProc<Ty>::writeBoundsFile(std::string const &path,
+                                 std::vector<bd::FileBlock> const &blocks) const
+{
+  std::ofstream os{ path };
+  if (!os.is_open()) {
+    bd::Err() << "Could not open preview bounds file: " << path;
+    return;
+  }
+
+  os << "{\n"
+     << "  \"approximate\": true,\n"
+     << "  \"sample_fraction\": " << m_clo.previewFraction << ",\n"
+     << "  \"bytes_read\": " << m_bytesRead << ",\n"
+     << "  \"file_size\": " << m_rawfile.size() << ",\n"
+     << "  \"strip_rows\": " << m_stripRows << ",\n"
+     << "  \"blocks\": [\n";
+
+  for (size_t i{ 0 }; i < blocks.size(); ++i) {
+    PreviewBlockStats const &st = m_stats[i];
+    os << "    { \"index\": " << i
+       << ", \"samples\": " << st.samples
+       << ", \"min_observed\": " << blocks[i].min_val
+       << ", \"max_observed\": " << blocks[i].max_val
+       << ", \"avg\": " << blocks[i].avg_val
+       << ", \"avg_ci95\": ";
+    writeHalfWidth95(os, st.samples, st.sumAvg, st.sumAvgSq);
+    os << ", \"rov\": " << blocks[i].rov
+       << ", \"rov_ci95\": ";
+    writeHalfWidth95(os, st.samples, st.sumRov, st.sumRovSq);
+    os << " }" << (i + 1 < blocks.size() ? ",\n" : "\n");
+  }
+
+  os << "  ]\n}\n";
+}
+
+} // namespace preproc
+
+#endif // ! preproc_processpreview_h__
@@ -6,9 +6,15 @@
 
 #include "cmdline.h"
 #include "voxelopacityfunction.h"
+#include "gradientrelevance.h"
+#include "transferfunction2d.h"
 #include "reader.h"
 #include "writer.h"
-#include "outputer.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "rawfile.h"
+#include "refbuffer.h"
+#include "roireader.h"
 #include "parallel/parallelreduce_blockminmax.h"
 #include "parallel/parallelfor_voxelrelevance.h"
 
@@ -23,12 +29,17 @@
 #include <tbb/tbb.h>
 #include <tbb/task_scheduler_init.h>
 
+#include <unistd.h>
+
 #include <sstream>
 #include <string>
 #include <iostream>
 #include <stdexcept>
 #include <vector>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <memory>
 
 namespace preproc
 {
@@ -84,9 +95,40 @@ namespace preproc
 
       return reinterpret_cast<char *>(p);
     } // allocateEmptyBuffers()
+
+
+    ///////////////////////////////////////////////////////////////////////////////
+    template <class Ty>
+    char*
+    allocateRefBuffers(char* mem,
+                       bd::BlockingQueue<bd::Buffer<Ty> *>& empty,
+                       size_t nBuff,
+                       size_t lenBuff)
+    {
+      Ty* p{ reinterpret_cast<Ty *>(mem) };
+
+      for (size_t i{ 0 }; i < nBuff; ++i) {
+        RefBuffer<Ty>* buf{ new RefBuffer<Ty>(p, lenBuff, &empty) };
+        empty.push(buf);
+        p += lenBuff;
+      }
+
+      return reinterpret_cast<char *>(p);
+    } // allocateRefBuffers()
   } // namespace
 
 
+  ///////////////////////////////////////////////////////////////////////////////
+  /// \brief The volume and blocks of one block count tuple that a raw file
+  /// pass accumulates into.
+  struct RawFileTarget
+  {
+    bd::Volume const* volume;
+    std::vector<bd::FileBlock>* blocks;
+    Checkpointer* ckpt; ///< May be null.
+  };
+
+
   ///////////////////////////////////////////////////////////////////////////////
   template <class Ty>
   class RFProc
@@ -95,6 +137,9 @@ namespace preproc
 
     RFProc()
       : m_mem{ nullptr }
+      , m_ckpt{ nullptr }
+      , m_startVoxel{ 0 }
+      , m_quit{ nullptr, 0 }
     {
     }
 
@@ -119,13 +164,51 @@ namespace preproc
                    bool skipRMap);
 
 
+    /// \brief Process the raw file once for several block count tuples.
+    ///
+    /// Each buffer read from the raw file is handed to a consumer for each
+    /// target, the consumers run concurrently and share the TBB worker pool.
+    /// A buffer is recycled once all of the consumers have released it. The
+    /// rmap, which doesn't depend on the blocks, is generated by the consumer
+    /// of the first target.
+    /// \throws std::runtime_error If the raw file could not be opened.
+    int
+    processRawFile(CommandLineOptions const& clo,
+                   std::vector<RawFileTarget> const& targets,
+                   bool skipRMap);
+
+
+    /// \brief Write checkpoints with \c ckpt while processing the raw file
+    /// for a single volume.
+    void
+    setCheckpointer(Checkpointer* ckpt)
+    {
+      m_ckpt = ckpt;
+    }
+
+
+    /// \brief Start processing at voxel \c voxel instead of the beginning of
+    /// the raw file, the blocks should hold the accumulated values up to it.
+    ///
+    /// If the rmap is generated, the rmap file is truncated to \c voxel
+    /// values and appended to.
+    void
+    setResumeOffset(uint64_t voxel)
+    {
+      m_startVoxel = voxel;
+    }
+
+
   private:
 
     void
-    loop(bool skipRMap,
-         bd::Volume const& volume,
-         std::vector<bd::FileBlock>& blocks,
-         preproc::VoxelOpacityFunction<Ty>& relFunc);
+    distribute(size_t numConsumers);
+
+    void
+    consume(bool genRMap,
+            RawFileTarget const& target,
+            bd::BlockingQueue<bd::Buffer<Ty> *>& full,
+            preproc::VoxelOpacityFunction<Ty>& relFunc);
 
     void
     genRMapData(bd::Buffer<Ty>* rawData,
@@ -136,12 +219,24 @@ namespace preproc
                         std::vector<bd::FileBlock>& blocks,
                         bd::Buffer<Ty> const* rawData);
 
+    void
+    checkpoint(bool genRMap,
+               RawFileTarget const& target,
+               uint64_t end);
+
 
     std::ofstream m_rmapfile;
     std::ifstream m_rawfile;
+    RawFile m_roiFile;
+    RoiReader<Ty> m_roiReader;
+    /// Read from for the gradient halo when relevance uses --tfunc2d.
+    RawFile m_haloFile;
+    std::unique_ptr<GradientRelevance<Ty>> m_gradRel;
 
     bd::BlockingQueue<bd::Buffer<Ty> *> m_rawFull;
     bd::BlockingQueue<bd::Buffer<Ty> *> m_rawEmpty;
+    /// One queue of shared raw buffers for each consumer.
+    std::vector<std::unique_ptr<bd::BlockingQueue<bd::Buffer<Ty> *>>> m_consumerFull;
     bd::BlockingQueue<bd::Buffer<double> *> m_rmapFull;
     bd::BlockingQueue<bd::Buffer<double> *> m_rmapEmpty;
 
@@ -149,6 +244,9 @@ namespace preproc
     Writer<double> m_writer;
 
     char* m_mem;
+    Checkpointer* m_ckpt;
+    uint64_t m_startVoxel;
+    bd::Buffer<Ty> m_quit; ///< Tells a consumer to quit.
   };
 
 
@@ -159,15 +257,36 @@ namespace preproc
                              std::vector<bd::FileBlock>& blocks,
                              bool skipRMap)
   {
-    //  preproc::Outputer outputer;
-    //  outputer.start();
+    return processRawFile(clo, { RawFileTarget{ &volume, &blocks, m_ckpt } }, skipRMap);
+  }
+
+
+  template <class Ty>
+  int
+  RFProc<Ty>::processRawFile(CommandLineOptions const& clo,
+                             std::vector<RawFileTarget> const& targets,
+                             bool skipRMap)
+  {
+    // Only the ROI is read if it is a part of the file, otherwise the whole
+    // file is streamed.
+    bool const readRoi{ !clo.roi.empty() && !clo.roi.covers(clo.file_dims) };
 
     try {
-      m_rawfile.open(clo.inFile, std::ios::binary);
-      if (!m_rawfile.is_open()) {
-        bd::Err() << "Could not open file " + clo.inFile;
-        return -1;
+      if (readRoi) {
+        if (!m_roiFile.open(clo.inFile)) {
+          return -1;
+        }
+        m_roiReader.set(&m_roiFile, clo.file_dims, clo.roi);
+        m_roiReader.seek(m_startVoxel);
+      } else {
+        m_rawfile.open(clo.inFile, std::ios::binary);
+        if (!m_rawfile.is_open()) {
+          bd::Err() << "Could not open file " + clo.inFile;
+          return -1;
+        }
+        m_rawfile.seekg(m_startVoxel * sizeof(Ty));
       }
+      m_reader.setStartOffset(m_startVoxel);
 
       m_reader.setFull(&m_rawFull);
       m_reader.setEmpty(&m_rawEmpty);
@@ -198,7 +317,7 @@ namespace preproc
         // how many raw buffs can we make of same length.
         size_t num_raw{ sz_total_raw / sz_raw };
 
-        char* mem = allocateEmptyBuffers<Ty>(m_mem, m_rawEmpty, num_raw, len_buffers);
+        char* mem = allocateRefBuffers<Ty>(m_mem, m_rawEmpty, num_raw, len_buffers);
         allocateEmptyBuffers<double>(mem, m_rmapEmpty, num_rmap, len_buffers);
 
         bd::Info() << "Allocated: " << num_raw << " raw buffers of length " << len_buffers
@@ -206,40 +325,105 @@ namespace preproc
       }
 
       bd::OpacityTransferFunction tr_func{};
+      TransferFunction2D tf2d{};
       // If we are doing relevance mapping, then open rmap output file,
       // load the relevance transfer function,
       // reserve space in the relevance map buffer.
       if (!skipRMap) {
 
-        m_rmapfile.open(clo.rmapFilePath);
+        if (m_startVoxel > 0) {
+          // Drop whatever was written after the checkpoint we resume from.
+          if (::truncate(clo.rmapFilePath.c_str(), m_startVoxel * sizeof(double)) != 0) {
+            bd::Err() << "Could not truncate rmap file for resume: " << clo.rmapFilePath;
+            return -1;
+          }
+          m_rmapfile.open(clo.rmapFilePath, std::ios::binary | std::ios::app);
+        } else {
+          m_rmapfile.open(clo.rmapFilePath, std::ios::binary);
+        }
         if (!m_rmapfile.is_open()) {
           bd::Err() << "Could not open rmap output file: " << clo.rmapFilePath;
           return -1;
         }
 
-        // Generate the transfer function
-        if (tr_func.load(clo.tfuncPath) < 0) {
-          bd::Err() << "Error reading transfer function.";
-          return -1;
-        }
-        if (tr_func.getNumKnots() == 0) {
-          bd::Err() << "Transfer function has size 0.";
-          return -1;
+        // Generate the transfer function, a 2D one replaces the 1D one.
+        if (!clo.tfunc2dPath.empty()) {
+          if (!tf2d.load(clo.tfunc2dPath)) {
+            return -1;
+          }
+          if (!m_haloFile.open(clo.inFile)) {
+            return -1;
+          }
+        } else {
+          if (tr_func.load(clo.tfuncPath) < 0) {
+            bd::Err() << "Error reading transfer function.";
+            return -1;
+          }
+          if (tr_func.getNumKnots() == 0) {
+            bd::Err() << "Transfer function has size 0.";
+            return -1;
+          }
         }
 
         Writer<double>::start(m_writer, m_rmapfile);
       } // if(! skipRMap)
 
 
-      Reader<Ty>::start(m_reader, m_rawfile);
+      if (readRoi) {
+        Reader<Ty>::start(m_reader, m_roiReader);
+      } else {
+        Reader<Ty>::start(m_reader, m_rawfile);
+      }
 
-      // set up the VoxelOpacityFunction
+      // set up the VoxelOpacityFunction, the volume min/max is the same for all targets.
+      bd::Volume const& volume = *targets[0].volume;
       preproc::VoxelOpacityFunction<Ty> rel_func{ tr_func, volume.min(), volume.max() };
+      if (!tf2d.empty()) {
+        m_gradRel.reset(new GradientRelevance<Ty>{ tf2d, volume.min(), volume.max(),
+                                                   tf2d.gradientMax() });
+        m_gradRel->set(&m_haloFile, clo.file_dims, clo.roi);
+      }
+
+      bd::Info() << "Begin raw file processing for " << targets.size()
+                 << " block counts, skip_rmap = " << std::boolalpha << skipRMap;
+
+      std::vector<std::future<void>> consumers;
+      for (size_t i{ 0 }; i < targets.size(); ++i) {
+        m_consumerFull.emplace_back(new bd::BlockingQueue<bd::Buffer<Ty> *>());
+        consumers.push_back(
+            std::async(std::launch::async,
+                       [this, i, skipRMap, &targets, &rel_func]() {
+                         consume(i == 0 && !skipRMap, targets[i], *m_consumerFull[i], rel_func);
+                       }));
+      }
 
-      loop(skipRMap, volume, blocks, rel_func);
+      distribute(targets.size());
+
+      // The consumers, reader and writer use this object's queues and
+      // buffers, all of them have to be finished before an error is passed
+      // on. A failed consumer stops the reader and drains its queue, so the
+      // others see the end of the stream.
+      std::exception_ptr error;
+      for (auto& c : consumers) {
+        try {
+          c.get();
+        } catch (...) {
+          if (!error) {
+            error = std::current_exception();
+          }
+        }
+      }
 
-      m_reader.join();
+      try {
+        m_reader.join();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
       m_rawfile.close();
+      m_roiFile.close();
+      m_haloFile.close();
 
       if (!skipRMap) {
         // push the quit buffer into the writer
@@ -250,15 +434,20 @@ namespace preproc
         m_rmapfile.close();
       }
 
-    } catch (std::runtime_error& e) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+
+    } catch (std::exception& e) {
       bd::Err() << "Exception in " << __func__ << ": " << e.what();
       return -1;
     }
 
     // compute block averages
-    for (size_t i{ 0 }; i < blocks.size(); ++i) {
-      bd::FileBlock& b = blocks[i];
-      b.avg_val = b.total_val / (b.voxel_dims[0] * b.voxel_dims[1] * b.voxel_dims[2]);
+    for (auto const& t : targets) {
+      for (bd::FileBlock& b : *t.blocks) {
+        b.avg_val = b.total_val / (b.voxel_dims[0] * b.voxel_dims[1] * b.voxel_dims[2]);
+      }
     }
 
     bd::Info() << "Finished processing raw file.";
@@ -267,33 +456,83 @@ namespace preproc
   } // processRawFile()
 
 
+  /// \brief Hand each buffer the reader fills to all of the consumers.
   template <class Ty>
   void
-  RFProc<Ty>::loop(bool skipRMap,
-                   bd::Volume const& volume,
-                   std::vector<bd::FileBlock>& blocks,
-                   preproc::VoxelOpacityFunction<Ty>& relFunc)
+  RFProc<Ty>::distribute(size_t numConsumers)
   {
-    bd::Info() << "Begin raw file processing, skip_rmap = " << std::boolalpha << skipRMap;
+    while (true) {
+      bd::Buffer<Ty>* rawData{ m_rawFull.pop() };
 
-    bd::Buffer<Ty>* rawData{ nullptr };
+      if (!rawData->getPtr()) {
+        bd::Dbg() << "Got null and empty buffer, stopping consumers.";
+        delete rawData;
+        for (auto& q : m_consumerFull) {
+          q->push(&m_quit);
+        }
+        break;
+      }
+
+      // All raw buffers are RefBuffers, see allocateRefBuffers().
+      static_cast<RefBuffer<Ty>*>(rawData)->share(static_cast<int>(numConsumers));
+      for (auto& q : m_consumerFull) {
+        q->push(rawData);
+      }
+    } // while
+  }
+
+
+  /// \brief Accumulate the shared raw buffers from \c full into the blocks
+  /// of \c target.
+  ///
+  /// If that throws, the reader is stopped and the rest of \c full is
+  /// released before the exception is passed on.
+  template <class Ty>
+  void
+  RFProc<Ty>::consume(bool genRMap,
+                      RawFileTarget const& target,
+                      bd::BlockingQueue<bd::Buffer<Ty> *>& full,
+                      preproc::VoxelOpacityFunction<Ty>& relFunc)
+  {
+    if (target.ckpt) {
+      target.ckpt->start(m_startVoxel * sizeof(Ty));
+    }
 
     while (true) {
-      rawData = m_rawFull.pop();
+      bd::Buffer<Ty>* rawData{ timedPop(full, Stage::BlockMinMax) };
 
       if (!rawData->getPtr()) {
-        bd::Dbg() << "Got null and empty buffer, breaking work loop.";
         break;
       }
 
-      parallelBlockMinMax(volume, blocks, rawData);
+      try {
+        {
+          StageTimer timer{ Stage::BlockMinMax, rawData->getNumElements() * sizeof(Ty),
+                            rawData->getNumElements(), rawData->getIndexOffset() };
+          parallelBlockMinMax(*target.volume, *target.blocks, rawData);
+        }
 
-      if (!skipRMap) {
-        bd::Dbg() << "Going to generate rmap data for current buffer";
-        genRMapData(rawData, relFunc);
+        if (genRMap) {
+          bd::Dbg() << "Going to generate rmap data for current buffer";
+          genRMapData(rawData, relFunc);
+        }
+
+        uint64_t const end{ rawData->getIndexOffset() + rawData->getNumElements() };
+        if (target.ckpt && target.ckpt->due(end * sizeof(Ty))) {
+          checkpoint(genRMap, target, end);
+        }
+      } catch (...) {
+        // The reader waits for the buffers this consumer holds, so they are
+        // released until the quit buffer comes.
+        m_reader.stop();
+        while (rawData->getPtr()) {
+          static_cast<RefBuffer<Ty>*>(rawData)->release();
+          rawData = full.pop();
+        }
+        throw;
       }
 
-      m_rawEmpty.push(rawData);
+      static_cast<RefBuffer<Ty>*>(rawData)->release();
 
     } // while
   }
@@ -331,28 +570,60 @@ namespace preproc
   } // parallelBlockMinMax
 
 
+  /// \brief Save the block accumulators after the first \c end voxels.
+  ///
+  /// The rmap writer may lag behind, so the checkpoint records how long the
+  /// rmap file has to be for it to be resumed from.
+  template <class Ty>
+  void
+  RFProc<Ty>::checkpoint(bool genRMap,
+                         RawFileTarget const& target,
+                         uint64_t end)
+  {
+    Checkpoint ckpt;
+    ckpt.phase = Checkpoint::Phase::RawFile;
+    ckpt.voxelOffset = end;
+    ckpt.rmapBytes = genRMap ? end * sizeof(double) : 0;
+    ckpt.save(*target.volume, *target.blocks);
+
+    try {
+      target.ckpt->write(ckpt, end * sizeof(Ty));
+    } catch (std::runtime_error& e) {
+      // A failed checkpoint shouldn't bring down the run.
+      bd::Warn() << e.what();
+    }
+  }
+
+
   template <class Ty>
   void
   RFProc<Ty>::genRMapData(bd::Buffer<Ty>* rawData,
                           preproc::VoxelOpacityFunction<Ty>& relFunc)
   {
     bd::Buffer<double>* rmapData{ nullptr };
-    rmapData = m_rmapEmpty.pop();
+    rmapData = timedPop(m_rmapEmpty, Stage::Relevance);
     if (!rmapData->getPtr()) {
       bd::Dbg() << "No rmap data to get. Returning...";
       return;
     }
 
+    StageTimer timer{ Stage::Relevance, rawData->getNumElements() * sizeof(Ty),
+                      rawData->getNumElements(), rawData->getIndexOffset() };
     double* rmapPtr{ rmapData->getPtr() };
 
-    // The voxel classifier uses the opacity function to write the opacity to the rmap.
-    using Relevance = ParallelForVoxelRelevance<
-      Ty, preproc::VoxelOpacityFunction<Ty>, double *>;
-    Relevance relevance{ rmapPtr, rawData, relFunc };
-
-    // Process this buffer in parallel with the classifier
-    tbb::blocked_range<size_t> range{ 0, rawData->getNumElements() };
-    tbb::parallel_for(range, relevance);
+    if (m_gradRel) {
+      // Value and gradient magnitude relevance, see --tfunc2d.
+      (*m_gradRel)(rawData, rmapPtr);
+    } else {
+      // The voxel classifier uses the opacity function to write the opacity to the rmap.
+      using Relevance = ParallelForVoxelRelevance<
+        Ty, preproc::VoxelOpacityFunction<Ty>, double *>;
+      Relevance relevance{ rmapPtr, rawData, relFunc };
+
+      // Process this buffer in parallel with the classifier
+      tbb::blocked_range<size_t> range{ 0, rawData->getNumElements() };
+      tbb::parallel_for(range, relevance);
+    }
     rmapData->setIndexOffset(rawData->getIndexOffset());
     rmapData->setNumElements(rawData->getNumElements());
     m_rmapFull.push(rmapData);
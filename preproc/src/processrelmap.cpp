@@ -3,14 +3,18 @@
 //
 
 #include "processrelmap.h"
+#include "reader.h"
+#include "metrics.h"
 #include "parallel/parallelreduce_blockempties.h"
 #include "parallel/parallelreduce_blockrov.h"
 
-#include <bd/io/bufferedreader.h>
+#include <bd/datastructure/blockingqueue.h>
 
 #include <tbb/tbb.h>
 #include <tbb/task_scheduler_init.h>
 
+#include <fstream>
+#include <memory>
 #include <stdexcept>
 
 
@@ -79,40 +83,15 @@ parallelSumBlockRelevances(bd::Buffer<double> const *buf,
     b->rov += vis[i];
   }
 } // parallelSumBlockRelevances()
+
+
 } // namespace
 
 
-/// \brief For each buffer in the RMap file, count the number of irrelevant voxels for each
-/// blocks, then compute the rov.
-/// \param clo - 
-/// \param volume - 
-/// \param blocks - 
+////////////////////////////////////////////////////////////////////////////////
 void
-processRelMap(CommandLineOptions const &clo,
-              bd::Volume &volume,
-              std::vector<bd::FileBlock> &blocks)
+finishBlockRelevances(bd::Volume &volume, std::vector<bd::FileBlock> &blocks)
 {
-  bd::BufferedReader<double> r{ clo.bufferSize };
-
-  bd::Info() << "Opening rmap file for processing: " << clo.rmapFilePath;
-  if (!r.open(clo.rmapFilePath)) {
-    throw std::runtime_error("Could not open file: " + clo.rmapFilePath);
-  }
-  r.start();
-
-  // In parallel, compute block statistics based on the RMap values.
-  // This loop runs for each buffer filled from the rmap file.
-  bd::Buffer<double> *buf{ nullptr };
-  while ((buf = r.waitNextFullUntilNone()) != nullptr) {
-
-//    parallelCountBlockEmptyVoxels(buf, clo, volume, blocks);
-
-    parallelSumBlockRelevances(buf, volume, blocks);
-
-    r.waitReturnEmpty(buf);
-  }
-
-
   // compute the block relevance as a ratio of
   for (auto &b : blocks) {
     uint64_t totalvox{ b.voxel_dims[0] * b.voxel_dims[1] * b.voxel_dims[2] };
@@ -138,6 +117,108 @@ processRelMap(CommandLineOptions const &clo,
 
   volume.rovMin((*minmaxE.first).rov);
   volume.rovMax((*minmaxE.second).rov);
+} // finishBlockRelevances()
+
+
+/// \brief For each buffer in the RMap file, count the number of irrelevant voxels for each
+/// blocks, then compute the rov.
+/// \param clo - 
+/// \param volume - 
+/// \param blocks - 
+/// \param ckpt - 
+/// \param startVoxel - 
+void
+processRelMap(CommandLineOptions const &clo,
+              bd::Volume &volume,
+              std::vector<bd::FileBlock> &blocks,
+              Checkpointer *ckpt,
+              uint64_t startVoxel)
+{
+  processRelMap(clo, { RelMapTarget{ &volume, &blocks, ckpt } }, startVoxel);
+}
+
+
+void
+processRelMap(CommandLineOptions const &clo,
+              std::vector<RelMapTarget> const &targets,
+              uint64_t startVoxel)
+{
+  PassTimer timer{ Pass::RelMap, startVoxel };
+
+  bd::Info() << "Opening rmap file for processing: " << clo.rmapFilePath;
+  std::ifstream rmapfile{ clo.rmapFilePath, std::ios::binary };
+  if (!rmapfile.is_open()) {
+    throw std::runtime_error("Could not open file: " + clo.rmapFilePath);
+  }
+  rmapfile.seekg(startVoxel * sizeof(double));
+
+  // Split the buffer memory into a few buffers so the reader can fill one
+  // while the others are being reduced.
+  size_t const num_buffers{ 4 };
+  size_t const len_buffers{ std::max<size_t>(1, clo.bufferSize / num_buffers / sizeof(double)) };
+  std::unique_ptr<double[]> mem{ new double[num_buffers * len_buffers] };
+  std::vector<std::unique_ptr<bd::Buffer<double>>> buffers;
+
+  bd::BlockingQueue<bd::Buffer<double> *> full;
+  bd::BlockingQueue<bd::Buffer<double> *> empty;
+  for (size_t i{ 0 }; i < num_buffers; ++i) {
+    buffers.emplace_back(new bd::Buffer<double>(mem.get() + i * len_buffers, len_buffers));
+    empty.push(buffers.back().get());
+  }
+
+  Reader<double> r{ &full, &empty };
+  r.setStartOffset(startVoxel);
+  r.setStage(Stage::RMapRead);
+  Reader<double>::start(r, rmapfile);
+
+  for (auto const &t : targets) {
+    if (t.ckpt) {
+      t.ckpt->start(startVoxel * sizeof(double));
+    }
+  }
+
+  // In parallel, compute block statistics based on the RMap values.
+  // This loop runs for each buffer filled from the rmap file.
+  while (true) {
+    bd::Buffer<double> *buf{ timedPop(full, Stage::BlockRov) };
+    if (!buf->getPtr()) {
+      // the reader's "magical empty buffer".
+      delete buf;
+      break;
+    }
+
+//    parallelCountBlockEmptyVoxels(buf, clo, volume, blocks);
+
+    uint64_t const end{ buf->getIndexOffset() + buf->getNumElements() };
+    for (auto const &t : targets) {
+      {
+        StageTimer timer{ Stage::BlockRov, buf->getNumElements() * sizeof(double),
+                          buf->getNumElements(), buf->getIndexOffset() };
+        parallelSumBlockRelevances(buf, *t.volume, *t.blocks);
+      }
+
+      if (t.ckpt && t.ckpt->due(end * sizeof(double))) {
+        Checkpoint c;
+        c.phase = Checkpoint::Phase::RelMap;
+        c.voxelOffset = end;
+        c.rmapBytes = end * sizeof(double);
+        c.save(*t.volume, *t.blocks);
+        try {
+          t.ckpt->write(c, end * sizeof(double));
+        } catch (std::runtime_error &e) {
+          bd::Warn() << e.what();
+        }
+      }
+    }
+
+    empty.push(buf);
+  }
+
+  r.join();
+
+  for (auto const &t : targets) {
+    finishBlockRelevances(*t.volume, *t.blocks);
+  }
 
 } // processRelMap()
 } // namespace preproc
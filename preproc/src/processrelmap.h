@@ -6,6 +6,7 @@
 #define PREPROCESSOR_PROCESSRELMAP_H
 
 #include "cmdline.h"
+#include "checkpoint.h"
 
 #include <bd/volume/volume.h>
 #include <bd/io/buffer.h>
@@ -22,10 +23,40 @@ namespace preproc
 /// \param clo[in] clo - User supplied options.
 /// \param volume[in,out] - The volume associated with the relevance map.
 /// \param blocks[in,o
+/// \param ckpt[in] - If not null, write checkpoints with it.
+/// \param startVoxel[in] - Resume at this rmap value, \c blocks hold the rov
+///                         sums of the values before it.
 void
 processRelMap(CommandLineOptions const &clo,
               bd::Volume &volume,
-              std::vector<bd::FileBlock> & blocks);
+              std::vector<bd::FileBlock> & blocks,
+              Checkpointer *ckpt = nullptr,
+              uint64_t startVoxel = 0);
+
+
+/// \brief Turn the summed block relevances into rovs and set the volume's
+/// rov range.
+void
+finishBlockRelevances(bd::Volume &volume, std::vector<bd::FileBlock> &blocks);
+
+
+/// \brief The volume and blocks of one block count tuple that a relevance
+/// map pass accumulates into.
+struct RelMapTarget
+{
+  bd::Volume *volume;
+  std::vector<bd::FileBlock> *blocks;
+  Checkpointer *ckpt; ///< May be null.
+};
+
+
+/// \brief Compute the rov of the blocks of several block count tuples with
+/// one pass over the RMap file.
+/// \param startVoxel[in] - Resume at this rmap value for all of the targets.
+void
+processRelMap(CommandLineOptions const &clo,
+              std::vector<RelMapTarget> const &targets,
+              uint64_t startVoxel = 0);
 
 
 } // namespace preproc
@@ -0,0 +1,173 @@
+#ifndef preproc_rawfile_h__
+#define preproc_rawfile_h__
+
+#include <bd/log/logger.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A read-only raw file that is read at explicit offsets with pread().
+///
+/// Unlike an std::ifstream, a RawFile has no file position, so any number of
+/// threads can read different parts of the file at the same time.
+class RawFile
+{
+public:
+
+  RawFile()
+      : m_fd{ -1 }
+      , m_size{ 0 }
+      , m_map{ nullptr }
+  {
+  }
+
+
+  ~RawFile()
+  {
+    close();
+  }
+
+
+  RawFile(RawFile const &) = delete;
+  RawFile &operator=(RawFile const &) = delete;
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Open the file at \c path for reading.
+  /// \return true if the file was opened.
+  bool
+  open(std::string const &path)
+  {
+    close();
+
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+      bd::Err() << "Could not open file " << path << ": " << std::strerror(errno);
+      return false;
+    }
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0) {
+      bd::Err() << "Could not stat file " << path << ": " << std::strerror(errno);
+      close();
+      return false;
+    }
+
+    m_size = static_cast<uint64_t>(st.st_size);
+    m_path = path;
+    return true;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  void
+  close()
+  {
+    if (m_map != nullptr) {
+      ::munmap(m_map, m_size);
+      m_map = nullptr;
+    }
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+    m_size = 0;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  bool
+  isOpen() const
+  {
+    return m_fd >= 0;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Size of the file in bytes.
+  uint64_t
+  size() const
+  {
+    return m_size;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Read \c bytes bytes starting at byte \c offset into \c dest.
+  ///
+  /// Short reads from pread() are retried until \c bytes bytes have been
+  /// read or the end of the file is reached.
+  /// \return The number of bytes read, less than \c bytes only at end of file.
+  /// \throws std::runtime_error if the read fails.
+  uint64_t
+  readAt(void *dest, uint64_t bytes, uint64_t offset) const
+  {
+    char *p{ static_cast<char *>(dest) };
+    uint64_t total{ 0 };
+
+    while (total < bytes) {
+      ssize_t amount{ ::pread(m_fd, p + total, bytes - total, offset + total) };
+
+      if (amount < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Read failed in " + m_path + ": " + std::strerror(errno));
+      }
+
+      if (amount == 0) {
+        break;
+      }
+
+      total += static_cast<uint64_t>(amount);
+    }
+
+    return total;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Map the whole file read-only, the mapping lives until close().
+  ///
+  /// Pages are read in on first touch and stay in the page cache, so a
+  /// long-running process can make repeated passes over the file without
+  /// re-reading it.
+  /// \return Pointer to the first byte of the file.
+  /// \throws std::runtime_error if the file can't be mapped.
+  void const *
+  map()
+  {
+    if (m_map == nullptr) {
+      void *p{ ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0) };
+      if (p == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + m_path + ": " + std::strerror(errno));
+      }
+      ::madvise(p, m_size, MADV_SEQUENTIAL);
+      m_map = p;
+    }
+    return m_map;
+  }
+
+
+private:
+  int m_fd;
+  uint64_t m_size;
+  std::string m_path;
+  void *m_map;
+
+}; // class RawFile
+
+} // namespace preproc
+
+#endif // ! preproc_rawfile_h__
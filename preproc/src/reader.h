@@ -6,12 +6,16 @@
 #ifndef PREPROCESSOR_READER_H
 #define PREPROCESSOR_READER_H
 
-#include "messages/recipient.h"
-#include "messages/messagebroker.h"
+#include "metrics.h"
+#include "roireader.h"
 
 #include <bd/io/buffer.h>
 #include <bd/datastructure/blockingqueue.h>
 
+#include <atomic>
+#include <fstream>
+#include <future>
+
 namespace preproc
 {
 
@@ -36,6 +40,9 @@ public:
          bd::BlockingQueue<buffer_type *> *empty)
       : m_empty{ empty }
       , m_full{ full }
+      , m_startOffset{ 0 }
+      , m_stage{ Stage::RawRead }
+      , m_stop{ false }
   {
   }
 
@@ -62,47 +69,56 @@ public:
   }
 
 
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Set the index of the first voxel that will be read, when the
+  /// stream is not read from its beginning.
+  void
+  setStartOffset(uint64_t voxels)
+  {
+    m_startOffset = voxels;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Set the stage the reads are recorded to, Stage::RawRead by default.
+  void
+  setStage(Stage s)
+  {
+    m_stage = s;
+  }
+
+
   ////////////////////////////////////////////////////////////////////////////////
   uint64_t
   operator()(std::istream &is)
   {
-    size_t bytes_read{ 0 };
     bd::Info() << "Starting reader loop.";
 
-    while (true) {
-      buffer_type *buf{ m_empty->pop() };
-      if (!buf->getPtr()) {
-        break;
-      }
-      buf->setIndexOffset(bytes_read / sizeof(Ty));
-
-      is.read(reinterpret_cast<char *>(buf->getPtr()), buf->getMaxNumElements() * sizeof(Ty));
+    uint64_t const bytes_read{
+        loop([&is](buffer_type *buf) -> uint64_t {
+               is.read(reinterpret_cast<char *>(buf->getPtr()),
+                       buf->getMaxNumElements() * sizeof(Ty));
+               return static_cast<uint64_t>(is.gcount()) / sizeof(Ty);
+             }) };
 
-      std::streamsize amount{ is.gcount() };
-      if (amount == 0) {
-        bd::Dbg() << "Read 0 bytes from file, exiting reader loop.";
-        m_empty->push(buf);
-        break;
-      }
-      bytes_read += amount;
-      buf->setNumElements(amount / sizeof(Ty));
-      m_full->push(buf);
+    bd::Info() << "Reader loop finished.";
+    return bytes_read;
+  }
 
-//      DataReadMessage *m{ new DataReadMessage };
-//      m->Amount = amount;
-//      Broker::send(m);
 
-      // entire file has been read.
-      if (buf->getNumElements() < buf->getMaxNumElements()) {
-        break;
-      }
-    } // while(true
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Read only the voxels of the ROI that \c rr was set up with.
+  uint64_t
+  operator()(RoiReader<Ty> &rr)
+  {
+    bd::Info() << "Starting region of interest reader loop.";
 
-    bd::Info() << "Reader loop finished.";
-    
-    // push an empty buffer to the full queue so the consumer of that queue will quit.
-    m_full->push(new bd::Buffer<Ty>(nullptr, 0));
+    uint64_t const bytes_read{
+        loop([&rr](buffer_type *buf) -> uint64_t {
+               return rr.next(buf);
+             }) };
 
+    bd::Info() << "Region of interest reader loop finished.";
     return bytes_read;
   }
 
@@ -120,6 +136,30 @@ public:
 
 
   ////////////////////////////////////////////////////////////////////////////////
+  static void
+  start(Reader &r, RoiReader<Ty> &rr)
+  {
+    r.reader_future =
+        std::async(std::launch::async,
+                   [&r, &rr]() -> uint64_t {
+                     return r(rr);
+                   });
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Make the reader loop quit at its next buffer, as if the end of
+  /// the stream was reached.
+  void
+  stop()
+  {
+    m_stop.store(true, std::memory_order_relaxed);
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Wait for the reader loop to finish.
+  /// \throws Whatever the reader loop threw.
   uint64_t
   join()
   {
@@ -129,8 +169,70 @@ public:
 
 
 private:
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Fill empty buffers with \c fill and pass them to the full queue
+  /// until \c fill comes up short.
+  ///
+  /// The quit buffer is pushed to the full queue even if \c fill throws, the
+  /// exception is then rethrown by join().
+  /// \param fill Reads into its buffer argument, returns the number of voxels read.
+  template<class Fill>
+  uint64_t
+  loop(Fill fill)
+  {
+    size_t bytes_read{ m_startOffset * sizeof(Ty) };
+
+    while (true) {
+      buffer_type *buf{ timedPop(*m_empty, m_stage) };
+      if (!buf->getPtr()) {
+        break;
+      }
+      if (m_stop.load(std::memory_order_relaxed)) {
+        m_empty->push(buf);
+        break;
+      }
+      buf->setIndexOffset(bytes_read / sizeof(Ty));
+
+      StageTimer timer{ m_stage, 0, 0, buf->getIndexOffset() };
+      uint64_t elements{ 0 };
+      try {
+        elements = fill(buf);
+      } catch (...) {
+        // The consumer is waiting on the full queue, it has to be told to
+        // quit before the error goes out through join().
+        m_empty->push(buf);
+        m_full->push(new bd::Buffer<Ty>(nullptr, 0));
+        throw;
+      }
+      timer.setAmount(elements * sizeof(Ty), elements);
+      if (elements == 0) {
+        bd::Dbg() << "Read 0 bytes from file, exiting reader loop.";
+        m_empty->push(buf);
+        break;
+      }
+      bytes_read += elements * sizeof(Ty);
+      buf->setNumElements(elements);
+      m_full->push(buf);
+
+      // entire file has been read.
+      if (buf->getNumElements() < buf->getMaxNumElements()) {
+        break;
+      }
+    } // while(true
+
+    // push an empty buffer to the full queue so the consumer of that queue will quit.
+    m_full->push(new bd::Buffer<Ty>(nullptr, 0));
+
+    return bytes_read;
+  }
+
+
   queue_type *m_empty;
   queue_type *m_full;
+  uint64_t m_startOffset; ///< Voxel index of the first voxel read.
+  Stage m_stage;
+  std::atomic<bool> m_stop;
 
   std::future<uint64_t> reader_future;
 
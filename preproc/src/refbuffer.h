@@ -0,0 +1,57 @@
+#ifndef preproc_refbuffer_h__
+#define preproc_refbuffer_h__
+
+#include <bd/io/buffer.h>
+#include <bd/datastructure/blockingqueue.h>
+
+#include <atomic>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A buffer that can be handed to several consumers at once.
+///
+/// The buffer goes back to its home queue of empty buffers when the last
+/// consumer releases it.
+template<class Ty>
+class RefBuffer : public bd::Buffer<Ty>
+{
+public:
+
+  RefBuffer(Ty *p, size_t len, bd::BlockingQueue<bd::Buffer<Ty> *> *home)
+      : bd::Buffer<Ty>(p, len)
+      , m_home{ home }
+      , m_refs{ 0 }
+  {
+  }
+
+
+  /// \brief Set the number of consumers that will release this buffer.
+  void
+  share(int consumers)
+  {
+    m_refs.store(consumers, std::memory_order_relaxed);
+  }
+
+
+  /// \brief Release one consumer's reference, the last one returns the
+  /// buffer to its home queue.
+  void
+  release()
+  {
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      m_home->push(this);
+    }
+  }
+
+
+private:
+  bd::BlockingQueue<bd::Buffer<Ty> *> *m_home;
+  std::atomic<int> m_refs;
+
+}; // class RefBuffer
+
+} // namespace preproc
+
+#endif // ! preproc_refbuffer_h__
@@ -0,0 +1,59 @@
+#include "roi.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace preproc
+{
+
+bool
+parseRoi(std::string const &s, Roi &roi)
+{
+  std::vector<std::string> corners;
+  boost::split(corners, s, boost::is_any_of(":"));
+  if (corners.size() != 2) {
+    return false;
+  }
+
+  Roi r;
+  uint64_t *ends[2]{ r.lo, r.hi };
+  for (int c{ 0 }; c < 2; ++c) {
+    std::vector<std::string> split;
+    boost::split(split, corners[c], boost::is_any_of(","));
+    if (split.size() != 3) {
+      return false;
+    }
+
+    try {
+      for (int d{ 0 }; d < 3; ++d) {
+        ends[c][d] = std::stoull(split[d]);
+      }
+    } catch (std::logic_error &) {
+      return false;
+    }
+  }
+
+  for (int d{ 0 }; d < 3; ++d) {
+    if (r.hi[d] <= r.lo[d]) {
+      return false;
+    }
+  }
+
+  roi = r;
+  return true;
+}
+
+
+std::string
+to_string(Roi const &roi)
+{
+  std::stringstream ss;
+  ss << roi.lo[0] << ',' << roi.lo[1] << ',' << roi.lo[2] << ':'
+     << roi.hi[0] << ',' << roi.hi[1] << ',' << roi.hi[2];
+  return ss.str();
+}
+
+} // namespace preproc
@@ -0,0 +1,63 @@
+#ifndef preproc_roi_h__
+#define preproc_roi_h__
+
+#include <cstdint>
+#include <string>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An axis aligned box of voxels, [lo, hi) along each dimension.
+///
+/// A default constructed Roi is empty, which means "the whole volume".
+struct Roi
+{
+  Roi()
+      : lo{ 0, 0, 0 }
+      , hi{ 0, 0, 0 }
+  {
+  }
+
+  uint64_t lo[3];
+  uint64_t hi[3];
+
+
+  /// \brief True if no ROI was given.
+  bool
+  empty() const
+  {
+    return hi[0] == 0 && hi[1] == 0 && hi[2] == 0;
+  }
+
+
+  /// \brief Number of voxels in the ROI along dimension \c d.
+  uint64_t
+  dim(int d) const
+  {
+    return hi[d] - lo[d];
+  }
+
+
+  /// \brief True if the ROI is exactly the volume with dimensions \c dims.
+  bool
+  covers(uint64_t const dims[3]) const
+  {
+    return lo[0] == 0 && lo[1] == 0 && lo[2] == 0 &&
+        hi[0] == dims[0] && hi[1] == dims[1] && hi[2] == dims[2];
+  }
+};
+
+
+/// \brief Parse a ROI of the form "x0,y0,z0:x1,y1,z1" into \c roi.
+/// \return false if \c s is not a well formed ROI with hi > lo.
+bool
+parseRoi(std::string const &s, Roi &roi);
+
+
+std::string
+to_string(Roi const &roi);
+
+} // namespace preproc
+
+#endif // ! preproc_roi_h__
@@ -0,0 +1,179 @@
+#ifndef preproc_roireader_h__
+#define preproc_roireader_h__
+
+#include "roi.h"
+#include "rawfile.h"
+
+#include <bd/io/buffer.h>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Reads the voxels of a Roi out of a raw file, packed in x, y, z order.
+///
+/// The ROI is read as a sequence of runs that are contiguous in the file. A
+/// run is a row of the ROI, or a whole slab band if the ROI spans entire
+/// rows, or the rest of the ROI if it spans entire slabs. When a buffer
+/// needs many short runs, the runs are read in parallel.
+///
+/// Buffers are given index offsets relative to the ROI, so the block kernels
+/// see the ROI as if it was the whole volume.
+template<class Ty>
+class RoiReader
+{
+public:
+
+  RoiReader()
+      : m_file{ nullptr }
+      , m_fileDims{ 0, 0, 0 }
+      , m_pos{ 0 }
+      , m_total{ 0 }
+  {
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Read \c roi out of \c file, a raw volume with dimensions \c fileDims.
+  void
+  set(RawFile const *file, uint64_t const fileDims[3], Roi const &roi)
+  {
+    m_file = file;
+    std::copy(fileDims, fileDims + 3, m_fileDims);
+    m_roi = roi;
+    m_pos = 0;
+    m_total = roi.dim(0) * roi.dim(1) * roi.dim(2);
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Skip to voxel \c pos of the ROI.
+  void
+  seek(uint64_t pos)
+  {
+    m_pos = std::min(pos, m_total);
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Fill \c buf with the next ROI voxels.
+  /// \return The number of voxels read, 0 once the whole ROI has been read.
+  /// \throws std::runtime_error if the file could not be read.
+  uint64_t
+  next(bd::Buffer<Ty> *buf)
+  {
+    uint64_t const count{ std::min<uint64_t>(buf->getMaxNumElements(), m_total - m_pos) };
+    buf->setIndexOffset(m_pos);
+    buf->setNumElements(count);
+    if (count == 0) {
+      return 0;
+    }
+
+    makeRuns(m_pos, count);
+
+    Ty *dest{ buf->getPtr() };
+    Run const *runs{ m_runs.data() };
+
+    // Small numbers of runs are cheaper to issue from this thread.
+    size_t const parallelThreshold{ 64 };
+    if (m_runs.size() < parallelThreshold) {
+      for (Run const &r : m_runs) {
+        readRun(r, dest);
+      }
+    } else {
+      tbb::parallel_for(tbb::blocked_range<size_t>{ 0, m_runs.size(), 16 },
+                        [&](tbb::blocked_range<size_t> const &range) {
+                          for (size_t i{ range.begin() }; i != range.end(); ++i) {
+                            readRun(runs[i], dest);
+                          }
+                        });
+    }
+
+    m_pos += count;
+    return count;
+  }
+
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /// \brief Total number of voxels in the ROI.
+  uint64_t
+  total() const
+  {
+    return m_total;
+  }
+
+
+private:
+
+  struct Run
+  {
+    uint64_t fileIdx; ///< Index of the first voxel of the run in the file.
+    uint64_t destIdx; ///< Index of the first voxel of the run in the buffer.
+    uint64_t length;  ///< Number of voxels.
+  };
+
+
+  void
+  makeRuns(uint64_t pos, uint64_t count)
+  {
+    uint64_t const w{ m_roi.dim(0) };
+    uint64_t const h{ m_roi.dim(1) };
+    uint64_t const d{ m_roi.dim(2) };
+    bool const fullRows{ w == m_fileDims[0] };
+    bool const fullSlabs{ fullRows && h == m_fileDims[1] };
+
+    m_runs.clear();
+    uint64_t dest{ 0 };
+    while (dest < count) {
+      uint64_t const rx{ pos % w };
+      uint64_t const ry{ (pos / w) % h };
+      uint64_t const rz{ pos / (w * h) };
+
+      uint64_t len{ w - rx };
+      if (fullSlabs) {
+        len = (d - rz) * w * h - ry * w - rx;
+      } else if (fullRows) {
+        len = (h - ry) * w - rx;
+      }
+      len = std::min(len, count - dest);
+
+      uint64_t const fileIdx{
+          ((m_roi.lo[2] + rz) * m_fileDims[1] + (m_roi.lo[1] + ry)) * m_fileDims[0]
+              + m_roi.lo[0] + rx };
+
+      m_runs.push_back(Run{ fileIdx, dest, len });
+      dest += len;
+      pos += len;
+    }
+  }
+
+
+  void
+  readRun(Run const &r, Ty *dest) const
+  {
+    uint64_t const bytes{ r.length * sizeof(Ty) };
+    uint64_t const amount{ m_file->readAt(dest + r.destIdx, bytes, r.fileIdx * sizeof(Ty)) };
+    if (amount != bytes) {
+      throw std::runtime_error("Short read inside of the region of interest.");
+    }
+  }
+
+
+  RawFile const *m_file;
+  uint64_t m_fileDims[3];
+  Roi m_roi;
+  uint64_t m_pos;
+  uint64_t m_total;
+  std::vector<Run> m_runs;
+
+}; // class RoiReader
+
+} // namespace preproc
+
+#endif // ! preproc_roireader_h__
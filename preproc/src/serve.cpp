@@ -0,0 +1,531 @@
+#include "serve.h"
+#include "generate.h"
+#include "indexer.h"
+#include "metrics.h"
+#include "processrelmap.h"
+#include "rawfile.h"
+#include "voxelopacityfunction.h"
+#include "parallel/histogrambinning.h"
+
+#include <bd/io/buffer.h>
+#include <bd/io/indexfile.h>
+#include <bd/log/logger.h>
+#include <bd/volume/transferfunction.h>
+
+#include <tbb/tbb.h>
+#include <tbb/task_scheduler_init.h>
+
+#include <boost/filesystem.hpp>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace preproc
+{
+
+namespace
+{
+
+/// Buckets of the float block histograms over the volume range. A voxel's
+/// relevance is taken at the mean of its bucket, which is at most 1/4096
+/// of the range away.
+size_t const FLOAT_BUCKETS{ 4096 };
+
+
+/// \brief Buckets of the block value histograms, one for each value of the
+/// integer types.
+template<class Ty>
+HistogramBinning
+blockBinning(double, double)
+{
+  return HistogramBinning::exact<Ty>();
+}
+
+
+template<>
+HistogramBinning
+blockBinning<float>(double min, double max)
+{
+  return HistogramBinning{ HistogramBinning::Scale::Linear, FLOAT_BUCKETS, min, max };
+}
+
+
+size_t
+sizeOf(bd::DataType type)
+{
+  switch (type) {
+  case bd::DataType::UnsignedCharacter:
+    return sizeof(unsigned char);
+  case bd::DataType::UnsignedShort:
+    return sizeof(unsigned short);
+  case bd::DataType::Float:
+    return sizeof(float);
+  default:
+    return 0;
+  }
+}
+
+
+std::string
+makeReply(int32_t status, std::string const &payload)
+{
+  ServeReplyHeader header;
+  std::memcpy(header.magic, "PPIX", 4);
+  header.status = status;
+  header.length = payload.size();
+
+  std::string reply(sizeof(header), '\0');
+  std::memcpy(&reply[0], &header, sizeof(header));
+  reply += payload;
+  return reply;
+}
+
+
+/// \brief send() all of \c bytes, without a SIGPIPE if the client is gone.
+/// \return false if the client hung up.
+bool
+sendAll(int fd, std::string const &bytes)
+{
+  char const *p{ bytes.data() };
+  size_t left{ bytes.size() };
+  while (left > 0) {
+    ssize_t amount{ ::send(fd, p, left, MSG_NOSIGNAL) };
+    if (amount < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += amount;
+    left -= static_cast<size_t>(amount);
+  }
+  return true;
+}
+
+} // namespace
+
+
+struct ResidentVolume::Impl
+{
+  /// \brief A non-empty bucket of a block's value histogram.
+  struct Bin
+  {
+    uint64_t count;
+    double sum; ///< Of the values in the bucket.
+  };
+
+
+  /// \brief The block statistics of one block grid and the value
+  /// histogram of each block.
+  struct Grid
+  {
+    std::unique_ptr<BlockIndexer> indexer;
+    std::vector<std::vector<Bin>> bins; ///< For each block, its non-empty buckets.
+  };
+
+
+  CommandLineOptions clo;
+  bd::DataType type;
+  RawFile raw;
+  char const *data;
+  uint64_t total;      ///< Voxels in the volume.
+  uint64_t chunk;      ///< Voxels per kernel pass.
+  std::map<std::tuple<int, int, int>, Grid> grids;
+
+
+  /// \brief Block min/max/total and histograms for the block counts in
+  /// \c t, computed on first use.
+  Grid const &
+  grid(std::tuple<int, int, int> const &t);
+
+
+  /// \brief Count the voxels of each block of \c g into its histogram.
+  template<class Ty>
+  void
+  computeHistograms(Grid &g);
+
+
+  /// \brief Set the rov of the blocks in \c index for \c tf from the
+  /// histograms of \c g.
+  template<class Ty>
+  void
+  computeRov(Grid const &g, bd::IndexFile &index, bd::OpacityTransferFunction const &tf);
+
+
+  std::string
+  index(std::string const &blockCount, std::string const &tfPath);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+ResidentVolume::Impl::Grid const &
+ResidentVolume::Impl::grid(std::tuple<int, int, int> const &t)
+{
+  auto found = grids.find(t);
+  if (found != grids.end()) {
+    return found->second;
+  }
+
+  Grid g;
+  g.indexer.reset(new BlockIndexer{ clo.vol_dims, type });
+  BlockIndexer &ix = *g.indexer;
+  ix.addBlockGrid(std::get<0>(t), std::get<1>(t), std::get<2>(t));
+  ix.setFileNames(fs::path(clo.inFile).filename().string(), "");
+  if (clo.useDataRange) {
+    ix.setDataRange(clo.dataMin, clo.dataMax);
+  }
+
+  size_t const voxelSize{ sizeOf(type) };
+  for (uint64_t start{ 0 }; start < total; start += chunk) {
+    ix.push(data + start * voxelSize, std::min(chunk, total - start));
+  }
+  ix.finish();
+
+  switch (type) {
+  case bd::DataType::UnsignedCharacter:
+    computeHistograms<unsigned char>(g);
+    break;
+  case bd::DataType::UnsignedShort:
+    computeHistograms<unsigned short>(g);
+    break;
+  case bd::DataType::Float:
+    computeHistograms<float>(g);
+    break;
+  default:
+    break;
+  }
+
+  return grids.emplace(t, std::move(g)).first->second;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+ResidentVolume::Impl::computeHistograms(Grid &g)
+{
+  bd::IndexFile const &index = g.indexer->indexFile(0);
+  bd::Volume const &volume = index.getVolume();
+  std::vector<bd::FileBlock> const &blocks = index.getFileBlocks();
+  HistogramBinning const binning{ blockBinning<Ty>(volume.min(), volume.max()) };
+  Ty const *voxels{ reinterpret_cast<Ty const *>(data) };
+  uint64_t const X{ clo.vol_dims[0] };
+  uint64_t const Y{ clo.vol_dims[1] };
+
+  // A whole histogram per thread, with the buckets a block used so only
+  // those have to be copied out and cleared.
+  struct Scratch
+  {
+    std::vector<Bin> bins;
+    std::vector<size_t> used;
+  };
+  tbb::enumerable_thread_specific<Scratch> scratch{ [&binning]() {
+    return Scratch{ std::vector<Bin>(binning.buckets, Bin{ 0, 0.0 }), {} };
+  } };
+
+  StageTimer timer{ Stage::BlockMinMax, total * sizeof(Ty), total };
+  g.bins.resize(blocks.size());
+  tbb::parallel_for(tbb::blocked_range<size_t>{ 0, blocks.size() },
+                    [&](tbb::blocked_range<size_t> const &r) {
+    Scratch &s = scratch.local();
+    for (size_t i{ r.begin() }; i != r.end(); ++i) {
+      bd::FileBlock const &b = blocks[i];
+      uint64_t const x0{ b.ijk_index[0] * b.voxel_dims[0] };
+      uint64_t const y0{ b.ijk_index[1] * b.voxel_dims[1] };
+      uint64_t const z0{ b.ijk_index[2] * b.voxel_dims[2] };
+      for (uint64_t z{ z0 }; z < z0 + b.voxel_dims[2]; ++z) {
+        for (uint64_t y{ y0 }; y < y0 + b.voxel_dims[1]; ++y) {
+          Ty const *row{ voxels + ( z * Y + y ) * X + x0 };
+          for (uint64_t x{ 0 }; x < b.voxel_dims[0]; ++x) {
+            size_t const k{ binning.bucket(double(row[x])) };
+            Bin &bin = s.bins[k];
+            if (bin.count == 0) {
+              s.used.push_back(k);
+            }
+            bin.count += 1;
+            bin.sum += double(row[x]);
+          }
+        }
+      }
+
+      std::vector<Bin> &out = g.bins[i];
+      out.reserve(s.used.size());
+      for (size_t k : s.used) {
+        out.push_back(s.bins[k]);
+        s.bins[k] = Bin{ 0, 0.0 };
+      }
+      s.used.clear();
+    }
+  });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template<class Ty>
+void
+ResidentVolume::Impl::computeRov(Grid const &g,
+                                 bd::IndexFile &index,
+                                 bd::OpacityTransferFunction const &tf)
+{
+  bd::Volume &volume = index.getVolume();
+  std::vector<bd::FileBlock> &blocks = index.getFileBlocks();
+  VoxelOpacityFunction<Ty> const relFunc{ tf, volume.min(), volume.max() };
+
+  // Every voxel of a bucket has the relevance of the bucket's mean, which
+  // is the voxels' value for the integer types.
+  StageTimer timer{ Stage::BlockRov, 0, total };
+  tbb::parallel_for(tbb::blocked_range<size_t>{ 0, blocks.size() },
+                    [&](tbb::blocked_range<size_t> const &r) {
+    for (size_t i{ r.begin() }; i != r.end(); ++i) {
+      double rov{ 0 };
+      for (Bin const &bin : g.bins[i]) {
+        rov += double(bin.count) * relFunc(static_cast<Ty>(bin.sum / double(bin.count)));
+      }
+      blocks[i].rov = rov;
+    }
+  });
+
+  finishBlockRelevances(volume, blocks);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::string
+ResidentVolume::Impl::index(std::string const &blockCount, std::string const &tfPath)
+{
+  std::vector<std::tuple<int, int, int>> tuples;
+  if (blockCount.empty() || !makeNumBlocksTuples(tuples, { blockCount })) {
+    return makeReply(1, "Malformed block count: " + blockCount);
+  }
+  std::tuple<int, int, int> const t{ tuples[0] };
+  int const bc[3]{ std::get<0>(t), std::get<1>(t), std::get<2>(t) };
+  for (int d{ 0 }; d < 3; ++d) {
+    if (bc[d] < 1 || uint64_t(bc[d]) > clo.vol_dims[d]) {
+      return makeReply(1, "Block count " + blockCount + " doesn't fit the volume.");
+    }
+  }
+
+  bd::OpacityTransferFunction tf;
+  if (!tfPath.empty() && tf.load(tfPath) < 0) {
+    return makeReply(1, "Could not load transfer function: " + tfPath);
+  }
+
+  Grid const &g = grid(t);
+  bd::IndexFile const &summary = g.indexer->indexFile(0);
+  bd::IndexFile index;
+  index.setRawFileName(fs::path(clo.inFile).filename().string());
+  index.setTFFileName(tfPath.empty() ? std::string() : fs::path(tfPath).filename().string());
+  index.setVolume(summary.getVolume());
+  index.init(type);
+  index.getFileBlocks() = summary.getFileBlocks();
+
+  if (!tfPath.empty()) {
+    switch (type) {
+    case bd::DataType::UnsignedCharacter:
+      computeRov<unsigned char>(g, index, tf);
+      break;
+    case bd::DataType::UnsignedShort:
+      computeRov<unsigned short>(g, index, tf);
+      break;
+    case bd::DataType::Float:
+      computeRov<float>(g, index, tf);
+      break;
+    default:
+      break;
+    }
+  }
+
+  std::ostringstream os;
+  index.writeBinaryIndexFile(os);
+  return makeReply(0, os.str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+ResidentVolume::ResidentVolume(CommandLineOptions const &clo)
+    : m_impl{ new Impl }
+{
+  Impl &im = *m_impl;
+  im.clo = clo;
+  im.type = bd::to_dataType(clo.dataType);
+  size_t const voxelSize{ sizeOf(im.type) };
+  if (voxelSize == 0) {
+    throw std::runtime_error("Unsupported data type for --serve: " + clo.dataType);
+  }
+
+  if (clo.useDataPercentiles) {
+    throw std::runtime_error("--serve takes the data range from --data-min/--data-max, "
+                             "not percentiles.");
+  }
+
+  im.total = clo.vol_dims[0] * clo.vol_dims[1] * clo.vol_dims[2];
+  im.chunk = std::max<uint64_t>(1, clo.bufferSize / voxelSize);
+  if (!im.raw.open(clo.inFile)) {
+    throw std::runtime_error("Could not open file: " + clo.inFile);
+  }
+  if (im.raw.size() < im.total * voxelSize) {
+    throw std::runtime_error("Raw file " + clo.inFile + " is smaller than the volume.");
+  }
+  im.data = static_cast<char const *>(im.raw.map());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+ResidentVolume::~ResidentVolume() = default;
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::string
+ResidentVolume::handle(std::string const &request, bool &shutdown)
+try
+{
+  std::istringstream is{ request };
+  std::string command;
+  is >> command;
+
+  if (command == "index") {
+    std::string blockCount;
+    std::string tfPath;
+    is >> blockCount;
+    std::getline(is >> std::ws, tfPath);
+    return m_impl->index(blockCount, tfPath);
+  }
+  if (command == "ping") {
+    return makeReply(0, "");
+  }
+  if (command == "shutdown") {
+    shutdown = true;
+    return makeReply(0, "");
+  }
+  return makeReply(1, "Unknown request: " + command);
+
+} catch (std::exception &e) {
+  return makeReply(1, e.what());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+serve(CommandLineOptions &clo)
+{
+  loadDatFile(clo);
+  if (!clo.roi.empty() || clo.shardCount > 0) {
+    throw std::runtime_error("--serve doesn't support --roi or --shard.");
+  }
+  applyRoi(clo);
+
+  int numThreads = clo.numThreads;
+  if (numThreads == 0) {
+    numThreads = tbb::task_scheduler_init::default_num_threads();
+  }
+  tbb::task_scheduler_init init(numThreads);
+
+  ResidentVolume volume{ clo };
+
+  // Compute the block grids given with -D up front.
+  bool stop{ false };
+  for (auto const &bc : clo.numBlocks) {
+    std::string const reply{ volume.handle("index " + bc, stop) };
+    ServeReplyHeader header;
+    std::memcpy(&header, reply.data(), sizeof(header));
+    if (header.status != 0) {
+      throw std::runtime_error("Could not index -D " + bc + ": " + reply.substr(sizeof(header)));
+    }
+  }
+
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (clo.serveSocket.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error("Socket path is too long: " + clo.serveSocket);
+  }
+  std::strncpy(addr.sun_path, clo.serveSocket.c_str(), sizeof(addr.sun_path) - 1);
+
+  // Remove the socket of a server that didn't shut down cleanly, but not
+  // one that is still being served.
+  struct stat st;
+  if (::stat(clo.serveSocket.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    int const probe{ ::socket(AF_UNIX, SOCK_STREAM, 0) };
+    bool const live{ probe >= 0 &&
+                     ::connect(probe, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 };
+    if (probe >= 0) {
+      ::close(probe);
+    }
+    if (live) {
+      throw std::runtime_error("Another server is listening on " + clo.serveSocket + ".");
+    }
+    ::unlink(clo.serveSocket.c_str());
+  }
+
+  int const fd{ ::socket(AF_UNIX, SOCK_STREAM, 0) };
+  if (fd < 0 ||
+      ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, 8) != 0) {
+    std::string const err{ std::strerror(errno) };
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw std::runtime_error("Could not listen on " + clo.serveSocket + ": " + err);
+  }
+  bd::Info() << "Serving " << clo.inFile << " on " << clo.serveSocket;
+
+  while (!stop) {
+    int const conn{ ::accept(fd, nullptr, nullptr) };
+    if (conn < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      bd::Err() << "accept() failed: " << std::strerror(errno);
+      break;
+    }
+
+    std::string pending;
+    char buf[4096];
+    bool open{ true };
+    while (open && !stop) {
+      ssize_t const amount{ ::read(conn, buf, sizeof(buf)) };
+      if (amount < 0 && errno == EINTR) {
+        continue;
+      }
+      if (amount <= 0) {
+        break;
+      }
+      pending.append(buf, static_cast<size_t>(amount));
+
+      size_t eol;
+      while (open && !stop && ( eol = pending.find('\n') ) != std::string::npos) {
+        std::string line{ pending.substr(0, eol) };
+        pending.erase(0, eol + 1);
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        std::string const reply{ volume.handle(line, stop) };
+        bd::Info() << line << ": " << std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count() << "s";
+        open = sendAll(conn, reply);
+      }
+    }
+    ::close(conn);
+  }
+
+  ::close(fd);
+  ::unlink(clo.serveSocket.c_str());
+}
+
+} // namespace preproc
@@ -0,0 +1,83 @@
+#ifndef preproc_serve_h__
+#define preproc_serve_h__
+
+#include "cmdline.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace preproc
+{
+
+/// \brief Header of every reply from preproc --serve.
+///
+/// Followed by \c length bytes: a binary index file (the contents of the
+/// .bin file preproc --generate would write) if status is 0, otherwise an
+/// error message.
+struct ServeReplyHeader
+{
+  char magic[4];   ///< "PPIX"
+  int32_t status;  ///< 0 on success.
+  uint64_t length; ///< Bytes that follow the header.
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A raw volume kept mapped in memory, with the block min/max/total
+/// and a value histogram of each block cached for each block grid, for
+/// answering index requests.
+///
+/// Block min/max/total don't depend on the transfer function, and a block's
+/// rov is the sum over its histogram of count times the opacity of the
+/// bucket. So a new transfer function on a grid that was seen before costs
+/// one opacity per histogram bucket rather than a pass over the voxels.
+/// The histograms are exact for uchar and ushort volumes, floats are put in
+/// 4096 buckets over the volume range.
+class ResidentVolume
+{
+public:
+
+  /// \param clo Options with the raw file, dims, data type and optionally
+  /// --data-min/--data-max, as after loadDatFile().
+  /// \throws std::runtime_error if the raw file can't be mapped or is too
+  /// small.
+  explicit ResidentVolume(CommandLineOptions const &clo);
+
+
+  ~ResidentVolume();
+
+
+  /// \brief Answer one request line, see serve() for the requests.
+  /// \param[out] shutdown Set if the request asks the server to stop.
+  /// \return The reply, a ServeReplyHeader and its payload.
+  std::string
+  handle(std::string const &request, bool &shutdown);
+
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+
+/// \brief Serve index requests on the unix domain socket clo.serveSocket
+/// until a shutdown request.
+///
+/// Requests are lines of text, any number per connection, and each gets a
+/// ServeReplyHeader and payload in return:
+///
+///   index XxYxZ [tfunc path]   Index file for X by Y by Z blocks, with
+///                              block rov if a transfer function is given.
+///   ping                       Empty reply.
+///   shutdown                   Empty reply, then the server exits.
+///
+/// Connections are handled one at a time.
+/// \throws std::runtime_error if the volume can't be loaded, a -D grid can't
+/// be indexed, or the socket can't be opened or has a server listening.
+void
+serve(CommandLineOptions &clo);
+
+} // namespace preproc
+
+#endif // ! preproc_serve_h__
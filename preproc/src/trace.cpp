@@ -0,0 +1,107 @@
+#include "trace.h"
+
+#ifdef PREPROC_TRACE
+
+#include <bd/log/logger.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+namespace preproc
+{
+
+std::atomic<bool> Trace::s_enabled{ false };
+Trace::clock::time_point Trace::s_origin{};
+std::mutex Trace::s_mutex;
+std::vector<std::unique_ptr<Trace::Ring>> Trace::s_rings;
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Trace::enable()
+{
+  s_origin = clock::now();
+  s_enabled.store(true, std::memory_order_release);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+Trace::Ring &
+Trace::ring()
+{
+  // The rings are owned by s_rings, so they outlive the threads that
+  // recorded them and can be written at the end of the run.
+  thread_local Ring *r{ nullptr };
+  if (!r) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_rings.emplace_back(new Ring{ static_cast<int>(s_rings.size()) });
+    r = s_rings.back().get();
+  }
+  return *r;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void
+Trace::record(char const *name,
+              clock::time_point begin,
+              clock::time_point end,
+              uint64_t offset,
+              uint64_t count)
+{
+  Ring &r = ring();
+  TraceEvent &e = r.events[r.next % RING_EVENTS];
+  e.name = name;
+  e.beginNs = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - s_origin).count();
+  e.durNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  e.offset = offset;
+  e.count = count;
+  ++r.next;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool
+Trace::write(std::string const &path)
+{
+  std::ofstream os{ path };
+  if (!os.is_open()) {
+    bd::Err() << "Could not open trace file " << path;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+
+  os << std::fixed << std::setprecision(3);
+  os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first{ true };
+  uint64_t dropped{ 0 };
+  for (auto const &r : s_rings) {
+    os << ( first ? "" : ",\n" )
+       << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << r->tid
+       << ", \"args\": {\"name\": \"thread " << r->tid << "\"}}";
+    first = false;
+
+    uint64_t const n{ std::min<uint64_t>(r->next, RING_EVENTS) };
+    dropped += r->next - n;
+    for (uint64_t i{ r->next - n }; i < r->next; ++i) {
+      TraceEvent const &e = r->events[i % RING_EVENTS];
+      os << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << r->tid
+         << ", \"ts\": " << e.beginNs / 1000.0 << ", \"dur\": " << e.durNs / 1000.0
+         << ", \"args\": {\"offset\": " << e.offset << ", \"count\": " << e.count << "}}";
+    }
+  }
+  os << "\n]}\n";
+
+  if (dropped > 0) {
+    bd::Warn() << "Trace ring buffers overflowed, the oldest " << dropped
+               << " spans were dropped.";
+  }
+  bd::Info() << "Wrote trace file " << path;
+  return true;
+}
+
+} // namespace preproc
+
+#endif // PREPROC_TRACE
@@ -0,0 +1,104 @@
+#ifndef preproc_trace_h__
+#define preproc_trace_h__
+
+///////////////////////////////////////////////////////////////////////////////
+// Span recording for --trace. Built only if PREPROC_TRACE is defined (the
+// PREPROC_TRACE cmake option), otherwise StageTimer doesn't record spans.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef PREPROC_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace preproc
+{
+
+/// \brief A completed span.
+struct TraceEvent
+{
+  char const *name; ///< Must be a string literal or otherwise outlive the trace.
+  int64_t beginNs;  ///< Since the trace was enabled.
+  int64_t durNs;
+  uint64_t offset;  ///< Voxel index of the buffer the span worked on.
+  uint64_t count;   ///< Voxels in the buffer.
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Records spans into a preallocated ring buffer for each thread.
+///
+/// Recording a span takes no locks and allocates nothing after a thread's
+/// first span. A thread keeps its most recent RING_EVENTS spans.
+class Trace
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr size_t RING_EVENTS{ 1 << 16 };
+
+
+  /// \brief Start recording spans.
+  static void
+  enable();
+
+
+  static bool
+  enabled()
+  {
+    return s_enabled.load(std::memory_order_relaxed);
+  }
+
+
+  /// \brief Record a span on the calling thread.
+  static void
+  record(char const *name,
+         clock::time_point begin,
+         clock::time_point end,
+         uint64_t offset,
+         uint64_t count);
+
+
+  /// \brief Write the recorded spans of all threads to \c path in Chrome
+  /// trace-event format. The spans should not be recorded to meanwhile.
+  /// \return false if the file could not be written.
+  static bool
+  write(std::string const &path);
+
+
+private:
+  struct Ring
+  {
+    explicit Ring(int tid)
+        : tid{ tid }
+        , next{ 0 }
+        , events(RING_EVENTS)
+    {
+    }
+
+    int const tid;
+    uint64_t next; ///< Total spans recorded, the next slot is next % RING_EVENTS.
+    std::vector<TraceEvent> events;
+  };
+
+
+  static Ring &
+  ring();
+
+
+  static std::atomic<bool> s_enabled;
+  static clock::time_point s_origin;
+  static std::mutex s_mutex; ///< Guards s_rings while a thread registers.
+  static std::vector<std::unique_ptr<Ring>> s_rings;
+};
+
+} // namespace preproc
+
+#endif // PREPROC_TRACE
+
+#endif // ! preproc_trace_h__
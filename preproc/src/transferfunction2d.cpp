@@ -0,0 +1,68 @@
+#include "transferfunction2d.h"
+
+#include <bd/log/logger.h>
+
+#include <fstream>
+#include <sstream>
+
+namespace preproc
+{
+
+TransferFunction2D::TransferFunction2D()
+    : m_valueBins{ 0 }
+    , m_gradBins{ 0 }
+    , m_valueLast{ 0.0 }
+    , m_gradLast{ 0.0 }
+    , m_gradMax{ 0.0 }
+{
+}
+
+
+bool
+TransferFunction2D::load(std::string const &path)
+{
+  std::ifstream is{ path };
+  if (!is.is_open()) {
+    bd::Err() << "Could not open 2D transfer function " << path;
+    return false;
+  }
+
+  // Drop the comments, then read it all as one stream of numbers.
+  std::stringstream numbers;
+  std::string line;
+  while (std::getline(is, line)) {
+    numbers << line.substr(0, line.find('#')) << '\n';
+  }
+
+  size_t nv{ 0 };
+  size_t ng{ 0 };
+  if (!( numbers >> nv >> ng ) || nv == 0 || ng == 0) {
+    bd::Err() << "Malformed 2D transfer function header in " << path;
+    return false;
+  }
+
+  // The gradient max is optional, so it is the first number if the line
+  // has three of them.
+  double gmax{ 0.0 };
+  std::getline(numbers, line);
+  std::istringstream{ line } >> gmax;
+
+  std::vector<double> table(nv * ng);
+  for (double &o : table) {
+    if (!( numbers >> o )) {
+      bd::Err() << "2D transfer function " << path << " should have " << nv * ng
+                << " opacities.";
+      return false;
+    }
+  }
+
+  m_valueBins = nv;
+  m_gradBins = ng;
+  m_valueLast = double(nv - 1);
+  m_gradLast = double(ng - 1);
+  m_gradMax = gmax > 0.0 ? gmax : 0.0;
+  m_table.swap(table);
+  return true;
+}
+
+} // namespace preproc
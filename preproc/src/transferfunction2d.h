@@ -0,0 +1,96 @@
+#ifndef preproc_transferfunction2d_h__
+#define preproc_transferfunction2d_h__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace preproc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief An opacity table over normalized voxel value and gradient
+/// magnitude, looked up with bilinear interpolation.
+///
+/// The file is text, '#' starts a comment:
+///
+///   <value bins> <gradient bins> [<gradient max>]
+///   <opacity> ... <opacity>       one row of value bins opacities
+///   ...                           for each gradient bin, first row is |grad| 0
+///
+/// Values are normalized to [0, 1] by the volume min/max, gradient
+/// magnitudes by the gradient max. If the file has no gradient max, or it
+/// is 0, the largest magnitude central differences can give is used,
+/// (max - min) * sqrt(3) / 2.
+class TransferFunction2D
+{
+public:
+
+  TransferFunction2D();
+
+
+  /// \brief Load the table in \c path.
+  /// \return false if the file can't be read or is malformed.
+  bool
+  load(std::string const &path);
+
+
+  /// \brief Opacity at normalized value \c value and gradient magnitude
+  /// \c grad, both are clamped to [0, 1].
+  double
+  interpolate(double value, double grad) const
+  {
+    double const v{ clamp(value) * m_valueLast };
+    double const g{ clamp(grad) * m_gradLast };
+    size_t const v0{ static_cast<size_t>(v) };
+    size_t const g0{ static_cast<size_t>(g) };
+    size_t const v1{ v0 < m_valueBins - 1 ? v0 + 1 : v0 };
+    size_t const g1{ g0 < m_gradBins - 1 ? g0 + 1 : g0 };
+    double const tv{ v - v0 };
+    double const tg{ g - g0 };
+
+    double const *r0{ m_table.data() + g0 * m_valueBins };
+    double const *r1{ m_table.data() + g1 * m_valueBins };
+    double const a{ r0[v0] + ( r0[v1] - r0[v0] ) * tv };
+    double const b{ r1[v0] + ( r1[v1] - r1[v0] ) * tv };
+    return a + ( b - a ) * tg;
+  }
+
+
+  /// \brief The gradient magnitude that normalizes to 1, 0 if the file
+  /// didn't give one.
+  double
+  gradientMax() const
+  {
+    return m_gradMax;
+  }
+
+
+  bool
+  empty() const
+  {
+    return m_table.empty();
+  }
+
+
+private:
+
+  static double
+  clamp(double x)
+  {
+    return x < 0.0 ? 0.0 : x > 1.0 ? 1.0 : x;
+  }
+
+
+  size_t m_valueBins;
+  size_t m_gradBins;
+  double m_valueLast; ///< m_valueBins - 1
+  double m_gradLast;  ///< m_gradBins - 1
+  double m_gradMax;
+  std::vector<double> m_table; ///< m_gradBins rows of m_valueBins opacities.
+
+}; // class TransferFunction2D
+
+} // namespace preproc
+
+#endif // ! preproc_transferfunction2d_h__
@@ -1,7 +1,10 @@
 #ifndef preproc_volumeminmax
 #define preproc_volumeminmax
 
+#include "metrics.h"
 #include "parallel/parallelreduce_minmax.h"
+#include "parallel/threadhistogram.h"
+#include "roireader.h"
 
 #include <bd/io/buffer.h>
 #include <bd/io/bufferedreader.h>
@@ -10,7 +13,9 @@
 
 #include <tbb/tbb.h>
 
+#include <future>
 #include <string>
+#include <vector>
 
 
 namespace preproc
@@ -22,11 +27,14 @@ namespace preproc
   /// \param path The path to the file.
   /// \param szbuf Size of buffer (in bytes) to allocate.
   /// \param volume The volume to use for storing the results in.
+  /// \param values If not null, the voxels are also counted in it for
+  ///        quantiles.
   template<typename Ty>
   void
     volumeMinMax(std::string const & path,
                  size_t szbuf,
-                 bd::Volume &volume)
+                 bd::Volume &volume,
+                 ThreadHistogram<Ty> *values = nullptr)
   {
 
     bd::BufferedReader<Ty> r{ szbuf };
@@ -46,6 +54,8 @@ namespace preproc
     bd::Buffer<Ty> *buf{ nullptr };
     while ((buf = r.waitNextFullUntilNone()) != nullptr) {
 
+      StageTimer timer{ Stage::VolumeMinMax, buf->getNumElements() * sizeof(Ty),
+                        buf->getNumElements(), buf->getIndexOffset() };
       tbb::blocked_range<size_t> range(0, buf->getNumElements());
       ParallelReduceMinMax<Ty> mm(buf);
 
@@ -57,6 +67,9 @@ namespace preproc
         min = mm.min_value;
 
       total += mm.tot_value;
+      if (values != nullptr) {
+        values->add(buf);
+      }
 
       r.waitReturnEmpty(buf);
 
@@ -72,6 +85,81 @@ namespace preproc
 
   }
 
+
+  /// Compute the min, max and average values of the region of interest read
+  /// by \c rr.
+  ///
+  /// Two buffers are used so the next part of the ROI is read while the
+  /// current one is reduced.
+  /// \tparam Ty The data type of the voxel elements in the volume.
+  /// \param rr Reader set up with the raw file and region of interest.
+  /// \param szbuf Size of buffer (in bytes) to allocate.
+  /// \param volume The volume to use for storing the results in.
+  /// \param values If not null, the voxels are also counted in it for
+  ///        quantiles.
+  template<typename Ty>
+  void
+    volumeMinMax(RoiReader<Ty> &rr,
+                 size_t szbuf,
+                 bd::Volume &volume,
+                 ThreadHistogram<Ty> *values = nullptr)
+  {
+    size_t const len{ std::max<size_t>(1, szbuf / 2 / sizeof(Ty)) };
+    std::vector<Ty> mem(2 * len);
+    bd::Buffer<Ty> bufs[2]{ { mem.data(), len }, { mem.data() + len, len } };
+
+    double max{ std::numeric_limits<double>::lowest() };
+    double min{ std::numeric_limits<double>::max() };
+    double total{ 0 };
+
+    bd::Info() << "Begin region of interest min/max computation.";
+
+    rr.seek(0);
+    int cur{ 0 };
+    uint64_t count{ rr.next(&bufs[cur]) };
+    while (count > 0) {
+      bd::Buffer<Ty> *next{ &bufs[1 - cur] };
+      uint64_t const nextOffset{ bufs[cur].getIndexOffset() + bufs[cur].getNumElements() };
+      std::future<uint64_t> nextCount{
+          std::async(std::launch::async, [&rr, next, nextOffset]() {
+            StageTimer timer{ Stage::RawRead, 0, 0, nextOffset };
+            uint64_t const n{ rr.next(next) };
+            timer.setAmount(n * sizeof(Ty), n);
+            return n;
+          }) };
+
+      {
+        StageTimer timer{ Stage::VolumeMinMax, bufs[cur].getNumElements() * sizeof(Ty),
+                          bufs[cur].getNumElements(), bufs[cur].getIndexOffset() };
+        tbb::blocked_range<size_t> range(0, bufs[cur].getNumElements());
+        ParallelReduceMinMax<Ty> mm(&bufs[cur]);
+
+        tbb::parallel_reduce(range, mm);
+
+        if (max < mm.max_value)
+          max = mm.max_value;
+        if (min > mm.min_value)
+          min = mm.min_value;
+
+        total += mm.tot_value;
+        if (values != nullptr) {
+          values->add(&bufs[cur]);
+        }
+      }
+
+      count = nextCount.get();
+      cur = 1 - cur;
+    }
+
+    bd::Info() << "Finished region of interest min/max computation.";
+
+    volume.min(min);
+    volume.max(max);
+    volume.total(total);
+    glm::u64vec3 dims{ volume.voxelDims() };
+    volume.avg(total / double(dims.x * dims.y * dims.z));
+  }
+
 } // namespace preproc
 #endif // ! preproc_volumeminmax
 
@@ -5,7 +5,7 @@
 #ifndef PREPROCESSOR_WRITER_H
 #define PREPROCESSOR_WRITER_H
 
-#include "messages/messagebroker.h"
+#include "metrics.h"
 
 #include <bd/log/logger.h>
 #include <bd/io/buffer.h>
@@ -68,7 +68,7 @@ public:
     bd::Info() << "Starting writer loop.";
     while (true) {
 
-      buffer_type *buf{ m_full->pop() };
+      buffer_type *buf{ timedPop(*m_full, Stage::RMapWrite) };
 
       // Let worker thread exit if the "magical empty buffer" is encountered
       if (!buf->getPtr()) {
@@ -76,11 +76,11 @@ public:
         break;
       }
 
-      os.write(reinterpret_cast<char *>(buf->getPtr()), buf->getNumElements() * sizeof(Ty));
-
-//      DataWrittenMessage *m = new DataWrittenMessage;
-//      m->Amount = buf->getNumElements() * sizeof(Ty);
-//      Broker::send(m);
+      {
+        StageTimer timer{ Stage::RMapWrite, buf->getNumElements() * sizeof(Ty),
+                          buf->getNumElements(), buf->getIndexOffset() };
+        os.write(reinterpret_cast<char *>(buf->getPtr()), buf->getNumElements() * sizeof(Ty));
+      }
 
       buf->setNumElements(0);
 
@@ -0,0 +1,130 @@
+#include "testutil.h"
+
+#include "preproc_capi.h"
+#include "voxelopacityfunction.h"
+
+#include <bd/volume/transferfunction.h>
+
+#include <catch.hpp>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+uint64_t const DIMS[3]{ 37, 29, 23 };
+
+
+/// \brief The C API's block stats as BlockValues, block i must be at
+/// stats[i].
+std::vector<BlockValues>
+capiBlockValues(std::vector<preproc_block_stats> const &stats, uint64_t const bc[3])
+{
+  std::vector<BlockValues> values;
+  for (size_t i{ 0 }; i < stats.size(); ++i) {
+    preproc_block_stats const &s = stats[i];
+    REQUIRE(s.ijk[0] + bc[0] * ( s.ijk[1] + bc[1] * s.ijk[2] ) == i);
+    values.push_back(BlockValues{ { s.ijk[0], s.ijk[1], s.ijk[2] },
+                                  s.min, s.max, s.total, s.avg, s.rov });
+  }
+  return values;
+}
+
+} // namespace
+
+
+TEST_CASE("C API block stats match a scalar reference", "[capi]")
+{
+  std::vector<unsigned short> const data{ makeVolume<unsigned short>(DIMS, 11) };
+  int64_t const strides[3]{ 2, int64_t(2 * DIMS[0]), int64_t(2 * DIMS[0] * DIMS[1]) };
+
+  for (auto const &bc : { std::vector<uint64_t>{ 4, 3, 5 }, std::vector<uint64_t>{ 1, 1, 1 },
+                          std::vector<uint64_t>{ 37, 1, 2 } }) {
+    for (int threads : { 1, 3 }) {
+      INFO("block count " << bc[0] << "x" << bc[1] << "x" << bc[2] << ", " << threads
+                          << " threads");
+      std::vector<preproc_block_stats> stats(bc[0] * bc[1] * bc[2]);
+      REQUIRE(preproc_block_stats_compute(data.data(), PREPROC_UINT16, DIMS, strides,
+                                          bc.data(), nullptr, 1, 0, threads,
+                                          stats.data()) == PREPROC_OK);
+      expectBlocksMatch(capiBlockValues(stats, bc.data()), data, DIMS, bc.data(),
+                        [](unsigned short) { return 0.0; });
+    }
+  }
+}
+
+
+TEST_CASE("C API reads strided views", "[capi]")
+{
+  // The volume is stored z, x, y (y fastest); the strides give the x, y, z
+  // view without a copy.
+  std::vector<float> const data{ makeVolume<float>(DIMS, 13) };
+  std::vector<float> transposed(data.size());
+  for (uint64_t z{ 0 }; z < DIMS[2]; ++z) {
+    for (uint64_t y{ 0 }; y < DIMS[1]; ++y) {
+      for (uint64_t x{ 0 }; x < DIMS[0]; ++x) {
+        transposed[y + DIMS[1] * ( x + DIMS[0] * z )] = data[x + DIMS[0] * ( y + DIMS[1] * z )];
+      }
+    }
+  }
+  int64_t const strides[3]{ int64_t(sizeof(float) * DIMS[1]), int64_t(sizeof(float)),
+                            int64_t(sizeof(float) * DIMS[0] * DIMS[1]) };
+  uint64_t const bc[3]{ 4, 3, 5 };
+
+  std::vector<preproc_block_stats> stats(bc[0] * bc[1] * bc[2]);
+  REQUIRE(preproc_block_stats_compute(transposed.data(), PREPROC_FLOAT32, DIMS, strides, bc,
+                                      nullptr, 1, 0, 2, stats.data()) == PREPROC_OK);
+  expectBlocksMatch(capiBlockValues(stats, bc), data, DIMS, bc, [](float) { return 0.0; });
+
+  double min, max, total;
+  REQUIRE(preproc_volume_minmax(transposed.data(), PREPROC_FLOAT32, DIMS, strides, 2, &min, &max,
+                                &total) == PREPROC_OK);
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  REQUIRE(min == *mm.first);
+  REQUIRE(max == *mm.second);
+}
+
+
+TEST_CASE("C API computes rov with a transfer function", "[capi]")
+{
+  TempDir dir;
+  {
+    std::ofstream os{ dir.file("vol.tf") };
+    os << "3\n0.0 0.0\n0.3 0.1\n1.0 1.0\n";
+  }
+  bd::OpacityTransferFunction tf;
+  REQUIRE(tf.load(dir.file("vol.tf")) >= 0);
+
+  std::vector<unsigned char> const data{ makeVolume<unsigned char>(DIMS, 17) };
+  int64_t const strides[3]{ 1, int64_t(DIMS[0]), int64_t(DIMS[0] * DIMS[1]) };
+  uint64_t const bc[3]{ 4, 3, 5 };
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  VoxelOpacityFunction<unsigned char> const rel{ tf, double(*mm.first), double(*mm.second) };
+
+  // data_min > data_max: the range comes from the volume.
+  std::vector<preproc_block_stats> stats(bc[0] * bc[1] * bc[2]);
+  REQUIRE(preproc_block_stats_compute(data.data(), PREPROC_UINT8, DIMS, strides, bc,
+                                      dir.file("vol.tf").c_str(), 1, 0, 0,
+                                      stats.data()) == PREPROC_OK);
+  expectBlocksMatch(capiBlockValues(stats, bc), data, DIMS, bc, rel);
+}
+
+
+TEST_CASE("C API reports bad arguments", "[capi]")
+{
+  std::vector<unsigned char> const data(DIMS[0] * DIMS[1] * DIMS[2]);
+  int64_t const strides[3]{ 1, int64_t(DIMS[0]), int64_t(DIMS[0] * DIMS[1]) };
+  uint64_t const tooMany[3]{ 38, 1, 1 };
+  uint64_t const bc[3]{ 1, 1, 1 };
+  preproc_block_stats stats;
+
+  REQUIRE(preproc_block_stats_compute(data.data(), PREPROC_UINT8, DIMS, strides, tooMany,
+                                      nullptr, 1, 0, 0, &stats) == PREPROC_INVALID_ARGUMENT);
+  REQUIRE(std::string(preproc_last_error()).find("Block count") != std::string::npos);
+  REQUIRE(preproc_block_stats_compute(data.data(), 42, DIMS, strides, bc, nullptr, 1, 0, 0,
+                                      &stats) == PREPROC_INVALID_ARGUMENT);
+  REQUIRE(preproc_block_stats_compute(data.data(), PREPROC_UINT8, DIMS, strides, bc,
+                                      "/nonexistent/vol.tf", 1, 0, 0,
+                                      &stats) == PREPROC_TRANSFER_FUNCTION);
+}
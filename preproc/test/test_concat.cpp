@@ -0,0 +1,173 @@
+#include "testutil.h"
+
+#include "datwriter.h"
+
+#include "concat/src/assemble.h"
+#include "concat/src/concatenator.h"
+#include "concat/src/manifest.h"
+
+#include <bd/io/datfile.h>
+
+#include <catch.hpp>
+
+#include <fstream>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+uint64_t const DIMS[3]{ 10, 7, 9 };
+
+/// Where the 8 tiles of DIMS are split along each axis. No two tiles have
+/// the same dimensions.
+uint64_t const SPLIT[3]{ 4, 3, 5 };
+
+
+template<class Ty>
+std::vector<Ty>
+readRaw(std::string const &path, uint64_t count)
+{
+  std::vector<Ty> data(count);
+  std::ifstream is{ path, std::ios::binary };
+  is.read(reinterpret_cast<char *>(data.data()), count * sizeof(Ty));
+  REQUIRE(uint64_t(is.gcount()) == count * sizeof(Ty));
+  return data;
+}
+
+
+/// \brief Cut \c data into the 8 tiles of DIMS, write each one to \c dir and
+/// write a manifest for them. Tile \c skip, if any, is left out of the
+/// manifest.
+/// \return The path of the manifest.
+std::string
+writeTiles(TempDir const &dir, std::vector<unsigned short> const &data, int skip = -1)
+{
+  std::string const path{ dir.file("tiles.txt") };
+  std::ofstream manifest{ path };
+  manifest << "# 8 tiles\ndims " << DIMS[0] << " " << DIMS[1] << " " << DIMS[2] << "\n";
+  for (int i{ 0 }; i < 8; ++i) {
+    uint64_t offset[3];
+    uint64_t dims[3];
+    for (int d{ 0 }; d < 3; ++d) {
+      bool const high{ ( i >> d & 1 ) != 0 };
+      offset[d] = high ? SPLIT[d] : 0;
+      dims[d] = high ? DIMS[d] - SPLIT[d] : SPLIT[d];
+    }
+
+    std::vector<unsigned short> tile;
+    for (uint64_t z{ offset[2] }; z < offset[2] + dims[2]; ++z) {
+      for (uint64_t y{ offset[1] }; y < offset[1] + dims[1]; ++y) {
+        for (uint64_t x{ offset[0] }; x < offset[0] + dims[0]; ++x) {
+          tile.push_back(data[( z * DIMS[1] + y ) * DIMS[0] + x]);
+        }
+      }
+    }
+    std::string const name{ "tile" + std::to_string(i) + ".raw" };
+    writeRaw(dir.file(name), tile);
+    if (i != skip) {
+      // Relative to the manifest's directory.
+      manifest << name << " " << offset[0] << " " << offset[1] << " " << offset[2]
+               << " " << dims[0] << " " << dims[1] << " " << dims[2] << "\n";
+    }
+  }
+  return path;
+}
+
+} // namespace
+
+
+TEST_CASE("concat assembles uneven tiles across chunks", "[concat]")
+{
+  TempDir dir;
+  std::vector<unsigned short> const data{ makeVolume<unsigned short>(DIMS, 37) };
+  concat::Manifest manifest;
+  std::string error;
+  REQUIRE(concat::loadManifest(writeTiles(dir, data), manifest, error));
+  REQUIRE(manifest.tiles.size() == 8);
+  REQUIRE(manifest.covered == data.size());
+
+  // A plane is 140 bytes, so a 1000 byte buffer makes chunks of 3 planes and
+  // the tiles that split at z = 5 straddle a chunk boundary.
+  std::string const out{ dir.file("out.raw") };
+  REQUIRE(concat::assemble<unsigned short>(manifest, out, 1000));
+  REQUIRE(readRaw<unsigned short>(out, data.size()) == data);
+
+  std::string const datPath{ dir.file("out.dat") };
+  REQUIRE(writeDat(datPath, out, manifest.dims, bd::DataType::UnsignedShort));
+  bd::DatFileData dat;
+  REQUIRE(bd::parseDat(datPath, dat));
+  REQUIRE(dat.rX == DIMS[0]);
+  REQUIRE(dat.rY == DIMS[1]);
+  REQUIRE(dat.rZ == DIMS[2]);
+  REQUIRE(dat.dataType == bd::DataType::UnsignedShort);
+}
+
+
+TEST_CASE("concat leaves voxels that no tile covers 0", "[concat]")
+{
+  TempDir dir;
+  std::vector<unsigned short> data{ makeVolume<unsigned short>(DIMS, 41) };
+  // Tile 5 is the one at (SPLIT[0], 0, SPLIT[2]).
+  std::string const path{ writeTiles(dir, data, 5) };
+  for (uint64_t z{ SPLIT[2] }; z < DIMS[2]; ++z) {
+    for (uint64_t y{ 0 }; y < SPLIT[1]; ++y) {
+      for (uint64_t x{ SPLIT[0] }; x < DIMS[0]; ++x) {
+        data[( z * DIMS[1] + y ) * DIMS[0] + x] = 0;
+      }
+    }
+  }
+
+  concat::Manifest manifest;
+  std::string error;
+  REQUIRE(concat::loadManifest(path, manifest, error));
+  REQUIRE(manifest.tiles.size() == 7);
+  std::string const out{ dir.file("out.raw") };
+  REQUIRE(concat::assemble<unsigned short>(manifest, out, 1000));
+  REQUIRE(readRaw<unsigned short>(out, data.size()) == data);
+}
+
+
+TEST_CASE("concat rejects overlapping tiles", "[concat]")
+{
+  TempDir dir;
+  std::vector<unsigned short> const data{ makeVolume<unsigned short>(DIMS, 43) };
+  std::string const path{ writeTiles(dir, data) };
+  {
+    std::ofstream manifest{ path, std::ios::app };
+    manifest << "tile0.raw 1 1 1 4 3 5\n";
+  }
+
+  concat::Manifest manifest;
+  std::string error;
+  REQUIRE_FALSE(concat::loadManifest(path, manifest, error));
+  REQUIRE(error.find("overlap") != std::string::npos);
+}
+
+
+TEST_CASE("concat replicates a volume to the target dimensions", "[concat]")
+{
+  TempDir dir;
+  uint64_t const inDims[3]{ 5, 4, 3 };
+  std::vector<float> const data{ makeVolume<float>(inDims, 47) };
+  writeRaw(dir.file("in.raw"), data);
+
+  // 11 isn't a multiple of 5, the output is cut to the whole copies.
+  std::string const out{ dir.file("out.raw") };
+  concat::Concatenator<float> cc{ dir.file("in.raw"), out, { 5, 4, 3 }, { 11, 8, 6 } };
+  REQUIRE(cc.concat());
+
+  uint64_t const outDims[3]{ 10, 8, 6 };
+  std::vector<float> const result{
+    readRaw<float>(out, outDims[0] * outDims[1] * outDims[2]) };
+  for (uint64_t z{ 0 }; z < outDims[2]; ++z) {
+    for (uint64_t y{ 0 }; y < outDims[1]; ++y) {
+      for (uint64_t x{ 0 }; x < outDims[0]; ++x) {
+        INFO("voxel " << x << "," << y << "," << z);
+        REQUIRE(result[( z * outDims[1] + y ) * outDims[0] + x] ==
+                data[( z % inDims[2] * inDims[1] + y % inDims[1] ) * inDims[0] + x % inDims[0]]);
+      }
+    }
+  }
+}
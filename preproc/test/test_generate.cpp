@@ -0,0 +1,456 @@
+#include "testutil.h"
+
+#include "generate.h"
+#include "reader.h"
+#include "voxelopacityfunction.h"
+
+#include <bd/io/indexfile.h>
+#include <bd/volume/transferfunction.h>
+
+#include <catch.hpp>
+
+#include <memory>
+#include <sstream>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+void
+writeDat(std::string const &path, std::string const &raw, uint64_t const dims[3],
+         char const *format)
+{
+  std::ofstream os{ path };
+  os << "ObjectFileName: " << raw
+     << "\nResolution: " << dims[0] << " " << dims[1] << " " << dims[2]
+     << "\nSliceThickness: 1 1 1"
+     << "\nFormat: " << format << "\n";
+}
+
+
+void
+writeTransferFunction(std::string const &path)
+{
+  std::ofstream os{ path };
+  os << "4\n"
+     << "0.0 0.0\n"
+     << "0.2 0.0\n"
+     << "0.6 0.5\n"
+     << "1.0 1.0\n";
+}
+
+
+/// \brief Check the index file at \c binPath for the block counts in \c t
+/// against a scalar reference over \c data.
+template<class Ty>
+void
+checkIndexFile(std::vector<Ty> const &data,
+               uint64_t const dims[3],
+               std::string const &tfPath,
+               std::tuple<int, int, int> const &t,
+               std::string const &binPath)
+{
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  double const vmin{ double(*mm.first) };
+  double const vmax{ double(*mm.second) };
+
+  bd::OpacityTransferFunction tf;
+  REQUIRE(tf.load(tfPath) >= 0);
+  VoxelOpacityFunction<Ty> const rel{ tf, vmin, vmax };
+
+  uint64_t const bc[3]{ uint64_t(std::get<0>(t)), uint64_t(std::get<1>(t)),
+                        uint64_t(std::get<2>(t)) };
+  INFO("block count " << bc[0] << "x" << bc[1] << "x" << bc[2]);
+
+  bool ok{ false };
+  std::unique_ptr<bd::IndexFile> index{ bd::IndexFile::fromBinaryIndexFile(binPath, ok) };
+  REQUIRE(ok);
+
+  bd::Volume const &volume = index->getVolume();
+  REQUIRE(volume.min() == vmin);
+  REQUIRE(volume.max() == vmax);
+  expectBlocksMatch(blockValues(index->getFileBlocks()), data, dims, bc, rel);
+}
+
+
+/// \brief The common arguments of a preproc run over the volume in \c dir.
+std::vector<std::string>
+volumeArgs(TempDir const &dir, std::vector<std::string> const &blockCounts)
+{
+  std::vector<std::string> args{ "-f", dir.file("vol.raw"),
+                                 "-d", dir.file("vol.dat"),
+                                 "-u", dir.file("vol.tf"),
+                                 "-o", dir.path(),
+                                 "--outfile-prefix", "vol" };
+  for (auto const &bc : blockCounts) {
+    args.push_back("-D");
+    args.push_back(bc);
+  }
+  return args;
+}
+
+
+/// \brief Run preproc --generate on a random volume and check every index
+/// file against a scalar reference.
+template<class Ty>
+void
+checkGenerate(char const *format,
+              uint64_t const dims[3],
+              std::vector<std::string> const &blockCounts,
+              std::string const &bufferSize,
+              int threads)
+{
+  TempDir dir;
+  std::vector<Ty> data{ makeVolume<Ty>(dims, 7) };
+  writeRaw(dir.file("vol.raw"), data);
+  writeDat(dir.file("vol.dat"), "vol.raw", dims, format);
+  writeTransferFunction(dir.file("vol.tf"));
+
+  std::vector<std::string> args{ volumeArgs(dir, blockCounts) };
+  args.insert(args.end(), { "-r", dir.file("vol.rmap"),
+                            "-b", bufferSize,
+                            "-n", std::to_string(threads),
+                            "--progress-interval", "0" });
+
+  CommandLineOptions clo;
+  REQUIRE(parseArgs(args, clo) != 0);
+  generate(clo);
+
+  std::vector<std::tuple<int, int, int>> tuples;
+  REQUIRE(makeNumBlocksTuples(tuples, blockCounts));
+  for (auto const &t : tuples) {
+    checkIndexFile(data, dims, dir.file("vol.tf"), t, makeFileNameString(clo, t) + ".bin");
+  }
+}
+
+
+uint64_t const EVEN[3]{ 32, 32, 32 };
+uint64_t const RAGGED[3]{ 37, 29, 23 };
+
+} // namespace
+
+
+TEST_CASE("generate matches a scalar reference", "[generate]")
+{
+  std::vector<std::string> const tuples{ "1x1x1", "4x3x5", "2x2x2" };
+
+  SECTION("uchar")
+  {
+    checkGenerate<unsigned char>("UCHAR", EVEN, tuples, "4K", 1);
+    checkGenerate<unsigned char>("UCHAR", RAGGED, tuples, "4K", 4);
+  }
+
+  SECTION("ushort")
+  {
+    checkGenerate<unsigned short>("USHORT", EVEN, tuples, "8K", 4);
+    checkGenerate<unsigned short>("USHORT", RAGGED, tuples, "1M", 1);
+  }
+
+  SECTION("float")
+  {
+    checkGenerate<float>("FLOAT", EVEN, tuples, "1M", 2);
+    checkGenerate<float>("FLOAT", RAGGED, tuples, "16K", 3);
+  }
+}
+
+
+TEST_CASE("generate gives the same blocks for any thread count", "[generate]")
+{
+  std::vector<std::string> const tuples{ "4x3x5" };
+  for (int threads : { 1, 2, 8 }) {
+    INFO(threads << " threads");
+    checkGenerate<unsigned short>("USHORT", RAGGED, tuples, "4K", threads);
+  }
+}
+
+
+TEST_CASE("sharded runs merge to the unsharded index", "[generate]")
+{
+  // Two tuples with different z block counts have different shard slabs,
+  // each needs its own rmap.
+  std::vector<std::string> const blockCounts{ "4x3x5", "2x2x3" };
+  int const shards{ 2 };
+
+  TempDir dir;
+  std::vector<unsigned short> data{ makeVolume<unsigned short>(RAGGED, 11) };
+  writeRaw(dir.file("vol.raw"), data);
+  writeDat(dir.file("vol.dat"), "vol.raw", RAGGED, "USHORT");
+  writeTransferFunction(dir.file("vol.tf"));
+
+  // The min/max pass totals the whole volume, --data-min/--data-max total
+  // the blocks, which leave out the ragged edges.
+  bool useDataRange{ false };
+  std::vector<std::string> rangeArgs;
+  SECTION("min/max pass") {}
+  SECTION("--data-min/--data-max")
+  {
+    useDataRange = true;
+    auto const mm = std::minmax_element(data.begin(), data.end());
+    rangeArgs = { "--data-min", std::to_string(*mm.first),
+                  "--data-max", std::to_string(*mm.second) };
+  }
+
+  std::vector<std::tuple<int, int, int>> tuples;
+  REQUIRE(makeNumBlocksTuples(tuples, blockCounts));
+  std::vector<std::string> names;
+  for (int i{ 0 }; i < shards; ++i) {
+    std::vector<std::string> args{ volumeArgs(dir, blockCounts) };
+    args.insert(args.end(), rangeArgs.begin(), rangeArgs.end());
+    args.insert(args.end(), { "-r", dir.file("vol.rmap"),
+                              "-b", "4K",
+                              "--progress-interval", "0",
+                              "--shard", std::to_string(i) + "/" + std::to_string(shards) });
+    CommandLineOptions clo;
+    REQUIRE(parseArgs(args, clo) != 0);
+    generate(clo);
+    if (names.empty()) {
+      for (auto const &t : tuples) {
+        names.push_back(makeFileNameString(clo, t));
+      }
+    }
+  }
+
+  for (size_t j{ 0 }; j < tuples.size(); ++j) {
+    std::vector<std::string> args{ volumeArgs(dir, { blockCounts[j] }) };
+    args.insert(args.end(), rangeArgs.begin(), rangeArgs.end());
+    for (int i{ 0 }; i < shards; ++i) {
+      args.push_back("--merge");
+      args.push_back(names[j] + "_shard" + std::to_string(i) + "of" +
+                     std::to_string(shards) + ".bin");
+    }
+    CommandLineOptions clo;
+    REQUIRE(parseArgs(args, clo) != 0);
+    merge(clo);
+
+    checkIndexFile(data, RAGGED, dir.file("vol.tf"), tuples[j], names[j] + ".bin");
+
+    uint64_t const bc[3]{ uint64_t(std::get<0>(tuples[j])), uint64_t(std::get<1>(tuples[j])),
+                          uint64_t(std::get<2>(tuples[j])) };
+    double total{ 0 };
+    uint64_t voxels{ 0 };
+    if (useDataRange) {
+      forEachBlockVoxel(data, RAGGED, bc, [&](uint64_t, unsigned short v) {
+        total += v;
+        ++voxels;
+      });
+    } else {
+      for (unsigned short v : data) {
+        total += v;
+      }
+      voxels = data.size();
+    }
+    REQUIRE(( voxels < data.size() ) == useDataRange);
+
+    bool ok{ false };
+    std::unique_ptr<bd::IndexFile> index{ bd::IndexFile::fromBinaryIndexFile(names[j] + ".bin", ok) };
+    REQUIRE(ok);
+    REQUIRE(index->getVolume().total() == Approx(total));
+    REQUIRE(index->getVolume().avg() == Approx(total / voxels));
+  }
+}
+
+
+TEST_CASE("Reader tells the consumer to quit before passing on a read error", "[generate]")
+{
+  TempDir dir;
+  std::vector<unsigned char> data{ makeVolume<unsigned char>(EVEN, 3) };
+  // Half of the slices are missing, the ROI reader hits the end of the file.
+  data.resize(data.size() / 2);
+  writeRaw(dir.file("vol.raw"), data);
+
+  RawFile file;
+  REQUIRE(file.open(dir.file("vol.raw")));
+  Roi roi;
+  REQUIRE(parseRoi("0,0,0:16,32,32", roi));
+  RoiReader<unsigned char> rr;
+  rr.set(&file, EVEN, roi);
+
+  std::vector<unsigned char> mem(4 * 1024);
+  std::vector<std::unique_ptr<bd::Buffer<unsigned char>>> buffers;
+  bd::BlockingQueue<bd::Buffer<unsigned char> *> full;
+  bd::BlockingQueue<bd::Buffer<unsigned char> *> empty;
+  for (size_t i{ 0 }; i < 4; ++i) {
+    buffers.emplace_back(new bd::Buffer<unsigned char>(mem.data() + i * 1024, 1024));
+    empty.push(buffers.back().get());
+  }
+
+  Reader<unsigned char> r{ &full, &empty };
+  Reader<unsigned char>::start(r, rr);
+  while (true) {
+    bd::Buffer<unsigned char> *buf{ full.pop() };
+    if (!buf->getPtr()) {
+      delete buf;
+      break;
+    }
+    empty.push(buf);
+  }
+  REQUIRE_THROWS_AS(r.join(), std::runtime_error const &);
+}
+
+
+TEST_CASE("generate fails instead of hanging on a short raw file", "[generate]")
+{
+  TempDir dir;
+  std::vector<unsigned char> data{ makeVolume<unsigned char>(EVEN, 3) };
+  // Half of the slices are missing.
+  data.resize(data.size() / 2);
+  writeRaw(dir.file("vol.raw"), data);
+  writeDat(dir.file("vol.dat"), "vol.raw", EVEN, "UCHAR");
+  writeTransferFunction(dir.file("vol.tf"));
+  {
+    std::ofstream os{ dir.file("vol.tf2d") };
+    os << "2 2 0\n0.0 0.5\n1.0 1.0\n";
+  }
+
+  std::vector<std::string> args{ volumeArgs(dir, { "2x2x2", "4x4x4" }) };
+  args.insert(args.end(), { "-r", dir.file("vol.rmap"),
+                            "-b", "4K",
+                            "--progress-interval", "0",
+                            "--data-min", "0",
+                            "--data-max", "255" });
+
+  SECTION("the ROI reader hits the end of the file")
+  {
+    args.insert(args.end(), { "--roi", "0,0,0:16,32,32" });
+  }
+
+  SECTION("the gradient halo of the rmap consumer hits the end of the file")
+  {
+    // The whole file is streamed, which stops quietly at the end, while
+    // the other tuple's consumer keeps going.
+    args.insert(args.end(), { "--tfunc2d", dir.file("vol.tf2d") });
+  }
+
+  CommandLineOptions clo;
+  REQUIRE(parseArgs(args, clo) != 0);
+  REQUIRE_THROWS_AS(generate(clo), std::runtime_error const &);
+}
+
+
+TEST_CASE("data range percentiles must give a non-empty range", "[generate]")
+{
+  TempDir dir;
+  // About half of the voxels are 0, so low percentiles are all 0.
+  std::vector<unsigned char> data{ makeVolume<unsigned char>(EVEN, 5) };
+  writeRaw(dir.file("vol.raw"), data);
+  writeDat(dir.file("vol.dat"), "vol.raw", EVEN, "UCHAR");
+  writeTransferFunction(dir.file("vol.tf"));
+
+  std::vector<std::string> args{ volumeArgs(dir, { "2x2x2" }) };
+  args.insert(args.end(), { "--progress-interval", "0" });
+  CommandLineOptions clo;
+
+  SECTION("the min percentile is not below the max percentile")
+  {
+    args.insert(args.end(), { "--data-min-percentile", "60",
+                              "--data-max-percentile", "60" });
+    REQUIRE(parseArgs(args, clo) == 0);
+  }
+
+  SECTION("both percentiles are in the run of zeros")
+  {
+    args.insert(args.end(), { "--data-min-percentile", "5",
+                              "--data-max-percentile", "30" });
+    REQUIRE(parseArgs(args, clo) != 0);
+    REQUIRE_THROWS_AS(generate(clo), std::runtime_error const &);
+  }
+}
+
+
+TEST_CASE("preview estimates are exact when every row is the same", "[generate]")
+{
+  TempDir dir;
+  // Every row of the volume is the same, so each strip sees exactly the
+  // voxels of its blocks' rows and the estimates match the full pass.
+  std::vector<unsigned char> data{ makeVolume<unsigned char>(EVEN, 9) };
+  for (size_t i{ EVEN[0] }; i < data.size(); ++i) {
+    data[i] = data[i % EVEN[0]];
+  }
+  writeRaw(dir.file("vol.raw"), data);
+  writeDat(dir.file("vol.dat"), "vol.raw", EVEN, "UCHAR");
+  writeTransferFunction(dir.file("vol.tf"));
+
+  std::vector<std::string> const blockCounts{ "4x4x4", "8x2x4" };
+  std::vector<std::string> args{ volumeArgs(dir, blockCounts) };
+  args.insert(args.end(), { "--preview", "0.1", "--progress-interval", "0" });
+  CommandLineOptions clo;
+  REQUIRE(parseArgs(args, clo) != 0);
+  generate(clo);
+
+  std::vector<std::tuple<int, int, int>> tuples;
+  REQUIRE(makeNumBlocksTuples(tuples, blockCounts));
+  for (auto const &t : tuples) {
+    std::string const name{ makeFileNameString(clo, t) + "-preview" };
+    checkIndexFile(data, EVEN, dir.file("vol.tf"), t, name + ".bin");
+
+    std::ifstream is{ name + ".bounds.json" };
+    std::string json{ std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+    REQUIRE(json.find("\"approximate\": true") != std::string::npos);
+  }
+}
+
+
+TEST_CASE("preview uses the given data range", "[generate]")
+{
+  TempDir dir;
+  std::vector<unsigned char> data{ makeVolume<unsigned char>(EVEN, 13) };
+  writeRaw(dir.file("vol.raw"), data);
+  writeDat(dir.file("vol.dat"), "vol.raw", EVEN, "UCHAR");
+  writeTransferFunction(dir.file("vol.tf"));
+
+  std::vector<std::string> args{ volumeArgs(dir, { "4x4x4" }) };
+  args.insert(args.end(), { "--preview", "0.1", "--progress-interval", "0",
+                            "--data-min", "100", "--data-max", "200" });
+  CommandLineOptions clo;
+  REQUIRE(parseArgs(args, clo) != 0);
+  generate(clo);
+
+  bool ok{ false };
+  std::unique_ptr<bd::IndexFile> index{ bd::IndexFile::fromBinaryIndexFile(
+      makeFileNameString(clo, std::make_tuple(4, 4, 4)) + "-preview.bin", ok) };
+  REQUIRE(ok);
+  REQUIRE(index->getVolume().min() == 100.0);
+  REQUIRE(index->getVolume().max() == 200.0);
+}
+
+
+TEST_CASE("preview rejects options it can't honour", "[generate]")
+{
+  TempDir dir;
+  std::vector<std::string> args{ volumeArgs(dir, { "4x4x4" }) };
+  std::vector<std::string> const preview{ "--preview", "0.1" };
+
+  SECTION("a fraction of 0 or less")
+  {
+    args.insert(args.end(), { "--preview", "-3" });
+  }
+  SECTION("a fraction over 1")
+  {
+    args.insert(args.end(), { "--preview", "7" });
+  }
+  SECTION("--shard")
+  {
+    args.insert(args.end(), preview.begin(), preview.end());
+    args.insert(args.end(), { "--shard", "1/2" });
+  }
+  SECTION("--merge")
+  {
+    args.insert(args.end(), preview.begin(), preview.end());
+    args.insert(args.end(), { "--merge", dir.file("vol_4-4-4_shard0of1.bin") });
+  }
+  SECTION("--resume")
+  {
+    args.insert(args.end(), preview.begin(), preview.end());
+    args.push_back("--resume");
+  }
+  SECTION("--checkpoint-interval")
+  {
+    args.insert(args.end(), preview.begin(), preview.end());
+    args.insert(args.end(), { "--checkpoint-interval", "1M" });
+  }
+
+  CommandLineOptions clo;
+  REQUIRE(parseArgs(args, clo) == 0);
+}
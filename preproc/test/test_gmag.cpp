@@ -0,0 +1,204 @@
+#include "testutil.h"
+
+#include "gradientrelevance.h"
+#include "rawfile.h"
+#include "transferfunction2d.h"
+
+#include "gmag/src/gradient.h"
+#include "gmag/src/hist2d.h"
+#include "gmag/src/slabring.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+uint64_t const DIMS[3]{ 21, 17, 13 };
+
+
+/// \brief A volume that doesn't span its type's range, so the volume range
+/// and the type range give different bins.
+std::vector<unsigned short>
+makeNarrowVolume()
+{
+  std::vector<unsigned short> data{ makeVolume<unsigned short>(DIMS, 71) };
+  for (unsigned short &v : data) {
+    v = static_cast<unsigned short>(1000 + v / 4);
+  }
+  return data;
+}
+
+
+/// \brief Bin of normalized \c x in [0, 1], or -1 if x is so close to a bin
+/// edge that rounding may put it on either side.
+int64_t
+expectedBin(double x, uint32_t bins)
+{
+  double const b{ x * bins };
+  if (std::abs(b - std::round(b)) < 1e-4 && b > 0.5 && b < bins - 0.5) {
+    return -1;
+  }
+  return std::min<int64_t>(bins - 1, std::max<int64_t>(0, int64_t(std::floor(b))));
+}
+
+
+/// \brief Squared gradient magnitude of voxel (x, y, z) by central
+/// differences, with neighbors clamped to the volume.
+template<class Ty>
+float
+refMagnitude(std::vector<Ty> const &data, uint64_t const dims[3],
+             int64_t x, int64_t y, int64_t z)
+{
+  auto at = [&](int64_t i, int64_t j, int64_t k) {
+    i = std::min<int64_t>(std::max<int64_t>(i, 0), dims[0] - 1);
+    j = std::min<int64_t>(std::max<int64_t>(j, 0), dims[1] - 1);
+    k = std::min<int64_t>(std::max<int64_t>(k, 0), dims[2] - 1);
+    return double(data[( k * dims[1] + j ) * dims[0] + i]);
+  };
+  double const dx{ ( at(x - 1, y, z) - at(x + 1, y, z) ) * 0.5 };
+  double const dy{ ( at(x, y - 1, z) - at(x, y + 1, z) ) * 0.5 };
+  double const dz{ ( at(x, y, z - 1) - at(x, y, z + 1) ) * 0.5 };
+  return static_cast<float>(dx * dx + dy * dy + dz * dz);
+}
+
+
+/// \brief Check the gradient slabs and the 2D histogram of a random volume
+/// with dimensions \c dims against the brute-force stencil.
+template<class Ty>
+void
+checkGmag(uint64_t const dims[3])
+{
+  INFO("dims " << dims[0] << "x" << dims[1] << "x" << dims[2]);
+  TempDir dir;
+  std::vector<Ty> const data{ makeVolume<Ty>(dims, 29) };
+  writeRaw(dir.file("vol.raw"), data);
+  uint64_t const slabVoxels{ dims[0] * dims[1] };
+
+  // Every slab, the first and the last have a clamped neighbor in z.
+  gmag::SlabRing<Ty> ring{ dir.file("vol.raw"), dims, gmag::STENCIL_RADIUS };
+  std::vector<float> g(slabVoxels);
+  for (int64_t z{ 0 }; z < int64_t(dims[2]); ++z) {
+    ring.advance(z);
+    gmag::gradientSlab(ring, z, dims, g.data());
+    for (uint64_t y{ 0 }; y < dims[1]; ++y) {
+      for (uint64_t x{ 0 }; x < dims[0]; ++x) {
+        INFO("voxel " << x << "," << y << "," << z);
+        REQUIRE(g[y * dims[0] + x] == refMagnitude(data, dims, x, y, z));
+      }
+    }
+  }
+
+  double valueMin{ 0.0 };
+  double valueMax{ 0.0 };
+  double gradMax{ 0.0 };
+  gmag::histogramRange<Ty>(dims, dir.file("vol.raw"), false, valueMin, valueMax, gradMax);
+  gmag::Hist2DBinner const binner{ 16, 8, valueMin, valueMax, gradMax };
+  int64_t slabs{ 0 };
+  std::vector<uint64_t> const counts{ gmag::histogram2dCounts<Ty>(
+      dims, dir.file("vol.raw"), binner, [&slabs](int64_t n) { slabs = n; }) };
+  REQUIRE(slabs == int64_t(dims[2]));
+
+  std::vector<uint64_t> ref(binner.size(), 0);
+  for (uint64_t z{ 0 }; z < dims[2]; ++z) {
+    for (uint64_t y{ 0 }; y < dims[1]; ++y) {
+      for (uint64_t x{ 0 }; x < dims[0]; ++x) {
+        ++ref[binner.bin(data[( z * dims[1] + y ) * dims[0] + x],
+                         std::sqrt(refMagnitude(data, dims, x, y, z)))];
+      }
+    }
+  }
+  REQUIRE(counts.size() == ref.size());
+  for (size_t i{ 0 }; i < ref.size(); ++i) {
+    INFO("bin " << i);
+    REQUIRE(counts[i] == ref[i]);
+  }
+}
+
+} // namespace
+
+
+TEST_CASE("gmag gradients and 2D histogram match a brute-force stencil", "[gmag]")
+{
+  uint64_t const dims[][3]{ { 19, 11, 9 }, { 1, 5, 4 }, { 7, 1, 1 }, { 6, 4, 2 } };
+  for (auto const &d : dims) {
+    checkGmag<unsigned char>(d);
+    checkGmag<unsigned short>(d);
+    checkGmag<float>(d);
+  }
+}
+
+
+TEST_CASE("gmag --hist2d bins like preproc --tfunc2d normalizes", "[gmag]")
+{
+  TempDir dir;
+  std::vector<unsigned short> data{ makeNarrowVolume() };
+  writeRaw(dir.file("vol.raw"), data);
+  uint64_t const total{ data.size() };
+
+  double valueMin{ 0.0 };
+  double valueMax{ 0.0 };
+  double gradMax{ 0.0 };
+  gmag::histogramRange<unsigned short>(DIMS, dir.file("vol.raw"), false,
+                                       valueMin, valueMax, gradMax);
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  REQUIRE(valueMin == double(*mm.first));
+  REQUIRE(valueMax == double(*mm.second));
+  REQUIRE(gradMax == Approx(( valueMax - valueMin ) * std::sqrt(3.0) * 0.5));
+
+  // Tables whose opacity is the normalized value, and the normalized
+  // gradient magnitude, give preproc's normalization of each voxel.
+  {
+    std::ofstream os{ dir.file("value") };
+    os << "2 2\n0.0 1.0\n0.0 1.0\n";
+  }
+  {
+    std::ofstream os{ dir.file("grad") };
+    os << "2 2\n0.0 0.0\n1.0 1.0\n";
+  }
+  TransferFunction2D valueTf;
+  REQUIRE(valueTf.load(dir.file("value")));
+  TransferFunction2D gradTf;
+  REQUIRE(gradTf.load(dir.file("grad")));
+
+  RawFile file;
+  REQUIRE(file.open(dir.file("vol.raw")));
+  std::vector<double> values(total);
+  std::vector<double> grads(total);
+  for (auto tfAndOut : { std::make_pair(&valueTf, &values), std::make_pair(&gradTf, &grads) }) {
+    GradientRelevance<unsigned short> rel{ *tfAndOut.first, valueMin, valueMax, 0.0 };
+    rel.set(&file, DIMS, Roi{});
+    BufferView<unsigned short> view{ data, 0, total };
+    rel(&view.buf, tfAndOut.second->data());
+  }
+
+  uint32_t const valueBins{ 64 };
+  uint32_t const gradBins{ 32 };
+  gmag::Hist2DBinner const binner{ valueBins, gradBins, valueMin, valueMax, gradMax };
+  gmag::SlabRing<unsigned short> ring{ dir.file("vol.raw"), DIMS, gmag::STENCIL_RADIUS };
+  uint64_t const slabVoxels{ DIMS[0] * DIMS[1] };
+  std::vector<float> g(slabVoxels);
+  uint64_t checked{ 0 };
+  for (int64_t iz{ 0 }; iz < int64_t(DIMS[2]); ++iz) {
+    ring.advance(iz);
+    gmag::gradientSlab(ring, iz, DIMS, g.data());
+    for (uint64_t j{ 0 }; j < slabVoxels; ++j) {
+      uint64_t const i{ iz * slabVoxels + j };
+      int64_t const v{ expectedBin(values[i], valueBins) };
+      int64_t const gb{ expectedBin(grads[i], gradBins) };
+      if (v < 0 || gb < 0) {
+        continue;
+      }
+      INFO("voxel " << i);
+      REQUIRE(binner.bin(data[i], std::sqrt(g[j])) == size_t(gb * valueBins + v));
+      ++checked;
+    }
+  }
+  // Only a few voxels are on a bin edge.
+  REQUIRE(checked > total * 9 / 10);
+}
@@ -0,0 +1,139 @@
+#include "testutil.h"
+
+#include "gradientrelevance.h"
+#include "rawfile.h"
+#include "transferfunction2d.h"
+
+#include <catch.hpp>
+
+#include <cmath>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+uint64_t const DIMS[3]{ 37, 29, 23 };
+
+
+/// \brief Scalar reference: relevance of file voxel (x, y, z), with
+/// neighbors clamped to the file.
+double
+refRelevance(std::vector<unsigned short> const &data,
+             TransferFunction2D const &tf,
+             double dataMin, double dataMax, double gradMax,
+             uint64_t x, uint64_t y, uint64_t z)
+{
+  auto at = [&](int64_t i, int64_t j, int64_t k) {
+    i = std::min<int64_t>(std::max<int64_t>(i, 0), DIMS[0] - 1);
+    j = std::min<int64_t>(std::max<int64_t>(j, 0), DIMS[1] - 1);
+    k = std::min<int64_t>(std::max<int64_t>(k, 0), DIMS[2] - 1);
+    return double(data[( k * DIMS[1] + j ) * DIMS[0] + i]);
+  };
+  int64_t const i(x), j(y), k(z);
+  double const dx{ ( at(i + 1, j, k) - at(i - 1, j, k) ) * 0.5 };
+  double const dy{ ( at(i, j + 1, k) - at(i, j - 1, k) ) * 0.5 };
+  double const dz{ ( at(i, j, k + 1) - at(i, j, k - 1) ) * 0.5 };
+  double const grad{ std::sqrt(dx * dx + dy * dy + dz * dz) };
+  return tf.interpolate(( at(i, j, k) - dataMin ) / ( dataMax - dataMin ), grad / gradMax);
+}
+
+} // namespace
+
+
+TEST_CASE("TransferFunction2D loads and interpolates a table", "[gradrel]")
+{
+  TempDir dir;
+  {
+    std::ofstream os{ dir.file("tf2d") };
+    os << "# value x gradient\n3 2 250.5\n0.0 0.5 1.0\n1.0 1.0 1.0  # grad 1\n";
+  }
+  TransferFunction2D tf;
+  REQUIRE(tf.load(dir.file("tf2d")));
+  REQUIRE(tf.gradientMax() == 250.5);
+  REQUIRE(tf.interpolate(0.0, 0.0) == Approx(0.0));
+  REQUIRE(tf.interpolate(0.25, 0.0) == Approx(0.25));
+  REQUIRE(tf.interpolate(1.0, 0.0) == Approx(1.0));
+  REQUIRE(tf.interpolate(0.0, 0.5) == Approx(0.5));
+  REQUIRE(tf.interpolate(-1.0, 2.0) == Approx(1.0));
+
+  {
+    std::ofstream os{ dir.file("short") };
+    os << "3 2\n0.0 0.5 1.0\n";
+  }
+  REQUIRE_FALSE(tf.load(dir.file("short")));
+  REQUIRE_FALSE(tf.load(dir.file("missing")));
+}
+
+
+TEST_CASE("GradientRelevance matches the scalar reference", "[gradrel]")
+{
+  TempDir dir;
+  std::vector<unsigned short> const data{ makeVolume<unsigned short>(DIMS, 43) };
+  writeRaw(dir.file("vol.raw"), data);
+  {
+    std::ofstream os{ dir.file("tf2d") };
+    os << "4 3\n"
+          "0.0 0.1 0.6 1.0\n"
+          "0.2 0.4 0.8 1.0\n"
+          "1.0 0.9 0.3 0.0\n";
+  }
+  TransferFunction2D tf;
+  REQUIRE(tf.load(dir.file("tf2d")));
+
+  RawFile file;
+  REQUIRE(file.open(dir.file("vol.raw")));
+
+  double const dataMin{ 0.0 };
+  double const dataMax{ 65535.0 };
+  double const gradMax{ dataMax * std::sqrt(3.0) * 0.5 };
+
+  Roi interior;
+  REQUIRE(parseRoi("3,5,2:30,21,19", interior));
+  Roi corner;
+  REQUIRE(parseRoi("0,0,10:37,29,23", corner));
+  // Whole rows, but not whole slabs.
+  Roi band;
+  REQUIRE(parseRoi("0,4,3:37,20,21", band));
+
+  for (Roi const &roi : { Roi{}, interior, corner, band }) {
+    Roi box{ roi };
+    if (box.empty()) {
+      std::copy(DIMS, DIMS + 3, box.hi);
+    }
+    uint64_t const total{ box.dim(0) * box.dim(1) * box.dim(2) };
+
+    // Whole ROI in one buffer, buffers that end mid-row and buffers
+    // smaller than a row.
+    for (size_t len : { size_t(total), size_t(1000), size_t(17) }) {
+      INFO("roi " << ( roi.empty() ? std::string("none") : to_string(roi) ) << ", length " << len);
+
+      GradientRelevance<unsigned short> rel{ tf, dataMin, dataMax, 0.0 };
+      rel.set(&file, DIMS, roi);
+
+      // The buffers hold the ROI, as the reader would give it.
+      std::vector<unsigned short> voxels;
+      for (uint64_t z{ box.lo[2] }; z < box.hi[2]; ++z) {
+        for (uint64_t y{ box.lo[1] }; y < box.hi[1]; ++y) {
+          auto const row = data.begin() + ( z * DIMS[1] + y ) * DIMS[0];
+          voxels.insert(voxels.end(), row + box.lo[0], row + box.hi[0]);
+        }
+      }
+      std::vector<double> rmap(total, -1.0);
+      forEachBuffer(total, len, [&](size_t offset, size_t count) {
+        BufferView<unsigned short> view{ voxels, offset, count };
+        rel(&view.buf, rmap.data() + offset);
+      });
+
+      uint64_t i{ 0 };
+      for (uint64_t z{ box.lo[2] }; z < box.hi[2]; ++z) {
+        for (uint64_t y{ box.lo[1] }; y < box.hi[1]; ++y) {
+          for (uint64_t x{ box.lo[0] }; x < box.hi[0]; ++x, ++i) {
+            REQUIRE(rmap[i] == Approx(refRelevance(data, tf, dataMin, dataMax, gradMax, x, y, z)));
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#include "testutil.h"
+
+#include "indexer.h"
+#include "voxelopacityfunction.h"
+
+#include <bd/volume/transferfunction.h>
+
+#include <catch.hpp>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+bd::OpacityTransferFunction
+makeTransferFunction(TempDir const &dir)
+{
+  std::string const path{ dir.file("vol.tf") };
+  {
+    std::ofstream os{ path };
+    os << "3\n"
+       << "0.0 0.0\n"
+       << "0.3 0.1\n"
+       << "1.0 1.0\n";
+  }
+  bd::OpacityTransferFunction tf;
+  REQUIRE(tf.load(path) >= 0);
+  return tf;
+}
+
+
+uint64_t const DIMS[3]{ 37, 29, 23 };
+uint64_t const GRID_A[3]{ 4, 3, 5 };
+uint64_t const GRID_B[3]{ 1, 1, 1 };
+
+} // namespace
+
+
+TEST_CASE("BlockIndexer push mode matches a scalar reference", "[indexer]")
+{
+  TempDir dir;
+  bd::OpacityTransferFunction const tf{ makeTransferFunction(dir) };
+  std::vector<unsigned short> const data{ makeVolume<unsigned short>(DIMS, 3) };
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  VoxelOpacityFunction<unsigned short> const rel{ tf, double(*mm.first), double(*mm.second) };
+
+  for (uint64_t chunk : { uint64_t(1000), uint64_t(DIMS[0] * DIMS[1]), uint64_t(data.size()) }) {
+    INFO("chunk " << chunk);
+    BlockIndexer ix{ DIMS, bd::DataType::UnsignedShort };
+    REQUIRE(ix.addBlockGrid(GRID_A[0], GRID_A[1], GRID_A[2]) == 0);
+    REQUIRE(ix.addBlockGrid(GRID_B[0], GRID_B[1], GRID_B[2]) == 1);
+    ix.setTransferFunction(tf);
+    ix.setDataRange(*mm.first, *mm.second);
+
+    for (uint64_t start{ 0 }; start < data.size(); start += chunk) {
+      ix.push(data.data() + start, std::min<uint64_t>(chunk, data.size() - start));
+    }
+    ix.finish();
+
+    REQUIRE(ix.voxelsPushed() == data.size());
+    REQUIRE(ix.indexFile(0).getVolume().min() == *mm.first);
+    REQUIRE(ix.indexFile(0).getVolume().max() == *mm.second);
+    expectBlocksMatch(blockValues(ix.blocks(0)), data, DIMS, GRID_A, rel);
+    expectBlocksMatch(blockValues(ix.blocks(1)), data, DIMS, GRID_B, rel);
+  }
+}
+
+
+TEST_CASE("BlockIndexer readFile finds the range itself", "[indexer]")
+{
+  TempDir dir;
+  bd::OpacityTransferFunction const tf{ makeTransferFunction(dir) };
+  std::vector<float> const data{ makeVolume<float>(DIMS, 5) };
+  writeRaw(dir.file("vol.raw"), data);
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  VoxelOpacityFunction<float> const rel{ tf, double(*mm.first), double(*mm.second) };
+
+  BlockIndexer ix{ DIMS, bd::DataType::Float };
+  ix.addBlockGrid(GRID_A[0], GRID_A[1], GRID_A[2]);
+  ix.setTransferFunction(tf);
+  ix.readFile(dir.file("vol.raw"), 4096);
+
+  REQUIRE(ix.indexFile(0).getVolume().min() == *mm.first);
+  REQUIRE(ix.indexFile(0).getVolume().max() == *mm.second);
+  expectBlocksMatch(blockValues(ix.blocks(0)), data, DIMS, GRID_A, rel);
+}
+
+
+TEST_CASE("BlockIndexer rejects misuse", "[indexer]")
+{
+  std::vector<unsigned char> const data(DIMS[0] * DIMS[1] * DIMS[2], 1);
+
+  REQUIRE_THROWS_AS(BlockIndexer(DIMS, bd::DataType::Double), std::invalid_argument const &);
+
+  BlockIndexer ix{ DIMS, bd::DataType::UnsignedCharacter };
+  ix.addBlockGrid(1, 1, 1);
+  ix.push(data.data(), 10);
+  REQUIRE_THROWS_AS(ix.addBlockGrid(2, 2, 2), std::logic_error const &);
+  REQUIRE_THROWS_AS(ix.finish(), std::logic_error const &);
+  REQUIRE_THROWS_AS(ix.push(data.data(), data.size()), std::logic_error const &);
+
+  // Pushed voxels can't be normalized for the transfer function without
+  // the range.
+  TempDir dir;
+  BlockIndexer noRange{ DIMS, bd::DataType::UnsignedCharacter };
+  noRange.addBlockGrid(1, 1, 1);
+  noRange.setTransferFunction(makeTransferFunction(dir));
+  REQUIRE_THROWS_AS(noRange.push(data.data(), data.size()), std::logic_error const &);
+}
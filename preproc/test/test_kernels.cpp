@@ -0,0 +1,457 @@
+#include "testutil.h"
+
+#include "parallel/loghistogram.h"
+#include "parallel/parallelfor_voxelrelevance.h"
+#include "parallel/parallelreduce_blockminmax.h"
+#include "parallel/parallelreduce_blockrov.h"
+#include "parallel/parallelreduce_histogram.h"
+#include "parallel/parallelreduce_minmax.h"
+#include "parallel/threadhistogram.h"
+
+#include <bd/volume/volume.h>
+
+#include <catch.hpp>
+
+#include <tbb/tbb.h>
+#include <tbb/task_scheduler_init.h>
+
+#include <cmath>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+struct Case
+{
+  uint64_t dims[3];
+  uint64_t blockCount[3];
+};
+
+
+// Even and ragged volumes, blocks that don't divide the volume leave
+// voxels outside of every block.
+Case const CASES[]{
+    { { 32, 32, 32 }, { 4, 4, 4 } },
+    { { 37, 29, 23 }, { 4, 3, 5 } },
+    { { 50, 1, 7 }, { 5, 1, 1 } },
+    { { 17, 19, 3 }, { 1, 1, 1 } },
+};
+
+int const THREADS[]{ 1, 2, 3, 8 };
+
+// Whole volume in one buffer, and buffers that end in the middle of rows.
+size_t const BUFFER_LENS[]{ std::numeric_limits<size_t>::max(), 1000 };
+
+
+std::string
+describe(Case const &c, int threads, size_t len)
+{
+  std::stringstream ss;
+  ss << c.dims[0] << "x" << c.dims[1] << "x" << c.dims[2] << " volume, "
+     << c.blockCount[0] << "x" << c.blockCount[1] << "x" << c.blockCount[2] << " blocks, "
+     << threads << " threads, buffer length " << len;
+  return ss.str();
+}
+
+
+template<class Ty>
+void
+checkMinMax()
+{
+  for (Case const &c : CASES) {
+    std::vector<Ty> data{ makeVolume<Ty>(c.dims, 1) };
+    auto const mm = std::minmax_element(data.begin(), data.end());
+    double total{ 0 };
+    for (Ty v : data) {
+      total += double(v);
+    }
+
+    for (int threads : THREADS) {
+      tbb::task_scheduler_init init(threads);
+      INFO(describe(c, threads, data.size()));
+
+      BufferView<Ty> view{ data, 0, data.size() };
+      ParallelReduceMinMax<Ty> k{ &view.buf };
+      tbb::parallel_reduce(tbb::blocked_range<size_t>{ 0, data.size() }, k);
+
+      REQUIRE(k.min_value == *mm.first);
+      REQUIRE(k.max_value == *mm.second);
+      REQUIRE(k.tot_value == Approx(total));
+    }
+  }
+}
+
+
+template<class Ty>
+void
+checkBlockMinMax()
+{
+  for (Case const &c : CASES) {
+    std::vector<Ty> data{ makeVolume<Ty>(c.dims, 2) };
+    std::vector<RefBlock> const ref{ refBlockMinMax(data, c.dims, c.blockCount) };
+    bd::Volume const volume{ { c.dims[0], c.dims[1], c.dims[2] },
+                             { c.blockCount[0], c.blockCount[1], c.blockCount[2] } };
+
+    for (int threads : THREADS) {
+      tbb::task_scheduler_init init(threads);
+      for (size_t len : BUFFER_LENS) {
+        INFO(describe(c, threads, len));
+
+        std::vector<RefBlock> got(ref.size(), RefBlock{ std::numeric_limits<double>::max(),
+                                                        std::numeric_limits<double>::lowest(),
+                                                        0 });
+        forEachBuffer(data.size(), len, [&](size_t offset, size_t count) {
+          BufferView<Ty> view{ data, offset, count };
+          ParallelReduceBlockMinMax<Ty> k{ &volume, &view.buf };
+          tbb::parallel_reduce(tbb::blocked_range<size_t>{ 0, count }, k);
+          for (size_t b{ 0 }; b < got.size(); ++b) {
+            got[b].min = std::min(got[b].min, k.pairs()[b].min);
+            got[b].max = std::max(got[b].max, k.pairs()[b].max);
+            got[b].total += k.pairs()[b].total;
+          }
+        });
+
+        for (size_t b{ 0 }; b < ref.size(); ++b) {
+          INFO("block " << b);
+          REQUIRE(got[b].min == ref[b].min);
+          REQUIRE(got[b].max == ref[b].max);
+          REQUIRE(got[b].total == Approx(ref[b].total));
+        }
+      }
+    }
+  }
+}
+
+
+template<class Ty>
+void
+checkHistogram()
+{
+  long long const maxIdx{ 1535 };
+  for (Case const &c : CASES) {
+    std::vector<Ty> data{ makeVolume<Ty>(c.dims, 3) };
+    auto const mm = std::minmax_element(data.begin(), data.end());
+    Ty const lo{ *mm.first };
+    Ty const hi{ *mm.second };
+
+    std::vector<unsigned int> ref(maxIdx + 1, 0);
+    for (Ty v : data) {
+      long long idx{ static_cast<long long>(( v - double(lo) ) / ( double(hi) - double(lo) ) *
+                                                maxIdx + 0.5) };
+      ref[std::min(idx, maxIdx)] += 1;
+    }
+
+    for (int threads : THREADS) {
+      tbb::task_scheduler_init init(threads);
+      INFO(describe(c, threads, data.size()));
+
+      BufferView<Ty> view{ data, 0, data.size() };
+      ParallelReduceHistogram<Ty> k{ &view.buf, lo, hi };
+      tbb::parallel_reduce(tbb::blocked_range<size_t>{ 0, data.size() }, k);
+
+      REQUIRE(k.getTotalCount() == static_cast<long long>(data.size()));
+      for (long long i{ 0 }; i <= maxIdx; ++i) {
+        INFO("bucket " << i);
+        REQUIRE(k.getBuckets()[i] == ref[i]);
+      }
+    }
+  }
+}
+
+
+/// \brief Check ThreadHistogram with the binning \c makeBinning(min, max)
+/// gives for each case's volume min/max.
+template<class Ty, class MakeBinning>
+void
+checkThreadHistogram(MakeBinning makeBinning)
+{
+  for (Case const &c : CASES) {
+    std::vector<Ty> data{ makeVolume<Ty>(c.dims, 5) };
+    auto const mm = std::minmax_element(data.begin(), data.end());
+    std::vector<Ty> sorted{ data };
+    std::sort(sorted.begin(), sorted.end());
+    HistogramBinning const binning{ makeBinning(double(*mm.first), double(*mm.second)) };
+    size_t const buckets{ binning.buckets };
+
+    HistogramBuckets ref{ std::vector<long long>(buckets, 0),
+                          std::vector<double>(buckets, std::numeric_limits<double>::max()),
+                          std::vector<double>(buckets, std::numeric_limits<double>::lowest()),
+                          static_cast<long long>(data.size()) };
+    for (Ty v : data) {
+      size_t const idx{ binning.bucket(v) };
+      ref.count[idx] += 1;
+      ref.min[idx] = std::min(ref.min[idx], double(v));
+      ref.max[idx] = std::max(ref.max[idx], double(v));
+    }
+
+    for (int threads : THREADS) {
+      tbb::task_scheduler_init init(threads);
+      for (size_t len : BUFFER_LENS) {
+        INFO(describe(c, threads, len) << ", " << binning.name() << " binning");
+
+        ThreadHistogram<Ty> k{ binning };
+        ThreadHistogram<Ty> deferred;
+        forEachBuffer(data.size(), len, [&](size_t offset, size_t count) {
+          BufferView<Ty> view{ data, offset, count };
+          k.add(&view.buf);
+          deferred.add(&view.buf);
+        });
+        HistogramBuckets const h{ k.result() };
+
+        // Index of the first bucket that differs, buckets if none do.
+        auto firstDiff = [](auto const &a, auto const &b) {
+          return size_t(std::mismatch(a.begin(), a.end(), b.begin()).first - a.begin());
+        };
+        REQUIRE(h.total == ref.total);
+        REQUIRE(h.count.size() == buckets);
+        REQUIRE(firstDiff(h.count, ref.count) == buckets);
+        REQUIRE(firstDiff(h.min, ref.min) == buckets);
+        REQUIRE(firstDiff(h.max, ref.max) == buckets);
+
+        // Binning after the pass: the range is exact, and so are the buckets
+        // except for the voxels of fine bins that were split, each of which
+        // can be counted one bucket off.
+        double lo, hi;
+        deferred.range(lo, hi);
+        REQUIRE(lo == double(*mm.first));
+        REQUIRE(hi == double(*mm.second));
+
+        long long split{ -1 };
+        HistogramBuckets const d{ deferred.result(binning, &split) };
+        REQUIRE(d.total == ref.total);
+        REQUIRE(d.count.size() == buckets);
+        if (std::is_integral<Ty>::value) {
+          REQUIRE(split == 0);
+        }
+        if (split == 0) {
+          REQUIRE(firstDiff(d.count, ref.count) == buckets);
+          REQUIRE(firstDiff(d.min, ref.min) == buckets);
+          REQUIRE(firstDiff(d.max, ref.max) == buckets);
+        } else {
+          long long moved{ 0 };
+          for (size_t i{ 0 }; i < buckets; ++i) {
+            moved += std::abs(d.count[i] - ref.count[i]);
+          }
+          REQUIRE(moved <= 2 * split);
+        }
+
+        // Quantiles are exact for integers, and within a fine bin for floats.
+        std::vector<double> const qs{ 0.0, 0.01, 0.5, 0.999, 1.0 };
+        std::vector<double> const qv{ deferred.quantiles(qs) };
+        for (size_t i{ 0 }; i < qs.size(); ++i) {
+          double const ref{ double(sorted[LogHistogram::rank(qs[i], sorted.size()) - 1]) };
+          INFO("quantile " << qs[i]);
+          REQUIRE(std::abs(qv[i] - ref) <= std::abs(ref) * std::ldexp(1.0, -LogHistogram::SUB_BITS));
+        }
+      }
+    }
+  }
+}
+
+
+template<class Ty>
+void
+checkThreadHistogramScales()
+{
+  using Scale = HistogramBinning::Scale;
+  checkThreadHistogram<Ty>([](double lo, double hi) {
+    return HistogramBinning{ Scale::Linear, 1536, lo, hi };
+  });
+  checkThreadHistogram<Ty>([](double lo, double hi) {
+    return HistogramBinning{ Scale::Log, 100, lo, hi };
+  });
+}
+
+
+template<class Ty>
+void
+checkVoxelRelevance()
+{
+  for (Case const &c : CASES) {
+    std::vector<Ty> data{ makeVolume<Ty>(c.dims, 4) };
+    auto rel = [](Ty const &v) -> double { return v > Ty(0) ? 1.0 : 0.25; };
+
+    for (int threads : THREADS) {
+      tbb::task_scheduler_init init(threads);
+      for (size_t len : BUFFER_LENS) {
+        INFO(describe(c, threads, len));
+
+        std::vector<double> map(data.size(), -1.0);
+        forEachBuffer(data.size(), len, [&](size_t offset, size_t count) {
+          BufferView<Ty> view{ data, offset, count };
+          double *out{ map.data() + offset };
+          ParallelForVoxelRelevance<Ty, decltype(rel), double *> k{ out, &view.buf, rel };
+          tbb::parallel_for(tbb::blocked_range<size_t>{ 0, count }, k);
+        });
+
+        for (size_t i{ 0 }; i < data.size(); ++i) {
+          if (map[i] != rel(data[i])) {
+            INFO("voxel " << i);
+            REQUIRE(map[i] == rel(data[i]));
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+
+
+TEST_CASE("ParallelReduceMinMax matches a scalar reduction", "[kernels]")
+{
+  SECTION("uchar") { checkMinMax<unsigned char>(); }
+  SECTION("ushort") { checkMinMax<unsigned short>(); }
+  SECTION("float") { checkMinMax<float>(); }
+}
+
+
+TEST_CASE("ParallelReduceBlockMinMax matches a scalar reduction", "[kernels]")
+{
+  SECTION("uchar") { checkBlockMinMax<unsigned char>(); }
+  SECTION("ushort") { checkBlockMinMax<unsigned short>(); }
+  SECTION("float") { checkBlockMinMax<float>(); }
+}
+
+
+TEST_CASE("ParallelReduceHistogram matches a scalar histogram", "[kernels]")
+{
+  SECTION("uchar") { checkHistogram<unsigned char>(); }
+  SECTION("ushort") { checkHistogram<unsigned short>(); }
+  SECTION("float") { checkHistogram<float>(); }
+}
+
+
+TEST_CASE("ThreadHistogram matches a scalar histogram", "[kernels]")
+{
+  SECTION("uchar") { checkThreadHistogramScales<unsigned char>(); }
+  SECTION("ushort") { checkThreadHistogramScales<unsigned short>(); }
+  SECTION("float") { checkThreadHistogramScales<float>(); }
+  SECTION("exact") {
+    checkThreadHistogram<unsigned char>([](double, double) {
+      return HistogramBinning::exact<unsigned char>();
+    });
+    checkThreadHistogram<unsigned short>([](double, double) {
+      return HistogramBinning::exact<unsigned short>();
+    });
+  }
+}
+
+
+TEST_CASE("HistogramBinning maps values to buckets", "[kernels]")
+{
+  using Scale = HistogramBinning::Scale;
+  HistogramBinning const linear{ Scale::Linear, 11, 0.0, 100.0 };
+  REQUIRE(linear.bucket(0.0) == 0);
+  REQUIRE(linear.bucket(4.9) == 0);
+  REQUIRE(linear.bucket(5.0) == 1);
+  REQUIRE(linear.bucket(100.0) == 10);
+  REQUIRE(linear.bucket(-3.0) == 0);
+  REQUIRE(linear.bucket(1e9) == 10);
+  REQUIRE(linear.bucket(std::nan("")) == 0);
+
+  HistogramBinning const log{ Scale::Log, 4, 0.0, 999.0 };
+  REQUIRE(log.bucket(0.0) == 0);
+  REQUIRE(log.bucket(9.0) == 1);
+  REQUIRE(log.bucket(99.0) == 2);
+  REQUIRE(log.bucket(999.0) == 3);
+
+  HistogramBinning const exact{ HistogramBinning::exact<unsigned short>() };
+  REQUIRE(exact.buckets == 65536);
+  REQUIRE(exact.bucket(12345) == 12345);
+}
+
+
+TEST_CASE("LogHistogram keeps the range and rebins exactly when no bin straddles",
+          "[kernels]")
+{
+  // Integers in [-500, 500) are each alone in a fine bin.
+  LogHistogram a;
+  LogHistogram b;
+  for (int v{ -500 }; v < 500; ++v) {
+    ( v % 3 == 0 ? a : b ).add(float(v));
+  }
+  b.add(std::numeric_limits<float>::quiet_NaN());
+  a.merge(b);
+
+  double lo, hi;
+  a.range(lo, hi);
+  REQUIRE(lo == -500.0);
+  REQUIRE(hi == 499.0);
+
+  HistogramBinning const binning{ HistogramBinning::Scale::Linear, 1000, -500.0, 499.0 };
+  long long split{ -1 };
+  HistogramBuckets const h{ a.rebin(binning, &split) };
+  REQUIRE(split == 0);
+  REQUIRE(h.total == 1001);
+  REQUIRE(h.count[0] == 2);
+  for (size_t i{ 1 }; i < 1000; ++i) {
+    if (h.count[i] != 1 || h.min[i] != i - 500.0 || h.max[i] != i - 500.0) {
+      FAIL("bucket " << i);
+    }
+  }
+
+  // Two values in the fine bin [1.09961, 1.10010) are on both sides of the
+  // bucket boundary at 1.1, their bin is split but keeps its count.
+  LogHistogram s;
+  s.add(1.0997f);
+  s.add(1.1f);
+  HistogramBinning const two{ HistogramBinning::Scale::Linear, 2, 0.0, 2.2 };
+  HistogramBuckets const t{ s.rebin(two, &split) };
+  REQUIRE(split == 2);
+  REQUIRE(t.total == 2);
+  REQUIRE(t.count[0] + t.count[1] == 2);
+  REQUIRE(t.min[0] == Approx(1.0997));
+}
+
+
+TEST_CASE("ParallelForVoxelRelevance writes every voxel's relevance", "[kernels]")
+{
+  SECTION("uchar") { checkVoxelRelevance<unsigned char>(); }
+  SECTION("ushort") { checkVoxelRelevance<unsigned short>(); }
+  SECTION("float") { checkVoxelRelevance<float>(); }
+}
+
+
+TEST_CASE("ParallelReduceBlockRov matches a scalar sum", "[kernels]")
+{
+  for (Case const &c : CASES) {
+    std::vector<double> rmap(c.dims[0] * c.dims[1] * c.dims[2]);
+    std::mt19937 gen{ 5 };
+    std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+    for (double &r : rmap) {
+      r = unit(gen);
+    }
+
+    std::vector<double> ref(c.blockCount[0] * c.blockCount[1] * c.blockCount[2], 0.0);
+    forEachBlockVoxel(rmap, c.dims, c.blockCount,
+                      [&ref](uint64_t b, double v) { ref[b] += v; });
+
+    bd::Volume const volume{ { c.dims[0], c.dims[1], c.dims[2] },
+                             { c.blockCount[0], c.blockCount[1], c.blockCount[2] } };
+
+    for (int threads : THREADS) {
+      tbb::task_scheduler_init init(threads);
+      for (size_t len : BUFFER_LENS) {
+        INFO(describe(c, threads, len));
+
+        std::vector<double> got(ref.size(), 0.0);
+        forEachBuffer(rmap.size(), len, [&](size_t offset, size_t count) {
+          BufferView<double> view{ rmap, offset, count };
+          ParallelReduceBlockRov k{ &view.buf, &volume };
+          tbb::parallel_reduce(tbb::blocked_range<size_t>{ 0, count }, k);
+          for (size_t b{ 0 }; b < got.size(); ++b) {
+            got[b] += k.relevances()[b];
+          }
+        });
+
+        for (size_t b{ 0 }; b < ref.size(); ++b) {
+          INFO("block " << b);
+          REQUIRE(got[b] == Approx(ref[b]));
+        }
+      }
+    }
+  }
+}
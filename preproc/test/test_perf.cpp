@@ -0,0 +1,252 @@
+////////////////////////////////////////////////////////////////////////////////
+// Throughput regression tests.
+//
+// These are hidden ([.perf]) so they only run when asked for:
+//     preproc_tests "[.perf]"
+// Each test measures voxels/s and fails if it is more than a tolerance
+// below the value stored for it in the baseline file, or if there is no
+// value for it. The baseline is machine specific, measure one on the machine
+// that runs the tests with
+//     PREPROC_PERF_UPDATE=baseline.txt preproc_tests "[.perf]"
+// and run them against it with
+//     PREPROC_PERF_BASELINE=baseline.txt preproc_tests "[.perf]"
+//
+// Environment:
+//   PREPROC_PERF_BASELINE   Baseline file (default test/perf_baseline.txt).
+//   PREPROC_PERF_TOLERANCE  Allowed fractional slowdown (default 0.25).
+//   PREPROC_PERF_UPDATE     Write the measurements to this file instead of
+//                           checking them. The file's other values are kept,
+//                           a new file starts from the baseline file.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "testutil.h"
+
+#include "generate.h"
+#include "parallel/parallelreduce_blockminmax.h"
+#include "parallel/parallelreduce_blockrov.h"
+#include "parallel/parallelreduce_minmax.h"
+
+#include <bd/volume/volume.h>
+
+#include <catch.hpp>
+
+#include <tbb/tbb.h>
+#include <tbb/task_scheduler_init.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <sstream>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+std::string
+baselinePath()
+{
+  char const *env{ std::getenv("PREPROC_PERF_BASELINE") };
+  return env ? env : PREPROC_PERF_BASELINE;
+}
+
+
+std::map<std::string, double>
+readBaseline()
+{
+  std::map<std::string, double> baseline;
+  std::ifstream is{ baselinePath() };
+  if (!is.is_open()) {
+    FAIL("Could not open the perf baseline " << baselinePath());
+  }
+  std::string line;
+  while (std::getline(is, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::stringstream ss{ line };
+    std::string name;
+    double value;
+    if (ss >> name >> value) {
+      baseline[name] = value;
+    }
+  }
+  return baseline;
+}
+
+
+/// \brief Replace or add the value of \c name in the baseline file \c path,
+/// keeping the comments and the other values.
+void
+updateBaseline(std::string const &path, std::string const &name, double value)
+{
+  std::vector<std::string> lines;
+  bool found{ false };
+  {
+    std::ifstream is{ path };
+    if (!is.is_open()) {
+      is.open(baselinePath());
+    }
+    std::string line;
+    while (std::getline(is, line)) {
+      std::stringstream ss{ line };
+      std::string first;
+      ss >> first;
+      if (first == name) {
+        line = name + " " + std::to_string(value);
+        found = true;
+      }
+      lines.push_back(line);
+    }
+  }
+  if (!found) {
+    lines.push_back(name + " " + std::to_string(value));
+  }
+
+  std::ofstream os{ path };
+  for (auto const &l : lines) {
+    os << l << "\n";
+  }
+  REQUIRE(os.good());
+}
+
+
+/// \brief Best voxels/s of \c reps runs of \c fn over \c voxels voxels, after
+/// one warmup run.
+double
+measure(uint64_t voxels, int reps, std::function<void()> const &fn)
+{
+  fn();
+  double best{ 0 };
+  for (int i{ 0 }; i < reps; ++i) {
+    auto const start = std::chrono::steady_clock::now();
+    fn();
+    double const secs{
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+    best = std::max(best, voxels / secs);
+  }
+  return best;
+}
+
+
+/// \brief Compare \c voxelsPerSecond to the baseline of \c name.
+void
+checkThroughput(std::string const &name, double voxelsPerSecond)
+{
+  char const *update{ std::getenv("PREPROC_PERF_UPDATE") };
+  if (update) {
+    updateBaseline(update, name, voxelsPerSecond);
+    WARN(name << ": " << voxelsPerSecond << " voxels/s written to " << update << ".");
+    return;
+  }
+
+  auto const baseline = readBaseline();
+  auto const it = baseline.find(name);
+  if (it == baseline.end()) {
+    FAIL(name << ": " << voxelsPerSecond << " voxels/s, no baseline in " << baselinePath()
+              << ", measure one with PREPROC_PERF_UPDATE=<file>.");
+  }
+
+  char const *env{ std::getenv("PREPROC_PERF_TOLERANCE") };
+  double const tolerance{ env ? std::atof(env) : 0.25 };
+  INFO(name << ": " << voxelsPerSecond << " voxels/s, baseline " << it->second
+            << ", tolerance " << tolerance);
+  REQUIRE(voxelsPerSecond >= it->second * ( 1.0 - tolerance ));
+}
+
+
+uint64_t const DIMS[3]{ 256, 256, 128 };
+uint64_t const BLOCKS[3]{ 16, 16, 8 };
+
+
+std::string
+threadsName(int threads)
+{
+  return threads == 1 ? "t1" : "tmax";
+}
+
+
+template<class Ty>
+void
+perfKernels(std::string const &type)
+{
+  std::vector<Ty> data{ makeVolume<Ty>(DIMS, 11) };
+  BufferView<Ty> view{ data, 0, data.size() };
+  bd::Volume const volume{ { DIMS[0], DIMS[1], DIMS[2] }, { BLOCKS[0], BLOCKS[1], BLOCKS[2] } };
+  tbb::blocked_range<size_t> const range{ 0, data.size() };
+
+  for (int threads : { 1, tbb::task_scheduler_init::default_num_threads() }) {
+    tbb::task_scheduler_init init(threads);
+
+    checkThroughput("minmax." + type + "." + threadsName(threads),
+                    measure(data.size(), 5, [&]() {
+                      ParallelReduceMinMax<Ty> k{ &view.buf };
+                      tbb::parallel_reduce(range, k);
+                    }));
+
+    checkThroughput("blockminmax." + type + "." + threadsName(threads),
+                    measure(data.size(), 5, [&]() {
+                      ParallelReduceBlockMinMax<Ty> k{ &volume, &view.buf };
+                      tbb::parallel_reduce(range, k);
+                    }));
+  }
+}
+
+} // namespace
+
+
+TEST_CASE("kernel throughput", "[.perf]")
+{
+  SECTION("uchar") { perfKernels<unsigned char>("uchar"); }
+  SECTION("ushort") { perfKernels<unsigned short>("ushort"); }
+  SECTION("float") { perfKernels<float>("float"); }
+
+  SECTION("blockrov")
+  {
+    std::vector<double> rmap(DIMS[0] * DIMS[1] * DIMS[2], 0.5);
+    BufferView<double> view{ rmap, 0, rmap.size() };
+    bd::Volume const volume{ { DIMS[0], DIMS[1], DIMS[2] },
+                             { BLOCKS[0], BLOCKS[1], BLOCKS[2] } };
+    tbb::task_scheduler_init init(tbb::task_scheduler_init::default_num_threads());
+    checkThroughput("blockrov.double.tmax",
+                    measure(rmap.size(), 5, [&]() {
+                      ParallelReduceBlockRov k{ &view.buf, &volume };
+                      tbb::parallel_reduce(tbb::blocked_range<size_t>{ 0, rmap.size() }, k);
+                    }));
+  }
+}
+
+
+TEST_CASE("generate throughput", "[.perf]")
+{
+  TempDir dir;
+  std::vector<unsigned short> data{ makeVolume<unsigned short>(DIMS, 12) };
+  writeRaw(dir.file("vol.raw"), data);
+  {
+    std::ofstream os{ dir.file("vol.dat") };
+    os << "ObjectFileName: vol.raw\nResolution: " << DIMS[0] << " " << DIMS[1] << " "
+       << DIMS[2] << "\nSliceThickness: 1 1 1\nFormat: USHORT\n";
+  }
+  {
+    std::ofstream os{ dir.file("vol.tf") };
+    os << "2\n0.0 0.0\n1.0 1.0\n";
+  }
+
+  std::vector<std::string> const args{ "-f", dir.file("vol.raw"),
+                                       "-d", dir.file("vol.dat"),
+                                       "-u", dir.file("vol.tf"),
+                                       "-r", dir.file("vol.rmap"),
+                                       "-o", dir.path(),
+                                       "--outfile-prefix", "vol",
+                                       "-D", "16x16x8",
+                                       "--progress-interval", "0" };
+
+  checkThroughput("generate.ushort.tmax",
+                  measure(data.size(), 3, [&]() {
+                    CommandLineOptions clo;
+                    REQUIRE(parseArgs(args, clo) != 0);
+                    generate(clo);
+                  }));
+}
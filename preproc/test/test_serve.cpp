@@ -0,0 +1,196 @@
+#include "testutil.h"
+
+#include "serve.h"
+#include "voxelopacityfunction.h"
+
+#include <bd/io/indexfile.h>
+#include <bd/volume/transferfunction.h>
+
+#include <catch.hpp>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <thread>
+
+using namespace preproc;
+using namespace preproc::test;
+
+namespace
+{
+
+uint64_t const DIMS[3]{ 37, 29, 23 };
+
+
+/// \brief Check the reply header and return the payload.
+std::string
+payloadOf(std::string const &reply, int32_t status)
+{
+  ServeReplyHeader header;
+  REQUIRE(reply.size() >= sizeof(header));
+  std::memcpy(&header, reply.data(), sizeof(header));
+  REQUIRE(std::string(header.magic, 4) == "PPIX");
+  REQUIRE(header.status == status);
+  REQUIRE(header.length == reply.size() - sizeof(header));
+  return reply.substr(sizeof(header));
+}
+
+
+CommandLineOptions
+serveOptions(TempDir const &dir, std::string const &type = "ushort")
+{
+  CommandLineOptions clo;
+  REQUIRE(parseArgs({ "-f", dir.file("vol.raw"),
+                      "--volx", std::to_string(DIMS[0]),
+                      "--voly", std::to_string(DIMS[1]),
+                      "--volz", std::to_string(DIMS[2]),
+                      "-b", "8K",
+                      "--serve", dir.file("sock") }, clo) != 0);
+  clo.dataType = type;
+  return clo;
+}
+
+
+/// \brief Check index requests with a transfer function against a scalar
+/// reference, with rov to within \c rovEpsilon.
+template<class Ty>
+void
+checkIndexRequests(std::string const &type, double rovEpsilon)
+{
+  TempDir dir;
+  std::vector<Ty> const data{ makeVolume<Ty>(DIMS, 19) };
+  writeRaw(dir.file("vol.raw"), data);
+  {
+    std::ofstream os{ dir.file("vol.tf") };
+    os << "3\n0.0 0.0\n0.3 0.1\n1.0 1.0\n";
+  }
+  bd::OpacityTransferFunction tf;
+  REQUIRE(tf.load(dir.file("vol.tf")) >= 0);
+
+  auto const mm = std::minmax_element(data.begin(), data.end());
+  VoxelOpacityFunction<Ty> const rel{ tf, double(*mm.first), double(*mm.second) };
+  uint64_t const bc[3]{ 4, 3, 5 };
+
+  ResidentVolume volume{ serveOptions(dir, type) };
+  bool stop{ false };
+
+  // The second request for the grid uses the cached block min/max.
+  for (int i{ 0 }; i < 2; ++i) {
+    INFO("request " << i);
+    std::string const payload{
+        payloadOf(volume.handle("index 4x3x5 " + dir.file("vol.tf"), stop), 0) };
+    {
+      std::ofstream os{ dir.file("reply.bin"), std::ios::binary };
+      os.write(payload.data(), payload.size());
+    }
+
+    bool ok{ false };
+    std::unique_ptr<bd::IndexFile> index{
+        bd::IndexFile::fromBinaryIndexFile(dir.file("reply.bin"), ok) };
+    REQUIRE(ok);
+    REQUIRE(index->getVolume().min() == *mm.first);
+    REQUIRE(index->getVolume().max() == *mm.second);
+    expectBlocksMatch(blockValues(index->getFileBlocks()), data, DIMS, bc, rel, rovEpsilon);
+  }
+  REQUIRE_FALSE(stop);
+}
+
+
+/// \brief Send \c line to the server on \c socketPath and return the
+/// status of its reply, -1 if the server can't be reached.
+int32_t
+request(std::string const &socketPath, std::string const &line)
+{
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+  int const fd{ ::socket(AF_UNIX, SOCK_STREAM, 0) };
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    return -1;
+  }
+  std::string const msg{ line + "\n" };
+  ServeReplyHeader header;
+  bool const ok{ ::write(fd, msg.data(), msg.size()) == ssize_t(msg.size()) &&
+                 ::read(fd, &header, sizeof(header)) == ssize_t(sizeof(header)) };
+  ::close(fd);
+  return ok ? header.status : -1;
+}
+
+} // namespace
+
+
+TEST_CASE("ResidentVolume answers index requests", "[serve]")
+{
+  SECTION("ushort")
+  {
+    checkIndexRequests<unsigned short>("ushort", 1e-9);
+  }
+
+  SECTION("uchar")
+  {
+    checkIndexRequests<unsigned char>("uchar", 1e-9);
+  }
+
+  SECTION("float")
+  {
+    // Float voxels get the relevance of their histogram bucket's mean.
+    checkIndexRequests<float>("float", 1e-3);
+  }
+}
+
+
+TEST_CASE("ResidentVolume answers bad requests with an error", "[serve]")
+{
+  TempDir dir;
+  writeRaw(dir.file("vol.raw"), makeVolume<unsigned short>(DIMS, 19));
+  ResidentVolume volume{ serveOptions(dir) };
+  bool stop{ false };
+
+  payloadOf(volume.handle("ping", stop), 0);
+  payloadOf(volume.handle("index 4x3", stop), 1);
+  payloadOf(volume.handle("index 38x1x1", stop), 1);
+  payloadOf(volume.handle("index 2x2x2 " + dir.file("missing.tf"), stop), 1);
+  payloadOf(volume.handle("frobnicate", stop), 1);
+  REQUIRE_FALSE(stop);
+
+  payloadOf(volume.handle("shutdown", stop), 0);
+  REQUIRE(stop);
+}
+
+
+TEST_CASE("serve reports bad -D grids and won't take over a live socket", "[serve]")
+{
+  TempDir dir;
+  writeRaw(dir.file("vol.raw"), makeVolume<unsigned short>(DIMS, 19));
+
+  {
+    CommandLineOptions clo{ serveOptions(dir) };
+    clo.numBlocks = { "38x1x1" };
+    REQUIRE_THROWS_AS(serve(clo), std::runtime_error const &);
+  }
+
+  CommandLineOptions first{ serveOptions(dir) };
+  std::future<void> server{ std::async(std::launch::async, [&first]() { serve(first); }) };
+  for (int i{ 0 }; i < 500 && request(dir.file("sock"), "ping") != 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  REQUIRE(request(dir.file("sock"), "ping") == 0);
+
+  CommandLineOptions second{ serveOptions(dir) };
+  REQUIRE_THROWS_AS(serve(second), std::runtime_error const &);
+  // The first server still has its socket.
+  REQUIRE(request(dir.file("sock"), "ping") == 0);
+
+  REQUIRE(request(dir.file("sock"), "shutdown") == 0);
+  server.get();
+}
@@ -0,0 +1,262 @@
+#ifndef preproc_testutil_h__
+#define preproc_testutil_h__
+
+#include "cmdline.h"
+
+#include <bd/io/buffer.h>
+#include <bd/io/fileblock.h>
+
+#include <boost/filesystem.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace preproc
+{
+namespace test
+{
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A volume of random voxels where about half of the voxels are in
+/// runs of zeros, so blocks have a mix of empty and non-empty space.
+///
+/// Integer types use their whole range, floats use [-10, 100).
+template<class Ty>
+std::vector<Ty>
+makeVolume(uint64_t const dims[3], uint64_t seed)
+{
+  std::mt19937_64 gen{ seed };
+  std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+  double const lo{ std::is_floating_point<Ty>::value ?
+                   -10.0 : double(std::numeric_limits<Ty>::lowest()) };
+  double const hi{ std::is_floating_point<Ty>::value ?
+                   100.0 : double(std::numeric_limits<Ty>::max()) };
+
+  std::vector<Ty> data(dims[0] * dims[1] * dims[2]);
+  size_t i{ 0 };
+  while (i < data.size()) {
+    size_t const run{ std::min<size_t>(data.size() - i, 1 + gen() % 97) };
+    bool const empty{ unit(gen) < 0.5 };
+    for (size_t j{ 0 }; j < run; ++j, ++i) {
+      data[i] = empty ? Ty(0) : static_cast<Ty>(lo + unit(gen) * ( hi - lo ));
+    }
+  }
+  return data;
+}
+
+
+/// \brief Statistics of one block from the scalar reference.
+struct RefBlock
+{
+  double min;
+  double max;
+  double total;
+};
+
+
+/// \brief Scalar reference for the block kernels.
+///
+/// Blocks are dims / blockCount voxels on a side, voxels past the last whole
+/// block in a dimension don't belong to any block.
+template<class Ty, class Fn>
+void
+forEachBlockVoxel(std::vector<Ty> const &data,
+                  uint64_t const dims[3],
+                  uint64_t const blockCount[3],
+                  Fn fn)
+{
+  uint64_t const bd[3]{ dims[0] / blockCount[0], dims[1] / blockCount[1],
+                        dims[2] / blockCount[2] };
+  for (uint64_t z{ 0 }; z < dims[2]; ++z) {
+    for (uint64_t y{ 0 }; y < dims[1]; ++y) {
+      for (uint64_t x{ 0 }; x < dims[0]; ++x) {
+        uint64_t const bi{ x / bd[0] };
+        uint64_t const bj{ y / bd[1] };
+        uint64_t const bk{ z / bd[2] };
+        if (bi < blockCount[0] && bj < blockCount[1] && bk < blockCount[2]) {
+          fn(bi + blockCount[0] * ( bj + bk * blockCount[1] ),
+             data[( z * dims[1] + y ) * dims[0] + x]);
+        }
+      }
+    }
+  }
+}
+
+
+template<class Ty>
+std::vector<RefBlock>
+refBlockMinMax(std::vector<Ty> const &data,
+               uint64_t const dims[3],
+               uint64_t const blockCount[3])
+{
+  std::vector<RefBlock> blocks(
+      blockCount[0] * blockCount[1] * blockCount[2],
+      RefBlock{ std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest(), 0 });
+  forEachBlockVoxel(data, dims, blockCount, [&blocks](uint64_t b, Ty v) {
+    blocks[b].min = std::min(blocks[b].min, double(v));
+    blocks[b].max = std::max(blocks[b].max, double(v));
+    blocks[b].total += double(v);
+  });
+  return blocks;
+}
+
+
+/// \brief The statistics of a block that are checked against the reference,
+/// from a bd::FileBlock or the C API's block stats.
+struct BlockValues
+{
+  uint64_t ijk[3];
+  double min;
+  double max;
+  double total;
+  double avg;
+  double rov;
+};
+
+
+inline std::vector<BlockValues>
+blockValues(std::vector<bd::FileBlock> const &blocks)
+{
+  std::vector<BlockValues> values;
+  for (bd::FileBlock const &b : blocks) {
+    values.push_back(BlockValues{ { b.ijk_index[0], b.ijk_index[1], b.ijk_index[2] },
+                                  b.min_val, b.max_val, b.total_val, b.avg_val, b.rov });
+  }
+  return values;
+}
+
+
+/// \brief Check min, max, total, avg and rov of \c blocks against the
+/// scalar reference over \c data with \c blockCount blocks, where the rov of
+/// a block is the average of rel(voxel). rov is compared to within
+/// \c rovEpsilon, the others to Approx's default.
+template<class Ty, class Rel>
+void
+expectBlocksMatch(std::vector<BlockValues> const &blocks,
+                  std::vector<Ty> const &data,
+                  uint64_t const dims[3],
+                  uint64_t const blockCount[3],
+                  Rel rel,
+                  double rovEpsilon = std::numeric_limits<float>::epsilon() * 100)
+{
+  std::vector<RefBlock> const ref{ refBlockMinMax(data, dims, blockCount) };
+  std::vector<double> refRov(ref.size(), 0.0);
+  forEachBlockVoxel(data, dims, blockCount, [&](uint64_t b, Ty v) { refRov[b] += rel(v); });
+  double const voxels{ double(( dims[0] / blockCount[0] ) * ( dims[1] / blockCount[1] ) *
+                              ( dims[2] / blockCount[2] )) };
+
+  REQUIRE(blocks.size() == ref.size());
+  for (BlockValues const &b : blocks) {
+    INFO("block " << b.ijk[0] << "," << b.ijk[1] << "," << b.ijk[2]);
+    uint64_t const idx{ b.ijk[0] + blockCount[0] * ( b.ijk[1] + b.ijk[2] * blockCount[1] ) };
+    REQUIRE(idx < ref.size());
+    REQUIRE(b.min == ref[idx].min);
+    REQUIRE(b.max == ref[idx].max);
+    REQUIRE(b.total == Approx(ref[idx].total));
+    REQUIRE(b.avg == Approx(ref[idx].total / voxels));
+    REQUIRE(b.rov == Approx(refRov[idx] / voxels).epsilon(rovEpsilon));
+  }
+}
+
+
+/// \brief Call fn(offset, count) for consecutive buffers of at most \c len
+/// elements covering \c total elements.
+template<class Fn>
+void
+forEachBuffer(size_t total, size_t len, Fn fn)
+{
+  for (size_t offset{ 0 }; offset < total; offset += len) {
+    fn(offset, std::min(len, total - offset));
+  }
+}
+
+
+/// \brief A buffer viewing elements [offset, offset + count) of \c data.
+template<class Ty>
+struct BufferView
+{
+  BufferView(std::vector<Ty> &data, size_t offset, size_t count)
+      : buf{ data.data() + offset, count }
+  {
+    buf.setNumElements(count);
+    buf.setIndexOffset(offset);
+  }
+
+  bd::Buffer<Ty> buf;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A uniquely named directory under the system temp directory that
+/// is removed with everything in it when destroyed.
+class TempDir
+{
+public:
+  TempDir()
+      : m_path{ boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path("preproc_test_%%%%-%%%%-%%%%") }
+  {
+    boost::filesystem::create_directories(m_path);
+  }
+
+
+  ~TempDir()
+  {
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(m_path, ec);
+  }
+
+
+  std::string
+  file(std::string const &name) const
+  {
+    return ( m_path / name ).string();
+  }
+
+
+  std::string
+  path() const
+  {
+    return m_path.string();
+  }
+
+
+private:
+  boost::filesystem::path const m_path;
+};
+
+
+template<class Ty>
+void
+writeRaw(std::string const &path, std::vector<Ty> const &data)
+{
+  std::ofstream os{ path, std::ios::binary };
+  os.write(reinterpret_cast<char const *>(data.data()), data.size() * sizeof(Ty));
+}
+
+
+/// \brief Parse \c args as a preproc command line into \c clo.
+/// \return The number of arguments parsed, 0 on a parse error.
+inline int
+parseArgs(std::vector<std::string> args, CommandLineOptions &clo)
+{
+  args.insert(args.begin(), "preproc");
+  std::vector<char const *> argv;
+  for (auto const &a : args) {
+    argv.push_back(a.c_str());
+  }
+  return parseThem(static_cast<int>(argv.size()), argv.data(), clo);
+}
+
+} // namespace test
+} // namespace preproc
+
+#endif // ! preproc_testutil_h__
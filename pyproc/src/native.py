@@ -0,0 +1,153 @@
+"""
+ctypes bridge to the preproc C interface (libpreproc_capi).
+
+Block statistics are computed by the TBB kernels directly on the memory of
+a numpy array or memmap, strided views included, without a copy.
+
+The library is looked up in $PREPROC_CAPI_LIB, then next to this package in
+build/preproc, then on the system library path.
+"""
+
+import ctypes
+import ctypes.util
+import logging
+import os
+
+import numpy as np
+
+logger = logging.getLogger('pydar')
+
+PREPROC_OK = 0
+
+DTYPES = {
+    np.dtype(np.int8): 0,
+    np.dtype(np.uint8): 1,
+    np.dtype(np.int16): 2,
+    np.dtype(np.uint16): 3,
+    np.dtype(np.int32): 4,
+    np.dtype(np.uint32): 5,
+    np.dtype(np.float32): 6,
+    np.dtype(np.float64): 7,
+}
+
+# Matches struct preproc_block_stats.
+BLOCK_STATS = np.dtype([('min', np.float64),
+                        ('max', np.float64),
+                        ('total', np.float64),
+                        ('avg', np.float64),
+                        ('rov', np.float64),
+                        ('ijk', np.uint64, (3,))])
+
+_U64_3 = ctypes.c_uint64 * 3
+_I64_3 = ctypes.c_int64 * 3
+_lib = None
+
+
+class NativeError(RuntimeError):
+    pass
+
+
+def _candidates():
+    env = os.environ.get('PREPROC_CAPI_LIB')
+    if env:
+        yield env
+    here = os.path.dirname(os.path.abspath(__file__))
+    for name in ('libpreproc_capi.so', 'libpreproc_capi.dylib'):
+        yield os.path.join(here, '..', '..', 'build', 'preproc', name)
+    found = ctypes.util.find_library('preproc_capi')
+    if found:
+        yield found
+
+
+def _load():
+    global _lib
+    if _lib is not None:
+        return _lib
+
+    for path in _candidates():
+        try:
+            lib = ctypes.CDLL(path)
+            break
+        except OSError:
+            continue
+    else:
+        raise NativeError('libpreproc_capi not found, set PREPROC_CAPI_LIB')
+
+    lib.preproc_volume_minmax.restype = ctypes.c_int
+    lib.preproc_volume_minmax.argtypes = [
+        ctypes.c_void_p, ctypes.c_int, _U64_3, _I64_3, ctypes.c_int,
+        ctypes.POINTER(ctypes.c_double), ctypes.POINTER(ctypes.c_double),
+        ctypes.POINTER(ctypes.c_double)]
+    lib.preproc_block_stats_compute.restype = ctypes.c_int
+    lib.preproc_block_stats_compute.argtypes = [
+        ctypes.c_void_p, ctypes.c_int, _U64_3, _I64_3, _U64_3, ctypes.c_char_p,
+        ctypes.c_double, ctypes.c_double, ctypes.c_int, ctypes.c_void_p]
+    lib.preproc_last_error.restype = ctypes.c_char_p
+    lib.preproc_last_error.argtypes = []
+
+    logger.debug('Loaded %s', path)
+    _lib = lib
+    return lib
+
+
+def available():
+    """True if the native library can be loaded."""
+    try:
+        _load()
+        return True
+    except NativeError:
+        return False
+
+
+def _volume_args(vol):
+    """
+    Pointer, dtype code, x,y,z dims and x,y,z byte strides of a (z, y, x)
+    shaped array.
+    """
+    if vol.ndim != 3:
+        raise ValueError('Expected a 3D (z, y, x) array, got shape {}'.format(vol.shape))
+    code = DTYPES.get(vol.dtype.newbyteorder('='))
+    if code is None or not vol.dtype.isnative:
+        raise ValueError('Unsupported dtype {}'.format(vol.dtype))
+    dims = _U64_3(*reversed(vol.shape))
+    strides = _I64_3(*reversed(vol.strides))
+    return ctypes.c_void_p(vol.ctypes.data), code, dims, strides
+
+
+def _check(lib, rval):
+    if rval != PREPROC_OK:
+        raise NativeError(lib.preproc_last_error().decode('utf-8', 'replace'))
+
+
+def volume_minmax(vol, threads=0):
+    """Return (min, max, total) of a (z, y, x) array."""
+    lib = _load()
+    ptr, code, dims, strides = _volume_args(vol)
+    vmin, vmax, total = ctypes.c_double(), ctypes.c_double(), ctypes.c_double()
+    _check(lib, lib.preproc_volume_minmax(ptr, code, dims, strides, threads,
+                                          ctypes.byref(vmin), ctypes.byref(vmax),
+                                          ctypes.byref(total)))
+    return vmin.value, vmax.value, total.value
+
+
+def block_stats(vol, blocks, tf_path=None, data_range=None, threads=0):
+    """
+    Statistics of each block of a (z, y, x) array.
+
+    blocks is the x,y,z block count, as for preproc -D. rov is computed when
+    tf_path names a transfer function file; voxels are normalized with
+    data_range=(min, max), or the range of the volume if it is None.
+
+    Returns a BLOCK_STATS array of shape (bz, by, bx).
+    """
+    lib = _load()
+    ptr, code, dims, strides = _volume_args(vol)
+    bc = _U64_3(*blocks)
+    lo, hi = data_range if data_range is not None else (1.0, 0.0)
+    out = np.zeros(blocks[0] * blocks[1] * blocks[2], dtype=BLOCK_STATS)
+    tf = tf_path.encode('utf-8') if tf_path else None
+
+    _check(lib, lib.preproc_block_stats_compute(ptr, code, dims, strides, bc, tf,
+                                                lo, hi, threads,
+                                                out.ctypes.data_as(ctypes.c_void_p)))
+    return out.reshape(blocks[2], blocks[1], blocks[0])
@@ -10,15 +10,23 @@ def parse():
     parser.add_argument('-o', '--ofile', type=str, default='',
                         help='Output file path')
 
-    parser.add_argument('--blocks', type=lambda x: x.split(','), default='1,1,1',
+    parser.add_argument('--blocks', type=lambda x: [int(v) for v in x.split(',')],
+                        default=[1, 1, 1],
                         help='Process file in x by y by z blocks')
 
-    parser.add_argument('--dims', type=lambda x: x.split(','), default='1,1,1',
-                        help='Input file voxel dimensions')
+    parser.add_argument('--dims', type=lambda x: [int(v) for v in x.split(',')],
+                        default=[1, 1, 1],
+                        help='Input file voxel dimensions x,y,z (x fastest)')
 
     parser.add_argument('-t', '--dtype', type=str, default='byte',
                         help='Data type')
 
+    parser.add_argument('-u', '--tfunc', type=str, default='',
+                        help='Opacity transfer function for block relevance')
+
+    parser.add_argument('-n', '--num-threads', type=int, default=0,
+                        help='Threads for the native kernels, 0 for all cores')
+
     parser.add_argument('--debug', action='store_true', default=False,
                         help='Debug/verbose logging')
 
@@ -1,13 +1,23 @@
+import logging
+
 import dask.array as da
 import numpy as np
 
+from src import native
+
+logger = logging.getLogger('pydar')
 
 
 class Process(object):
-    def __init__(self, infile, dtype=np.byte, vol_dims=(1,1,1)):
+    def __init__(self, infile, dtype=np.byte, vol_dims=(1,1,1), tf_path=None, threads=0):
+        """
+        vol_dims is the x,y,z voxel dims of the raw file (x fastest).
+        """
         self.infile = infile
         self.vol_dims = vol_dims
         self.dtype = dtype
+        self.tf_path = tf_path
+        self.threads = threads
         self.first_run = True
 
     def _start(self, data):
@@ -15,16 +25,56 @@ class Process(object):
             volsum = data.sum()
             print(volsum)
 
+    def _memmap(self):
+        x, y, z = self.vol_dims
+        return np.memmap(self.infile, dtype=self.dtype, mode='r', shape=(z, y, x))
+
     def process(self, blocks=(1,1,1)):
-        mm = np.memmap(self.infile, dtype=self.dtype, mode='r', shape=self.vol_dims)
-        chunk_shape = (self.vol_dims[0] / blocks[0],
-                       self.vol_dims[1] / blocks[1],
-                       self.vol_dims[2] / blocks[2])
+        """
+        Return the block statistics as a native.BLOCK_STATS array of shape
+        (bz, by, bx), blocks being the x,y,z block count.
 
-        data = da.from_array(mm, chunks=chunk_shape)
+        Without libpreproc_capi the statistics are computed with dask, which
+        can't compute rov, so that raises RuntimeError if tf_path was given.
+        """
+        mm = self._memmap()
+        if native.available():
+            stats = native.block_stats(mm, blocks, tf_path=self.tf_path, threads=self.threads)
+            self._start_native(stats)
+            return stats
 
-        self._start(data)
+        if self.tf_path:
+            # The dask fallback has no transfer function, its rov would be 0.
+            raise RuntimeError('libpreproc_capi not found, it is needed for block '
+                               'relevance with transfer function {}'.format(self.tf_path))
+
+        logger.info('libpreproc_capi not found, falling back to dask')
+        return self._process_dask(mm, blocks)
+
+    def _start_native(self, stats):
+        if self.first_run:
+            print(stats['total'].sum())
 
+    def _process_dask(self, mm, blocks):
+        bx, by, bz = blocks
+        x, y, z = self.vol_dims
+        chunk_shape = (z // bz, y // by, x // bx)
+        full = da.from_array(mm, chunks=chunk_shape)
+        self._start(full)
 
+        # Voxels past the last whole block don't belong to any block.
+        data = full[:chunk_shape[0] * bz, :chunk_shape[1] * by, :chunk_shape[2] * bx]
 
+        shaped = data.reshape(bz, chunk_shape[0], by, chunk_shape[1], bx, chunk_shape[2])
+        axes = (1, 3, 5)
+        mins, maxs, totals = da.compute(shaped.min(axis=axes), shaped.max(axis=axes),
+                                        shaped.astype(np.float64).sum(axis=axes))
 
+        stats = np.zeros((bz, by, bx), dtype=native.BLOCK_STATS)
+        stats['min'] = mins
+        stats['max'] = maxs
+        stats['total'] = totals
+        stats['avg'] = totals / float(chunk_shape[0] * chunk_shape[1] * chunk_shape[2])
+        k, j, i = np.indices((bz, by, bx))
+        stats['ijk'] = np.stack([i, j, k], axis=-1)
+        return stats
@@ -0,0 +1,264 @@
+#! /usr/bin/env python3
+"""
+End to end throughput benchmark for preproc --generate.
+
+Generates a synthetic raw volume with matching .dat and transfer function
+files in a scratch directory, runs preproc on it with a cold page cache and
+then warm, and collects the per pass timings from the stats file preproc
+writes next to its index files.
+
+Example:
+    python/bench_preproc.py --preproc build/preproc/preproc \\
+        --dims 512,512,512 --dtype ushort --sparsity 0.7 -D 16x16x16 \\
+        --warm-runs 3 --json results.json
+
+The cold run evicts the raw file from the page cache with
+posix_fadvise(DONTNEED), which needs no privileges but only drops clean
+pages. Use --drop-caches to write to /proc/sys/vm/drop_caches instead
+(needs root).
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+
+DTYPES = {
+    'uchar': (np.uint8, 'UCHAR'),
+    'ushort': (np.uint16, 'USHORT'),
+    'float': (np.float32, 'FLOAT'),
+}
+
+PASSES = ['volume min/max pass', 'raw file pass', 'relevance map pass', 'index write']
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Benchmark preproc on synthetic volumes.')
+
+    parser.add_argument('--preproc', type=str, default='build/preproc/preproc',
+                        help='Path to the preproc executable')
+    parser.add_argument('--dims', type=lambda x: [int(v) for v in x.split(',')],
+                        default=[256, 256, 256], help='Volume dims x,y,z')
+    parser.add_argument('--dtype', type=str, default='uchar', choices=sorted(DTYPES),
+                        help='Voxel type')
+    parser.add_argument('--sparsity', type=float, default=0.5,
+                        help='Fraction of the volume that is empty (zero) space')
+    parser.add_argument('--cell', type=int, default=16,
+                        help='Side of the cells that are either empty or filled')
+    parser.add_argument('--seed', type=int, default=1,
+                        help='Random seed, the same seed gives the same volume')
+    parser.add_argument('-D', '--bdim', type=str, action='append', default=None,
+                        help='Block count tuple XxYxZ, may be repeated (default 16x16x16)')
+    parser.add_argument('-b', '--buffer-size', type=str, default='64M',
+                        help='preproc --buffer-size')
+    parser.add_argument('-n', '--num-threads', type=int, default=0,
+                        help='preproc --num-threads, 0 for all cores')
+    parser.add_argument('--gradvol', type=str, default='',
+                        help='Generate the volume with this gradvol executable instead '
+                             'of numpy, much faster for large volumes')
+    parser.add_argument('--workdir', type=str, default='',
+                        help='Scratch directory, a temp directory by default. It should '
+                             'be on the disk to be measured.')
+    parser.add_argument('--keep', action='store_true', default=False,
+                        help='Keep the scratch directory')
+    parser.add_argument('--warm-runs', type=int, default=3,
+                        help='Number of runs after the cold run')
+    parser.add_argument('--no-cold', action='store_true', default=False,
+                        help='Skip the cold cache run')
+    parser.add_argument('--drop-caches', action='store_true', default=False,
+                        help='Drop the whole page cache before the cold run (root)')
+    parser.add_argument('--json', type=str, default='',
+                        help='Write the results to this file')
+    parser.add_argument('--label', type=str, default='',
+                        help='Label stored in the results, e.g. a commit hash')
+
+    return parser.parse_args()
+
+
+def generate_volume(path, dims, dtype, sparsity, cell, seed):
+    """
+    Write a raw volume made of cell^3 cells, each either empty or filled
+    with a smooth random field. Written one z slab of cells at a time.
+    """
+    rng = np.random.RandomState(seed)
+    np_type = DTYPES[dtype][0]
+    hi = 1.0 if dtype == 'float' else float(np.iinfo(np_type).max)
+    x, y, z = dims
+    cells = [(d + cell - 1) // cell for d in dims]
+
+    with open(path, 'wb') as f:
+        for cz in range(cells[2]):
+            nz = min(cell, z - cz * cell)
+            occupied = rng.random_sample((cells[1], cells[0])) >= sparsity
+            occupied = np.repeat(np.repeat(occupied, cell, axis=0), cell, axis=1)[:y, :x]
+            zz = (cz * cell + np.arange(nz)).reshape(nz, 1, 1)
+            yy = np.arange(y).reshape(1, y, 1)
+            xx = np.arange(x).reshape(1, 1, x)
+            field = 0.55 + 0.4 * np.sin(xx * 0.05) * np.cos(yy * 0.07) * np.sin(zz * 0.03)
+            field = field + rng.uniform(-0.05, 0.05, (nz, y, x))
+            slab = np.where(occupied, np.clip(field, 0.1, 1.0), 0.0) * hi
+            f.write(slab.astype(np_type).tobytes())
+
+
+def generate_with_gradvol(gradvol, path, dims, dtype, sparsity, cell, seed):
+    """
+    Write the raw volume and its .dat file with gradvol's blobs field, which
+    has the same cell structure as generate_volume().
+    """
+    subprocess.check_call([gradvol,
+                           '--field', 'blobs',
+                           '-t', dtype,
+                           '--dims', '{}x{}x{}'.format(*dims),
+                           '--empty', str(sparsity),
+                           '--cell', str(cell),
+                           '--seed', str(seed),
+                           '-f', path],
+                          stdout=subprocess.DEVNULL)
+
+
+def write_dat(path, raw_name, dims, dtype):
+    with open(path, 'w') as f:
+        f.write('ObjectFileName: {}\n'.format(raw_name))
+        f.write('Resolution: {} {} {}\n'.format(*dims))
+        f.write('SliceThickness: 1 1 1\n')
+        f.write('Format: {}\n'.format(DTYPES[dtype][1]))
+
+
+def write_tfunc(path):
+    """
+    Opacity transfer function: empty space is transparent, the rest ramps up.
+    The first line is the number of knots, then one 'scalar opacity' pair per
+    line with the scalar normalized to [0, 1].
+    """
+    knots = [(0.0, 0.0), (0.05, 0.0), (0.3, 0.2), (0.7, 0.8), (1.0, 1.0)]
+    with open(path, 'w') as f:
+        f.write('{}\n'.format(len(knots)))
+        for s, a in knots:
+            f.write('{} {}\n'.format(s, a))
+
+
+def evict(path, drop_caches):
+    if drop_caches:
+        subprocess.check_call(['sync'])
+        with open('/proc/sys/vm/drop_caches', 'w') as f:
+            f.write('3\n')
+        return
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        os.fdatasync(fd)
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+    finally:
+        os.close(fd)
+
+
+def run_preproc(args, work, raw, dat, tfunc, prefix):
+    outdir = os.path.join(work, 'out')
+    if os.path.exists(outdir):
+        shutil.rmtree(outdir)
+    os.makedirs(outdir)
+
+    cmd = [args.preproc,
+           '-f', raw,
+           '-d', dat,
+           '-u', tfunc,
+           '-r', os.path.join(work, prefix + '.rmap'),
+           '-o', outdir,
+           '--outfile-prefix', prefix,
+           '-b', args.buffer_size,
+           '-n', str(args.num_threads),
+           '--progress-interval', '0']
+    for t in args.bdim or ['16x16x16']:
+        cmd += ['-D', t]
+
+    start = time.time()
+    subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+    elapsed = time.time() - start
+
+    with open(os.path.join(outdir, prefix + '.stats.json')) as f:
+        stats = json.load(f)
+    stats['process_seconds'] = elapsed
+    return stats
+
+
+def summarize(runs):
+    if not runs:
+        return {}
+    s = {'wall_seconds': statistics.median(r['wall_seconds'] for r in runs)}
+    for p in PASSES:
+        s[p] = statistics.median(r['passes'].get(p, 0.0) for r in runs)
+    return s
+
+
+def print_run(name, stats, volume_bytes):
+    passes = '  '.join('{} {:.3f}s'.format(p, stats['passes'].get(p, 0.0)) for p in PASSES)
+    print('{:>6}: {:.3f}s {:.1f} MiB/s  {}'.format(
+        name, stats['wall_seconds'], volume_bytes / stats['wall_seconds'] / 2**20, passes))
+
+
+def main():
+    args = parse_args()
+    if len(args.dims) != 3:
+        print('--dims needs three values', file=sys.stderr)
+        return 1
+
+    work = args.workdir or tempfile.mkdtemp(prefix='preproc_bench_')
+    os.makedirs(work, exist_ok=True)
+    try:
+        prefix = 'bench_{}_{}x{}x{}'.format(args.dtype, *args.dims)
+        raw = os.path.join(work, prefix + '.raw')
+        dat = os.path.join(work, prefix + '.dat')
+        tfunc = os.path.join(work, prefix + '.tf')
+
+        print('Generating {} in {}'.format(prefix, work))
+        if args.gradvol:
+            generate_with_gradvol(args.gradvol, raw, args.dims, args.dtype,
+                                  args.sparsity, args.cell, args.seed)
+        else:
+            generate_volume(raw, args.dims, args.dtype, args.sparsity, args.cell, args.seed)
+            write_dat(dat, os.path.basename(raw), args.dims, args.dtype)
+        write_tfunc(tfunc)
+        volume_bytes = os.path.getsize(raw)
+
+        cold = None
+        if not args.no_cold:
+            evict(raw, args.drop_caches)
+            cold = run_preproc(args, work, raw, dat, tfunc, prefix)
+            print_run('cold', cold, volume_bytes)
+
+        warm = []
+        for i in range(args.warm_runs):
+            warm.append(run_preproc(args, work, raw, dat, tfunc, prefix))
+            print_run('warm{}'.format(i), warm[-1], volume_bytes)
+
+        if args.json:
+            results = {
+                'label': args.label,
+                'dims': args.dims,
+                'dtype': args.dtype,
+                'sparsity': args.sparsity,
+                'bytes': volume_bytes,
+                'bdim': args.bdim or ['16x16x16'],
+                'buffer_size': args.buffer_size,
+                'cold': cold,
+                'warm': warm,
+                'warm_median': summarize(warm),
+            }
+            with open(args.json, 'w') as f:
+                json.dump(results, f, indent=2)
+    finally:
+        if not args.keep and not args.workdir:
+            shutil.rmtree(work)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
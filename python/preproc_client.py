@@ -0,0 +1,84 @@
+#! /usr/bin/env python3
+"""
+Client for preproc --serve.
+
+Sends index requests to a running server and writes each reply as a binary
+index file, e.g. from a transfer function editing loop:
+
+    preproc -f vol.raw -d vol.dat -D 16x16x16 --serve /tmp/vol.sock &
+    python/preproc_client.py /tmp/vol.sock -D 16x16x16 -u edited.tf -o vol_16.bin
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+# struct ServeReplyHeader in preproc/src/serve.h
+HEADER = struct.Struct('=4siQ')
+
+
+class PreprocClient(object):
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+
+    def close(self):
+        self.sock.close()
+
+    def _recv_exactly(self, n):
+        chunks = []
+        while n > 0:
+            chunk = self.sock.recv(min(n, 1 << 20))
+            if not chunk:
+                raise ConnectionError('preproc server closed the connection')
+            chunks.append(chunk)
+            n -= len(chunk)
+        return b''.join(chunks)
+
+    def request(self, line):
+        """Send one request line, return the reply payload."""
+        self.sock.sendall(line.encode('utf-8') + b'\n')
+        magic, status, length = HEADER.unpack(self._recv_exactly(HEADER.size))
+        if magic != b'PPIX':
+            raise RuntimeError('Not a preproc server reply')
+        payload = self._recv_exactly(length)
+        if status != 0:
+            raise RuntimeError(payload.decode('utf-8', 'replace'))
+        return payload
+
+    def index(self, bdim, tfunc=''):
+        """Binary index file contents for block count bdim, e.g. '16x16x16'."""
+        return self.request('index {} {}'.format(bdim, tfunc).rstrip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Request index files from preproc --serve.')
+    parser.add_argument('socket', type=str, help='Server socket path')
+    parser.add_argument('-D', '--bdim', type=str, default='1x1x1', help='Block count XxYxZ')
+    parser.add_argument('-u', '--tfunc', type=str, default='',
+                        help='Transfer function path, as seen by the server')
+    parser.add_argument('-o', '--outfile', type=str, default='index.bin',
+                        help='Where to write the index file')
+    parser.add_argument('--shutdown', action='store_true', default=False,
+                        help='Stop the server instead')
+    args = parser.parse_args()
+
+    client = PreprocClient(args.socket)
+    try:
+        if args.shutdown:
+            client.request('shutdown')
+            return 0
+        start = time.time()
+        payload = client.index(args.bdim, args.tfunc)
+        with open(args.outfile, 'wb') as f:
+            f.write(payload)
+        print('{}: {} bytes in {:.3f}s'.format(args.outfile, len(payload), time.time() - start))
+    finally:
+        client.close()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
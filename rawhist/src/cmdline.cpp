@@ -49,6 +49,22 @@ try
                     "uint");
   cmd.add(bufferSizeArg);
 
+  // histogram binning
+  TCLAP::ValueArg<uint64_t>
+      bucketsArg("", "buckets", "Number of histogram buckets. Default: one per value for "
+                 "uchar and ushort, 1536 for float.", false, 0, "uint");
+  cmd.add(bucketsArg);
+
+  TCLAP::SwitchArg
+      logArg("", "log", "Space the buckets evenly in log(1 + value - min) instead of "
+             "value.", false);
+  cmd.add(logArg);
+
+  TCLAP::MultiArg<double>
+      percentileArg("", "percentile", "Print this percentile (0 - 100) of the values. "
+                    "Can be given more than once.", false, "float");
+  cmd.add(percentileArg);
+
   cmd.parse(argc, argv);
 
   opts.rawFilePath = fileArg.getValue();
@@ -56,6 +72,15 @@ try
   opts.outputFilePath = outputFilePath.getValue();
   opts.dataType = dataTypeArg.getValue();
   opts.bufferSize = convertToBytes(bufferSizeArg.getValue());
+  opts.numBuckets = bucketsArg.getValue();
+  opts.logBins = logArg.getValue();
+  opts.percentiles = percentileArg.getValue();
+  for (double p : opts.percentiles) {
+    if (!( p >= 0.0 && p <= 100.0 )) {
+      std::cout << "Percentiles must be in [0, 100]: " << p << std::endl;
+      return 0;
+    }
+  }
 
   return static_cast<int>(cmd.getArgList().size());
 
@@ -74,6 +99,8 @@ printThem(CommandLineOptions &opts)
       << "\nDat file: " << opts.datFilePath
       << "\nData Type: " << opts.dataType
       << "\nBuffer Size: " << opts.bufferSize
+      << "\nBuckets: " << opts.numBuckets << ( opts.logBins ? " log" : "" )
+      << "\nPercentiles: " << opts.percentiles.size()
       << std::endl;
 }
 
@@ -92,7 +119,8 @@ convertToBytes(std::string s)
     multiplier = 1024*1024*1024;
   }
 
-  std::string numPart(s.begin(), s.end()-1);
+  // a plain number of bytes has no suffix to strip.
+  std::string numPart(s.begin(), multiplier == 1 ? s.end() : s.end()-1);
   auto num = stoull(numPart);
 
   return num*multiplier;
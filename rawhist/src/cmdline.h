@@ -1,7 +1,9 @@
 #ifndef rawhist_cmdline_h__
 #define rawhist_cmdline_h__
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace rawhist
 {
@@ -17,6 +19,13 @@ struct CommandLineOptions
   std::string dataType;
   // buffer size
   uint64_t bufferSize;
+  // histogram buckets, 0 for one per value of 8 and 16 bit types and 1536
+  // for floats.
+  uint64_t numBuckets;
+  // true for buckets equally spaced in log(1 + v - min).
+  bool logBins;
+  // percentiles (0 - 100) of the values to print before the buckets.
+  std::vector<double> percentiles;
 };
 
 
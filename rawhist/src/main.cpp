@@ -3,86 +3,72 @@
 //
 
 #include "cmdline.h"
+#include "parallel/threadhistogram.h"
 
 #include <bd/io/datatypes.h>
 #include <bd/log/logger.h>
 #include <bd/io/buffer.h>
 #include <bd/io/bufferedreader.h>
-#include <bd/tbb/parallelreduce_minmax.h>
-#include <bd/tbb/parallelreduce_histogram.h>
 #include <bd/io/datfile.h>
 
 #include <iostream>
 #include <fstream>
 //#include <unistd.h>
 #include <iomanip>
-#include <tbb/blocked_range.h>
-#include <tbb/parallel_reduce.h>
+#include <limits>
+#include <type_traits>
+#include <vector>
 
 namespace rawhist
 {
 
 namespace
 {
-int const nBuckets{ 1536 };
-int const MAX_IDX{ nBuckets - 1 };
-long long histcount[nBuckets];
-double histmin[nBuckets];
-double histmax[nBuckets];
-long long totalcount{ 0 };
+/// Bucket count if none is given.
+size_t const defaultBuckets{ 1536 };
+preproc::HistogramBinning binning;
+preproc::HistogramBuckets histo;
 double rawmin{ 0 };
 double rawmax{ 0 };
+/// Values at clo.percentiles.
+std::vector<double> percentiles;
 
 } // namespace
 
 
+/// \brief Floats are binned in the volume min/max.
 template<typename Ty>
-void volumeMinMax(std::string const &path, size_t szbuf, double* volMin, double* volMax)
+void chooseBinning(CommandLineOptions const &clo, std::false_type)
 {
-  bd::BufferedReader<Ty> r{ szbuf };
-  if (!r.open(path)) {
-    bd::Err() << "File " << path << " was not opened.";
-    return;
-  }
-
-
-  r.start();
-  Ty max{ 0 };
-  Ty min{ 0 };
-
-  bd::Info() << "Begin min/max computation.";
-
-  bd::Buffer<Ty> *buf{ nullptr };
-
-  while ((buf = r.waitNextFullUntilNone()) != nullptr) {
-
-    tbb::blocked_range<size_t> range(0, buf->getNumElements());
-    bd::ParallelReduceMinMax<Ty> mm(buf);
-
-    tbb::parallel_reduce(range, mm);
-
-    if (max < mm.max_value)
-      max = mm.max_value;
-    if (min > mm.min_value)
-      min = mm.min_value;
-
-    r.waitReturnEmpty(buf);
+  binning.scale = clo.logBins ? preproc::HistogramBinning::Scale::Log
+                              : preproc::HistogramBinning::Scale::Linear;
+  binning.buckets = clo.numBuckets == 0 ? defaultBuckets : clo.numBuckets;
+  binning.min = rawmin;
+  binning.max = rawmax;
+}
 
+/// \brief Integers get a bucket per value unless a bucket count or log
+/// bins were asked for.
+template<typename Ty>
+void chooseBinning(CommandLineOptions const &clo, std::true_type)
+{
+  if (clo.numBuckets == 0 && !clo.logBins) {
+    binning = preproc::HistogramBinning::exact<Ty>();
+    return;
   }
-
-  bd::Info() << "Finished min/max computation.";
-  *volMin = min;
-  *volMax = max;
+  chooseBinning<Ty>(clo, std::false_type{});
 }
 
-
+/// \brief Histogram of the raw file in one pass, the buffers are counted in
+/// per-thread bins while the reader thread fills the next ones. The binning
+/// is chosen after the pass from the value range that was counted.
 template<typename Ty>
-void hist(std::string const &fileName, size_t szbuf, float rawmin, float rawmax)
+void doit(CommandLineOptions const &clo)
 {
 
-  bd::BufferedReader<Ty> r(szbuf);
-  if (!r.open(fileName)) {
-    bd::Err() << "File " << fileName << " was not opened.";
+  bd::BufferedReader<Ty> r(clo.bufferSize);
+  if (!r.open(clo.rawFilePath)) {
+    bd::Err() << "File " << clo.rawFilePath << " was not opened.";
     return;
   }
   r.start();
@@ -90,87 +76,53 @@ void hist(std::string const &fileName, size_t szbuf, float rawmin, float rawmax)
 
   bd::Info() << "Begin volume histogram computation.";
 
+  preproc::ThreadHistogram<Ty> counts;
 
   bd::Buffer<Ty> *buf{ nullptr };
   while ((buf = r.waitNextFullUntilNone()) != nullptr) {
-
-
-//    tbb::blocked_range<size_t> range(0, buf->getNumElements());
-//    bd::ParallelReduceHistogram<Ty> histo(buf,
-//                                          static_cast<Ty>(rawmin),
-//                                          static_cast<Ty>(rawmax) );
-//    tbb::parallel_reduce(range, histo);
-
-    Ty const * p{ buf->getPtr() };
-
-    for (size_t i{ 0 }; i < buf->getNumElements(); ++i) {
-
-      Ty val = p[i];
-
-      long long idx{
-          static_cast<long long>((val - rawmin)/(rawmax - rawmin) * float(MAX_IDX) + 0.5f) };
-
-      if (idx > MAX_IDX)
-        idx = MAX_IDX;
-
-      histcount[idx] += 1;
-
-      if (histmin[idx] > val) {
-        histmin[idx] = val;
-      }
-      if (histmax[idx] < val) {
-        histmax[idx] = val;
-      }
-
-    }
-
-    totalcount += buf->getNumElements();
+    counts.add(buf);
     r.waitReturnEmpty(buf);
-
-
-    // Accumulate this buffer's histo
-//    for (size_t i{ 0 }; i < nBuckets; ++i) {
-//      histcount[i] += histo.getBuckets()[i];
-//
-//      if (histo.getHistMin()[i] < histmin[i])
-//        histmin[i] = histo.getHistMin()[i];
-//
-//      if (histo.getHistMax()[i] > histmax[i])
-//        histmax[i] = histo.getHistMax()[i];
-//    }
-
-
-
-
   } // while
 
-  bd::Info() << "Finished volume histogram computation.";
-}
+  counts.range(rawmin, rawmax);
+  if (rawmin > rawmax) {
+    rawmin = rawmax = 0;
+  }
+  chooseBinning<Ty>(clo, std::is_integral<Ty>{});
 
-template<typename Ty>
-void doit(CommandLineOptions const &clo)
-{
-  for (int i = 0; i < nBuckets; ++i) {
-    histmin[i] = std::numeric_limits<double>::max();
-    histmax[i] = std::numeric_limits<double>::lowest();
-    histcount[i] = 0;
+  std::vector<double> qs;
+  for (double p : clo.percentiles) {
+    qs.push_back(p / 100.0);
+  }
+  percentiles = counts.quantiles(qs);
+
+  long long split{ 0 };
+  histo = counts.result(binning, &split);
+  if (split != 0) {
+    bd::Info() << split << " voxels were in fine bins that straddle buckets, "
+                  "their buckets are estimated.";
   }
 
-  volumeMinMax<Ty>(clo.rawFilePath, clo.bufferSize, &rawmin, &rawmax);
-  hist<Ty>(clo.rawFilePath, clo.bufferSize, rawmin, rawmax);
+  bd::Info() << "Finished volume histogram computation.";
 }
 
-void printHisto(std::ostream &os)
+void printHisto(CommandLineOptions const &clo, std::ostream &os)
 {
   os << std::fixed << std::setprecision(6);
   os << "MinMax " << std::setw(20) << rawmin << std::setw(20) << rawmax << '\n';
+  os << "Binning " << binning.name() << ' ' << binning.buckets
+     << std::setw(20) << binning.min << std::setw(20) << binning.max << '\n';
+  for (size_t i = 0; i < percentiles.size(); ++i) {
+    os << "Percentile " << std::setw(20) << clo.percentiles[i] << std::setw(20)
+       << percentiles[i] << '\n';
+  }
   os << "#Index Perc Offset Min Max\n";
   double pindex = 0;
-  for (int i = 0; i < nBuckets; i++) {
-    double pcount = (double)histcount[i] / (double)totalcount;
-    if (histcount[i] != 0) {
+  for (size_t i = 0; i < histo.count.size(); i++) {
+    double pcount = (double)histo.count[i] / (double)histo.total;
+    if (histo.count[i] != 0) {
       os << std::left << std::setw(5) << i << std::left << std::setw(20) << std::setprecision(12) << pcount << std::left << std::setw(20) << std::setprecision(12) << pindex
-        << std::left << std::setw(20) << std::setprecision(12) << histmin[i] << std::left << std::setw(20) << std::setprecision(12) << histmax[i] << '\n';
+        << std::left << std::setw(20) << std::setprecision(12) << histo.min[i] << std::left << std::setw(20) << std::setprecision(12) << histo.max[i] << '\n';
     }
     else {
       os << std::left << std::setw(5) << i << std::left << std::setw(20) << 0.0 << std::left << std::setw(20) << pindex
@@ -215,14 +167,14 @@ generate(CommandLineOptions &clo)
     if (!os.is_open()) {
       bd::Err() << "Could not open output file: "
         << clo.outputFilePath << ", using stdout instead.";
-      printHisto(std::cout);
+      printHisto(clo, std::cout);
     }
     else {
-      printHisto(os);
+      printHisto(clo, os);
     }
   }
   else {
-    printHisto(std::cout);
+    printHisto(clo, std::cout);
   }
 
   //print histo to stdout.